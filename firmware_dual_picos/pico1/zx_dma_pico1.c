@@ -34,10 +34,79 @@
 #include "pico/platform.h"
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
+#include "hardware/timer.h"
+#include "hardware/sync.h"
 #include <string.h>
 
 #include "gpios.h"
 
+/* Pico2 steps through the addresses for the same number of bytes */
+#define WRITE_LENGTH 6912
+
+/* 48K frame timing, in microseconds from the fall of /INT, see below */
+#define FRAME_US               19968
+#define TOP_BORDER_END_US       4096
+#define LOWER_BORDER_START_US  16384
+
+/*
+ * /INT is low for 32Ts, about 9us. The Z80 has to finish its instruction
+ * and start the acknowledge in that time, so BUSREQ waits a little longer.
+ */
+#define INT_HOLDOFF_US           12
+
+/*
+ * The bus is given back this long before the border ends. Stopping part
+ * way through takes up to about 14us of it: the last look at the time,
+ * then Pico2 letting go of the address bus, see zx_address_step.pio.
+ */
+#define BORDER_GUARD_US          20
+
+/*
+ * After giving up on BUSACK, how long to watch for it anyway. The Z80
+ * answers a request it's already seen within a T-state, about 0.3us.
+ */
+#define BUSACK_LATE_US            2
+
+/*
+ * The time is looked at every this many bytes, about 6us. It has to be
+ * even, see run_burst().
+ */
+#define DEADLINE_CHECK_BYTES     16
+
+/* Look at these in the debugger */
+typedef struct
+{
+  uint32_t frames;
+  uint32_t transfers;        /* Whole screens written */
+  uint32_t bursts;           /* Times the bus was taken */
+  uint32_t deferred;         /* Bursts which ran out of border, finished in the next one */
+  uint32_t busack_timeouts;
+  uint32_t busack_late;      /* BUSACKs which came just as the wait for them ran out */
+  uint32_t int_overlaps;     /* /INTs which fell while the bus was held, the Z80 may miss them */
+  uint32_t start_late_max_us;
+} dma_stats_t;
+
+static dma_stats_t dma_stats;
+
+/*
+ * The frame state. The /INT handler notes when the frame started, the
+ * timer's compare fires when the next burst is due, and the main loop
+ * does the bursts. Each one goes on until the whole screen's written or
+ * the border runs out, whichever's first. A transfer that doesn't fit
+ * carries on in the next border, so every frame gets one started.
+ */
+static uint              burst_timer;
+static volatile uint64_t frame_start_us;
+static volatile uint32_t frame_count;
+static volatile bool     burst_due;
+static volatile uint64_t burst_start_us;
+static volatile uint64_t burst_end_us;
+static volatile bool     bursting;
+
+/* Bytes of the transfer written so far, and the frame it was started in */
+static volatile uint32_t bytes_done;
+static volatile uint32_t started_frame = UINT32_MAX;
+
 static void test_blipper( void )
 {
   gpio_put( GPIO_P1_BLIPPER, 1 );
@@ -48,6 +117,25 @@ static void test_blipper( void )
   gpio_put( GPIO_P1_BLIPPER, 0 );
 }
 
+/*
+ * BUSREQ has just gone back high because BUSACK didn't come in time. If
+ * the Z80 had already seen the request it answers anyway, and Pico2 starts
+ * driving the address bus when it does.
+ */
+static bool busack_came_late( void )
+{
+  uint64_t until_us = time_us_64() + BUSACK_LATE_US;
+
+  do
+  {
+    if( (gpio_get( GPIO_Z80_BUSACK ) == 0) || (gpio_get( GPIO_P2_DRIVING_SIGNAL ) == 0) )
+      return true;
+  }
+  while( time_us_64() < until_us );
+
+  return false;
+}
+
 /*
  * https://worldofspectrum.org/faq/reference/48kreference.htm
  *
@@ -62,26 +150,33 @@ static void test_blipper( void )
  *
  * Lower border is also usable if I can synchronise the Pico to running
  * when the lower border starts. Lower border is 56 lines, which is another
- * 2.229ms, so 6.325ms in total: that's start of lower border to the start of
+ * 3.584ms, so 7.68ms in total: that's start of lower border to the start of
  * the top line of the display.
  *
  * So, to hit the start of lower border from /INT, I need 64 lines of top border,
- * plus 192 lines of screen, That's 228 lines from /INT to the start of the lower
- * border. At 224Ts per line, 228 lines is 64,512 Ts from /INT to the point I
- * want to start BUSREQ. That's 18.432ms from /INT.
+ * plus 192 lines of screen. That's 256 lines from /INT to the start of the lower
+ * border. At 224Ts per line, 256 lines is 57,344 Ts from /INT to the point I
+ * want to start BUSREQ. That's 16.384ms from /INT. The next /INT is 69,888Ts,
+ * 19.968ms, after the last.
  *
  * The screen is 6144+768 bytes, = 6912 bytes.
+ *
+ * A burst takes the bus, writes from where the transfer got to until it's
+ * finished or end_us, then gives the bus back. It can only stop on an even
+ * byte: the request signal to Pico2 is high there, and Pico2 is waiting
+ * for it to fall, which is where Pico2 keeps its place to carry on from.
+ * Either way Pico2 lets go of the address bus first, and BUSREQ stays low
+ * until it has.
  */
-int64_t alarm_callback( alarm_id_t id, void *user_data )
+static void run_burst( uint64_t end_us )
 {
-/* The overlapping interrupts (i.e. INT arriving while the DMA is is running)
- * isn't working. Not sure if the SDK alarm thing is smart enough. Skipping
- * every other INT makes it stable
- */
-  static uint32_t  toggle = 0;
-  toggle = ~toggle;
-  if ( ~toggle )
-    return 0;
+  uint64_t late = time_us_64() - burst_start_us;
+  if( late > dma_stats.start_late_max_us )
+    dma_stats.start_late_max_us = late;
+
+  if( bytes_done == 0 )
+    started_frame = frame_count;
+  dma_stats.bursts++;
 
   /* Assert bus request */
   gpio_put( GPIO_Z80_BUSREQ, 0 );
@@ -95,7 +190,28 @@ int64_t alarm_callback( alarm_id_t id, void *user_data )
    * up to, and part would be how this loop fits with the moment the ACK
    * line goes low.
    */
-  while( gpio_get( GPIO_Z80_BUSACK ) == 1 );
+  while( gpio_get( GPIO_Z80_BUSACK ) == 1 )
+  {
+    if( time_us_64() >= end_us )
+    {
+      gpio_put( GPIO_Z80_BUSREQ, 1 );
+      if( !busack_came_late() )
+      {
+        dma_stats.busack_timeouts++;
+        return;
+      }
+
+      /*
+       * It came anyway. Take the bus back before the Z80 does more than
+       * start its next cycle, and stop the normal way: it's past end_us,
+       * so that's before the first byte, and Pico2 keeps its place.
+       */
+      gpio_put( GPIO_Z80_BUSREQ, 0 );
+      dma_stats.busack_late++;
+      while( gpio_get( GPIO_Z80_BUSACK ) == 1 );
+      break;
+    }
+  }
 
   /* RD and IORQ lines are unused and stay inactive */
   gpio_set_dir( GPIO_Z80_RD,   GPIO_OUT ); gpio_put( GPIO_Z80_RD,   1 );
@@ -105,18 +221,24 @@ int64_t alarm_callback( alarm_id_t id, void *user_data )
   /* Approx 500ns passes between BUSACK and here */
   gpio_put( GPIO_P1_BLIPPER, 1 );
 
+  /*
+   * Pico2 saw BUSACK too, and puts the first address on the bus. This is
+   * the only time its answer is waited for, see zx_address_step.pio in
+   * Pico2's firmware.
+   */
+  while( gpio_get( GPIO_P2_DRIVING_SIGNAL ) == 1 );
+
   uint32_t byte_counter;
-  for( byte_counter=0; byte_counter < 6912; byte_counter++ )
+  for( byte_counter=bytes_done; byte_counter < WRITE_LENGTH; byte_counter++ )
   {
+    /* Out of border. The rest goes in the next one */
+    if( ((byte_counter % DEADLINE_CHECK_BYTES) == 0) && (time_us_64() >= end_us) )
+      break;
+
     /*
      * Moving on to the right hand side of fig7 in the Z80 manual.
-     * We're at the start of T1.
-     *
-     * Set address bus (active low signal to other Pico), then wait for other
-     * Pico to confirm it's done it
+     * We're at the start of T1, and the address is already on the bus.
      */
-    gpio_put( GPIO_P1_REQUEST_SIGNAL, 0 );
-    while( gpio_get( GPIO_P2_DRIVING_SIGNAL ) == 1 );
 
     /*
      * With full Z80 synchronisation a 2048 byte DMA transfer takes 2.9ms.
@@ -130,6 +252,11 @@ int64_t alarm_callback( alarm_id_t id, void *user_data )
      * So, use the lower border and my current performance is 5.55ms for
      * the whole screen, which is inside the 6.325 total border time.
      * In theory.
+     *
+     * Without the round trip to Pico2 for every byte, about 500ns of it,
+     * a byte is the 19 NOPs, the settle time and the GPIO writes, about
+     * 47 cycles or 380ns. That's 2.6ms for the whole screen, which fits
+     * in the lower border with time to spare.
      */
 
     /* Assert memory request */
@@ -177,12 +304,51 @@ int64_t alarm_callback( alarm_id_t id, void *user_data )
     gpio_put( GPIO_Z80_MREQ, 1 ); 
     
     /*
-     * Write cycle is complete. Clean everything up.
-     *
-     * Remove address bus (active high signal to other Pico).
+     * Write cycle is complete. Either edge of the request signal tells
+     * Pico2 to put the next address out, or after the last byte to let
+     * go of the address bus. It doesn't answer. It takes about 5 of its
+     * cycles to see a rise and change the address, 7 for a fall, then the
+     * address lines have to settle, which is what the NOPs allow for
+     * before /MREQ goes low again. About 100ns in all.
      */
-    gpio_put( GPIO_P1_REQUEST_SIGNAL, 1 );
-    while( gpio_get( GPIO_P2_DRIVING_SIGNAL ) == 0 );
+    gpio_xor_mask( 1u << GPIO_P1_REQUEST_SIGNAL );
+
+    __asm volatile ("nop");
+    __asm volatile ("nop");
+    __asm volatile ("nop");
+    __asm volatile ("nop");
+    __asm volatile ("nop");
+
+    __asm volatile ("nop");
+    __asm volatile ("nop");
+    __asm volatile ("nop");
+    __asm volatile ("nop");
+    __asm volatile ("nop");
+
+    __asm volatile ("nop");
+    __asm volatile ("nop");
+  }
+
+  /*
+   * The request signal idles high, so the first edge of the next transfer
+   * is a fall. It's high here either way. Finished, Pico2 has let go of
+   * the address bus after the last edge. Stopped short, it's waiting for
+   * a fall and lets go when it doesn't come, about 8us. Wait for it to
+   * say so before the Z80 has its bus back.
+   */
+  gpio_put( GPIO_P1_REQUEST_SIGNAL, 1 );
+  while( gpio_get( GPIO_P2_DRIVING_SIGNAL ) == 0 );
+
+  bool finished = (byte_counter == WRITE_LENGTH);
+  if( finished )
+  {
+    bytes_done = 0;
+    dma_stats.transfers++;
+  }
+  else
+  {
+    bytes_done = byte_counter;
+    dma_stats.deferred++;
   }
 
   /* Put the data and control buses back to hi-Z */
@@ -202,9 +368,55 @@ int64_t alarm_callback( alarm_id_t id, void *user_data )
 
   /* Indicate DMA process complete */
   gpio_put( GPIO_P1_BLIPPER, 0 );
+}
 
-  /* Don't reschedule this alarm function */
-  return 0;
+static void burst_timer_callback( uint alarm_num )
+{
+  burst_due = true;
+}
+
+/*
+ * The next burst is set on the timer's compare, which fires to the
+ * microsecond. If the time's already passed it's due now.
+ */
+static void schedule_burst( uint64_t start_us, uint64_t end_us )
+{
+  burst_start_us = start_us;
+  burst_end_us   = end_us;
+  burst_due      = false;
+
+  if( hardware_alarm_set_target( burst_timer, from_us_since_boot( start_us ) ) )
+    burst_due = true;
+}
+
+/*
+ * What's next. A transfer which has been started goes on in the top
+ * border, as soon after /INT as the Z80 has taken it, then the lower
+ * border. A new one is started in each frame's lower border. If there's
+ * nothing until the next /INT, the /INT handler calls this again.
+ */
+static void next_burst( void )
+{
+  uint64_t frame_us = frame_start_us;
+  uint64_t now_us   = time_us_64();
+  uint64_t top_end   = frame_us + TOP_BORDER_END_US - BORDER_GUARD_US;
+  uint64_t lower_end = frame_us + FRAME_US - BORDER_GUARD_US;
+
+  if( bytes_done && (now_us < top_end) )
+  {
+    uint64_t start = frame_us + INT_HOLDOFF_US;
+    schedule_burst( (start > now_us) ? start : now_us, top_end );
+  }
+  else if( (bytes_done || (started_frame != frame_count)) && (now_us < lower_end) )
+  {
+    uint64_t start = frame_us + LOWER_BORDER_START_US;
+    schedule_burst( (start > now_us) ? start : now_us, lower_end );
+  }
+  else
+  {
+    hardware_alarm_cancel( burst_timer );
+    burst_due = false;
+  }
 }
 
 /*
@@ -213,10 +425,10 @@ int64_t alarm_callback( alarm_id_t id, void *user_data )
  * enough time to DMA the screen, so I need to start the DMA
  * the the top of the lower border. i.e. just after the last
  * line of the screen has been drawn.
- * The only marker point I have is /INT, so I need to time
- * 18.432ms from this point. I can't do it that precisely
- * using SDK on core, so I have to do my best until I can get
- * PIOs involved.
+ * The only marker point I have is /INT, so everything's timed
+ * from it. The bursts run in the main loop, not in an IRQ, so
+ * this is on time even if one is still going. If it is, that
+ * burst sets up the next itself when it stops.
  */
 void int_callback( uint gpio, uint32_t events ) 
 {
@@ -229,26 +441,17 @@ void int_callback( uint gpio, uint32_t events )
    */
   const uint32_t INT_TO_HANDLER_TIME_US = 2;
 
-  /*
-   * The delay between this alarm being scheduled to go off and the
-   * handler actually running varies by about 2uS. That's measured
-   * with the blipper pinging at the top of the handler. I can't use
-   * the lower number because that will set the BUSREQ running while
-   * the lowest part of the screen is still being drawn, which is
-   * going to cause contention issues. It has to be consistently
-   * /at least/ 18.432ms before BUSREQ is fired so I have to err on
-   * the side of caution here.
-   *
-   * This is where using PIO to get the timing right will be of
-   * benefit.
-   */
-  const uint32_t ALARM_TO_HANDLER_TIME_US = 3;
+  frame_start_us = time_us_64() - INT_TO_HANDLER_TIME_US;
+  frame_count++;
+  dma_stats.frames++;
 
-  const uint32_t INT_TO_LOWER_BORDER_TIME_US = 18432;
+  if( bursting )
+  {
+    dma_stats.int_overlaps++;
+    return;
+  }
 
-  add_alarm_in_us( INT_TO_LOWER_BORDER_TIME_US-
-		   INT_TO_HANDLER_TIME_US-
-		   ALARM_TO_HANDLER_TIME_US, alarm_callback, (void*)0, false );
+  next_burst();
 }
 
 void main( void )
@@ -293,11 +496,29 @@ void main( void )
   gpio_put( GPIO_P1_REQUEST_SIGNAL, 1 );
   sleep_ms(1);
 
+  burst_timer = hardware_alarm_claim_unused( true );
+  hardware_alarm_set_callback( burst_timer, burst_timer_callback );
+
   gpio_set_irq_enabled_with_callback( GPIO_Z80_INT, GPIO_IRQ_EDGE_FALL, true, &int_callback );
 
   while( 1 )
   {
-    sleep_ms(5);
+    /* The flag's taken with the IRQs off so /INT sees bursting straight after */
+    uint32_t irq_state = save_and_disable_interrupts();
+    bool due = burst_due;
+    burst_due = false;
+    bursting  = due;
+    restore_interrupts( irq_state );
+
+    if( !due )
+      continue;
+
+    run_burst( burst_end_us );
+
+    irq_state = save_and_disable_interrupts();
+    bursting = false;
+    next_burst();
+    restore_interrupts( irq_state );
   }
 
 }
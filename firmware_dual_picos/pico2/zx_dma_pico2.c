@@ -34,9 +34,86 @@
 #include "pico/platform.h"
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
+#include "hardware/pio.h"
 #include <string.h>
 
 #include "gpios.h"
+#include "zx_address_step.pio.h"
+
+/* Where the transfer goes and how long it is, Pico1 writes the same number of bytes */
+#define WRITE_ADDRESS 0x4000
+#define WRITE_LENGTH  6912
+
+/* Longer than Pico1 has BUSREQ up for when it changes its mind, see stop_if_abandoned() */
+#define ABANDONED_CONFIRM_US 5
+
+static PIO  step_pio = pio0;
+static uint step_sm;
+static uint step_offset;
+
+/*
+ * Pico1 waits for the program to let go of the address bus before it lets
+ * go of BUSREQ, when it's finished and when it stops part way through,
+ * see zx_address_step.pio. This is a backstop in case it doesn't: with
+ * BUSREQ high the Z80 is about to have its bus back, with this Pico still
+ * driving the address bus.
+ *
+ * It has to be that way for ABANDONED_CONFIRM_US. Pico1 lets go of BUSREQ
+ * and takes it again straight away if BUSACK came just as it gave up
+ * waiting for it.
+ *
+ * Waiting at "fall", with X and Y to carry on from, the program is sent
+ * to its own pause, which lets go and keeps its place. Anywhere else it's
+ * part way through a byte: stop it, let go, and start again, ready for
+ * the next transfer.
+ */
+static bool driving_abandoned( void )
+{
+  return ((step_pio->dbg_padoe & GPIO_ABUS_BITMASK) != 0) && (gpio_get( GPIO_Z80_BUSREQ ) == 1);
+}
+
+static void stop_if_abandoned( void )
+{
+  if( !driving_abandoned() )
+    return;
+
+  busy_wait_us( ABANDONED_CONFIRM_US );
+  if( !driving_abandoned() )
+    return;
+
+  pio_sm_set_enabled( step_pio, step_sm, false );
+
+  /* Letting go already, at the pause or at the end */
+  uint pc = pio_sm_get_pc( step_pio, step_sm ) - step_offset;
+  if( (pc < zx_address_step_offset_redrive) ||
+      ((pc >= zx_address_step_offset_done) && (pc < zx_address_step_offset_next_rise)) )
+  {
+    pio_sm_set_enabled( step_pio, step_sm, true );
+    return;
+  }
+
+  if( (pc < zx_address_step_offset_next_fall) && (gpio_get( GPIO_P1_REQUEST_SIGNAL ) == 1) )
+  {
+    /* The pause takes the bytes left from the ISR, until "fall" they're in Y */
+    if( pc <= zx_address_step_offset_fall )
+      pio_sm_exec( step_pio, step_sm, pio_encode_mov( pio_isr, pio_y ) );
+    pio_sm_exec( step_pio, step_sm, pio_encode_jmp( step_offset + zx_address_step_offset_pause ) );
+    pio_sm_set_enabled( step_pio, step_sm, true );
+    return;
+  }
+
+  pio_sm_set_pindirs_with_mask( step_pio, step_sm, 0, GPIO_ABUS_BITMASK );
+  pio_sm_set_pins_with_mask( step_pio, step_sm, 1u << GPIO_P2_DRIVING_SIGNAL, 1u << GPIO_P2_DRIVING_SIGNAL );
+
+  pio_sm_clear_fifos( step_pio, step_sm );
+  pio_sm_restart( step_pio, step_sm );
+  pio_sm_exec( step_pio, step_sm, pio_encode_jmp( step_offset + zx_address_step_offset_start ) );
+
+  /* BUSACK's still low, the program would take it for the next transfer */
+  while( gpio_get( GPIO_Z80_BUSACK ) == 0 );
+
+  pio_sm_set_enabled( step_pio, step_sm, true );
+}
 
 static void test_blipper( void )
 {
@@ -58,12 +135,13 @@ void main( void )
   /* Watch for the incoming cue from Pico1 into this Pico */
   gpio_init( GPIO_P1_REQUEST_SIGNAL );  gpio_set_dir( GPIO_P1_REQUEST_SIGNAL, GPIO_IN );  gpio_pull_up( GPIO_P1_REQUEST_SIGNAL );
 
-  /* Outgoing signal tells Pico1 when this Pico has the address bus set */
-  gpio_init( GPIO_P2_DRIVING_SIGNAL );  gpio_set_dir( GPIO_P2_DRIVING_SIGNAL, GPIO_OUT ); gpio_put( GPIO_P2_DRIVING_SIGNAL, 1  );
-
-  /* Set up the GPIOs which drive the Z80's address bus */
-  gpio_init_mask( GPIO_ABUS_BITMASK );
-  gpio_set_dir_in_masked( GPIO_ABUS_BITMASK );
+  /*
+   * The address bus, and the outgoing signal which tells Pico1 when it's
+   * set, belong to the PIO, see zx_address_step.pio
+   */
+  step_sm     = pio_claim_unused_sm( step_pio, true );
+  step_offset = pio_add_program( step_pio, &zx_address_step_program );
+  zx_address_step_program_init( step_pio, step_sm, step_offset, GPIO_P2_DRIVING_SIGNAL );
 
   /* These are unused on this Pico and stay hi-Z */
   gpio_init( GPIO_Z80_MREQ );   gpio_set_dir( GPIO_Z80_MREQ, GPIO_IN );
@@ -84,53 +162,20 @@ void main( void )
   while( 1 )
   {
     /*
-     * When BUSACK goes low Pico1 has the Z80 bus. That's when we put the
-     * address on the address bus.
-     *
-     * This scanning busy-loop takes about 200ns per iteration.
+     * The PIO does each transfer on its own. Keep it one transfer ahead:
+     * the FIFO takes the next one's address and length while it's doing
+     * this one, so it's ready for BUSACK straight after.
      */
-    while( gpio_get( GPIO_Z80_BUSACK ) == 1 ) test_blipper(); 
-
-    const uint32_t write_address = 0x4000;
-    uint32_t write_counter = 0;
-
-    /* OK, Pico 1 has requested this Pico drives the address bus */
-    for( write_counter = 0; write_counter < 6912; write_counter++ )
+    if( pio_sm_is_tx_fifo_empty( step_pio, step_sm ) )
     {
-      /*
-       * If Pico1 has turned off the bus request we've been
-       * too slow - that's bad, stop driving the address bus immediately
-       * and hope for the best
-       */
-      if( gpio_get( GPIO_Z80_BUSREQ ) == 1 )
-	break;
-
-      /* Wait for Pico1 to request the address bus is set */
-      while( gpio_get( GPIO_P1_REQUEST_SIGNAL ) == 1 ); 
-
-      /* Put 0x4000 on the address bus */
-      gpio_set_dir_out_masked( GPIO_ABUS_BITMASK );
-      gpio_put_masked( GPIO_ABUS_BITMASK, write_address+write_counter );
-
-      /* Address bus has correct content, assert indicator showing we're driving address bus */
-      /* This blipper goes high 200ns to 300ns after Pico1 requests the address be placed */
-      gpio_put( GPIO_P2_BLIPPER, 1 );
-      gpio_put( GPIO_P2_DRIVING_SIGNAL, 0 );
-
-      /* Wait for the other Pico to end its memory request, then put the address bus lines back to inputs */
-      while( gpio_get( GPIO_P1_REQUEST_SIGNAL ) == 0 ); 
-      gpio_set_dir_in_masked( GPIO_ABUS_BITMASK );
-
-      /* The address bus is loaded for about 390ns per byte */
-      gpio_put( GPIO_P2_DRIVING_SIGNAL, 1 );
-      gpio_put( GPIO_P2_BLIPPER, 0 );
+      pio_sm_put( step_pio, step_sm, ~(uint32_t)WRITE_ADDRESS );
+      pio_sm_put( step_pio, step_sm, WRITE_LENGTH-1 );
     }
 
-    /*
-     * Pico1 will turn off the bus requested, then we wait for the
-     * Z80 to acknowledge the DMA has ended and it's taken the bus back
-     */
-    while( gpio_get( GPIO_Z80_BUSACK ) == 0 );
+    stop_if_abandoned();
+
+    /* The address bus is driven by the PIO, the blipper shows it's busy */
+    gpio_put( GPIO_P2_BLIPPER, gpio_get( GPIO_P2_DRIVING_SIGNAL ) == 0 );
   }
 
 }
@@ -0,0 +1,57 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BUS_HAL_H
+#define __BUS_HAL_H
+
+/*
+ * Thin layer over the Z80 bus signals so the DMA code can run off-target.
+ *
+ * Both backends provide:
+ *
+ *  void     bus_hal_busreq( bool active )        Drive /BUSREQ
+ *  bool     bus_hal_busack( void )               True when /BUSACK is active
+ *  void     bus_hal_drive_rd_iorq( bool drive )  Hold /RD and /IORQ inactive, or let go
+ *  uint64_t bus_hal_sample( void )               All GPIOs, in the gpios.h layout
+ *  void     bus_hal_signal( uint32_t gpio, bool level )  Blippers and other outputs
+ *  void     bus_hal_busy_wait_us( uint32_t us )
+ *  uint64_t bus_hal_time_us( void )              Microseconds since boot
+ *  uint32_t bus_hal_cycles( void )               Free running CPU cycle count, for timings
+ *  bool     bus_hal_z80_reset( void )            True while the Spectrum's /RESET is active
+ *  void     bus_hal_alarm_at_us( uint64_t at, bus_hal_alarm_t callback )
+ *                                                One shot, called from the timer IRQ.
+ *                                                Setting it again replaces it
+ *
+ * The board build gets static inline wrappers round the Pico SDK GPIO
+ * calls, so there's no cost over calling the SDK directly. The host build
+ * (ZX_DMA_HOST_SIM, see sim/) gets the simulated Z80/ULA/DRAM.
+ *
+ * The transfer itself goes through bus_master.h, which the simulator
+ * also implements.
+ */
+
+typedef void (*bus_hal_alarm_t)( void );
+
+#ifdef ZX_DMA_HOST_SIM
+#include "bus_hal_sim.h"
+#else
+#include "bus_hal_pico.h"
+#endif
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BUS_HAL_PICO_H
+#define __BUS_HAL_PICO_H
+
+/*
+ * Pico SDK backend for bus_hal.h. Include bus_hal.h, not this.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/structs/m33.h"
+
+#include "gpios.h"
+
+static inline void bus_hal_busreq( bool active )
+{
+  gpio_put( GPIO_Z80_BUSREQ, !active );
+}
+
+/*
+ * BUSACK goes active (low) on the rising edge of the clock - see fig8 in
+ * the Z80 manual
+ */
+static inline bool bus_hal_busack( void )
+{
+  return gpio_get( GPIO_Z80_BUSACK ) == 0;
+}
+
+/* RD and IORQ lines are unused by the DMA process and stay inactive */
+static inline void bus_hal_drive_rd_iorq( bool drive )
+{
+  if( drive )
+  {
+    gpio_set_dir( GPIO_Z80_RD,   GPIO_OUT ); gpio_put( GPIO_Z80_RD,   1 );
+    gpio_set_dir( GPIO_Z80_IORQ, GPIO_OUT ); gpio_put( GPIO_Z80_IORQ, 1 );
+  }
+  else
+  {
+    gpio_set_dir( GPIO_Z80_IORQ, GPIO_IN );
+    gpio_set_dir( GPIO_Z80_RD,   GPIO_IN );
+  }
+}
+
+static inline uint64_t bus_hal_sample( void )
+{
+  return gpio_get_all64();
+}
+
+static inline void bus_hal_signal( uint32_t gpio, bool level )
+{
+  gpio_put( gpio, level );
+}
+
+static inline void bus_hal_busy_wait_us( uint32_t us )
+{
+  busy_wait_us_32( us );
+}
+
+static inline uint64_t bus_hal_time_us( void )
+{
+  return time_us_64();
+}
+
+static inline bool bus_hal_z80_reset( void )
+{
+  return gpio_get( GPIO_Z80_RESET ) == 0;
+}
+
+/* The M33's DWT cycle counter, zx_dma_rp2350b.c starts it */
+static inline uint32_t bus_hal_cycles( void )
+{
+  return m33_hw->dwt_cyccnt;
+}
+
+/* The alarm that's set, 0 if there isn't one */
+static inline alarm_id_t *bus_hal_alarm_id( void )
+{
+  static alarm_id_t id = 0;
+  return &id;
+}
+
+static inline int64_t bus_hal_alarm_fired( alarm_id_t id, void *user_data )
+{
+  *bus_hal_alarm_id() = 0;
+  ((bus_hal_alarm_t)user_data)();
+  return 0;
+}
+
+/*
+ * If the time has already passed the callback is called straight away.
+ * There's only one, setting it again replaces the one that was set.
+ */
+static inline void bus_hal_alarm_at_us( uint64_t at, bus_hal_alarm_t callback )
+{
+  alarm_id_t *id = bus_hal_alarm_id();
+
+  if( *id > 0 )
+  {
+    cancel_alarm( *id );
+    *id = 0;
+  }
+
+  /* Already past, it's been called, and might have set another */
+  alarm_id_t set = add_alarm_at( from_us_since_boot( at ), bus_hal_alarm_fired, (void *)callback, true );
+  if( set > 0 )
+    *id = set;
+}
+
+#endif
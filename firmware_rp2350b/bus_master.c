@@ -0,0 +1,527 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Bus master write and read engines. The per-byte bus cycle is done by the
+ * zx_bus_write PIO program, the bytes are fed to it by a pair of DMA
+ * channels:
+ *
+ * The data channel moves bytes into the PIO's TX FIFO, paced by the PIO's
+ * DREQ. When it finishes it chains to the control channel.
+ *
+ * The control channel reprograms the data channel from a list of control
+ * blocks, each of which is a transfer count and a read address. Writing the
+ * read address triggers the data channel again. Each run in the transfer
+ * takes two control blocks, one for the 4 byte run header and one for the
+ * run's data. The list ends with a null block which stops the chain and
+ * raises the DMA IRQ.
+ *
+ * So the CPU just builds the list and starts the control channel. Nothing
+ * happens on the CPU until the DMA IRQ says it's all done.
+ *
+ * Reads are the same the other way round, with the zx_bus_read program on
+ * a second state machine. One channel feeds it all the run headers in one
+ * go. The bytes it reads are taken from its RX FIFO by a data channel,
+ * which is reprogrammed for each run's destination by a control channel,
+ * its list of control blocks ending in a null block which raises the IRQ.
+ */
+
+#include "pico.h"
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+
+#include "gpios.h"
+#include "bus_master.h"
+#include "zx_bus_write.pio.h"
+#include "zx_bus_read.pio.h"
+
+static PIO  bus_pio = pio0;
+static uint bus_sm;
+static uint bus_offset;
+
+static uint data_chan;
+static uint ctrl_chan;
+
+static uint read_sm;
+static uint read_offset;
+static uint read_tx_chan;
+static uint read_data_chan;
+static uint read_ctrl_chan;
+
+/* The 4 byte header for each run, see zx_bus_write.pio */
+static uint8_t run_headers[BUS_MASTER_MAX_RUNS][4];
+
+/* Control blocks, in the layout of the DMA's alias 3 registers */
+typedef struct
+{
+  uint32_t       transfer_count;
+  const uint8_t *read_addr;
+} control_block_t;
+
+static control_block_t control_blocks[(BUS_MASTER_MAX_RUNS*2)+1];
+
+/* The 2 word header for each read run, see zx_bus_read.pio */
+static uint32_t read_headers[BUS_MASTER_MAX_RUNS][2];
+
+/* Read control blocks, in the layout of the DMA's alias 1 write address and count (trigger) */
+typedef struct
+{
+  uint8_t       *write_addr;
+  uint32_t       transfer_count;
+} read_control_block_t;
+
+static read_control_block_t read_control_blocks[BUS_MASTER_MAX_RUNS+1];
+
+static uint32_t                       num_runs = 0;
+static bool                           reading  = false;
+static uint32_t                       strobe_cycles = BUS_MASTER_STROBE_CYCLES;
+static bool                           clk_gated = false;
+static bool                           io_cycle  = false;
+static volatile bool                  transfer_active = false;
+static volatile bus_master_complete_t complete_callback = NULL;
+
+/*
+ * The pins the PIO takes over for the duration of the transfer. /WR and
+ * /MREQ are active low so are set high before the outputs are enabled.
+ */
+static const uint32_t BUS_PINS_MASK  = GPIO_ABUS_BITMASK | GPIO_DBUS_BITMASK |
+                                       (1u << GPIO_Z80_WR) | (1u << GPIO_Z80_MREQ);
+static const uint32_t CTRL_PINS_MASK = (1u << GPIO_Z80_WR) | (1u << GPIO_Z80_MREQ);
+
+/* For an I/O write /IORQ is the PIO's as well, see bus_master_out_blocking() */
+static const uint32_t IORQ_PIN_MASK  = (1u << GPIO_Z80_IORQ);
+
+/* For reads the data bus stays an input and /RD is driven too */
+static const uint32_t READ_PINS_MASK      = GPIO_ABUS_BITMASK | (1u << GPIO_Z80_RD) |
+                                            (1u << GPIO_Z80_WR) | (1u << GPIO_Z80_MREQ);
+static const uint32_t READ_CTRL_PINS_MASK = (1u << GPIO_Z80_RD) | (1u << GPIO_Z80_WR) | (1u << GPIO_Z80_MREQ);
+
+/*
+ * The SDK's pin setting functions borrow the state machine to execute SET
+ * instructions, which isn't allowed while it's enabled. It's sitting stalled
+ * on a PULL at this point so stopping it briefly doesn't lose anything.
+ */
+static void drive_bus_pins( bool drive )
+{
+  uint32_t bus  = BUS_PINS_MASK  | (io_cycle ? IORQ_PIN_MASK : 0);
+  uint32_t ctrl = CTRL_PINS_MASK | (io_cycle ? IORQ_PIN_MASK : 0);
+
+  pio_sm_set_enabled( bus_pio, bus_sm, false );
+
+  /* /IORQ is being driven high by the CPU, as /RD is for the read engine */
+  if( drive )
+  {
+    pio_sm_set_pins_with_mask( bus_pio, bus_sm, ctrl, ctrl );
+    pio_sm_set_pindirs_with_mask( bus_pio, bus_sm, bus, bus );
+    if( io_cycle )
+      gpio_set_function( GPIO_Z80_IORQ, GPIO_FUNC_PIO0 );
+  }
+  else
+  {
+    if( io_cycle )
+      gpio_set_function( GPIO_Z80_IORQ, GPIO_FUNC_SIO );
+    pio_sm_set_pindirs_with_mask( bus_pio, bus_sm, 0, bus );
+  }
+
+  pio_sm_set_enabled( bus_pio, bus_sm, true );
+}
+
+/*
+ * The same for the read engine. /RD is being driven high by the CPU, see
+ * bus_hal_drive_rd_iorq(); the PIO drives it high too before it's handed
+ * over, and it's handed back before the PIO lets go of it.
+ */
+static void drive_read_pins( bool drive )
+{
+  pio_sm_set_enabled( bus_pio, read_sm, false );
+
+  if( drive )
+  {
+    pio_sm_set_pins_with_mask( bus_pio, read_sm, READ_CTRL_PINS_MASK, READ_CTRL_PINS_MASK );
+    pio_sm_set_pindirs_with_mask( bus_pio, read_sm, READ_PINS_MASK, READ_PINS_MASK );
+    gpio_set_function( GPIO_Z80_RD, GPIO_FUNC_PIO0 );
+  }
+  else
+  {
+    gpio_set_function( GPIO_Z80_RD, GPIO_FUNC_SIO );
+    pio_sm_set_pindirs_with_mask( bus_pio, read_sm, 0, READ_PINS_MASK );
+  }
+
+  pio_sm_set_enabled( bus_pio, read_sm, true );
+}
+
+/*
+ * The two instructions at the program's "gate" label are swapped for CLK
+ * waits in gated mode. The state machine is stalled on its first PULL, so
+ * it can't be part way through them.
+ */
+void bus_master_set_clk_gated( bool gated )
+{
+  uint gate = bus_offset + zx_bus_write_offset_gate;
+
+  if( gated )
+  {
+    bus_pio->instr_mem[gate]   = pio_encode_wait_gpio( true,  GPIO_Z80_CLK );
+    bus_pio->instr_mem[gate+1] = pio_encode_wait_gpio( false, GPIO_Z80_CLK );
+  }
+  else
+  {
+    bus_pio->instr_mem[gate]   = pio_encode_set( pio_pins, io_cycle ? zx_bus_write_IORQ_ACTIVE : zx_bus_write_MREQ_ACTIVE );
+    bus_pio->instr_mem[gate+1] = pio_encode_nop();
+  }
+
+  clk_gated = gated;
+}
+
+/*
+ * The strobe is the "set" at the program's "strobe" label and the "nop"
+ * after it, so it's 2 cycles plus the two delays
+ */
+void bus_master_set_strobe_cycles( uint32_t cycles )
+{
+  if( cycles < BUS_MASTER_MIN_STROBE_CYCLES )
+    cycles = BUS_MASTER_MIN_STROBE_CYCLES;
+  if( cycles > BUS_MASTER_MAX_STROBE_CYCLES )
+    cycles = BUS_MASTER_MAX_STROBE_CYCLES;
+
+  uint delay  = cycles-2;
+  uint first  = (delay > 31) ? 31 : delay;
+  uint strobe = bus_offset + zx_bus_write_offset_strobe;
+
+  bus_pio->instr_mem[strobe]   = pio_encode_set( pio_pins, io_cycle ? zx_bus_write_WR_IORQ_ACTIVE : zx_bus_write_WR_MREQ_ACTIVE ) |
+                                 pio_encode_delay( first );
+  bus_pio->instr_mem[strobe+1] = pio_encode_nop() | pio_encode_delay( delay-first );
+
+  strobe_cycles = cycles;
+}
+
+uint32_t bus_master_strobe_cycles( void )
+{
+  return strobe_cycles;
+}
+
+uint32_t bus_master_cycles_per_byte( void )
+{
+  return BUS_MASTER_CYCLES_PER_BYTE - BUS_MASTER_STROBE_CYCLES + strobe_cycles;
+}
+
+/*
+ * The DMA has finished, but the last few bytes are still in the FIFO. Wait
+ * for the state machine to work through them and stall waiting for the next
+ * run header. That's a couple of microseconds at most.
+ */
+static void finish_transfer( void )
+{
+  if( reading )
+  {
+    /* The last byte has landed, the state machine has a few cycles to go */
+    while( pio_sm_get_pc( bus_pio, read_sm ) != read_offset + zx_bus_read_offset_idle );
+
+    drive_read_pins( false );
+  }
+  else
+  {
+    while( !pio_sm_is_tx_fifo_empty( bus_pio, bus_sm ) );
+    while( pio_sm_get_pc( bus_pio, bus_sm ) != bus_offset + zx_bus_write_offset_idle );
+
+    /* Put the address, data, /MREQ and /WR lines back to hi-Z */
+    drive_bus_pins( false );
+  }
+
+  transfer_active = false;
+}
+
+/*
+ * DMA IRQ, raised by the null control block at the end of the list, on
+ * the write data channel or the read one. A blocking transfer will have
+ * acknowledged it already.
+ */
+static void __time_critical_func(bus_master_dma_irq)( void )
+{
+  uint chan = reading ? read_data_chan : data_chan;
+
+  if( !dma_channel_get_irq0_status( chan ) )
+    return;
+
+  dma_channel_acknowledge_irq0( chan );
+
+  finish_transfer();
+
+  if( complete_callback )
+    complete_callback();
+}
+
+void bus_master_init( void )
+{
+  float clkdiv = (float)clock_get_hz( clk_sys ) / (float)BUS_MASTER_REFERENCE_HZ;
+  if( clkdiv < 1.0f )
+    clkdiv = 1.0f;
+
+  bus_sm     = pio_claim_unused_sm( bus_pio, true );
+  bus_offset = pio_add_program( bus_pio, &zx_bus_write_program );
+  zx_bus_write_program_init( bus_pio, bus_sm, bus_offset, clkdiv );
+
+  read_sm     = pio_claim_unused_sm( bus_pio, true );
+  read_offset = pio_add_program( bus_pio, &zx_bus_read_program );
+  zx_bus_read_program_init( bus_pio, read_sm, read_offset, clkdiv );
+
+  data_chan = dma_claim_unused_channel( true );
+  ctrl_chan = dma_claim_unused_channel( true );
+
+  /*
+   * Data channel: bytes into the TX FIFO at the PIO's pace, then hand back to
+   * the control channel. Quiet IRQ means only the null trigger raises it.
+   */
+  dma_channel_config c = dma_channel_get_default_config( data_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_8 );
+  channel_config_set_read_increment( &c, true );
+  channel_config_set_write_increment( &c, false );
+  channel_config_set_dreq( &c, pio_get_dreq( bus_pio, bus_sm, true ) );
+  channel_config_set_chain_to( &c, ctrl_chan );
+  channel_config_set_irq_quiet( &c, true );
+  dma_channel_configure( data_chan, &c, &bus_pio->txf[bus_sm], NULL, 0, false );
+
+  /*
+   * Control channel: two words per block into the data channel's alias 3
+   * transfer count and read address (trigger) registers, wrapping the write
+   * address so it hits the same pair each time.
+   */
+  c = dma_channel_get_default_config( ctrl_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+  channel_config_set_read_increment( &c, true );
+  channel_config_set_write_increment( &c, true );
+  channel_config_set_ring( &c, true, 3 );
+  dma_channel_configure( ctrl_chan, &c, &dma_hw->ch[data_chan].al3_transfer_count, NULL, 2, false );
+
+  /* Read side: headers into the read engine's TX FIFO, all in one go */
+  read_tx_chan   = dma_claim_unused_channel( true );
+  read_data_chan = dma_claim_unused_channel( true );
+  read_ctrl_chan = dma_claim_unused_channel( true );
+
+  c = dma_channel_get_default_config( read_tx_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+  channel_config_set_read_increment( &c, true );
+  channel_config_set_write_increment( &c, false );
+  channel_config_set_dreq( &c, pio_get_dreq( bus_pio, read_sm, true ) );
+  dma_channel_configure( read_tx_chan, &c, &bus_pio->txf[read_sm], NULL, 0, false );
+
+  /* Bytes out of the RX FIFO into the current run's destination */
+  c = dma_channel_get_default_config( read_data_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_8 );
+  channel_config_set_read_increment( &c, false );
+  channel_config_set_write_increment( &c, true );
+  channel_config_set_dreq( &c, pio_get_dreq( bus_pio, read_sm, false ) );
+  channel_config_set_chain_to( &c, read_ctrl_chan );
+  channel_config_set_irq_quiet( &c, true );
+  dma_channel_configure( read_data_chan, &c, NULL, &bus_pio->rxf[read_sm], 0, false );
+
+  /* Two words per block into the read data channel's alias 1 write address and count (trigger) */
+  c = dma_channel_get_default_config( read_ctrl_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+  channel_config_set_read_increment( &c, true );
+  channel_config_set_write_increment( &c, true );
+  channel_config_set_ring( &c, true, 3 );
+  dma_channel_configure( read_ctrl_chan, &c, &dma_hw->ch[read_data_chan].al1_write_addr, NULL, 2, false );
+
+  dma_channel_set_irq0_enabled( data_chan, true );
+  dma_channel_set_irq0_enabled( read_data_chan, true );
+  irq_set_exclusive_handler( DMA_IRQ_0, bus_master_dma_irq );
+  irq_set_enabled( DMA_IRQ_0, true );
+}
+
+void bus_master_clear_runs( void )
+{
+  num_runs = 0;
+}
+
+/*
+ * Queue a run of bytes to be written to consecutive Z80 addresses. The
+ * source buffer isn't copied so it needs to stay put until the transfer
+ * completes. Returns false if the run list is full.
+ */
+bool bus_master_add_run( uint16_t zx_address, const uint8_t *src, uint32_t length )
+{
+  if( (length == 0) || (length > 0x10000) || (num_runs == BUS_MASTER_MAX_RUNS) )
+    return false;
+
+  if( (num_runs > 0) && reading )
+    return false;
+  reading = false;
+
+  uint8_t *header = run_headers[num_runs];
+  header[0] = zx_address >> 8;
+  header[1] = zx_address & 0xFF;
+  header[2] = (length-1) >> 8;
+  header[3] = (length-1) & 0xFF;
+
+  control_blocks[num_runs*2].transfer_count   = 4;
+  control_blocks[num_runs*2].read_addr        = header;
+  control_blocks[num_runs*2+1].transfer_count = length;
+  control_blocks[num_runs*2+1].read_addr      = src;
+
+  num_runs++;
+
+  return true;
+}
+
+/*
+ * Queue a run of bytes to be read from consecutive Z80 addresses into dst.
+ * Returns false if the run list is full or already has writes in it.
+ */
+bool bus_master_add_read( uint16_t zx_address, uint8_t *dst, uint32_t length )
+{
+  if( (length == 0) || (length > 0x10000) || (num_runs == BUS_MASTER_MAX_RUNS) )
+    return false;
+
+  if( (num_runs > 0) && !reading )
+    return false;
+  reading = true;
+
+  read_headers[num_runs][0] = ~(uint32_t)zx_address;
+  read_headers[num_runs][1] = length-1;
+
+  read_control_blocks[num_runs].write_addr     = dst;
+  read_control_blocks[num_runs].transfer_count = length;
+
+  num_runs++;
+
+  return true;
+}
+
+/* Terminate the control block list and set the DMA going */
+static void start_transfer( void )
+{
+  if( reading )
+  {
+    read_control_blocks[num_runs].write_addr     = NULL;
+    read_control_blocks[num_runs].transfer_count = 0;
+
+    transfer_active = true;
+
+    drive_read_pins( true );
+
+    /* The destination side is ready before the first byte can arrive */
+    dma_channel_set_read_addr( read_ctrl_chan, read_control_blocks, true );
+    dma_channel_transfer_from_buffer_now( read_tx_chan, read_headers, num_runs*2 );
+    return;
+  }
+
+  /* Terminating null block */
+  control_blocks[num_runs*2].transfer_count = 0;
+  control_blocks[num_runs*2].read_addr      = NULL;
+
+  transfer_active = true;
+
+  /* /WR and /MREQ inactive, then drive the buses */
+  drive_bus_pins( true );
+
+  dma_channel_set_read_addr( ctrl_chan, control_blocks, true );
+}
+
+/*
+ * Start the queued runs going. The caller must have the Z80's bus. This
+ * returns immediately, the complete function is called from the DMA IRQ
+ * when the transfer is finished.
+ */
+void bus_master_start( bus_master_complete_t complete )
+{
+  complete_callback = complete;
+
+  if( num_runs == 0 )
+  {
+    if( complete )
+      complete();
+    return;
+  }
+
+  start_transfer();
+}
+
+bool bus_master_busy( void )
+{
+  return transfer_active;
+}
+
+void bus_master_write( uint16_t zx_address, const uint8_t *src, uint32_t length,
+		       bus_master_complete_t complete )
+{
+  bus_master_clear_runs();
+  bus_master_add_run( zx_address, src, length );
+  bus_master_start( complete );
+}
+
+/*
+ * The DMA IRQ can't run while the caller is in a handler of the same
+ * priority, so the end of the transfer is polled for. The IRQ still goes
+ * pending, it finds nothing to do when it does run.
+ */
+static void wait_transfer( void )
+{
+  uint chan = reading ? read_data_chan : data_chan;
+
+  start_transfer();
+
+  while( !dma_channel_get_irq0_status( chan ) );
+  dma_channel_acknowledge_irq0( chan );
+
+  finish_transfer();
+}
+
+void bus_master_write_blocking( uint16_t zx_address, const uint8_t *src, uint32_t length )
+{
+  bus_master_clear_runs();
+  if( !bus_master_add_run( zx_address, src, length ) )
+    return;
+
+  wait_transfer();
+}
+
+/*
+ * The ULA's port sees an OUT from the Z80 as /IORQ and /WR with the port
+ * on the address bus; the ULA latches it asynchronously, so the strobe is
+ * made as long as it can be, about 1.5T, rather than the RAM's. The gate
+ * and strobe are put back as they were afterwards.
+ */
+void bus_master_out_blocking( uint16_t port, uint8_t data )
+{
+  uint32_t cycles = strobe_cycles;
+  bool     gated  = clk_gated;
+
+  io_cycle = true;
+  bus_master_set_clk_gated( false );
+  bus_master_set_strobe_cycles( BUS_MASTER_MAX_STROBE_CYCLES );
+
+  bus_master_write_blocking( port, &data, 1 );
+
+  io_cycle = false;
+  bus_master_set_clk_gated( gated );
+  bus_master_set_strobe_cycles( cycles );
+}
+
+void bus_master_read( uint16_t zx_address, uint8_t *dst, uint32_t length )
+{
+  bus_master_clear_runs();
+  if( !bus_master_add_read( zx_address, dst, length ) )
+    return;
+
+  wait_transfer();
+}
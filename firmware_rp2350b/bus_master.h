@@ -0,0 +1,120 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BUS_MASTER_H
+#define __BUS_MASTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * PIO + DMA bus master write and read engines. The caller owns
+ * BUSREQ/BUSACK, this code takes over the address, data, /MREQ, /WR (and
+ * for reads /RD) lines once the Z80 has given up the bus, and gives them
+ * back when the transfer is done.
+ *
+ * A transfer is a list of runs, each run being a block of bytes written to
+ * or read from consecutive Z80 addresses. Runs are queued with
+ * bus_master_add_run() or bus_master_add_read() then the whole lot is done
+ * with bus_master_start(). A transfer is all writes or all reads. The DMA
+ * hardware does the work; the completion callback is called from the DMA
+ * IRQ once the last byte has been written or read and the buses are back
+ * to hi-Z.
+ */
+
+/* Maximum number of runs in a single transfer */
+#define BUS_MASTER_MAX_RUNS 64
+
+/*
+ * PIO cycle counts, see zx_bus_write.pio, which these need to match. They
+ * hold at BUS_MASTER_REFERENCE_HZ, the clock divider is scaled to keep them
+ * true at other system clock speeds. sim/pio_check.c runs both programs
+ * and checks them against these.
+ */
+#define BUS_MASTER_REFERENCE_HZ      150000000
+#define BUS_MASTER_HEADER_CYCLES     12
+#define BUS_MASTER_CYCLES_PER_BYTE   44
+#define BUS_MASTER_STROBE_CYCLES     35
+
+/* The range bus_master_set_strobe_cycles() can set, in the same cycles */
+#define BUS_MASTER_MIN_STROBE_CYCLES 2
+#define BUS_MASTER_MAX_STROBE_CYCLES 64
+
+/* The same for zx_bus_read.pio */
+#define BUS_MASTER_READ_HEADER_CYCLES    2
+#define BUS_MASTER_READ_CYCLES_PER_BYTE  44
+#define BUS_MASTER_READ_ACCESS_CYCLES    39
+
+/*
+ * In CLK gated mode each byte waits for the ULA to let a T-state go, so the
+ * time per byte depends on where in the frame it is. It averages 3.5T over
+ * a display line, this is 4T to plan with.
+ */
+#define BUS_MASTER_CLK_GATED_CYCLES_PER_BYTE  172
+
+typedef void (*bus_master_complete_t)( void );
+
+void bus_master_init( void );
+
+void bus_master_clear_runs( void );
+bool bus_master_add_run( uint16_t zx_address, const uint8_t *src, uint32_t length );
+bool bus_master_add_read( uint16_t zx_address, uint8_t *dst, uint32_t length );
+
+/*
+ * Set the /WR strobe length. BUS_MASTER_CYCLES_PER_BYTE and
+ * BUS_MASTER_STROBE_CYCLES are the default; bus_master_cycles_per_byte()
+ * gives the current figure. Only call this between transfers.
+ */
+void     bus_master_set_strobe_cycles( uint32_t cycles );
+uint32_t bus_master_strobe_cycles( void );
+uint32_t bus_master_cycles_per_byte( void );
+
+/*
+ * Wait for a falling edge of the Z80's CLK before each write, so writes can
+ * go into contended RAM while the ULA is drawing the screen. See
+ * zx_bus_write.pio. Only call this between transfers.
+ */
+void bus_master_set_clk_gated( bool gated );
+
+void bus_master_start( bus_master_complete_t complete );
+bool bus_master_busy( void );
+
+/* Convenience, a single run transfer */
+void bus_master_write( uint16_t zx_address, const uint8_t *src, uint32_t length,
+		       bus_master_complete_t complete );
+
+/*
+ * Blocking versions, for when the caller can't wait for the DMA IRQ, such
+ * as from inside another handler of the same priority. The caller must
+ * have the Z80's bus.
+ */
+void bus_master_write_blocking( uint16_t zx_address, const uint8_t *src, uint32_t length );
+void bus_master_read( uint16_t zx_address, uint8_t *dst, uint32_t length );
+
+/*
+ * An I/O write, OUT to a port, blocking like the above. It's a one byte
+ * run with /IORQ in place of /MREQ and the longest strobe, so it takes
+ * BUS_MASTER_OUT_CYCLES.
+ */
+#define BUS_MASTER_OUT_CYCLES \
+  (BUS_MASTER_HEADER_CYCLES + BUS_MASTER_CYCLES_PER_BYTE - BUS_MASTER_STROBE_CYCLES + BUS_MASTER_MAX_STROBE_CYCLES)
+
+void bus_master_out_blocking( uint16_t port, uint8_t data );
+
+#endif
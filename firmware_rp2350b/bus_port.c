@@ -0,0 +1,125 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * I/O port responder. The zx_bus_port_decode PIO program on pio1 watches
+ * every I/O cycle for the port. An IN is handed to zx_bus_port_read on
+ * pio2, which is answered the same way as the ROM server's reads: one DMA
+ * channel takes the register's address from the RX FIFO and triggers a
+ * second, which copies the byte into the TX FIFO. An OUT is pushed into
+ * the decoder's RX FIFO and picked up by its IRQ.
+ *
+ * The data bus is pio2's, shared with the ROM server, and given to the
+ * bus master on pio0 while it has the Z80's bus, see bus_rom.h.
+ */
+
+#include "pico.h"
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+
+#include "gpios.h"
+#include "bus_rom.h"
+#include "bus_port.h"
+#include "zx_bus_port.pio.h"
+
+static PIO  decode_pio = pio1;
+static PIO  read_pio   = pio2;
+static uint decode_sm;
+static uint read_sm;
+static uint address_chan;
+static uint byte_chan;
+
+static bus_port_written_t port_written;
+static bus_port_read_t    port_read;
+
+/* The reader puts A8-A11 under the top bits of this address */
+volatile uint8_t bus_port_in[BUS_PORT_REGISTERS] __attribute__((aligned(BUS_PORT_REGISTERS)));
+volatile uint8_t bus_port_out[BUS_PORT_REGISTERS];
+
+/* OUTs, each one the pins as they were: D0-D7, then A0-A15 */
+static void __not_in_flash_func(port_written_irq)( void )
+{
+  while( !pio_sm_is_rx_fifo_empty( decode_pio, decode_sm ) )
+  {
+    uint32_t pins = pio_sm_get( decode_pio, decode_sm );
+    uint8_t  reg  = BUS_PORT_REGISTER( pins >> GPIO_ABUS_A0 );
+    uint8_t  data = pins & GPIO_DBUS_BITMASK;
+
+    bus_port_out[reg] = data;
+    if( port_written )
+      port_written( reg, data );
+  }
+}
+
+static void __not_in_flash_func(port_read_irq)( void )
+{
+  pio_interrupt_clear( read_pio, 0 );
+
+  if( port_read )
+    port_read();
+}
+
+void bus_port_init( uint8_t port, bus_port_written_t written, bus_port_read_t read )
+{
+  port_written = written;
+  port_read    = read;
+
+  decode_sm    = pio_claim_unused_sm( decode_pio, true );
+  read_sm      = pio_claim_unused_sm( read_pio, true );
+  address_chan = dma_claim_unused_channel( true );
+  byte_chan    = dma_claim_unused_channel( true );
+
+  uint decode_offset = pio_add_program( decode_pio, &zx_bus_port_decode_program );
+  uint read_offset   = pio_add_program( read_pio, &zx_bus_port_read_program );
+
+  /* Byte channel: the register into the TX FIFO, as the ROM server's does */
+  dma_channel_config c = dma_channel_get_default_config( byte_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_8 );
+  channel_config_set_read_increment( &c, false );
+  channel_config_set_write_increment( &c, false );
+  channel_config_set_high_priority( &c, true );
+  dma_channel_configure( byte_chan, &c, &read_pio->txf[read_sm], bus_port_in, 1, false );
+
+  /* Address channel: RX FIFO into the byte channel's read address trigger, for ever */
+  c = dma_channel_get_default_config( address_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+  channel_config_set_read_increment( &c, false );
+  channel_config_set_write_increment( &c, false );
+  channel_config_set_dreq( &c, pio_get_dreq( read_pio, read_sm, false ) );
+  channel_config_set_high_priority( &c, true );
+  dma_channel_configure( address_chan, &c, &dma_hw->ch[byte_chan].al3_read_addr_trig, &read_pio->rxf[read_sm],
+			 DMA_CH0_TRANS_COUNT_MODE_VALUE_ENDLESS << DMA_CH0_TRANS_COUNT_MODE_LSB,
+			 true );
+
+  /* OUTs, and the reader's IRQ 0 after each IN */
+  pio_set_irq0_source_enabled( decode_pio, pio_get_rx_fifo_not_empty_interrupt_source( decode_sm ), true );
+  irq_set_exclusive_handler( PIO1_IRQ_0, port_written_irq );
+  irq_set_enabled( PIO1_IRQ_0, true );
+
+  pio_set_irq0_source_enabled( read_pio, pis_interrupt0, true );
+  irq_set_exclusive_handler( PIO2_IRQ_0, port_read_irq );
+  irq_set_enabled( PIO2_IRQ_0, true );
+
+  zx_bus_port_read_program_init( read_pio, read_sm, read_offset, (uintptr_t)bus_port_in >> 4 );
+  zx_bus_port_decode_program_init( decode_pio, decode_sm, decode_offset, port );
+
+  bus_rom_claim_data_bus();
+}
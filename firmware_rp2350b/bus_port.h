@@ -0,0 +1,54 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BUS_PORT_H
+#define __BUS_PORT_H
+
+#include <stdint.h>
+
+/*
+ * I/O port responder. One port address, decoded on A0-A7, has a file of
+ * registers selected by A8-A11. The Z80's IN from it is answered from
+ * bus_port_in[] by PIO and DMA, inside the I/O cycle, with no CPU help.
+ * Its OUT to it is latched into bus_port_out[] and the written function
+ * is called, from an IRQ on core 0, a microsecond or two later: before the
+ * Z80 can get another IN in.
+ *
+ * IN A,(C) and OUT (C),r put B on A8-A15, so with BC loaded one
+ * instruction reads or writes a register. IN A,(n) puts A there.
+ *
+ * The read function is called after each IN, the same way, so registers
+ * which change every time they're read can be moved on.
+ */
+
+#define BUS_PORT_REGISTERS 16
+
+#define BUS_PORT_REGISTER( port ) (((port) >> 8) & (BUS_PORT_REGISTERS-1))
+
+typedef void (*bus_port_written_t)( uint8_t reg, uint8_t data );
+typedef void (*bus_port_read_t)( void );
+
+/* What the Z80 reads, and the last it wrote, by register */
+extern volatile uint8_t bus_port_in[BUS_PORT_REGISTERS];
+extern volatile uint8_t bus_port_out[BUS_PORT_REGISTERS];
+
+/* Answer IN and OUT on the port whose low byte is this, from now on */
+void bus_port_init( uint8_t port, bus_port_written_t written, bus_port_read_t read );
+
+#endif
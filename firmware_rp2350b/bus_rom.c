@@ -0,0 +1,127 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * ROM server. The zx_bus_rom PIO program pushes the address in the image
+ * of each ROM byte the Z80 reads. One DMA channel takes that from the RX
+ * FIFO and writes it to the read address trigger of a second, which copies
+ * the byte into the TX FIFO for the program to put on the data bus. The CPU
+ * has nothing to do with it once it's going.
+ *
+ * A GPIO can only be driven by one PIO. The ROM server is on pio2, with
+ * the I/O port responder's reader (see bus_port.c); the data bus is
+ * handed back to the bus master on pio0 while it has the Z80's bus, and
+ * the Z80 can't read the ROM or the port then.
+ */
+
+#include <string.h>
+
+#include "pico.h"
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+
+#include "gpios.h"
+#include "zx_display.h"
+#include "bus_rom.h"
+#include "zx_bus_rom.pio.h"
+
+static PIO  rom_pio = pio2;
+static uint rom_sm;
+static uint rom_offset;
+static uint address_chan;
+static uint byte_chan;
+
+static bool serving = false;
+
+/* pio2 has the data bus, for the ROM server and bus_port.c's reader */
+static bool data_bus_claimed = false;
+
+/* The PIO program puts A0-A13 under the top bits of this address */
+static uint8_t rom_image[ZX_ROM_SIZE] __attribute__((aligned(ZX_ROM_SIZE)));
+
+static void data_bus_to( gpio_function_t function )
+{
+  for( uint32_t gpio = GPIO_DBUS_D0; gpio <= GPIO_DBUS_D7; gpio++ )
+    gpio_set_function( gpio, function );
+}
+
+void bus_rom_init( const uint8_t *rom )
+{
+  memcpy( rom_image, rom, ZX_ROM_SIZE );
+
+  rom_sm       = pio_claim_unused_sm( rom_pio, true );
+  rom_offset   = pio_add_program( rom_pio, &zx_bus_rom_program );
+  address_chan = dma_claim_unused_channel( true );
+  byte_chan    = dma_claim_unused_channel( true );
+
+  /*
+   * Byte channel: one byte from wherever it's pointed into the TX FIFO.
+   * There's always room, the program has just emptied it. Each trigger
+   * starts it again with the same count.
+   */
+  dma_channel_config c = dma_channel_get_default_config( byte_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_8 );
+  channel_config_set_read_increment( &c, false );
+  channel_config_set_write_increment( &c, false );
+  channel_config_set_high_priority( &c, true );
+  dma_channel_configure( byte_chan, &c, &rom_pio->txf[rom_sm], rom_image, 1, false );
+
+  /* Address channel: RX FIFO into the byte channel's read address trigger, for ever */
+  c = dma_channel_get_default_config( address_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+  channel_config_set_read_increment( &c, false );
+  channel_config_set_write_increment( &c, false );
+  channel_config_set_dreq( &c, pio_get_dreq( rom_pio, rom_sm, false ) );
+  channel_config_set_high_priority( &c, true );
+  dma_channel_configure( address_chan, &c, &dma_hw->ch[byte_chan].al3_read_addr_trig, &rom_pio->rxf[rom_sm],
+			 DMA_CH0_TRANS_COUNT_MODE_VALUE_ENDLESS << DMA_CH0_TRANS_COUNT_MODE_LSB,
+			 true );
+
+  zx_bus_rom_program_init( rom_pio, rom_sm, rom_offset, (uintptr_t)rom_image >> 14 );
+  bus_rom_claim_data_bus();
+  serving = true;
+
+  /* Turn the Spectrum's ROM off */
+  gpio_put( GPIO_ROMCS, 1 );
+  gpio_set_dir( GPIO_ROMCS, GPIO_OUT );
+}
+
+uint8_t *bus_rom_image( void )
+{
+  return serving ? rom_image : NULL;
+}
+
+void bus_rom_claim_data_bus( void )
+{
+  data_bus_to( GPIO_FUNC_PIO2 );
+  data_bus_claimed = true;
+}
+
+void bus_rom_pause( void )
+{
+  if( data_bus_claimed )
+    data_bus_to( GPIO_FUNC_PIO0 );
+}
+
+void bus_rom_resume( void )
+{
+  if( data_bus_claimed )
+    data_bus_to( GPIO_FUNC_PIO2 );
+}
@@ -0,0 +1,49 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BUS_ROM_H
+#define __BUS_ROM_H
+
+#include <stdint.h>
+
+/*
+ * ROM takeover. ROMCS is driven high, which turns off the Spectrum's own
+ * ROM, and the zx_bus_rom PIO program answers the Z80's reads of
+ * 0x0000-0x3FFF from a 16K image in the RP2350's SRAM. The image can be
+ * changed while it's being served, zx_tape.c uses that to talk to a
+ * patched LD-BYTES.
+ */
+
+/* Copy in the ROM image, take over from the Spectrum's ROM and start serving it */
+void     bus_rom_init( const uint8_t *rom );
+
+/* The image being served, or NULL if the Spectrum's own ROM is in use */
+uint8_t *bus_rom_image( void );
+
+/* Give the data bus to pio2, for bus_port.c as well as the ROM server */
+void     bus_rom_claim_data_bus( void );
+
+/*
+ * The data bus is shared with the bus master, which needs it while it
+ * has the Z80's bus. Nothing happens if pio2 hasn't claimed it.
+ */
+void     bus_rom_pause( void );
+void     bus_rom_resume( void );
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Z80 write snoop. The zx_bus_snoop PIO program pushes a word per Z80
+ * memory write into its RX FIFO, and a DMA channel empties the FIFO into a
+ * ring buffer. The DMA runs in endless mode with its write address wrapping
+ * round the ring, so it never needs restarting and never raises an IRQ.
+ *
+ * The producer's position is the DMA's write address. The consumer's is
+ * kept here. Nothing stops the DMA overwriting events which haven't been
+ * drained yet; the sequence numbers in the events show when that happens.
+ *
+ * The snoop runs on pio1, out of the way of the bus master on pio0.
+ */
+
+#include "pico.h"
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+
+#include "gpios.h"
+#include "bus_snoop.h"
+#include "zx_bus_snoop.pio.h"
+
+static PIO  snoop_pio = pio1;
+static uint snoop_sm;
+static uint snoop_offset;
+static uint snoop_chan;
+
+/* The DMA's ring wrap needs the buffer aligned to its size */
+static uint32_t snoop_ring[BUS_SNOOP_RING_EVENTS] __attribute__((aligned(1u << BUS_SNOOP_RING_BITS)));
+
+static uint32_t tail          = 0;
+static uint8_t  next_sequence = 0;
+
+bus_snoop_stats_t bus_snoop_stats;
+
+void bus_snoop_init( void )
+{
+  snoop_sm     = pio_claim_unused_sm( snoop_pio, true );
+  snoop_offset = pio_add_program( snoop_pio, &zx_bus_snoop_program );
+  snoop_chan   = dma_claim_unused_channel( true );
+
+  /*
+   * RX FIFO into the ring, for ever. High priority because the FIFO is only
+   * 8 deep and the bus master's channels are busy at the same time.
+   */
+  dma_channel_config c = dma_channel_get_default_config( snoop_chan );
+  channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+  channel_config_set_read_increment( &c, false );
+  channel_config_set_write_increment( &c, true );
+  channel_config_set_ring( &c, true, BUS_SNOOP_RING_BITS );
+  channel_config_set_dreq( &c, pio_get_dreq( snoop_pio, snoop_sm, false ) );
+  channel_config_set_high_priority( &c, true );
+  dma_channel_configure( snoop_chan, &c, snoop_ring, &snoop_pio->rxf[snoop_sm],
+			 DMA_CH0_TRANS_COUNT_MODE_VALUE_ENDLESS << DMA_CH0_TRANS_COUNT_MODE_LSB,
+			 true );
+
+  zx_bus_snoop_program_init( snoop_pio, snoop_sm, snoop_offset );
+}
+
+/*
+ * The bus master's writes look just like the Z80's to the snoop program,
+ * and applying them to the mirror later could undo changes made since. So
+ * the state machine is stopped once the Z80 has given up the bus and
+ * restarted before it gets it back.
+ */
+void bus_snoop_pause( void )
+{
+  pio_sm_set_enabled( snoop_pio, snoop_sm, false );
+}
+
+/*
+ * It might have been stopped half way through a sample, so the part word
+ * in the ISR is thrown away and it starts again at the top. Y, the sequence
+ * number, is left alone.
+ */
+void bus_snoop_resume( void )
+{
+  pio_sm_exec( snoop_pio, snoop_sm, pio_encode_mov( pio_isr, pio_null ) );
+  pio_sm_exec( snoop_pio, snoop_sm, pio_encode_jmp( snoop_offset + zx_bus_snoop_offset_start ) );
+  pio_sm_set_enabled( snoop_pio, snoop_sm, true );
+}
+
+/*
+ * The sequence number counts down by one per event. If a batch doesn't
+ * carry on from the last one, or doesn't count down by its length, the DMA
+ * has lapped the consumer. Gaps of multiples of 256 can't be seen, but
+ * that's a whole lot of ring.
+ */
+static void check_sequence( const uint32_t *events, uint32_t count )
+{
+  uint8_t first = BUS_SNOOP_EVENT_SEQUENCE( events[0] );
+  uint8_t last  = BUS_SNOOP_EVENT_SEQUENCE( events[count-1] );
+
+  uint8_t skipped = (uint8_t)(next_sequence - first) + (uint8_t)((first - last) - (count-1));
+  if( skipped )
+  {
+    bus_snoop_stats.overflows++;
+    bus_snoop_stats.lost += skipped;
+  }
+
+  next_sequence = last - 1;
+}
+
+/*
+ * Pass everything waiting in the ring to the apply function, in at most
+ * two batches (the second if it wraps). Returns the number of events.
+ * Called from IRQ handlers of the same priority, so they can't interrupt
+ * each other part way through.
+ */
+uint32_t bus_snoop_drain( bus_snoop_batch_t apply )
+{
+  uint32_t head    = (dma_hw->ch[snoop_chan].write_addr - (uintptr_t)snoop_ring) / sizeof(uint32_t);
+  uint32_t pending = (head - tail) & (BUS_SNOOP_RING_EVENTS-1);
+
+  if( pending == 0 )
+    return 0;
+
+  if( pending > bus_snoop_stats.high_water )
+    bus_snoop_stats.high_water = pending;
+
+  uint32_t remaining = pending;
+  while( remaining )
+  {
+    uint32_t count = remaining;
+    if( tail+count > BUS_SNOOP_RING_EVENTS )
+      count = BUS_SNOOP_RING_EVENTS-tail;
+
+    check_sequence( &snoop_ring[tail], count );
+    apply( &snoop_ring[tail], count );
+
+    tail = (tail+count) & (BUS_SNOOP_RING_EVENTS-1);
+    remaining -= count;
+  }
+
+  bus_snoop_stats.events += pending;
+
+  return pending;
+}
@@ -0,0 +1,69 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BUS_SNOOP_H
+#define __BUS_SNOOP_H
+
+#include <stdint.h>
+
+/*
+ * PIO + DMA snoop on the Z80's memory writes. The zx_bus_snoop PIO program
+ * catches every write and a DMA channel copies them into a ring buffer, so
+ * nothing is lost however busy the CPU is. The ring is drained in batches by
+ * bus_snoop_drain().
+ */
+
+/* Ring buffer size, as a power of 2 in bytes for the DMA's address wrap */
+#define BUS_SNOOP_RING_BITS     14
+#define BUS_SNOOP_RING_EVENTS   ((1u << BUS_SNOOP_RING_BITS)/sizeof(uint32_t))
+
+/* Event layout, see zx_bus_snoop.pio */
+#define BUS_SNOOP_EVENT_ADDRESS(e)   ((uint16_t)((e) >> 16))
+#define BUS_SNOOP_EVENT_DATA(e)      ((uint8_t)((e) >> 8))
+#define BUS_SNOOP_EVENT_SEQUENCE(e)  ((uint8_t)(e))
+
+/*
+ * "high_water" is the most events ever found waiting in the ring. If that
+ * gets near BUS_SNOOP_RING_EVENTS it's not being drained often enough.
+ * "overflows" counts the batches where the sequence numbers show the DMA
+ * lapped the consumer, "lost" is an estimate of the events that went with
+ * it. Look at these in the debugger.
+ */
+typedef struct
+{
+  uint64_t events;
+  uint32_t high_water;
+  uint32_t overflows;
+  uint64_t lost;
+} bus_snoop_stats_t;
+
+extern bus_snoop_stats_t bus_snoop_stats;
+
+/* Called with each contiguous batch of events, oldest first */
+typedef void (*bus_snoop_batch_t)( const uint32_t *events, uint32_t count );
+
+void     bus_snoop_init( void );
+
+/* Stop and restart the snoop around the bus master's own writes */
+void     bus_snoop_pause( void );
+void     bus_snoop_resume( void );
+
+uint32_t bus_snoop_drain( bus_snoop_batch_t apply );
+
+#endif
@@ -0,0 +1,284 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Tile and sprite compositing.
+ *
+ * A character row is 32 cells, so the cells to draw are a word per row.
+ * When a sprite changes, the cells it was in and the cells it's now in
+ * are marked. Each marked cell is then built up in 9 bytes on the stack,
+ * the tile first then every sprite in that row of cells which covers it,
+ * and written out a byte at a time, only where it differs from what's on
+ * the screen.
+ *
+ * The sprites in each character row are a 64 bit set, made once a frame,
+ * so a cell only looks at the sprites which might be in it.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "zx_display.h"
+#include "screen_dirty.h"
+#include "compositor.h"
+
+typedef struct
+{
+  int8_t col0, col1;     /* Inclusive, col0 > col1 for none */
+  int8_t row0, row1;
+} cell_rect_t;
+
+compositor_stats_t compositor_stats;
+
+static const compositor_tile_t *tiles;
+static compositor_frame_t       frame_function;
+
+static uint8_t                  map[ZX_DISPLAY_CHAR_ROWS][ZX_DISPLAY_COLUMNS];
+static uint32_t                 dirty[ZX_DISPLAY_CHAR_ROWS];
+
+/* What's been asked for, and what's on the screen */
+static compositor_sprite_t      sprites[COMPOSITOR_MAX_SPRITES];
+static compositor_sprite_t      drawn[COMPOSITOR_MAX_SPRITES];
+static cell_rect_t              drawn_rect[COMPOSITOR_MAX_SPRITES];
+
+static uint64_t                 row_sprites[ZX_DISPLAY_CHAR_ROWS];
+
+static void mark_rect( const cell_rect_t *r )
+{
+  if( (r->col0 > r->col1) || (r->row0 > r->row1) )
+    return;
+
+  uint32_t width = r->col1 - r->col0 + 1;
+  uint32_t bits  = ((width == 32) ? 0xFFFFFFFFu : ((1u << width) - 1)) << r->col0;
+
+  for( int32_t row = r->row0; row <= r->row1; row++ )
+    dirty[row] |= bits;
+}
+
+static int32_t clamp( int32_t v, int32_t low, int32_t high )
+{
+  return (v < low) ? low : ((v > high) ? high : v);
+}
+
+/* The cells a sprite covers, clipped to the screen */
+static cell_rect_t sprite_rect( const compositor_sprite_t *s )
+{
+  cell_rect_t r = { 0, -1, 0, -1 };
+
+  if( s->graphic == NULL )
+    return r;
+
+  int32_t x1 = s->x + (s->graphic->cols*8) - 1;
+  int32_t y1 = s->y + s->graphic->rows - 1;
+
+  if( (x1 < 0) || (y1 < 0) || (s->x >= ZX_DISPLAY_COLUMNS*8) || (s->y >= ZX_DISPLAY_PIXEL_ROWS) )
+    return r;
+
+  r.col0 = clamp( s->x >> 3, 0, ZX_DISPLAY_COLUMNS-1 );
+  r.col1 = clamp( x1 >> 3,   0, ZX_DISPLAY_COLUMNS-1 );
+  r.row0 = clamp( s->y >> 3, 0, ZX_DISPLAY_CHAR_ROWS-1 );
+  r.row1 = clamp( y1 >> 3,   0, ZX_DISPLAY_CHAR_ROWS-1 );
+
+  return r;
+}
+
+void compositor_init( const compositor_tile_t *tile_set, compositor_frame_t frame )
+{
+  tiles          = tile_set;
+  frame_function = frame;
+
+  memset( &compositor_stats, 0, sizeof(compositor_stats) );
+
+  memset( map,     0, sizeof(map) );
+  memset( sprites, 0, sizeof(sprites) );
+  memset( drawn,   0, sizeof(drawn) );
+  for( uint32_t i = 0; i < COMPOSITOR_MAX_SPRITES; i++ )
+    drawn_rect[i] = sprite_rect( &drawn[i] );
+
+  compositor_redraw();
+}
+
+void compositor_redraw( void )
+{
+  for( uint32_t row = 0; row < ZX_DISPLAY_CHAR_ROWS; row++ )
+    dirty[row] = 0xFFFFFFFFu;
+}
+
+void compositor_set_tile( uint32_t col, uint32_t row, uint8_t tile )
+{
+  if( (col >= ZX_DISPLAY_COLUMNS) || (row >= ZX_DISPLAY_CHAR_ROWS) || (map[row][col] == tile) )
+    return;
+
+  map[row][col] = tile;
+  dirty[row]   |= (1u << col);
+}
+
+void compositor_set_sprite( uint32_t sprite, const compositor_sprite_t *state )
+{
+  if( sprite < COMPOSITOR_MAX_SPRITES )
+    sprites[sprite] = *state;
+}
+
+void compositor_load_table( const uint8_t *table, uint32_t count,
+			    const compositor_graphic_t *const *graphics, uint32_t graphic_count )
+{
+  if( count > COMPOSITOR_MAX_SPRITES )
+    count = COMPOSITOR_MAX_SPRITES;
+
+  for( uint32_t i = 0; i < count; i++, table += COMPOSITOR_TABLE_ENTRY )
+  {
+    compositor_sprite_t *s = &sprites[i];
+
+    s->x        = table[0] - COMPOSITOR_TABLE_OFFSET;
+    s->y        = table[1] - COMPOSITOR_TABLE_OFFSET;
+    s->graphic  = (table[2] < graphic_count) ? graphics[table[2]] : NULL;
+    s->attr     = table[3];
+    s->coloured = (table[3] != 0);
+  }
+}
+
+/* Sprites which have changed leave their old cells and go to their new ones */
+static void move_sprites( void )
+{
+  for( uint32_t i = 0; i < COMPOSITOR_MAX_SPRITES; i++ )
+  {
+    compositor_sprite_t *s = &sprites[i];
+    compositor_sprite_t *d = &drawn[i];
+
+    if( (s->x != d->x) || (s->y != d->y) || (s->graphic != d->graphic) ||
+	(s->attr != d->attr) || (s->coloured != d->coloured) )
+    {
+      mark_rect( &drawn_rect[i] );
+
+      *d            = *s;
+      drawn_rect[i] = sprite_rect( d );
+      mark_rect( &drawn_rect[i] );
+    }
+  }
+
+  memset( row_sprites, 0, sizeof(row_sprites) );
+  for( uint32_t i = 0; i < COMPOSITOR_MAX_SPRITES; i++ )
+  {
+    for( int32_t row = drawn_rect[i].row0; row <= drawn_rect[i].row1; row++ )
+      row_sprites[row] |= (1ull << i);
+  }
+}
+
+/* One sprite's part of one cell */
+static void draw_sprite( uint8_t *cell, uint8_t *attr, const compositor_sprite_t *s, int32_t col, int32_t row )
+{
+  const compositor_graphic_t *g = s->graphic;
+
+  int32_t j     = col - (s->x >> 3);
+  int32_t shift = s->x & 7;
+  if( (j < 0) || (j > g->cols) || ((j == g->cols) && (shift == 0)) )
+    return;
+
+  int32_t top    = row*8 - s->y;
+  int32_t first  = (top < 0) ? -top : 0;
+  int32_t last   = g->rows - top;
+  if( last > 8 )
+    last = 8;
+
+  for( int32_t line = first; line < last; line++ )
+  {
+    const uint8_t *data = &g->data[(top+line) * g->cols * 2];
+
+    /* The byte to the left's right hand pixels, then this one's left hand ones */
+    uint32_t mask   = (j > 0) ? (data[(j-1)*2] << 8) : 0xFF00;
+    uint32_t pixels = (j > 0) ? (data[(j-1)*2+1] << 8) : 0;
+
+    mask   |= (j < g->cols) ? data[j*2]   : 0xFF;
+    pixels |= (j < g->cols) ? data[j*2+1] : 0;
+
+    cell[line] = (cell[line] & (mask >> shift)) | (pixels >> shift);
+  }
+
+  if( s->coloured )
+    *attr = s->attr;
+}
+
+static uint32_t draw_cell( uint8_t *screen, int32_t col, int32_t row )
+{
+  const compositor_tile_t *tile = &tiles[map[row][col]];
+
+  uint8_t cell[8];
+  uint8_t attr = tile->attr;
+  memcpy( cell, tile->pixels, sizeof(cell) );
+
+  for( uint64_t in_row = row_sprites[row]; in_row; in_row &= in_row-1 )
+  {
+    uint32_t i = __builtin_ctzll( in_row );
+
+    if( (col >= drawn_rect[i].col0) && (col <= drawn_rect[i].col1) )
+      draw_sprite( cell, &attr, &drawn[i], col, row );
+  }
+
+  uint32_t changed = 0;
+  for( uint32_t line = 0; line < 8; line++ )
+  {
+    uint32_t offset = ZX_DISPLAY_ROW_OFFSET( row*8 + line ) + col;
+
+    if( screen[offset] != cell[line] )
+    {
+      screen[offset] = cell[line];
+      screen_render_mark( offset );
+      changed++;
+    }
+  }
+
+  uint32_t offset = ZX_DISPLAY_ATTR_ROW_OFFSET( row ) + col;
+  if( screen[offset] != attr )
+  {
+    screen[offset] = attr;
+    screen_render_mark( offset );
+    changed++;
+  }
+
+  return changed;
+}
+
+void compositor_render( uint8_t *screen )
+{
+  if( tiles == NULL )
+    return;
+
+  if( frame_function )
+    frame_function( compositor_stats.frames );
+
+  move_sprites();
+
+  uint32_t cells = 0, bytes = 0;
+  for( int32_t row = 0; row < ZX_DISPLAY_CHAR_ROWS; row++ )
+  {
+    for( uint32_t bits = dirty[row]; bits; bits &= bits-1 )
+    {
+      bytes += draw_cell( screen, __builtin_ctz( bits ), row );
+      cells++;
+    }
+
+    dirty[row] = 0;
+  }
+
+  compositor_stats.frames++;
+  compositor_stats.last_cells = cells;
+  compositor_stats.last_bytes = bytes;
+  compositor_stats.cells     += cells;
+}
@@ -0,0 +1,119 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __COMPOSITOR_H
+#define __COMPOSITOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "zx_display.h"
+
+/*
+ * A renderer for core 1 which draws a background of 8x8 tiles with masked
+ * sprites over it, colouring the cells the sprites are in if they're
+ * given an attribute. Only the character cells which a sprite has moved
+ * into or out of, or whose tile has changed, are drawn again each frame,
+ * and only the bytes which come out different are marked, so a screen
+ * where little moves costs little on both the CPU and the bus.
+ *
+ * Everything here is core 1's. Tiles and sprites are changed from the
+ * frame function, which is called at the start of each frame's drawing,
+ * and the changes show in that frame. The frame function can take a
+ * sprite table from the Spectrum's RAM with compositor_load_table(), so
+ * the game on the Z80 only writes a few bytes per sprite a frame.
+ */
+#define COMPOSITOR_MAX_SPRITES  64
+
+typedef struct
+{
+  uint8_t pixels[8];       /* Top row first */
+  uint8_t attr;
+} compositor_tile_t;
+
+/*
+ * A sprite's picture, cols bytes wide and rows pixel rows high. For each
+ * row, for each byte, the mask then the pixels: the screen byte becomes
+ * (screen & mask) | pixels, so the mask's set bits are the see-through
+ * ones. Drawn at any pixel position, it covers another column unless it's
+ * on a byte boundary.
+ */
+typedef struct
+{
+  uint8_t        cols;
+  uint8_t        rows;
+  const uint8_t *data;
+} compositor_graphic_t;
+
+/*
+ * Sprites are drawn in order, the highest numbered on top. They can be
+ * partly off any edge of the screen.
+ */
+typedef struct
+{
+  int16_t                     x;
+  int16_t                     y;
+  const compositor_graphic_t *graphic;   /* NULL to hide it */
+  uint8_t                     attr;
+  bool                        coloured;  /* The attr goes on the cells it's in */
+} compositor_sprite_t;
+
+/*
+ * A sprite table in the Spectrum's RAM, 4 bytes a sprite: X and Y, the
+ * pixel position less COMPOSITOR_TABLE_OFFSET so sprites can come in from
+ * the top and left edges; the graphic's number, COMPOSITOR_TABLE_HIDDEN
+ * for none; and the attribute, 0 to leave the cells' colours be.
+ */
+#define COMPOSITOR_TABLE_ENTRY   4
+#define COMPOSITOR_TABLE_OFFSET  32
+#define COMPOSITOR_TABLE_HIDDEN  0xFF
+
+typedef void (*compositor_frame_t)( uint32_t frame );
+
+/* Look at these in the debugger */
+typedef struct
+{
+  uint32_t frames;
+  uint32_t last_cells;     /* Cells drawn in the last frame */
+  uint32_t last_bytes;     /* Bytes those changed */
+  uint64_t cells;
+} compositor_stats_t;
+
+extern compositor_stats_t compositor_stats;
+
+/* The tile set, which has to stay put. Every cell starts as tile 0 */
+void compositor_init( const compositor_tile_t *tiles, compositor_frame_t frame );
+
+void compositor_set_tile( uint32_t col, uint32_t row, uint8_t tile );
+void compositor_set_sprite( uint32_t sprite, const compositor_sprite_t *state );
+
+/* Draw every cell again at the next frame, after something else has been on the screen */
+void compositor_redraw( void );
+
+/*
+ * Set sprites 0 to count-1 from a copy of a sprite table, see above. The
+ * graphics are numbered from the list given.
+ */
+void compositor_load_table( const uint8_t *table, uint32_t count,
+			    const compositor_graphic_t *const *graphics, uint32_t graphic_count );
+
+/* The renderer, see zx_dma_set_renderer() */
+void compositor_render( uint8_t *screen );
+
+#endif
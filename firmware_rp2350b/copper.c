@@ -0,0 +1,217 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The display list's checks and its place in the frame. Nothing here
+ * touches the bus, zx_dma.c does that, so it builds for the sim as is.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "zx_display.h"
+#include "bus_master.h"
+#include "copper.h"
+
+/*
+ * Setting up each action's transfer, before the bus master starts, about
+ * a microsecond
+ */
+#define COPPER_ACTION_OVERHEAD_TSTATES 4
+
+copper_stats_t copper_stats;
+
+/* The list being run, and where it's got to this frame */
+static const copper_action_t *active;
+static uint32_t               active_count;
+static uint32_t               next_action;
+
+/* The list for the next frame, picked up at /INT */
+static const copper_action_t *pending;
+static uint32_t               pending_count;
+static volatile bool          pending_set;
+
+/* RP2350 cycles at the reference clock to T-states, rounded up */
+static uint32_t cycles_to_tstates( uint32_t cycles )
+{
+  return ((cycles*7) + 299) / 300;
+}
+
+uint32_t copper_action_tstates( const copper_action_t *action )
+{
+  uint32_t byte_cycles = BUS_MASTER_CYCLES_PER_BYTE - BUS_MASTER_STROBE_CYCLES + BUS_MASTER_MAX_STROBE_CYCLES;
+
+  switch( action->op )
+  {
+  case COPPER_WRITE:
+    return COPPER_ACTION_OVERHEAD_TSTATES +
+           cycles_to_tstates( BUS_MASTER_HEADER_CYCLES + (action->length*byte_cycles) );
+
+  case COPPER_BORDER:
+    return COPPER_ACTION_OVERHEAD_TSTATES + cycles_to_tstates( BUS_MASTER_OUT_CYCLES );
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ * True if the ULA could be fetching at any time from start to end. It
+ * fetches for the first ZX_ULA_FETCH_TSTATES of each display line.
+ */
+static bool meets_ula( uint32_t start, uint32_t end )
+{
+  for( uint32_t line = ZX_TOP_BORDER_LINES; line < ZX_TOP_BORDER_LINES+ZX_DISPLAY_PIXEL_ROWS; line++ )
+  {
+    uint32_t fetch_start = line*ZX_TSTATES_PER_LINE;
+    uint32_t fetch_end   = fetch_start + ZX_ULA_FETCH_TSTATES;
+
+    if( (start < fetch_end) && (end > fetch_start) )
+      return true;
+  }
+
+  return false;
+}
+
+static copper_result_t check_action( const copper_action_t *action, uint32_t free_from )
+{
+  uint32_t end = action->tstate + copper_action_tstates( action );
+
+  switch( action->op )
+  {
+  case COPPER_WRITE:
+    if( (action->length == 0) || (action->src == NULL) || (action->zx_address < ZX_ROM_SIZE) ||
+        ((uint32_t)action->zx_address+action->length > 0x10000) )
+      return COPPER_BAD_ACTION;
+    break;
+
+  case COPPER_BORDER:
+  case COPPER_WAIT:
+    break;
+
+  default:
+    return COPPER_BAD_ACTION;
+  }
+
+  if( (action->tstate < COPPER_FIRST_TSTATE) || (end > COPPER_LAST_TSTATE) )
+    return COPPER_OUT_OF_FRAME;
+
+  if( action->tstate < free_from )
+    return COPPER_UNSORTED;
+
+  if( (action->op == COPPER_WRITE) && (action->zx_address < ZX_CONTENDED_RAM_END) &&
+      meets_ula( action->tstate - COPPER_SLACK_TSTATES, end + COPPER_SLACK_TSTATES ) )
+    return COPPER_CONTENDED;
+
+  return COPPER_OK;
+}
+
+copper_result_t copper_check( const copper_action_t *list, uint32_t count, uint32_t *bad )
+{
+  uint32_t free_from = 0;
+
+  for( uint32_t i = 0; i < count; i++ )
+  {
+    copper_result_t result = check_action( &list[i], free_from );
+
+    if( result != COPPER_OK )
+    {
+      if( bad )
+        *bad = i;
+      return result;
+    }
+
+    free_from = list[i].tstate + copper_action_tstates( &list[i] );
+  }
+
+  return COPPER_OK;
+}
+
+/* The list and count go in before the flag, the /INT handler only looks at them after */
+copper_result_t copper_set_list( const copper_action_t *list, uint32_t count )
+{
+  if( list == NULL )
+    count = 0;
+
+  copper_result_t result = copper_check( list, count, NULL );
+  if( result != COPPER_OK )
+  {
+    copper_stats.rejected++;
+    return result;
+  }
+
+  pending_set   = false;
+  pending       = list;
+  pending_count = count;
+  pending_set   = true;
+
+  return COPPER_OK;
+}
+
+void copper_frame( void )
+{
+  if( pending_set )
+  {
+    active       = pending;
+    active_count = pending_count;
+    pending_set  = false;
+  }
+
+  /* A WAIT with no group before it has nothing to hold the bus for */
+  next_action = 0;
+  while( (next_action < active_count) && (active[next_action].op == COPPER_WAIT) )
+    next_action++;
+
+  if( active_count )
+    copper_stats.frames++;
+}
+
+uint32_t copper_next_tstate( void )
+{
+  return (next_action < active_count) ? active[next_action].tstate : UINT32_MAX;
+}
+
+/*
+ * Actions go in the same group as the one before while they start less
+ * than COPPER_HOLD_TSTATES after it finishes. Giving the bus back and
+ * taking it again would take about that long. A WAIT always goes in,
+ * however long after, that's what it's for.
+ */
+uint32_t copper_next_group( const copper_action_t **group )
+{
+  if( next_action >= active_count )
+    return 0;
+
+  uint32_t first = next_action;
+  uint32_t end   = active[first].tstate + copper_action_tstates( &active[first] );
+
+  for( next_action++; next_action < active_count; next_action++ )
+  {
+    const copper_action_t *action = &active[next_action];
+
+    if( (action->op != COPPER_WAIT) && (action->tstate >= end + COPPER_HOLD_TSTATES) )
+      break;
+
+    end = action->tstate + copper_action_tstates( action );
+  }
+
+  *group = &active[first];
+  return next_action - first;
+}
@@ -0,0 +1,130 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __COPPER_H
+#define __COPPER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "zx_display.h"
+
+/*
+ * Display list, run every frame, of actions at set T-states from /INT:
+ * write some bytes, usually attributes, or OUT a colour to the border.
+ * Changing the attributes between pixel lines gives multicolour, changing
+ * the border colour every line gives raster bars, and the Z80 does none
+ * of the work.
+ *
+ * zx_dma.c runs it. The bus is taken a little before each action, or
+ * each group of actions close enough together to keep it between them,
+ * and given back after; the scheduler's windows stop short to leave it
+ * free. The timing is to the microsecond, about 3.5T, which is as well as
+ * the time of /INT is known. A WAIT action does nothing, but holds the
+ * bus up to its time as part of the group before it, however long that
+ * is. One at the start of the list is passed over.
+ *
+ * The list is checked when it's set: in time order, not overlapping, and
+ * writes to 0x4000-0x7FFF clear of the ULA's fetches, allowing for the
+ * timing being out and the longest strobe. An attribute row fits in the
+ * 96T each display line leaves the ULA not fetching, started 84T before
+ * the line.
+ *
+ * Writes go in the mirror and the shadow, the same as the scheduler's.
+ * An OUT writes all of 0xFE's bits, the speaker and MIC ones included.
+ */
+
+#define COPPER_ULA_PORT        0x00FE
+
+/* The /INT handler's own work comes first, and the bus goes back before the next */
+#define COPPER_FIRST_TSTATE    448
+#define COPPER_LAST_TSTATE     (ZX_TSTATES_PER_FRAME-224)
+
+/* How early the bus is asked for, and the gap the bus is held across */
+#define COPPER_LEAD_US         8
+#define COPPER_HOLD_TSTATES    64
+
+/*
+ * How far out an action's timing can be: the time of /INT and the wait
+ * are each to the microsecond, and T-states are rounded down to one. A
+ * contended write keeps this far from the ULA's fetches either side.
+ */
+#define COPPER_SLACK_TSTATES   12
+
+typedef enum
+{
+  COPPER_WRITE,     /* length bytes from src to zx_address */
+  COPPER_BORDER,    /* value to port 0xFE */
+  COPPER_WAIT,
+} copper_op_t;
+
+typedef struct
+{
+  uint32_t       tstate;
+  uint8_t        op;
+  uint8_t        value;
+  uint16_t       zx_address;
+  uint16_t       length;
+  const uint8_t *src;
+} copper_action_t;
+
+typedef enum
+{
+  COPPER_OK = 0,
+  COPPER_BAD_ACTION,    /* Unknown op, or a write of nothing, into the ROM or past 0xFFFF */
+  COPPER_OUT_OF_FRAME,  /* Before COPPER_FIRST_TSTATE, or not finished by COPPER_LAST_TSTATE */
+  COPPER_UNSORTED,      /* Starts before the one before has finished */
+  COPPER_CONTENDED,     /* A write which could meet the ULA fetching */
+} copper_result_t;
+
+/* Look at these in the debugger */
+typedef struct
+{
+  uint32_t frames;     /* Frames a list ran in */
+  uint32_t groups;     /* Times the bus was taken */
+  uint32_t actions;
+  uint32_t late;       /* Actions started after their time */
+  uint32_t missed;     /* Actions dropped: the bus was busy, or didn't come */
+  uint32_t rejected;   /* Lists copper_set_list() didn't take */
+} copper_stats_t;
+
+extern copper_stats_t copper_stats;
+
+/* T-states an action holds the bus for, at the longest strobe */
+uint32_t        copper_action_tstates( const copper_action_t *action );
+
+/* Check a list without setting it. *bad is the first action at fault */
+copper_result_t copper_check( const copper_action_t *list, uint32_t count, uint32_t *bad );
+
+/*
+ * Run this list, from the next /INT on, if it checks out. It isn't copied,
+ * nor is what it writes, they have to stay put. NULL or 0 for none.
+ */
+copper_result_t copper_set_list( const copper_action_t *list, uint32_t count );
+
+/* zx_dma.c's side. A new frame, the list starts again */
+void            copper_frame( void );
+
+/* The next group's first T-state, UINT32_MAX if there's nothing left this frame */
+uint32_t        copper_next_tstate( void );
+
+/* The next group, moving past it. Returns the number of actions */
+uint32_t        copper_next_group( const copper_action_t **group );
+
+#endif
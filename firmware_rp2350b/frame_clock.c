@@ -0,0 +1,131 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The frame clock's loop. Nothing here touches the hardware, the /INT
+ * handler passes the time in, so it builds for the sim as is.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "frame_clock.h"
+
+/* Times are in 1/65536ths of a microsecond, small corrections don't round away */
+#define FRAME_CLOCK_SHIFT        16
+#define US_TO_FIXED(us)          ((int64_t)(us) << FRAME_CLOCK_SHIFT)
+
+/*
+ * The loop's gains, as divisors. An early /INT moves the phase half way
+ * to it, a late one 1/128th of the way, and the period follows 1/32nd of
+ * each move. Tried against a 12us hold off and 100ppm either way, the
+ * prediction stays within about 3us.
+ */
+#define FRAME_CLOCK_EARLY_GAIN   2
+#define FRAME_CLOCK_LATE_GAIN    128
+#define FRAME_CLOCK_PERIOD_GAIN  32
+
+frame_clock_stats_t frame_clock_stats;
+
+static bool     running;
+static bool     locked;
+static uint32_t lock_count;
+static int64_t  phase;
+static int64_t  period = US_TO_FIXED( FRAME_CLOCK_PERIOD_US );
+
+static int32_t fixed_to_ns( int64_t fixed )
+{
+  return (int32_t)((fixed*1000) / US_TO_FIXED( 1 ));
+}
+
+static void unlock( void )
+{
+  if( locked )
+    frame_clock_stats.unlocks++;
+
+  locked     = false;
+  lock_count = 0;
+}
+
+uint64_t frame_clock_int( uint64_t seen_us )
+{
+  int64_t seen = US_TO_FIXED( seen_us );
+
+  frame_clock_stats.frames++;
+
+  if( !running )
+  {
+    running = true;
+    phase   = seen;
+    return seen_us;
+  }
+
+  phase += period;
+
+  int64_t error = seen - phase;
+  frame_clock_stats.error_ns = fixed_to_ns( error );
+
+  if( (error > US_TO_FIXED( FRAME_CLOCK_CAPTURE_US )) || (error < -US_TO_FIXED( FRAME_CLOCK_CAPTURE_US )) )
+  {
+    frame_clock_stats.resyncs++;
+    unlock();
+    phase = seen;
+    return seen_us;
+  }
+
+  /* What's returned is the prediction, before this frame's correction */
+  uint64_t predicted_us = (uint64_t)((phase + US_TO_FIXED( 1 )/2) >> FRAME_CLOCK_SHIFT);
+
+  if( error < -US_TO_FIXED( FRAME_CLOCK_LOCK_US ) )
+    unlock();
+  else if( !locked && (error <= US_TO_FIXED( FRAME_CLOCK_LOCK_US )) && (++lock_count == FRAME_CLOCK_LOCK_FRAMES) )
+  {
+    locked = true;
+    frame_clock_stats.locks++;
+    frame_clock_stats.error_min_ns = 0;
+    frame_clock_stats.error_max_ns = 0;
+  }
+
+  if( locked )
+  {
+    if( frame_clock_stats.error_ns < frame_clock_stats.error_min_ns )
+      frame_clock_stats.error_min_ns = frame_clock_stats.error_ns;
+    if( frame_clock_stats.error_ns > frame_clock_stats.error_max_ns )
+      frame_clock_stats.error_max_ns = frame_clock_stats.error_ns;
+  }
+
+  int64_t correction = error / ((error < 0) ? FRAME_CLOCK_EARLY_GAIN : FRAME_CLOCK_LATE_GAIN);
+
+  phase  += correction;
+  period += correction / FRAME_CLOCK_PERIOD_GAIN;
+
+  if( period > US_TO_FIXED( FRAME_CLOCK_PERIOD_US + FRAME_CLOCK_PULL_US ) )
+    period = US_TO_FIXED( FRAME_CLOCK_PERIOD_US + FRAME_CLOCK_PULL_US );
+  else if( period < US_TO_FIXED( FRAME_CLOCK_PERIOD_US - FRAME_CLOCK_PULL_US ) )
+    period = US_TO_FIXED( FRAME_CLOCK_PERIOD_US - FRAME_CLOCK_PULL_US );
+
+  frame_clock_stats.period_ns = fixed_to_ns( period - US_TO_FIXED( FRAME_CLOCK_PERIOD_US ) );
+
+  return locked ? predicted_us : seen_us;
+}
+
+bool frame_clock_locked( void )
+{
+  return locked;
+}
@@ -0,0 +1,83 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __FRAME_CLOCK_H
+#define __FRAME_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "zx_display.h"
+
+/*
+ * The frame's time, from a software phase locked loop on the timer. /INT
+ * comes every 69,888T, as steady as the Spectrum's crystal, but the time
+ * the handler reads the clock isn't: any other handler at the same
+ * priority holds it off. Fed with that time each frame, this predicts when
+ * /INT really fell, and the windows and the display list go by that.
+ *
+ * The handler can only ever be late, so a time earlier than predicted is
+ * taken nearly at its word and a later one hardly at all. The period is
+ * corrected from what the phase is, which takes up the difference between
+ * the Spectrum's crystal and the RP2350's.
+ */
+
+#define FRAME_CLOCK_PERIOD_US    ZX_TSTATES_TO_US( ZX_TSTATES_PER_FRAME )
+
+/*
+ * Locked once this many frames have been this close, or closer. Only a
+ * /INT earlier than this, or any further out than the capture range,
+ * unlocks it: a late handler isn't the clock's fault.
+ */
+#define FRAME_CLOCK_LOCK_US      4
+#define FRAME_CLOCK_LOCK_FRAMES  16
+
+/* Further out than this a /INT was missed, or the handler was, and it starts again */
+#define FRAME_CLOCK_CAPTURE_US   200
+
+/* The period stays within this of FRAME_CLOCK_PERIOD_US, about 400ppm */
+#define FRAME_CLOCK_PULL_US      8
+
+/*
+ * Errors are the time the handler saw less the prediction, in nanoseconds.
+ * The worst is since the clock last locked. Look at these in the debugger.
+ */
+typedef struct
+{
+  uint32_t frames;
+  uint32_t locks;
+  uint32_t unlocks;
+  uint32_t resyncs;      /* Outside the capture range */
+  int32_t  error_ns;
+  int32_t  error_min_ns;
+  int32_t  error_max_ns;
+  int32_t  period_ns;    /* Less FRAME_CLOCK_PERIOD_US */
+} frame_clock_stats_t;
+
+extern frame_clock_stats_t frame_clock_stats;
+
+/*
+ * A /INT, seen at seen_us. Returns when the frame started: the prediction
+ * while the clock's locked, seen_us while it isn't.
+ */
+uint64_t frame_clock_int( uint64_t seen_us );
+
+bool     frame_clock_locked( void );
+
+#endif
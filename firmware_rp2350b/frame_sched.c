@@ -0,0 +1,387 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Pending transfers, in four queues: writes and reads, each split by
+ * whether they touch the contended RAM. Each queue is taken in order; each
+ * window's transfer is some number of whole entries from the head of one
+ * queue, maybe followed by the first part of the next one. Nothing is
+ * removed until the transfer has finished, at which point the whole ones
+ * are retired and the part one is trimmed.
+ *
+ * Writes go before reads. A read sees the writes to its class of RAM
+ * queued before it, and maybe some queued after it.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bus_master.h"
+#include "frame_sched.h"
+
+typedef struct
+{
+  uint16_t            zx_address;
+  const uint8_t      *src;
+  uint8_t            *dst;
+  uint32_t            length;
+  frame_sched_done_t  done;
+  void               *context;
+} sched_entry_t;
+
+typedef struct
+{
+  sched_entry_t       entries[FRAME_SCHED_MAX_WRITES];
+  uint32_t            head;
+  uint32_t            count;
+} sched_queue_t;
+
+static sched_queue_t contended_writes;
+static sched_queue_t contended_reads;
+static sched_queue_t uncontended_writes;
+static sched_queue_t uncontended_reads;
+
+/*
+ * The order the queues are looked at in each window. The borders take
+ * the contended RAM's transfers first, they can't go anywhere else.
+ */
+static sched_queue_t *const border_order[] =
+{
+  &contended_writes, &contended_reads, &uncontended_writes, &uncontended_reads,
+};
+
+static sched_queue_t *const display_order[] =
+{
+  &uncontended_writes, &uncontended_reads, &contended_writes,
+};
+
+/* What the transfer in flight covers */
+static sched_queue_t *flight_queue = NULL;
+static uint32_t       flight_whole = 0;
+static uint32_t       flight_part  = 0;
+
+static frame_sched_written_t written_hook = NULL;
+
+static bool           clk_gated        = false;
+static uint32_t       read_budget      = FRAME_SCHED_READ_BUDGET;
+static uint32_t       read_budget_left = FRAME_SCHED_READ_BUDGET;
+
+frame_sched_stats_t   frame_sched_stats;
+
+/* Long ones can wrap round from 0xFFFF to 0x0000 */
+static bool contended( uint16_t zx_address, uint32_t length )
+{
+  uint32_t end = zx_address+length;
+
+  return ((zx_address < ZX_CONTENDED_RAM_END) && (end > ZX_CONTENDED_RAM_START)) ||
+         (end > 0x10000+ZX_CONTENDED_RAM_START);
+}
+
+static bool add( sched_queue_t *q, uint16_t zx_address, const uint8_t *src, uint8_t *dst,
+		 uint32_t length, frame_sched_done_t done, void *context )
+{
+  if( (length == 0) || (length > 0x10000) )
+    return false;
+
+  if( q->count == FRAME_SCHED_MAX_WRITES )
+  {
+    frame_sched_stats.queue_full++;
+    return false;
+  }
+
+  sched_entry_t *e = &q->entries[(q->head+q->count) % FRAME_SCHED_MAX_WRITES];
+  e->zx_address = zx_address;
+  e->src        = src;
+  e->dst        = dst;
+  e->length     = length;
+  e->done       = done;
+  e->context    = context;
+  q->count++;
+
+  return true;
+}
+
+bool frame_sched_add( uint16_t zx_address, const uint8_t *src, uint32_t length,
+		      frame_sched_done_t done, void *context )
+{
+  sched_queue_t *q = contended( zx_address, length ) ? &contended_writes : &uncontended_writes;
+
+  return add( q, zx_address, src, NULL, length, done, context );
+}
+
+bool frame_sched_add_read( uint16_t zx_address, uint8_t *dst, uint32_t length,
+			   frame_sched_done_t done, void *context )
+{
+  sched_queue_t *q = contended( zx_address, length ) ? &contended_reads : &uncontended_reads;
+
+  return add( q, zx_address, NULL, dst, length, done, context );
+}
+
+uint32_t frame_sched_space( void )
+{
+  uint32_t used = contended_writes.count;
+  if( uncontended_writes.count > used )
+    used = uncontended_writes.count;
+
+  return FRAME_SCHED_MAX_WRITES-used;
+}
+
+bool frame_sched_pending( void )
+{
+  return contended_writes.count || contended_reads.count ||
+         uncontended_writes.count || uncontended_reads.count;
+}
+
+static bool is_read_queue( const sched_queue_t *q )
+{
+  return (q == &contended_reads) || (q == &uncontended_reads);
+}
+
+/* The first queue with something which can go in this window, or NULL */
+static sched_queue_t *next_queue( frame_sched_window_t window )
+{
+  sched_queue_t *const *order = border_order;
+  uint32_t              n     = sizeof(border_order)/sizeof(border_order[0]);
+
+  if( window == FRAME_SCHED_DISPLAY )
+  {
+    order = display_order;
+    n     = sizeof(display_order)/sizeof(display_order[0]);
+
+    /* The contended writes only go during the display lines CLK gated */
+    if( !clk_gated )
+      n--;
+  }
+
+  for( uint32_t i = 0; i < n; i++ )
+  {
+    if( order[i]->count == 0 )
+      continue;
+
+    if( is_read_queue( order[i] ) && (read_budget_left == 0) )
+      continue;
+
+    return order[i];
+  }
+
+  return NULL;
+}
+
+bool frame_sched_has_work( frame_sched_window_t window )
+{
+  return next_queue( window ) != NULL;
+}
+
+void frame_sched_set_clk_gated( bool gated )
+{
+  clk_gated = gated;
+}
+
+void frame_sched_set_written( frame_sched_written_t written )
+{
+  written_hook = written;
+}
+
+void frame_sched_new_frame( void )
+{
+  read_budget_left = read_budget;
+  frame_sched_stats.frames++;
+}
+
+void frame_sched_set_read_budget( uint32_t bytes_per_frame )
+{
+  read_budget = bytes_per_frame;
+}
+
+uint32_t frame_sched_read_frames( uint32_t bytes )
+{
+  return read_budget ? (bytes+read_budget-1)/read_budget : 0;
+}
+
+uint32_t frame_sched_fill( uint32_t budget_cycles, frame_sched_window_t window )
+{
+  uint32_t bytes = 0;
+
+  bus_master_clear_runs();
+  flight_queue = NULL;
+  flight_whole = 0;
+  flight_part  = 0;
+
+  sched_queue_t *q = next_queue( window );
+  if( q == NULL )
+    return 0;
+
+  bool     reading       = is_read_queue( q );
+  bool     gated         = (window == FRAME_SCHED_DISPLAY) && (q == &contended_writes);
+  uint32_t header_cycles = BUS_MASTER_HEADER_CYCLES;
+  uint32_t byte_cycles   = bus_master_cycles_per_byte();
+  uint32_t limit         = UINT32_MAX;
+
+  if( reading )
+  {
+    header_cycles = BUS_MASTER_READ_HEADER_CYCLES;
+    byte_cycles   = BUS_MASTER_READ_CYCLES_PER_BYTE;
+    limit         = read_budget_left;
+  }
+  else if( gated )
+  {
+    byte_cycles = BUS_MASTER_CLK_GATED_CYCLES_PER_BYTE;
+  }
+
+  bus_master_set_clk_gated( gated );
+
+  for( uint32_t i = 0; i < q->count; i++ )
+  {
+    sched_entry_t *e = &q->entries[(q->head+i) % FRAME_SCHED_MAX_WRITES];
+
+    if( budget_cycles < header_cycles+byte_cycles )
+      break;
+
+    uint32_t fits = (budget_cycles-header_cycles) / byte_cycles;
+    if( fits > limit-bytes )
+      fits = limit-bytes;
+    if( fits == 0 )
+      break;
+
+    uint32_t length = (e->length < fits) ? e->length : fits;
+
+    bool added = reading ? bus_master_add_read( e->zx_address, e->dst, length ) :
+                           bus_master_add_run( e->zx_address, e->src, length );
+    if( !added )
+      break;
+
+    budget_cycles -= header_cycles + (length*byte_cycles);
+    bytes         += length;
+
+    if( length < e->length )
+    {
+      flight_part = length;
+      frame_sched_stats.split++;
+      break;
+    }
+
+    flight_whole++;
+  }
+
+  if( bytes )
+  {
+    flight_queue = q;
+
+    frame_sched_stats.windows++;
+    if( window == FRAME_SCHED_TOP )
+      frame_sched_stats.top_windows++;
+    else if( window == FRAME_SCHED_DISPLAY )
+      frame_sched_stats.display_windows++;
+    else
+      frame_sched_stats.lower_windows++;
+
+    if( reading )
+    {
+      read_budget_left             -= bytes;
+      frame_sched_stats.bytes_read += bytes;
+    }
+    else
+    {
+      frame_sched_stats.bytes += bytes;
+    }
+
+    if( (q == &uncontended_writes) || (q == &uncontended_reads) )
+      frame_sched_stats.bytes_uncontended += bytes;
+
+    frame_sched_stats.last_window_bytes = bytes;
+  }
+
+  return bytes;
+}
+
+/* What the done functions queue stays queued */
+static uint32_t cancel( sched_queue_t *q )
+{
+  uint32_t dropped = q->count;
+
+  for( uint32_t i = 0; i < dropped; i++ )
+  {
+    sched_entry_t e = q->entries[q->head];
+
+    q->head = (q->head+1) % FRAME_SCHED_MAX_WRITES;
+    q->count--;
+
+    if( e.done )
+      e.done( e.context );
+  }
+
+  return dropped;
+}
+
+/* The done functions are called as if the transfers had been made */
+uint32_t frame_sched_cancel( void )
+{
+  return cancel( &contended_writes ) + cancel( &contended_reads ) +
+         cancel( &uncontended_writes ) + cancel( &uncontended_reads );
+}
+
+/*
+ * Called from the bus master's completion, in the DMA IRQ. The done
+ * functions can queue more.
+ */
+void frame_sched_retire( void )
+{
+  sched_queue_t *q     = flight_queue;
+  uint32_t       whole = flight_whole;
+  uint32_t       part  = flight_part;
+
+  flight_queue = NULL;
+  flight_whole = 0;
+  flight_part  = 0;
+
+  if( q == NULL )
+    return;
+
+  bool wrote = !is_read_queue( q ) && (written_hook != NULL);
+
+  while( whole-- )
+  {
+    sched_entry_t e = q->entries[q->head];
+
+    if( wrote )
+      written_hook( e.zx_address, e.src, e.length );
+
+    q->head = (q->head+1) % FRAME_SCHED_MAX_WRITES;
+    q->count--;
+
+    if( e.done )
+      e.done( e.context );
+  }
+
+  if( part )
+  {
+    sched_entry_t *e = &q->entries[q->head];
+
+    if( wrote )
+      written_hook( e->zx_address, e->src, part );
+
+    e->zx_address += part;
+    e->length     -= part;
+    if( e->dst )
+      e->dst += part;
+    else
+      e->src += part;
+  }
+}
@@ -0,0 +1,167 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __FRAME_SCHED_H
+#define __FRAME_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "zx_display.h"
+
+/*
+ * Queue of pending writes to the Spectrum, and reads from it, and the
+ * planning of which of them go in each of the frame's safe windows.
+ *
+ * There are two windows where the ULA isn't contending 0x4000-0x7FFF: the
+ * top border, from /INT, and the lower border, which runs up to the next
+ * /INT. The bus has to be given back before /INT or the Z80 misses the
+ * interrupt, so they're separate windows, each ending a guard time early.
+ * A write which doesn't fit in what's left of a window is split, the rest
+ * going in the next one.
+ *
+ * The third window is between them, over the display lines. Transfers
+ * which don't touch 0x4000-0x7FFF go there at full speed, the ULA never
+ * gets in their way; the borders are kept for the contended RAM first and
+ * only take the others when there's time left. Optionally the contended
+ * writes go in the display window too, with the bus master in CLK gated
+ * mode so it only writes when the ULA lets it. That's slower, and the Z80
+ * is held off the bus for most of the frame, so it's only worth it for a
+ * lot of data.
+ *
+ * Reads follow the same rules, except that there's no CLK gated read so
+ * contended ones don't go in the display window. A transfer is all reads
+ * or all writes, and writes go first. Reads are limited to a budget of
+ * bytes per frame, so a long one, like a capture of the whole 48K, leaves
+ * the Z80 some time and takes a known number of frames. The budget should
+ * be less than the windows can take with the screen's writes, or it'll
+ * take longer.
+ *
+ * The queue is only touched from core 0's IRQ handlers, which are all the
+ * same priority.
+ */
+
+#define FRAME_SCHED_MAX_WRITES        128
+
+/* Default read budget, 48K in 6 frames */
+#define FRAME_SCHED_READ_BUDGET       8192
+
+/* Window edges, microseconds from /INT */
+#define FRAME_SCHED_TOP_END_US        (ZX_TSTATES_TO_US( ZX_TOP_BORDER_TSTATES ) - FRAME_SCHED_GUARD_US)
+#define FRAME_SCHED_DISPLAY_START_US  ZX_TSTATES_TO_US( ZX_TOP_BORDER_TSTATES )
+#define FRAME_SCHED_DISPLAY_END_US    (ZX_TSTATES_TO_US( ZX_LOWER_BORDER_START_TSTATES ) - FRAME_SCHED_GUARD_US)
+#define FRAME_SCHED_LOWER_START_US    ZX_TSTATES_TO_US( ZX_LOWER_BORDER_START_TSTATES )
+#define FRAME_SCHED_LOWER_END_US      (ZX_TSTATES_TO_US( ZX_TSTATES_PER_FRAME ) - FRAME_SCHED_GUARD_US)
+
+/*
+ * Time kept back at the end of each window for starting and finishing the
+ * transfer, giving the bus back, and timer jitter
+ */
+#define FRAME_SCHED_GUARD_US          20
+
+typedef enum
+{
+  FRAME_SCHED_TOP,
+  FRAME_SCHED_DISPLAY,  /* Uncontended, and contended CLK gated */
+  FRAME_SCHED_LOWER,
+} frame_sched_window_t;
+
+typedef void (*frame_sched_done_t)( void *context );
+
+/* Told what each write put in the Spectrum's RAM, once it's been written */
+typedef void (*frame_sched_written_t)( uint16_t zx_address, const uint8_t *src, uint32_t length );
+
+/*
+ * "windows" counts the windows which had something to send, "split" the
+ * writes which didn't fit and carried on in a later one. Look at these in
+ * the debugger.
+ */
+typedef struct
+{
+  uint32_t windows;
+  uint32_t top_windows;
+  uint32_t display_windows;
+  uint32_t lower_windows;
+  uint32_t split;
+  uint64_t bytes;
+  uint64_t bytes_read;
+  uint64_t bytes_uncontended;
+  uint32_t last_window_bytes;
+  uint32_t queue_full;
+  uint32_t frames;
+} frame_sched_stats_t;
+
+extern frame_sched_stats_t frame_sched_stats;
+
+/*
+ * Queue a write. The source isn't copied, it has to stay put until the
+ * done function is called. Returns false if the queue is full.
+ */
+bool     frame_sched_add( uint16_t zx_address, const uint8_t *src, uint32_t length,
+			  frame_sched_done_t done, void *context );
+
+/*
+ * Queue a read into dst, which has to stay put until the done function is
+ * called. Returns false if the queue is full.
+ */
+bool     frame_sched_add_read( uint16_t zx_address, uint8_t *dst, uint32_t length,
+			       frame_sched_done_t done, void *context );
+
+bool     frame_sched_pending( void );
+
+/* How many more writes can be queued, whatever their addresses */
+uint32_t frame_sched_space( void );
+
+/* True if there's anything that can go in this window */
+bool     frame_sched_has_work( frame_sched_window_t window );
+
+/* Let contended writes go in the display window, CLK gated */
+void     frame_sched_set_clk_gated( bool gated );
+
+/*
+ * Set a function to be told about the writes as they're retired, before
+ * their done functions are called. NULL for none.
+ */
+void     frame_sched_set_written( frame_sched_written_t written );
+
+/* /INT has fallen, the read budget starts again */
+void     frame_sched_new_frame( void );
+
+void     frame_sched_set_read_budget( uint32_t bytes_per_frame );
+
+/* How many frames a read of this many bytes takes, at most, with the windows free */
+uint32_t frame_sched_read_frames( uint32_t bytes );
+
+/*
+ * Fill the bus master's run list with as much of the queue as fits in the
+ * given number of bus master cycles, and set its mode for the window.
+ * Returns the number of bytes.
+ */
+uint32_t frame_sched_fill( uint32_t budget_cycles, frame_sched_window_t window );
+
+/* The transfer frame_sched_fill() planned has finished */
+void     frame_sched_retire( void );
+
+/*
+ * Drop everything queued, calling the done functions. Not while a
+ * transfer is in flight. Returns how many were dropped.
+ */
+uint32_t frame_sched_cancel( void );
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Frame trace. The record at the ring's head is the frame in progress; it
+ * joins the ring when the next /INT comes along.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bus_hal.h"
+#include "frame_trace.h"
+
+static frame_trace_t ring[FRAME_TRACE_FRAMES];
+static uint32_t      head;
+static uint32_t      count;
+static uint16_t      frame;
+static uint32_t      cycles_hz;
+
+static volatile bool holding = false;
+static bool          started = false;
+
+/* When BUSREQ and the transfer in flight started */
+static uint32_t      busreq_at;
+static uint32_t      transfer_at;
+
+void frame_trace_init( uint32_t hz )
+{
+  cycles_hz = hz;
+  head      = 0;
+  count     = 0;
+  frame     = 0;
+  started   = false;
+}
+
+void frame_trace_frame_start( void )
+{
+  uint32_t now = bus_hal_cycles();
+
+  /* While the trace is being sent the frame in progress is started again */
+  if( started && !holding )
+  {
+    head = (head+1) % FRAME_TRACE_FRAMES;
+    if( count < FRAME_TRACE_FRAMES-1 )
+      count++;
+  }
+  started = true;
+
+  frame_trace_t *t = &ring[head];
+  t->int_cycles      = now;
+  t->transfer_cycles = 0;
+  t->bytes           = 0;
+  t->frame           = frame++;
+  t->busreq_cycles   = 0xFFFF;
+  t->busack_cycles   = 0;
+  t->windows         = 0;
+  t->flags           = 0;
+}
+
+void frame_trace_flag( uint8_t flag )
+{
+  ring[head].flags |= flag;
+}
+
+static uint16_t saturate( uint32_t cycles )
+{
+  return (cycles > 0xFFFE) ? 0xFFFE : cycles;
+}
+
+void frame_trace_busreq( void )
+{
+  frame_trace_t *t = &ring[head];
+
+  busreq_at = bus_hal_cycles();
+
+  if( t->busreq_cycles == 0xFFFF )
+    t->busreq_cycles = saturate( busreq_at - t->int_cycles );
+}
+
+void frame_trace_busack( void )
+{
+  frame_trace_t *t    = &ring[head];
+  uint16_t       wait = saturate( bus_hal_cycles() - busreq_at );
+
+  if( wait > t->busack_cycles )
+    t->busack_cycles = wait;
+}
+
+void frame_trace_transfer_start( uint32_t bytes )
+{
+  frame_trace_t *t = &ring[head];
+
+  transfer_at = bus_hal_cycles();
+  t->bytes += bytes;
+  if( t->windows < 0xFF )
+    t->windows++;
+}
+
+/*
+ * A transfer started late in a frame can finish in the next one, it's
+ * counted in the frame it finishes in
+ */
+void frame_trace_transfer_end( bool overrun )
+{
+  frame_trace_t *t = &ring[head];
+
+  t->transfer_cycles += bus_hal_cycles() - transfer_at;
+  if( overrun )
+    t->flags |= FRAME_TRACE_OVERRUN;
+}
+
+void frame_trace_send( frame_trace_put_t put )
+{
+  holding = true;
+
+  frame_trace_header_t header =
+  {
+    .magic       = FRAME_TRACE_MAGIC,
+    .version     = FRAME_TRACE_VERSION,
+    .record_size = sizeof(frame_trace_t),
+    .records     = count,
+    .cycles_hz   = cycles_hz,
+  };
+  put( &header, sizeof(header) );
+
+  /* The frame in progress isn't sent, the oldest is the one after the head */
+  uint32_t oldest = (head+FRAME_TRACE_FRAMES-count) % FRAME_TRACE_FRAMES;
+  for( uint32_t i = 0; i < count; i++ )
+    put( &ring[(oldest+i) % FRAME_TRACE_FRAMES], sizeof(frame_trace_t) );
+
+  holding = false;
+}
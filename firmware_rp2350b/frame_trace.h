@@ -0,0 +1,94 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __FRAME_TRACE_H
+#define __FRAME_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A record of each frame's timings, kept in a ring in SRAM, so they can be
+ * looked at without a scope on the blippers. The last FRAME_TRACE_FRAMES-1
+ * frames are kept, which is about 10 seconds' worth.
+ *
+ * Times are in cycles of bus_hal_cycles(), the CPU clock on the board.
+ * The calls are made from the /INT, timer and DMA IRQ handlers and are
+ * just a few loads and stores each.
+ */
+#define FRAME_TRACE_FRAMES 512
+
+/* Sent over the USB serial port to ask for the trace */
+#define FRAME_TRACE_REQUEST 'T'
+
+/*
+ * The trace as it's sent: this header, then the records oldest first, all
+ * little endian. sim/trace_decode.c reads it.
+ */
+#define FRAME_TRACE_MAGIC   0x5254585A  /* "ZXTR" */
+#define FRAME_TRACE_VERSION 1
+
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;
+  uint8_t  version;
+  uint8_t  record_size;
+  uint16_t records;
+  uint32_t cycles_hz;
+} frame_trace_header_t;
+
+/* Frame flags */
+#define FRAME_TRACE_BUSY       0x01  /* Last frame's transfer was still going at /INT */
+#define FRAME_TRACE_CALIBRATED 0x02  /* The strobe was calibrated this frame */
+#define FRAME_TRACE_OVERRUN    0x04  /* A transfer finished after the end of its window */
+#define FRAME_TRACE_TIMEOUT    0x08  /* BUSACK didn't come, a window was given up */
+#define FRAME_TRACE_RESET      0x10  /* The Spectrum was in reset, or just out of it */
+
+typedef struct __attribute__((packed))
+{
+  uint32_t int_cycles;       /* When the /INT handler was entered */
+  uint32_t transfer_cycles;  /* All of the frame's transfers, from start to DMA IRQ */
+  uint32_t bytes;            /* Written and read */
+  uint16_t frame;
+  uint16_t busreq_cycles;    /* From the /INT handler to BUSREQ, 0xFFFF if there wasn't one */
+  uint16_t busack_cycles;    /* Longest wait from BUSREQ to BUSACK */
+  uint8_t  windows;          /* Transfers made */
+  uint8_t  flags;
+} frame_trace_t;
+
+void frame_trace_init( uint32_t cycles_hz );
+
+/* Called as the /INT handler starts, finishes the last frame's record */
+void frame_trace_frame_start( void );
+void frame_trace_flag( uint8_t flag );
+
+void frame_trace_busreq( void );
+void frame_trace_busack( void );
+void frame_trace_transfer_start( uint32_t bytes );
+void frame_trace_transfer_end( bool overrun );
+
+/*
+ * Send the trace through the given function. Recording stops while it's
+ * being sent, so what's sent is consistent.
+ */
+typedef void (*frame_trace_put_t)( const void *data, uint32_t length );
+
+void frame_trace_send( frame_trace_put_t put );
+
+#endif
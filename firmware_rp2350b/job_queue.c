@@ -0,0 +1,121 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Job queues. head and tail count up forever, the slot is the count modulo
+ * the ring size. The producer fills the slot before it publishes the new
+ * head, the consumer takes the descriptor before it publishes the tail.
+ *
+ * The parts of a job can land in different scheduler queues, which go at
+ * different times, so the first descriptor counts the parts outstanding
+ * and the job is done when that gets to 0.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "frame_sched.h"
+#include "job_queue.h"
+
+job_queue_stats_t job_queue_stats;
+
+static job_queue_t *queues[JOB_QUEUE_MAX];
+static uint32_t     num_queues = 0;
+
+bool job_queue_register( job_queue_t *q )
+{
+  if( num_queues == JOB_QUEUE_MAX )
+    return false;
+
+  atomic_store_explicit( &q->head, 0, memory_order_relaxed );
+  atomic_store_explicit( &q->tail, 0, memory_order_relaxed );
+  q->full = 0;
+  queues[num_queues++] = q;
+
+  return true;
+}
+
+bool job_queue_submit( job_queue_t *q, job_desc_t *job )
+{
+  uint32_t head = atomic_load_explicit( &q->head, memory_order_relaxed );
+  uint32_t tail = atomic_load_explicit( &q->tail, memory_order_acquire );
+
+  if( head-tail == JOB_QUEUE_SLOTS )
+  {
+    q->full++;
+    return false;
+  }
+
+  q->slots[head % JOB_QUEUE_SLOTS] = job;
+  atomic_store_explicit( &q->head, head+1, memory_order_release );
+
+  return true;
+}
+
+static void part_done( void *context )
+{
+  job_desc_t *job = context;
+
+  if( --job->outstanding == 0 )
+  {
+    job_queue_stats.done++;
+    if( job->done )
+      job->done( job->context );
+  }
+}
+
+void job_queue_drain( void )
+{
+  for( uint32_t i = 0; i < num_queues; i++ )
+  {
+    job_queue_t *q    = queues[i];
+    uint32_t     tail = atomic_load_explicit( &q->tail, memory_order_relaxed );
+    uint32_t     head = atomic_load_explicit( &q->head, memory_order_acquire );
+
+    while( tail != head )
+    {
+      job_desc_t *job = q->slots[tail % JOB_QUEUE_SLOTS];
+
+      /* The whole job goes in or none of it, the scheduler can't take half back */
+      uint32_t parts = 0;
+      for( job_desc_t *d = job; d; d = d->next )
+	parts++;
+
+      if( parts > frame_sched_space() )
+	break;
+
+      job->outstanding = parts;
+      for( job_desc_t *d = job; d; d = d->next )
+      {
+	if( !frame_sched_add( d->zx_address, d->src, d->length, part_done, job ) )
+	{
+	  /* Nothing to write, or more than 64K */
+	  job_queue_stats.bad_parts++;
+	  part_done( job );
+	}
+      }
+
+      tail++;
+      atomic_store_explicit( &q->tail, tail, memory_order_release );
+      job_queue_stats.scheduled++;
+    }
+  }
+}
@@ -0,0 +1,99 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __JOB_QUEUE_H
+#define __JOB_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "frame_sched.h"
+
+/*
+ * Jobs for the bus master from code outside core 0's IRQ handlers, core 1
+ * included. A job is a chain of descriptors, each a source buffer and
+ * where it goes in the Spectrum, so one job can scatter to several places.
+ *
+ * Each producer has its own queue, a single producer, single consumer
+ * ring with no locks. The consumer is core 0, which moves the jobs to
+ * frame_sched.c at /INT and every ZX_DMA_SNOOP_DRAIN_US, so lots of small
+ * ones go in the same BUSREQ window.
+ *
+ * The descriptors and the buffers they point to are the producer's, and
+ * have to stay put until the job's done function is called. That's called
+ * from core 0's DMA IRQ when the last part has been written.
+ */
+#define JOB_QUEUE_SLOTS  32   /* Power of 2 */
+#define JOB_QUEUE_MAX    4    /* Queues which can be registered */
+
+typedef struct job_desc job_desc_t;
+
+struct job_desc
+{
+  uint16_t            zx_address;
+  const uint8_t      *src;
+  uint32_t            length;
+  job_desc_t         *next;          /* More of the same job, or NULL */
+
+  /* Only looked at in the first descriptor of the chain */
+  frame_sched_done_t  done;
+  void               *context;
+
+  /* The job queue's */
+  uint32_t            outstanding;
+};
+
+typedef struct
+{
+  job_desc_t         *slots[JOB_QUEUE_SLOTS];
+  atomic_uint         head;          /* Written by the producer */
+  atomic_uint         tail;          /* Written by the consumer */
+  uint32_t            full;          /* Submits refused, the ring was full */
+} job_queue_t;
+
+/* Core 0's side. Look at these in the debugger */
+typedef struct
+{
+  uint32_t scheduled;     /* Jobs moved to the scheduler */
+  uint32_t done;
+  uint32_t bad_parts;     /* Descriptors the scheduler wouldn't take, skipped */
+} job_queue_stats_t;
+
+extern job_queue_stats_t job_queue_stats;
+
+/*
+ * Set up a queue and add it to the ones core 0 drains. Call it on core 0
+ * before the producer starts. False if there's no room.
+ */
+bool     job_queue_register( job_queue_t *q );
+
+/*
+ * Producer side. Returns false if the ring is full, in which case the
+ * job is still the caller's.
+ */
+bool     job_queue_submit( job_queue_t *q, job_desc_t *job );
+
+/*
+ * Consumer side, core 0's IRQ handlers. Moves as many whole jobs to the
+ * scheduler as it has room for.
+ */
+void     job_queue_drain( void );
+
+#endif
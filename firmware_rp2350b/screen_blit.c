@@ -0,0 +1,432 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Display file kernels.
+ *
+ * Everything works a pixel row at a time. A row is 32 bytes which always
+ * start on a 32 byte boundary, so a row is exactly one word of the dirty
+ * map, and the rows can be visited in any order using
+ * ZX_DISPLAY_ROW_OFFSET().
+ *
+ * Horizontal pixel scrolls treat a row as one 256 bit number, held in
+ * native words (32 bit on the RP2350, 64 bit on the host) with the bytes
+ * swapped so the leftmost pixel is the most significant bit. A scroll is
+ * then a multi-word shift. Whole screen width scrolls of less than a word
+ * have their own loop, that's the common case.
+ *
+ * Changes are marked in the render map in groups of 4 bytes where the row
+ * is handled as words. Marking exact bytes costs more on the CPU than the
+ * odd extra byte costs on the bus. Both CPUs are little endian.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "zx_display.h"
+#include "screen_dirty.h"
+#include "screen_blit.h"
+
+#if UINTPTR_MAX > 0xFFFFFFFFu
+typedef uint64_t word_t;
+#define WORD_SWAP(w) __builtin_bswap64(w)
+#else
+typedef uint32_t word_t;
+#define WORD_SWAP(w) __builtin_bswap32(w)
+#endif
+
+#define WORD_BITS  (sizeof(word_t)*8)
+#define ROW_WORDS  (ZX_DISPLAY_COLUMNS/sizeof(word_t))
+
+const screen_rect_t screen_whole       = { 0, ZX_DISPLAY_COLUMNS, 0, ZX_DISPLAY_PIXEL_ROWS };
+const screen_rect_t screen_whole_attrs = { 0, ZX_DISPLAY_COLUMNS, 0, ZX_DISPLAY_CHAR_ROWS  };
+
+/* Rows which wrap round in a vertical scroll. Core 1 only, not reentrant */
+static uint8_t saved_rows[ZX_DISPLAY_PIXEL_ROWS][ZX_DISPLAY_COLUMNS];
+
+static inline uint32_t row_offset( bool attrs, uint32_t row )
+{
+  return attrs ? ZX_DISPLAY_ATTR_ROW_OFFSET( row ) : ZX_DISPLAY_ROW_OFFSET( row );
+}
+
+/* Render map bits for each 4 byte group of a word which differs */
+static inline uint32_t group_mask( word_t diff )
+{
+  uint32_t mask = 0;
+  for( uint32_t g = 0; g < sizeof(word_t)/4; g++ )
+  {
+    if( (uint32_t)(diff >> (32*g)) )
+      mask |= 0xFu << (4*g);
+  }
+  return mask;
+}
+
+/*
+ * Write len bytes from src over the display file at offset, which is all
+ * within one row, marking what changes. src mustn't overlap the
+ * destination.
+ */
+static void store_marked( uint8_t *screen, uint32_t offset, const uint8_t *src, uint32_t len )
+{
+  uint8_t  *dst     = screen+offset;
+  uint32_t  changed = 0;
+  uint32_t  bit     = offset & 31;
+
+  if( ((offset | len) & 3) == 0 )
+  {
+    for( uint32_t i = 0; i < len; i += 4 )
+    {
+      uint32_t old, new;
+      memcpy( &old, dst+i, 4 );
+      memcpy( &new, src+i, 4 );
+      if( old != new )
+      {
+	memcpy( dst+i, &new, 4 );
+	changed |= 0xFu << (bit+i);
+      }
+    }
+  }
+  else
+  {
+    for( uint32_t i = 0; i < len; i++ )
+    {
+      if( dst[i] != src[i] )
+      {
+	dst[i] = src[i];
+	changed |= 1u << (bit+i);
+      }
+    }
+  }
+
+  screen_render_map[offset >> 5] |= changed;
+}
+
+/*
+ * Whole width scroll of fewer pixels than a word has bits, the fast path
+ */
+static void scroll_rows_fast( uint8_t *screen, const screen_rect_t *rect, uint32_t n, bool wrap, bool left )
+{
+  for( uint32_t y = rect->row; y < rect->row+rect->rows; y++ )
+  {
+    uint32_t offset = ZX_DISPLAY_ROW_OFFSET( y );
+    uint8_t *p      = screen+offset;
+    word_t   old[ROW_WORDS], w[ROW_WORDS];
+
+    memcpy( old, p, sizeof(old) );
+    for( uint32_t i = 0; i < ROW_WORDS; i++ )
+      w[i] = WORD_SWAP( old[i] );
+
+    if( left )
+    {
+      word_t carry = wrap ? (w[0] >> (WORD_BITS-n)) : 0;
+      for( uint32_t i = 0; i < ROW_WORDS-1; i++ )
+	w[i] = (w[i] << n) | (w[i+1] >> (WORD_BITS-n));
+      w[ROW_WORDS-1] = (w[ROW_WORDS-1] << n) | carry;
+    }
+    else
+    {
+      word_t carry = wrap ? (w[ROW_WORDS-1] << (WORD_BITS-n)) : 0;
+      for( uint32_t i = ROW_WORDS-1; i > 0; i-- )
+	w[i] = (w[i] >> n) | (w[i-1] << (WORD_BITS-n));
+      w[0] = (w[0] >> n) | carry;
+    }
+
+    uint32_t changed = 0;
+    for( uint32_t i = 0; i < ROW_WORDS; i++ )
+    {
+      w[i] = WORD_SWAP( w[i] );
+      changed |= group_mask( w[i] ^ old[i] ) << (i*sizeof(word_t));
+    }
+
+    memcpy( p, w, sizeof(w) );
+    screen_render_map[offset >> 5] |= changed;
+  }
+}
+
+/* Multi-word shifts of a row held most significant word first */
+static void row_shl( word_t *out, const word_t *in, uint32_t n )
+{
+  uint32_t words = n / WORD_BITS;
+  uint32_t bits  = n % WORD_BITS;
+
+  for( uint32_t i = 0; i < ROW_WORDS; i++ )
+  {
+    word_t hi = (i+words   < ROW_WORDS) ? in[i+words]   : 0;
+    word_t lo = (i+words+1 < ROW_WORDS) ? in[i+words+1] : 0;
+    out[i] = bits ? ((hi << bits) | (lo >> (WORD_BITS-bits))) : hi;
+  }
+}
+
+static void row_shr( word_t *out, const word_t *in, uint32_t n )
+{
+  uint32_t words = n / WORD_BITS;
+  uint32_t bits  = n % WORD_BITS;
+
+  for( uint32_t i = 0; i < ROW_WORDS; i++ )
+  {
+    word_t lo = (i >= words)   ? in[i-words]   : 0;
+    word_t hi = (i >= words+1) ? in[i-words-1] : 0;
+    out[i] = bits ? ((lo >> bits) | (hi << (WORD_BITS-bits))) : lo;
+  }
+}
+
+/*
+ * Any other horizontal scroll. The window's bytes are copied to the left
+ * of a zeroed row, shifted there, and copied back.
+ */
+static void scroll_rows_generic( uint8_t *screen, const screen_rect_t *rect, uint32_t n, bool wrap, bool left )
+{
+  uint32_t width = rect->cols*8;
+
+  for( uint32_t y = rect->row; y < rect->row+rect->rows; y++ )
+  {
+    uint32_t offset = ZX_DISPLAY_ROW_OFFSET( y ) + rect->col;
+    word_t   in[ROW_WORDS], out[ROW_WORDS], wrapped[ROW_WORDS];
+    uint8_t  bytes[ZX_DISPLAY_COLUMNS] = { 0 };
+
+    memcpy( bytes, screen+offset, rect->cols );
+    memcpy( in, bytes, sizeof(in) );
+    for( uint32_t i = 0; i < ROW_WORDS; i++ )
+      in[i] = WORD_SWAP( in[i] );
+
+    if( left )
+    {
+      row_shl( out, in, n );
+      if( wrap )
+	row_shr( wrapped, in, width-n );
+    }
+    else
+    {
+      row_shr( out, in, n );
+      if( wrap )
+	row_shl( wrapped, in, width-n );
+    }
+
+    /* Anything which landed beyond the window is dropped on the copy back */
+    for( uint32_t i = 0; i < ROW_WORDS; i++ )
+      out[i] = WORD_SWAP( wrap ? (out[i] | wrapped[i]) : out[i] );
+
+    memcpy( bytes, out, sizeof(out) );
+    store_marked( screen, offset, bytes, rect->cols );
+  }
+}
+
+static void scroll_horizontal( uint8_t *screen, const screen_rect_t *rect, uint32_t n, bool wrap, bool left )
+{
+  uint32_t width = rect->cols*8;
+
+  if( (width == 0) || (rect->rows == 0) )
+    return;
+
+  if( wrap )
+    n %= width;
+
+  if( n == 0 )
+    return;
+
+  if( n >= width )
+  {
+    screen_fill( screen, rect, 0 );
+    return;
+  }
+
+  if( (rect->cols == ZX_DISPLAY_COLUMNS) && (n < WORD_BITS) )
+    scroll_rows_fast( screen, rect, n, wrap, left );
+  else
+    scroll_rows_generic( screen, rect, n, wrap, left );
+}
+
+void screen_scroll_left( uint8_t *screen, const screen_rect_t *rect, uint32_t pixels, bool wrap )
+{
+  scroll_horizontal( screen, rect, pixels, wrap, true );
+}
+
+void screen_scroll_right( uint8_t *screen, const screen_rect_t *rect, uint32_t pixels, bool wrap )
+{
+  scroll_horizontal( screen, rect, pixels, wrap, false );
+}
+
+/*
+ * Vertical scrolls, pixel rows or attribute rows. Rows are copied whole
+ * from one to the other in the order which doesn't overwrite a row before
+ * it's been read. The ones which wrap round are put aside first.
+ */
+static void scroll_vertical( uint8_t *screen, const screen_rect_t *rect, uint32_t n, bool wrap,
+			     bool up, bool attrs, uint8_t fill )
+{
+  uint32_t h = rect->rows;
+
+  if( (h == 0) || (rect->cols == 0) )
+    return;
+
+  if( wrap )
+    n %= h;
+
+  if( n == 0 )
+    return;
+
+  if( n > h )
+    n = h;
+
+  uint8_t blank[ZX_DISPLAY_COLUMNS];
+  memset( blank, fill, sizeof(blank) );
+
+  if( wrap )
+  {
+    for( uint32_t i = 0; i < n; i++ )
+    {
+      uint32_t from = up ? (rect->row+i) : (rect->row+h-n+i);
+      memcpy( saved_rows[i], screen+row_offset( attrs, from )+rect->col, rect->cols );
+    }
+  }
+
+  if( up )
+  {
+    for( uint32_t i = 0; i < h-n; i++ )
+      store_marked( screen, row_offset( attrs, rect->row+i )+rect->col,
+		    screen+row_offset( attrs, rect->row+i+n )+rect->col, rect->cols );
+
+    for( uint32_t i = h-n; i < h; i++ )
+      store_marked( screen, row_offset( attrs, rect->row+i )+rect->col,
+		    wrap ? saved_rows[i-(h-n)] : blank, rect->cols );
+  }
+  else
+  {
+    for( uint32_t i = h-1; i >= n; i-- )
+      store_marked( screen, row_offset( attrs, rect->row+i )+rect->col,
+		    screen+row_offset( attrs, rect->row+i-n )+rect->col, rect->cols );
+
+    for( uint32_t i = 0; i < n; i++ )
+      store_marked( screen, row_offset( attrs, rect->row+i )+rect->col,
+		    wrap ? saved_rows[i] : blank, rect->cols );
+  }
+}
+
+void screen_scroll_up( uint8_t *screen, const screen_rect_t *rect, uint32_t rows, bool wrap )
+{
+  scroll_vertical( screen, rect, rows, wrap, true, false, 0 );
+}
+
+void screen_scroll_down( uint8_t *screen, const screen_rect_t *rect, uint32_t rows, bool wrap )
+{
+  scroll_vertical( screen, rect, rows, wrap, false, false, 0 );
+}
+
+static void fill_rows( uint8_t *screen, const screen_rect_t *rect, uint8_t value, bool attrs )
+{
+  uint8_t row[ZX_DISPLAY_COLUMNS];
+  memset( row, value, sizeof(row) );
+
+  for( uint32_t y = rect->row; y < rect->row+rect->rows; y++ )
+    store_marked( screen, row_offset( attrs, y )+rect->col, row, rect->cols );
+}
+
+void screen_fill( uint8_t *screen, const screen_rect_t *rect, uint8_t value )
+{
+  fill_rows( screen, rect, value, false );
+}
+
+/*
+ * Each row goes through a buffer, so overlaps along a row are fine. For
+ * overlaps across rows the rows are done bottom up if the copy is moving
+ * down.
+ */
+void screen_copy( uint8_t *screen, uint32_t col, uint32_t row,
+		  const uint8_t *src, const screen_rect_t *rect )
+{
+  bool bottom_up = (src == screen) && (row > rect->row);
+
+  for( uint32_t i = 0; i < rect->rows; i++ )
+  {
+    uint32_t y = bottom_up ? (rect->rows-1-i) : i;
+    uint8_t  bytes[ZX_DISPLAY_COLUMNS];
+
+    memcpy( bytes, src+ZX_DISPLAY_ROW_OFFSET( rect->row+y )+rect->col, rect->cols );
+    store_marked( screen, ZX_DISPLAY_ROW_OFFSET( row+y )+col, bytes, rect->cols );
+  }
+}
+
+void screen_blit( uint8_t *screen, uint32_t col, uint32_t row,
+		  const uint8_t *bitmap, uint32_t cols, uint32_t rows )
+{
+  for( uint32_t y = 0; y < rows; y++ )
+    store_marked( screen, ZX_DISPLAY_ROW_OFFSET( row+y )+col, bitmap+(y*cols), cols );
+}
+
+/*
+ * Attributes are a simple 32x24 array, so a sideways scroll is just a
+ * rotate of the bytes in each row
+ */
+static void attr_scroll_horizontal( uint8_t *screen, const screen_rect_t *rect, uint32_t n, bool wrap,
+				    bool left, uint8_t fill )
+{
+  uint32_t w = rect->cols;
+
+  if( (w == 0) || (rect->rows == 0) )
+    return;
+
+  if( wrap )
+    n %= w;
+
+  if( n == 0 )
+    return;
+
+  for( uint32_t y = rect->row; y < rect->row+rect->rows; y++ )
+  {
+    uint32_t offset = ZX_DISPLAY_ATTR_ROW_OFFSET( y )+rect->col;
+    uint8_t  bytes[ZX_DISPLAY_COLUMNS];
+
+    for( uint32_t x = 0; x < w; x++ )
+    {
+      uint32_t from = left ? (x+n) : (x+w-(n%w));
+      if( !wrap && (left ? (x+n >= w) : (x < n)) )
+	bytes[x] = fill;
+      else
+	bytes[x] = screen[offset + (from % w)];
+    }
+
+    store_marked( screen, offset, bytes, w );
+  }
+}
+
+void screen_attr_scroll_left( uint8_t *screen, const screen_rect_t *rect, uint32_t cells, bool wrap, uint8_t fill )
+{
+  attr_scroll_horizontal( screen, rect, cells, wrap, true, fill );
+}
+
+void screen_attr_scroll_right( uint8_t *screen, const screen_rect_t *rect, uint32_t cells, bool wrap, uint8_t fill )
+{
+  attr_scroll_horizontal( screen, rect, cells, wrap, false, fill );
+}
+
+void screen_attr_scroll_up( uint8_t *screen, const screen_rect_t *rect, uint32_t cells, bool wrap, uint8_t fill )
+{
+  scroll_vertical( screen, rect, cells, wrap, true, true, fill );
+}
+
+void screen_attr_scroll_down( uint8_t *screen, const screen_rect_t *rect, uint32_t cells, bool wrap, uint8_t fill )
+{
+  scroll_vertical( screen, rect, cells, wrap, false, true, fill );
+}
+
+void screen_attr_fill( uint8_t *screen, const screen_rect_t *rect, uint8_t attr )
+{
+  fill_rows( screen, rect, attr, true );
+}
@@ -0,0 +1,75 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __SCREEN_BLIT_H
+#define __SCREEN_BLIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Scroll, fill and copy kernels for a ZX display file image, in the real
+ * Spectrum layout. They're meant for core 1's renderers: every byte they
+ * change is marked in screen_render_map.
+ *
+ * Pixel areas are whole character columns wide and any number of pixel rows
+ * high. Attribute areas are in character cells.
+ */
+typedef struct
+{
+  uint8_t col;   /* First character column, 0-31 */
+  uint8_t cols;
+  uint8_t row;   /* First pixel row 0-191, or character row 0-23 for attributes */
+  uint8_t rows;
+} screen_rect_t;
+
+extern const screen_rect_t screen_whole;
+extern const screen_rect_t screen_whole_attrs;
+
+/*
+ * Pixel scrolls, by any number of pixels. Without wrap the pixels coming
+ * in are paper (0).
+ */
+void screen_scroll_left( uint8_t *screen, const screen_rect_t *rect, uint32_t pixels, bool wrap );
+void screen_scroll_right( uint8_t *screen, const screen_rect_t *rect, uint32_t pixels, bool wrap );
+void screen_scroll_up( uint8_t *screen, const screen_rect_t *rect, uint32_t rows, bool wrap );
+void screen_scroll_down( uint8_t *screen, const screen_rect_t *rect, uint32_t rows, bool wrap );
+
+void screen_fill( uint8_t *screen, const screen_rect_t *rect, uint8_t value );
+
+/*
+ * Copy an area of pixels from src (another display file image, or the same
+ * one) to the given position in screen. Overlapping copies are fine.
+ */
+void screen_copy( uint8_t *screen, uint32_t col, uint32_t row,
+		  const uint8_t *src, const screen_rect_t *rect );
+
+/* Draw a linear bitmap, cols bytes by rows pixel rows, at the given position */
+void screen_blit( uint8_t *screen, uint32_t col, uint32_t row,
+		  const uint8_t *bitmap, uint32_t cols, uint32_t rows );
+
+/* Attribute scrolls, by character cells. Without wrap the cells coming in are fill */
+void screen_attr_scroll_left( uint8_t *screen, const screen_rect_t *rect, uint32_t cells, bool wrap, uint8_t fill );
+void screen_attr_scroll_right( uint8_t *screen, const screen_rect_t *rect, uint32_t cells, bool wrap, uint8_t fill );
+void screen_attr_scroll_up( uint8_t *screen, const screen_rect_t *rect, uint32_t cells, bool wrap, uint8_t fill );
+void screen_attr_scroll_down( uint8_t *screen, const screen_rect_t *rect, uint32_t cells, bool wrap, uint8_t fill );
+
+void screen_attr_fill( uint8_t *screen, const screen_rect_t *rect, uint8_t attr );
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Dirty byte tracking for the screen mirror.
+ *
+ * A run header costs the PIO 12 cycles against 44 for a data byte, so it's
+ * always cheaper on the bus to start a new run than to send clean bytes to
+ * bridge a gap. The only thing which forces clean bytes to be sent is the
+ * bus master's limit on the number of runs, in which case the last run
+ * covers everything from there to the last dirty byte.
+ *
+ * The runs are limited to what the bus master can take in one transfer, so
+ * a window with room for the whole screen sends it in one go.
+ *
+ * The map is read and cleared from the /INT handler. Anything marking bytes
+ * from outside that IRQ does a read-modify-write which might put back bits
+ * the handler has just cleared. That only causes a byte to be sent twice,
+ * never a change to be missed.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "zx_display.h"
+#include "screen_dirty.h"
+#include "bus_master.h"
+#include "frame_sched.h"
+
+uint32_t             screen_dirty_map[SCREEN_DIRTY_MAP_WORDS];
+uint32_t             screen_render_map[SCREEN_DIRTY_MAP_WORDS];
+screen_dirty_stats_t screen_dirty_stats;
+
+void screen_dirty_mark_range( uint32_t offset, uint32_t length )
+{
+  uint32_t end = offset+length;
+  if( end > ZX_DISPLAY_FILE_SIZE )
+    end = ZX_DISPLAY_FILE_SIZE;
+
+  /* Partial word at the start, whole words, partial word at the end */
+  while( (offset < end) && (offset & 31) )
+    screen_dirty_mark( offset++ );
+
+  while( offset+32 <= end )
+  {
+    screen_dirty_map[offset >> 5] = 0xFFFFFFFF;
+    offset += 32;
+  }
+
+  while( offset < end )
+    screen_dirty_mark( offset++ );
+}
+
+void screen_dirty_mark_all( void )
+{
+  screen_dirty_mark_range( 0, ZX_DISPLAY_FILE_SIZE );
+}
+
+/* True if anything is marked in the given map */
+bool screen_dirty_any( const uint32_t *map )
+{
+  for( uint32_t i = 0; i < SCREEN_DIRTY_MAP_WORDS; i++ )
+  {
+    if( map[i] )
+      return true;
+  }
+
+  return false;
+}
+
+/*
+ * The back buffer has become the front, so everything core 1 changed in it
+ * needs sending. The render map is cleared ready for the next frame.
+ */
+void screen_dirty_merge_render( void )
+{
+  for( uint32_t i = 0; i < SCREEN_DIRTY_MAP_WORDS; i++ )
+  {
+    screen_dirty_map[i] |= screen_render_map[i];
+    screen_render_map[i] = 0;
+  }
+}
+
+/*
+ * Find the first byte at or after offset which is dirty (or clean, if
+ * dirty is false). Returns ZX_DISPLAY_FILE_SIZE if there isn't one.
+ */
+static uint32_t find_next( uint32_t offset, bool dirty )
+{
+  while( offset < ZX_DISPLAY_FILE_SIZE )
+  {
+    uint32_t word = screen_dirty_map[offset >> 5];
+    if( !dirty )
+      word = ~word;
+
+    /* Ignore the bits below the start point */
+    word &= (0xFFFFFFFF << (offset & 31));
+
+    if( word )
+    {
+      offset = (offset & ~31u) + __builtin_ctz( word );
+      break;
+    }
+
+    offset = (offset & ~31u) + 32;
+  }
+
+  return (offset < ZX_DISPLAY_FILE_SIZE) ? offset : ZX_DISPLAY_FILE_SIZE;
+}
+
+/* One past the last dirty byte, or 0 if nothing is dirty */
+static uint32_t find_end( void )
+{
+  for( int32_t i = SCREEN_DIRTY_MAP_WORDS-1; i >= 0; i-- )
+  {
+    if( screen_dirty_map[i] )
+      return (i*32) + (32 - __builtin_clz( screen_dirty_map[i] ));
+  }
+
+  return 0;
+}
+
+/* Clear the map below the given offset */
+static void clear_below( uint32_t offset )
+{
+  uint32_t word = offset >> 5;
+
+  memset( screen_dirty_map, 0, word*sizeof(uint32_t) );
+  if( offset & 31 )
+    screen_dirty_map[word] &= (0xFFFFFFFF << (offset & 31));
+}
+
+/*
+ * Queue the dirty parts of the mirror with the frame scheduler, clear the
+ * map and update the stats. Returns the number of bytes queued. Each run's
+ * done function is called once it has been written. If the scheduler's
+ * queue fills up, whatever didn't make it stays dirty for next time.
+ */
+uint32_t screen_dirty_queue_runs( const uint8_t *mirror, frame_sched_done_t done )
+{
+  uint32_t bytes_sent = 0;
+  uint32_t runs       = 0;
+
+  uint32_t start = find_next( 0, true );
+  while( start < ZX_DISPLAY_FILE_SIZE )
+  {
+    /* Out of runs? Take everything that's left in one go */
+    uint32_t end;
+    if( runs == BUS_MASTER_MAX_RUNS-1 )
+      end = find_end();
+    else
+      end = find_next( start, false );
+
+    if( !frame_sched_add( ZX_DISPLAY_FILE_ADDRESS+start, mirror+start, end-start, done, NULL ) )
+      break;
+
+    bytes_sent += end-start;
+    runs++;
+
+    start = find_next( end, true );
+  }
+
+  clear_below( start );
+
+  screen_dirty_stats.frames++;
+  screen_dirty_stats.last_bytes_sent     = bytes_sent;
+  screen_dirty_stats.last_bytes_skipped  = ZX_DISPLAY_FILE_SIZE-bytes_sent;
+  screen_dirty_stats.last_runs           = runs;
+  screen_dirty_stats.total_bytes_sent    += bytes_sent;
+  screen_dirty_stats.total_bytes_skipped += ZX_DISPLAY_FILE_SIZE-bytes_sent;
+  screen_dirty_stats.total_runs          += runs;
+
+  return bytes_sent;
+}
@@ -0,0 +1,82 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __SCREEN_DIRTY_H
+#define __SCREEN_DIRTY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "zx_display.h"
+#include "frame_sched.h"
+
+/*
+ * Change tracking for the screen mirror. One bit per display file byte,
+ * set when the mirror's copy of that byte differs from what's in the
+ * Spectrum. Only the dirty bytes are sent over the bus each frame.
+ */
+#define SCREEN_DIRTY_MAP_WORDS ((ZX_DISPLAY_FILE_SIZE+31)/32)
+
+extern uint32_t screen_dirty_map[SCREEN_DIRTY_MAP_WORDS];
+
+/*
+ * Byte counts for the saving the delta transfer makes. "last" is the most
+ * recent frame, the totals run from boot. Look at these in the debugger.
+ */
+typedef struct
+{
+  uint32_t frames;
+  uint32_t last_bytes_sent;
+  uint32_t last_bytes_skipped;
+  uint32_t last_runs;
+  uint64_t total_bytes_sent;
+  uint64_t total_bytes_skipped;
+  uint64_t total_runs;
+} screen_dirty_stats_t;
+
+extern screen_dirty_stats_t screen_dirty_stats;
+
+/* Mark a single mirror byte, offset from the start of the display file */
+static inline void screen_dirty_mark( uint32_t offset )
+{
+  screen_dirty_map[offset >> 5] |= (1u << (offset & 31));
+}
+
+void screen_dirty_mark_range( uint32_t offset, uint32_t length );
+void screen_dirty_mark_all( void );
+
+/*
+ * Bytes core 1 has changed in the back buffer while drawing the next frame,
+ * in the same layout as the dirty map. Only core 1 marks it, and only while
+ * it owns the back buffer. It's merged into the dirty map by core 0 when the
+ * buffers are swapped.
+ */
+extern uint32_t screen_render_map[SCREEN_DIRTY_MAP_WORDS];
+
+static inline void screen_render_mark( uint32_t offset )
+{
+  screen_render_map[offset >> 5] |= (1u << (offset & 31));
+}
+
+void screen_dirty_merge_render( void );
+
+bool     screen_dirty_any( const uint32_t *map );
+uint32_t screen_dirty_queue_runs( const uint8_t *mirror, frame_sched_done_t done );
+
+#endif
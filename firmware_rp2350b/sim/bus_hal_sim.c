@@ -0,0 +1,996 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Simulated Z80, ULA and DRAM behind the bus_hal.h and bus_master.h
+ * interfaces.
+ *
+ * This isn't an emulator. There's no Z80 instruction execution, just enough
+ * of the bus behaviour to find out whether the firmware's timing is right:
+ *
+ * - BUSACK arrives at the end of the Z80's current machine cycle, which is
+ *   a pseudo-random 3 to 6 T-states long, plus a T-state
+ * - /INT falls every 69,888 T-states, and a Z80 with BUSREQ held as it
+ *   falls misses the interrupt
+ * - the ULA fetches screen data for the first 128T of each of the 192
+ *   display lines, and a DMA write to 0x4000-0x7FFF at that time is
+ *   contention
+ * - the ULA holds CLK high through the T-states it wants the contended
+ *   RAM for, 6 of every 8 during the fetch part of a display line, when
+ *   there's a contended address on the bus. The CLK gated bus master waits
+ *   for a falling edge.
+ * - a /WR strobe shorter than the DRAM needs is a lost write
+ * - Z80 writes queued by the caller appear on the buses for 1.5T, and
+ *   are caught by the snoop unless it's paused or its ring is full
+ *
+ * Time only moves when the firmware calls into the HAL or the bus master,
+ * each call being charged a few RP2350 cycles. The code between the two
+ * BLIPPER2 edges (the scroll demo) is charged sim_config.compute_us. Calls
+ * made from core 1 go on core 1's own clock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpios.h"
+#include "bus_hal.h"
+#include "bus_master.h"
+#include "bus_snoop.h"
+#include "bus_rom.h"
+#include "bus_port.h"
+#include "zx_display.h"
+
+sim_config_t sim_config =
+{
+  .min_strobe_ns = 150,
+  .compute_us    = 465,
+  .z80_stalled   = false,
+};
+
+sim_stats_t sim_stats;
+uint8_t     sim_ram[0x10000];
+sim_out_t   sim_outs[SIM_MAX_OUTS];
+uint32_t    sim_out_count;
+
+#define SIM_TICKS_PER_FRAME  ((uint64_t)SIM_TSTATES_PER_FRAME*SIM_TICKS_PER_TSTATE)
+
+/* From the fall of /INT to the handler, see ZX_DMA_INT_LATENCY_US */
+#define SIM_INT_LATENCY_US   2
+
+/* RP2350 cycles charged for each HAL call */
+#define SIM_GPIO_CYCLES      4
+#define SIM_DIR_CYCLES       12
+#define SIM_DMA_START_CYCLES 10
+#define SIM_DRAIN_CYCLES     20
+#define SIM_EVENT_CYCLES     4
+
+/* How long a Z80 write holds /MREQ and /WR low */
+#define SIM_Z80_WRITE_TICKS  ((SIM_TICKS_PER_TSTATE*3)/2)
+
+static uint64_t now;
+static uint64_t frame_start;
+static uint32_t lcg_state = 1;
+
+static bool     busreq_active;
+static uint64_t busreq_at;
+static bool     busack_active;
+static uint64_t busack_at;
+static uint64_t busack_release_at;
+
+static bool     blipper2_high;
+
+static bool            alarm_pending;
+static uint64_t        alarm_at;
+static bus_hal_alarm_t alarm_callback;
+
+static bool     on_core1;
+static uint64_t core1_ticks;
+static uint64_t busreq_frame_start;
+
+typedef struct
+{
+  uint16_t       zx_address;
+  const uint8_t *src;
+  uint8_t       *dst;
+  uint32_t       length;
+} sim_run_t;
+
+static sim_run_t             runs[BUS_MASTER_MAX_RUNS];
+static uint32_t              num_runs;
+static bool                  reading;
+static bool                  clk_gated;
+static uint32_t              strobe_cycles = BUS_MASTER_STROBE_CYCLES;
+static bool                  dma_busy;
+static uint64_t              dma_end;
+static bus_master_complete_t dma_complete;
+
+#define SIM_MAX_Z80_WRITES 16384
+
+typedef struct
+{
+  uint64_t at;
+  uint16_t address;
+  uint8_t  data;
+  bool     io;           /* An OUT, the address is the port */
+  bool     committed;
+} sim_z80_write_t;
+
+static sim_z80_write_t z80_writes[SIM_MAX_Z80_WRITES];
+static uint32_t        z80_head;
+static uint32_t        z80_count;
+
+static uint32_t snoop_ring[BUS_SNOOP_RING_EVENTS];
+static uint32_t snoop_head;
+static uint32_t snoop_tail;
+static uint8_t  snoop_sequence;
+static uint8_t  snoop_next_sequence;
+static bool     snoop_paused;
+
+/* The ROM image, see bus_rom_init() */
+static uint8_t  rom_image[ZX_ROM_SIZE];
+static bool     rom_serving;
+
+/* The I/O port, see bus_port_init() */
+static bool               port_answering;
+static uint8_t            port_address;
+static bus_port_written_t port_written;
+static bus_port_read_t    port_read;
+
+volatile uint8_t bus_port_in[BUS_PORT_REGISTERS];
+volatile uint8_t bus_port_out[BUS_PORT_REGISTERS];
+
+bus_snoop_stats_t bus_snoop_stats;
+
+static void snoop_capture( uint16_t address, uint8_t data );
+static void port_out( uint16_t port, uint8_t data );
+
+static uint32_t lcg( void )
+{
+  lcg_state = lcg_state*1103515245 + 12345;
+  return lcg_state >> 16;
+}
+
+/*
+ * Bring the model up to date with the current time. This is where the DMA
+ * IRQ "fires", so the completion callback can call back into the HAL.
+ */
+static void sim_update( void )
+{
+  bool waiting = sim_config.z80_stalled ||
+                 (now < frame_start + (uint64_t)sim_config.z80_wait_tstates*SIM_TICKS_PER_TSTATE);
+
+  if( busreq_active && !busack_active && !waiting && !sim_config.z80_reset &&
+      (now >= busack_at) )
+  {
+    uint32_t wait = (busack_at-busreq_at)/SIM_TICKS_PER_TSTATE;
+
+    busack_active = true;
+    sim_stats.busack_waits++;
+    sim_stats.busack_wait_tstates += wait;
+    if( wait > sim_stats.busack_wait_max_tstates )
+      sim_stats.busack_wait_max_tstates = wait;
+  }
+
+  if( !busreq_active && busack_active && (now >= busack_release_at) )
+  {
+    /* The Z80 picks up where it left off, everything it had to do is later */
+    uint64_t stall = busack_release_at - busack_at;
+
+    sim_stats.stalls++;
+    sim_stats.stall_ticks += stall;
+    if( stall > sim_stats.stall_max_ticks )
+      sim_stats.stall_max_ticks = stall;
+    if( sim_config.stall_limit_us && (stall > (uint64_t)sim_config.stall_limit_us*SIM_TICKS_PER_US) )
+      sim_stats.long_stalls++;
+    for( uint32_t i = 0; i < z80_count; i++ )
+    {
+      sim_z80_write_t *w = &z80_writes[(z80_head+i) % SIM_MAX_Z80_WRITES];
+      if( !w->committed )
+	w->at += stall;
+    }
+
+    busack_active = false;
+  }
+
+  if( dma_busy && (now >= dma_end) )
+  {
+    dma_busy = false;
+    if( dma_complete )
+      dma_complete();
+  }
+
+  while( z80_count )
+  {
+    sim_z80_write_t *w = &z80_writes[z80_head];
+
+    /* The Z80 can't write while it's given up the bus, it carries on after */
+    if( busack_active )
+    {
+      if( w->at < now )
+        w->at = now;
+      break;
+    }
+
+    if( now < w->at )
+      break;
+
+    if( !w->committed && w->io )
+    {
+      w->committed = true;
+      port_out( w->address, w->data );
+    }
+    else if( !w->committed )
+    {
+      /* The ROM doesn't take the write, but the snoop sees it */
+      if( w->address >= ZX_ROM_SIZE )
+	sim_ram[w->address] = w->data;
+      w->committed = true;
+      sim_stats.z80_writes++;
+      snoop_capture( w->address, w->data );
+    }
+
+    if( now < w->at+SIM_Z80_WRITE_TICKS )
+      break;
+
+    z80_head = (z80_head+1) % SIM_MAX_Z80_WRITES;
+    z80_count--;
+  }
+}
+
+void sim_advance( uint64_t ticks )
+{
+  uint64_t until = now+ticks;
+
+  /* The DMA IRQ comes in when the transfer ends, not when the time is next looked at */
+  while( dma_busy && (dma_end < until) )
+  {
+    if( now < dma_end )
+      now = dma_end;
+    sim_update();
+  }
+
+  if( now < until )
+    now = until;
+  sim_update();
+}
+
+/* Time taken by the caller, on whichever core it's running */
+static void charge( uint64_t ticks )
+{
+  if( on_core1 )
+    core1_ticks += ticks;
+  else
+    sim_advance( ticks );
+}
+
+void sim_core1_begin( void )
+{
+  on_core1    = true;
+  core1_ticks = 0;
+}
+
+uint64_t sim_core1_end( void )
+{
+  on_core1 = false;
+  return core1_ticks;
+}
+
+void sim_reset( void )
+{
+  now = frame_start = 0;
+  busreq_active = busack_active = dma_busy = blipper2_high = on_core1 = false;
+  clk_gated = false;
+  strobe_cycles = BUS_MASTER_STROBE_CYCLES;
+  alarm_pending = false;
+  busreq_frame_start = UINT64_MAX;
+  num_runs = z80_head = z80_count = 0;
+  snoop_head = snoop_tail = 0;
+  snoop_sequence = snoop_next_sequence = 0;
+  snoop_paused = false;
+  memset( &bus_snoop_stats, 0, sizeof(bus_snoop_stats) );
+  lcg_state = 1;
+  memset( &sim_stats, 0, sizeof(sim_stats) );
+  memset( sim_ram, 0, sizeof(sim_ram) );
+  rom_serving = false;
+  port_answering = false;
+  sim_out_count = 0;
+}
+
+uint64_t sim_now( void )
+{
+  return now;
+}
+
+/*
+ * /INT falls. The handler can't run until whatever was running before has
+ * finished, which is only an issue if the firmware has overrun the frame.
+ */
+void sim_begin_frame( uint32_t frame )
+{
+  frame_start = (uint64_t)frame*SIM_TICKS_PER_FRAME;
+  if( now < frame_start )
+    now = frame_start;
+
+  sim_update();
+
+  if( busreq_active )
+    sim_stats.missed_ints++;
+
+  /* The board's GPIO IRQ takes about 2us to get to the handler, plus whatever's holding it off */
+  uint64_t holdoff = (uint64_t)SIM_INT_LATENCY_US*SIM_TICKS_PER_US;
+  if( sim_config.int_holdoff_us )
+    holdoff += (uint64_t)(lcg() % (sim_config.int_holdoff_us*100 + 1)) * (SIM_TICKS_PER_US/100);
+  sim_advance( holdoff );
+
+  sim_stats.frames++;
+}
+
+uint64_t sim_frame_end( void )
+{
+  return frame_start+SIM_TICKS_PER_FRAME;
+}
+
+uint32_t sim_frame_tstate( void )
+{
+  return (now-frame_start)/SIM_TICKS_PER_TSTATE;
+}
+
+/* Queue a Z80 write, in time order, at a T-state offset in the current frame */
+void sim_z80_write( uint32_t frame_tstate, uint16_t address, uint8_t data )
+{
+  if( z80_count == SIM_MAX_Z80_WRITES )
+  {
+    fprintf( stderr, "sim: Z80 write queue full\n" );
+    exit( 1 );
+  }
+
+  sim_z80_write_t *w = &z80_writes[(z80_head+z80_count) % SIM_MAX_Z80_WRITES];
+  w->at        = frame_start + (uint64_t)frame_tstate*SIM_TICKS_PER_TSTATE;
+  w->address   = address;
+  w->data      = data;
+  w->io        = false;
+  w->committed = false;
+  z80_count++;
+}
+
+/* The same for an OUT, in the same queue so it keeps its place among the writes */
+void sim_z80_out( uint32_t frame_tstate, uint16_t port, uint8_t data )
+{
+  sim_z80_write( frame_tstate, port, data );
+  z80_writes[(z80_head+z80_count-1) % SIM_MAX_Z80_WRITES].io = true;
+}
+
+/*
+ * True if a Z80 write into 0x4000-0x7FFF at this time collides with the
+ * ULA fetching screen data
+ */
+static bool ula_fetching( uint64_t at, uint16_t address )
+{
+  if( (address < 0x4000) || (address > 0x7FFF) )
+    return false;
+
+  uint64_t t = ((at-frame_start)/SIM_TICKS_PER_TSTATE) % SIM_TSTATES_PER_FRAME;
+  if( t < SIM_TOP_BORDER_TSTATES )
+    return false;
+
+  t -= SIM_TOP_BORDER_TSTATES;
+  if( t >= SIM_DISPLAY_LINES*SIM_TSTATES_PER_LINE )
+    return false;
+
+  return (t % SIM_TSTATES_PER_LINE) < SIM_ULA_FETCH_TSTATES;
+}
+
+/*
+ * True if the ULA holds CLK high through T-state n, counted from the start
+ * of the simulation, for an access to this address. That's the 6,5,4,3,2,1,0,0
+ * contention pattern: an access can't start in the first 6 T-states of
+ * each 8 while the ULA is fetching.
+ */
+static bool ula_holds_clk( uint64_t n, uint16_t address )
+{
+  if( (address < 0x4000) || (address > 0x7FFF) )
+    return false;
+
+  uint64_t t = n % SIM_TSTATES_PER_FRAME;
+  if( (t < SIM_TOP_BORDER_TSTATES) || (t >= SIM_LOWER_BORDER_TSTATES) )
+    return false;
+
+  t = (t-SIM_TOP_BORDER_TSTATES) % SIM_TSTATES_PER_LINE;
+  return (t < SIM_ULA_FETCH_TSTATES) && ((t & 7) < 6);
+}
+
+/*
+ * The first falling edge of CLK at or after the given time, with the given
+ * address on the bus. CLK rises at the start of each T-state and falls
+ * half way through, unless the ULA is holding it.
+ */
+static uint64_t clk_next_fall( uint64_t at, uint16_t address )
+{
+  uint64_t n = at/SIM_TICKS_PER_TSTATE;
+  if( at > n*SIM_TICKS_PER_TSTATE + SIM_TICKS_PER_TSTATE/2 )
+    n++;
+
+  while( ula_holds_clk( n, address ) )
+    n++;
+
+  return n*SIM_TICKS_PER_TSTATE + SIM_TICKS_PER_TSTATE/2;
+}
+
+/*
+ * HAL
+ */
+
+void bus_hal_busreq( bool active )
+{
+  sim_advance( SIM_GPIO_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+
+  if( active && !busreq_active )
+  {
+    /* Acknowledged at the end of the current machine cycle */
+    uint32_t mcycle = 3 + (lcg() % 4);
+    uint32_t phase  = lcg() % mcycle;
+
+    busreq_active = true;
+    busreq_at     = now;
+
+    if( busreq_frame_start != frame_start )
+    {
+      uint64_t latency = now-frame_start;
+
+      busreq_frame_start = frame_start;
+      sim_stats.busreqs++;
+      sim_stats.busreq_latency_ticks += latency;
+      if( latency > sim_stats.busreq_latency_max_ticks )
+	sim_stats.busreq_latency_max_ticks = latency;
+    }
+    busack_at     = now + (uint64_t)(mcycle-phase+1)*SIM_TICKS_PER_TSTATE;
+  }
+  else if( !active && busreq_active )
+  {
+    busreq_active     = false;
+    busack_release_at = now + SIM_TICKS_PER_TSTATE;
+  }
+
+  sim_update();
+}
+
+bool bus_hal_busack( void )
+{
+  sim_advance( SIM_GPIO_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+
+  /*
+   * A Z80 which never answers would hang the firmware in its spin loop. On
+   * the board that's a lock up, here it's a report
+   */
+  if( busreq_active && !busack_active && (now-busreq_at > SIM_TICKS_PER_FRAME) )
+  {
+    fprintf( stderr, "sim: BUSACK not seen for a whole frame after BUSREQ, firmware is hung\n" );
+    exit( 2 );
+  }
+
+  return busack_active;
+}
+
+void bus_hal_drive_rd_iorq( bool drive )
+{
+  sim_advance( SIM_DIR_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+}
+
+uint64_t bus_hal_sample( void )
+{
+  sim_advance( SIM_GPIO_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+
+  uint64_t gpios = (1u << GPIO_Z80_WR)   | (1u << GPIO_Z80_MREQ) |
+                   (1u << GPIO_Z80_RD)   | (1u << GPIO_Z80_IORQ) |
+                   (1u << GPIO_Z80_INT)  | (1u << GPIO_Z80_BUSREQ) |
+                   (UINT64_C(1) << GPIO_Z80_WAIT) | (UINT64_C(1) << GPIO_Z80_RESET);
+
+  if( busreq_active )
+    gpios &= ~(UINT64_C(1) << GPIO_Z80_BUSREQ);
+
+  if( busack_active )
+    return gpios;
+
+  gpios |= (UINT64_C(1) << GPIO_Z80_BUSACK);
+
+  if( z80_count )
+  {
+    sim_z80_write_t *w = &z80_writes[z80_head];
+    if( w->committed && (now >= w->at) && (now < w->at+SIM_Z80_WRITE_TICKS) )
+    {
+      gpios &= ~(uint64_t)((1u << GPIO_Z80_WR) | (1u << (w->io ? GPIO_Z80_IORQ : GPIO_Z80_MREQ)));
+      gpios |= ((uint64_t)w->address << GPIO_ABUS_A0) | w->data;
+    }
+  }
+
+  return gpios;
+}
+
+void bus_hal_signal( uint32_t gpio, bool level )
+{
+  charge( SIM_GPIO_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+
+  if( gpio == GPIO_BLIPPER2 )
+  {
+    if( blipper2_high && !level )
+      charge( (uint64_t)sim_config.compute_us*SIM_TICKS_PER_US );
+    blipper2_high = level;
+  }
+}
+
+void bus_hal_busy_wait_us( uint32_t us )
+{
+  charge( (uint64_t)us*SIM_TICKS_PER_US );
+}
+
+uint64_t bus_hal_time_us( void )
+{
+  return now/SIM_TICKS_PER_US;
+}
+
+bool bus_hal_z80_reset( void )
+{
+  charge( SIM_GPIO_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+  return sim_config.z80_reset;
+}
+
+/* The RP2350 running at the bus master's reference clock */
+uint32_t bus_hal_cycles( void )
+{
+  return (uint32_t)(now/SIM_TICKS_PER_RP_CYCLE);
+}
+
+/*
+ * One alarm at a time is enough for the firmware. The driver fires it with
+ * sim_run_alarms(), between the other handlers, the same as the board's
+ * equal priority IRQs.
+ */
+void bus_hal_alarm_at_us( uint64_t at, bus_hal_alarm_t callback )
+{
+  charge( SIM_DIR_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+
+  alarm_pending  = true;
+  alarm_at       = at*SIM_TICKS_PER_US;
+  alarm_callback = callback;
+}
+
+uint64_t sim_next_alarm( void )
+{
+  return alarm_pending ? alarm_at : UINT64_MAX;
+}
+
+uint64_t sim_dma_end( void )
+{
+  return dma_busy ? dma_end : UINT64_MAX;
+}
+
+void sim_run_alarms( void )
+{
+  if( alarm_pending && (now >= alarm_at) )
+  {
+    alarm_pending = false;
+    alarm_callback();
+  }
+}
+
+/*
+ * Bus master. The whole transfer is played into the RAM model as soon as
+ * it starts, with each byte checked against the time it would reach the
+ * DRAM. Completion is signalled when the time catches up with the end.
+ */
+
+void bus_master_init( void )
+{
+  num_runs = 0;
+}
+
+void bus_master_clear_runs( void )
+{
+  num_runs = 0;
+  reading  = false;
+}
+
+static bool add_run( uint16_t zx_address, const uint8_t *src, uint8_t *dst, uint32_t length )
+{
+  if( (length == 0) || (length > 0x10000) || (num_runs == BUS_MASTER_MAX_RUNS) )
+    return false;
+
+  /* A transfer is all reads or all writes */
+  if( (num_runs > 0) && (reading != (dst != NULL)) )
+    return false;
+
+  runs[num_runs].zx_address = zx_address;
+  runs[num_runs].src        = src;
+  runs[num_runs].dst        = dst;
+  runs[num_runs].length     = length;
+  reading = (dst != NULL);
+  num_runs++;
+
+  return true;
+}
+
+bool bus_master_add_run( uint16_t zx_address, const uint8_t *src, uint32_t length )
+{
+  return add_run( zx_address, src, NULL, length );
+}
+
+bool bus_master_add_read( uint16_t zx_address, uint8_t *dst, uint32_t length )
+{
+  return add_run( zx_address, NULL, dst, length );
+}
+
+void bus_master_set_clk_gated( bool gated )
+{
+  clk_gated = gated;
+}
+
+/*
+ * Read the queued runs from the RAM model, starting at t. /RD goes low a
+ * cycle into each byte, see zx_bus_read.pio.
+ */
+static uint64_t play_reads( uint64_t t )
+{
+  const uint64_t cycle = SIM_TICKS_PER_RP_CYCLE;
+
+  for( uint32_t r = 0; r < num_runs; r++ )
+  {
+    t += BUS_MASTER_READ_HEADER_CYCLES*cycle;
+    sim_stats.bus_master_cycles += BUS_MASTER_READ_HEADER_CYCLES;
+
+    for( uint32_t i = 0; i < runs[r].length; i++ )
+    {
+      uint16_t address = runs[r].zx_address+i;
+
+      if( ula_fetching( t + cycle, address ) )
+        sim_stats.contended_reads++;
+
+      runs[r].dst[i] = sim_ram[address];
+
+      t += BUS_MASTER_READ_CYCLES_PER_BYTE*cycle;
+      sim_stats.bus_master_cycles += BUS_MASTER_READ_CYCLES_PER_BYTE;
+      sim_stats.bytes_read++;
+    }
+  }
+
+  return t;
+}
+
+/*
+ * Play the queued runs into the RAM model, starting now. Returns the time
+ * the last byte is done. Probe writes are the strobe calibration's, it's
+ * expected to find strobes which are too short.
+ */
+static uint64_t play_runs( bool probe )
+{
+  if( !busack_active )
+  {
+    fprintf( stderr, "sim: bus master started without the Z80's bus\n" );
+    exit( 1 );
+  }
+
+  const uint64_t cycle     = SIM_TICKS_PER_RP_CYCLE;
+  const uint32_t strobe_ns = (uint32_t)(((uint64_t)strobe_cycles*1000000000)/BUS_MASTER_REFERENCE_HZ);
+  const bool     strobe_ok = (strobe_ns >= sim_config.min_strobe_ns);
+  const uint32_t byte_cycles = bus_master_cycles_per_byte();
+
+  uint64_t t = now + SIM_DMA_START_CYCLES*cycle;
+
+  if( reading )
+    return play_reads( t );
+
+  for( uint32_t r = 0; r < num_runs; r++ )
+  {
+    t += BUS_MASTER_HEADER_CYCLES*cycle;
+    sim_stats.bus_master_cycles += BUS_MASTER_HEADER_CYCLES;
+
+    for( uint32_t i = 0; i < runs[r].length; i++ )
+    {
+      uint16_t address = runs[r].zx_address+i;
+
+      if( clk_gated )
+      {
+	/*
+	 * The address goes out 4 cycles into the byte. /WR goes low 3 cycles
+	 * after the CLK edge, what with the input synchroniser, and the rest
+	 * of the byte is the same as ever
+	 */
+	uint64_t wr   = clk_next_fall( t + 4*cycle, address ) + 3*cycle;
+	uint64_t wait = wr - (t + 6*cycle);
+
+	if( ula_holds_clk( wr/SIM_TICKS_PER_TSTATE, address ) )
+	  sim_stats.contended_writes++;
+
+	t += wait;
+	sim_stats.bus_master_cycles += wait/cycle;
+	sim_stats.clk_wait_cycles   += wait/cycle;
+	sim_stats.clk_gated_bytes++;
+      }
+      else if( ula_fetching( t + 6*cycle, address ) )
+      {
+	/* /WR goes low 6 cycles into the byte, see zx_bus_write.pio */
+        sim_stats.contended_writes++;
+      }
+
+      if( strobe_ok )
+        sim_ram[address] = runs[r].src[i];
+      else if( probe )
+	sim_stats.probe_short_strobes++;
+      else
+        sim_stats.short_strobe_writes++;
+
+      t += byte_cycles*cycle;
+      sim_stats.bus_master_cycles += byte_cycles;
+      if( !probe )
+	sim_stats.bytes_written++;
+    }
+  }
+
+  return t;
+}
+
+static bool runs_contended( void )
+{
+  for( uint32_t r = 0; r < num_runs; r++ )
+  {
+    uint32_t end = runs[r].zx_address+runs[r].length;
+
+    if( ((runs[r].zx_address < 0x8000) && (end > 0x4000)) || (end > 0x14000) )
+      return true;
+  }
+
+  return false;
+}
+
+void bus_master_start( bus_master_complete_t complete )
+{
+  if( num_runs == 0 )
+  {
+    if( complete )
+      complete();
+    return;
+  }
+
+  dma_busy     = true;
+  dma_end      = play_runs( false );
+  dma_complete = complete;
+  sim_stats.transfers++;
+
+  /* Still using the contended RAM when the ULA starts on the display lines */
+  uint64_t end_tstate = (dma_end-frame_start)/SIM_TICKS_PER_TSTATE;
+  if( !clk_gated && runs_contended() &&
+      (end_tstate > SIM_TOP_BORDER_TSTATES) && (end_tstate < SIM_LOWER_BORDER_TSTATES) )
+    sim_stats.frame_overruns++;
+
+  sim_update();
+}
+
+void bus_master_set_strobe_cycles( uint32_t cycles )
+{
+  if( cycles < BUS_MASTER_MIN_STROBE_CYCLES )
+    cycles = BUS_MASTER_MIN_STROBE_CYCLES;
+  if( cycles > BUS_MASTER_MAX_STROBE_CYCLES )
+    cycles = BUS_MASTER_MAX_STROBE_CYCLES;
+
+  strobe_cycles = cycles;
+}
+
+uint32_t bus_master_strobe_cycles( void )
+{
+  return strobe_cycles;
+}
+
+uint32_t bus_master_cycles_per_byte( void )
+{
+  return BUS_MASTER_CYCLES_PER_BYTE - BUS_MASTER_STROBE_CYCLES + strobe_cycles;
+}
+
+void bus_master_write_blocking( uint16_t zx_address, const uint8_t *src, uint32_t length )
+{
+  bus_master_clear_runs();
+  if( !bus_master_add_run( zx_address, src, length ) )
+    return;
+
+  sim_advance( play_runs( true ) - now );
+}
+
+void bus_master_read( uint16_t zx_address, uint8_t *dst, uint32_t length )
+{
+  bus_master_clear_runs();
+  if( !bus_master_add_read( zx_address, dst, length ) )
+    return;
+
+  sim_advance( play_runs( false ) - now );
+}
+
+/* /WR goes low 6 cycles into the byte, as for a write */
+void bus_master_out_blocking( uint16_t port, uint8_t data )
+{
+  if( !busack_active )
+  {
+    fprintf( stderr, "sim: bus master started without the Z80's bus\n" );
+    exit( 1 );
+  }
+
+  const uint64_t cycle = SIM_TICKS_PER_RP_CYCLE;
+  uint64_t       wr    = now + (SIM_DMA_START_CYCLES + BUS_MASTER_HEADER_CYCLES + 6)*cycle;
+
+  if( sim_out_count < SIM_MAX_OUTS )
+  {
+    sim_outs[sim_out_count].tstate = (wr-frame_start)/SIM_TICKS_PER_TSTATE;
+    sim_outs[sim_out_count].port   = port;
+    sim_outs[sim_out_count].data   = data;
+    sim_outs[sim_out_count].hold   = sim_stats.stalls;
+    sim_out_count++;
+  }
+
+  sim_stats.bus_master_cycles += BUS_MASTER_OUT_CYCLES;
+  sim_advance( (SIM_DMA_START_CYCLES + BUS_MASTER_OUT_CYCLES)*cycle );
+}
+
+bool bus_master_busy( void )
+{
+  return dma_busy;
+}
+
+void bus_master_write( uint16_t zx_address, const uint8_t *src, uint32_t length,
+		       bus_master_complete_t complete )
+{
+  bus_master_clear_runs();
+  bus_master_add_run( zx_address, src, length );
+  bus_master_start( complete );
+}
+
+/*
+ * ROM takeover. There's no Z80 to read the image, the workload which uses
+ * it in zx_dma_sim.c plays the Z80's part itself.
+ */
+void bus_rom_init( const uint8_t *rom )
+{
+  memcpy( rom_image, rom, ZX_ROM_SIZE );
+  rom_serving = true;
+}
+
+uint8_t *bus_rom_image( void )
+{
+  return rom_serving ? rom_image : NULL;
+}
+
+void bus_rom_pause( void )
+{
+}
+
+void bus_rom_resume( void )
+{
+}
+
+void bus_rom_claim_data_bus( void )
+{
+}
+
+/*
+ * I/O port. The Z80's OUTs come through the write queue, the IRQ which
+ * picks them up on the board firing as they land. Its INs are made by the
+ * workload, with sim_z80_in(), answered straight away.
+ */
+void bus_port_init( uint8_t port, bus_port_written_t written, bus_port_read_t read )
+{
+  port_address   = port;
+  port_written   = written;
+  port_read      = read;
+  port_answering = true;
+}
+
+static void port_out( uint16_t port, uint8_t data )
+{
+  if( !port_answering || ((port & 0xFF) != port_address) )
+    return;
+
+  bus_port_out[BUS_PORT_REGISTER( port )] = data;
+  if( port_written )
+    port_written( BUS_PORT_REGISTER( port ), data );
+}
+
+uint8_t sim_z80_in( uint16_t port )
+{
+  sim_update();
+
+  /* Not this device's, whatever else answers isn't modelled */
+  if( !port_answering || ((port & 0xFF) != port_address) )
+    return 0xFF;
+
+  uint8_t data = bus_port_in[BUS_PORT_REGISTER( port )];
+  if( port_read )
+    port_read();
+
+  return data;
+}
+
+/*
+ * Snoop. The PIO and DMA are modelled as a ring which fills as the Z80's
+ * writes land, in the same event format. The real DMA would overwrite the
+ * oldest events when the ring is full; here the new one is dropped and
+ * counted as a miss, which shows up the same in the totals.
+ */
+
+static void snoop_capture( uint16_t address, uint8_t data )
+{
+  if( snoop_paused || (((snoop_head+1) & (BUS_SNOOP_RING_EVENTS-1)) == snoop_tail) )
+  {
+    sim_stats.snoop_misses++;
+    bus_snoop_stats.lost++;
+    snoop_sequence--;
+    return;
+  }
+
+  snoop_ring[snoop_head] = ((uint32_t)address << 16) | ((uint32_t)data << 8) | snoop_sequence--;
+  snoop_head = (snoop_head+1) & (BUS_SNOOP_RING_EVENTS-1);
+  sim_stats.snoop_hits++;
+}
+
+void bus_snoop_init( void )
+{
+}
+
+void bus_snoop_pause( void )
+{
+  sim_advance( SIM_GPIO_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+  snoop_paused = true;
+}
+
+void bus_snoop_resume( void )
+{
+  sim_advance( SIM_DIR_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+  snoop_paused = false;
+}
+
+uint32_t bus_snoop_drain( bus_snoop_batch_t apply )
+{
+  sim_advance( SIM_DRAIN_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+
+  uint32_t pending = (snoop_head - snoop_tail) & (BUS_SNOOP_RING_EVENTS-1);
+  if( pending == 0 )
+    return 0;
+
+  if( pending > bus_snoop_stats.high_water )
+    bus_snoop_stats.high_water = pending;
+
+  uint32_t remaining = pending;
+  while( remaining )
+  {
+    uint32_t count = remaining;
+    if( snoop_tail+count > BUS_SNOOP_RING_EVENTS )
+      count = BUS_SNOOP_RING_EVENTS-snoop_tail;
+
+    /* Dropped events leave a gap in the sequence, the same as on the board */
+    if( BUS_SNOOP_EVENT_SEQUENCE( snoop_ring[snoop_tail] ) != snoop_next_sequence )
+      bus_snoop_stats.overflows++;
+    snoop_next_sequence = BUS_SNOOP_EVENT_SEQUENCE( snoop_ring[snoop_tail+count-1] ) - 1;
+
+    apply( &snoop_ring[snoop_tail], count );
+    sim_advance( (uint64_t)count*SIM_EVENT_CYCLES*SIM_TICKS_PER_RP_CYCLE );
+
+    snoop_tail = (snoop_tail+count) & (BUS_SNOOP_RING_EVENTS-1);
+    remaining -= count;
+  }
+
+  bus_snoop_stats.events += pending;
+
+  return pending;
+}
@@ -0,0 +1,162 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BUS_HAL_SIM_H
+#define __BUS_HAL_SIM_H
+
+/*
+ * Host simulator backend for bus_hal.h. Include bus_hal.h, not this.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void     bus_hal_busreq( bool active );
+bool     bus_hal_busack( void );
+void     bus_hal_drive_rd_iorq( bool drive );
+uint64_t bus_hal_sample( void );
+void     bus_hal_signal( uint32_t gpio, bool level );
+void     bus_hal_busy_wait_us( uint32_t us );
+uint64_t bus_hal_time_us( void );
+uint32_t bus_hal_cycles( void );
+bool     bus_hal_z80_reset( void );
+void     bus_hal_alarm_at_us( uint64_t at, bus_hal_alarm_t callback );
+
+/*
+ * Simulated time is kept in ticks of 1/10.5GHz, which divides exactly into
+ * both a Z80 T-state (3.5MHz) and an RP2350 cycle (150MHz).
+ */
+#define SIM_TICKS_PER_TSTATE      3000
+#define SIM_TICKS_PER_RP_CYCLE    70
+#define SIM_TICKS_PER_US          10500
+
+/* 48K Spectrum frame geometry, in T-states from the fall of /INT */
+#define SIM_TSTATES_PER_LINE      224
+#define SIM_TSTATES_PER_FRAME     69888
+#define SIM_TOP_BORDER_TSTATES    (64*SIM_TSTATES_PER_LINE)
+#define SIM_DISPLAY_LINES         192
+#define SIM_ULA_FETCH_TSTATES     128
+#define SIM_LOWER_BORDER_TSTATES  (SIM_TOP_BORDER_TSTATES+SIM_DISPLAY_LINES*SIM_TSTATES_PER_LINE)
+
+typedef struct
+{
+  /*
+   * Shortest /WR the lower RAM accepts. 4116-15s are 150ns parts. Change it
+   * between frames to model the machine warming up.
+   */
+  uint32_t min_strobe_ns;
+
+  /* Time the code between the BLIPPER2 edges (on core 1) is charged, in microseconds */
+  uint32_t compute_us;
+
+  /* Z80 held in WAIT, so it never acknowledges BUSREQ */
+  bool     z80_stalled;
+
+  /* Z80 held in WAIT for this many T-states after /INT, by a slow peripheral */
+  uint32_t z80_wait_tstates;
+
+  /* /RESET held low. The Z80 doesn't acknowledge BUSREQ either */
+  bool     z80_reset;
+
+  /* The /INT handler is held off by up to this long, another handler's running */
+  uint32_t int_holdoff_us;
+
+  /* Z80 stalls longer than this are counted, 0 for none */
+  uint32_t stall_limit_us;
+} sim_config_t;
+
+typedef struct
+{
+  uint32_t frames;
+  uint64_t bus_master_cycles;    /* PIO cycles spent on run headers and bytes */
+  uint64_t bytes_written;
+  uint64_t bytes_read;
+  uint64_t clk_gated_bytes;      /* Written in CLK gated mode */
+  uint64_t clk_wait_cycles;      /* PIO cycles those spent waiting for the CLK edge */
+  uint32_t transfers;
+  uint32_t busreqs;
+  uint64_t busreq_latency_ticks; /* From /INT to the first BUSREQ of the frame */
+  uint64_t busreq_latency_max_ticks;
+  uint32_t busack_waits;
+  uint64_t busack_wait_tstates;
+  uint32_t busack_wait_max_tstates;
+  uint32_t stalls;               /* Times the Z80 gave up the bus, and for how long */
+  uint64_t stall_ticks;
+  uint64_t stall_max_ticks;
+  uint32_t long_stalls;          /* Longer than sim_config.stall_limit_us */
+  uint32_t frame_overruns;       /* Ungated transfer to 0x4000-0x7FFF going on into the display lines */
+  uint32_t missed_ints;          /* BUSREQ held as /INT fell, the Z80 doesn't see it */
+  uint64_t contended_writes;     /* DMA writes into 0x4000-0x7FFF while the ULA is fetching */
+  uint64_t contended_reads;      /* The same for DMA reads */
+  uint64_t short_strobe_writes;  /* DMA writes with /WR shorter than the RAM needs, lost */
+  uint64_t probe_short_strobes;  /* The same, from the strobe calibration's probes */
+  uint64_t z80_writes;
+  uint64_t snoop_hits;
+  uint64_t snoop_misses;         /* Z80 writes made with the snoop paused or its ring full */
+} sim_stats_t;
+
+/*
+ * The bus master's OUTs. The ULA's border isn't modelled, these are for
+ * checking when they happened. The workload empties it as it checks them.
+ */
+#define SIM_MAX_OUTS 1024
+
+typedef struct
+{
+  uint32_t tstate;               /* Of the fall of /WR, from the frame's /INT */
+  uint16_t port;
+  uint8_t  data;
+  uint32_t hold;                 /* The Z80's stalls so far, the same for OUTs in one hold */
+} sim_out_t;
+
+extern sim_config_t sim_config;
+extern sim_stats_t  sim_stats;
+extern uint8_t      sim_ram[0x10000];
+extern sim_out_t    sim_outs[SIM_MAX_OUTS];
+extern uint32_t     sim_out_count;
+
+void     sim_reset( void );
+uint64_t sim_now( void );
+void     sim_advance( uint64_t ticks );
+void     sim_begin_frame( uint32_t frame );
+uint64_t sim_frame_end( void );
+uint32_t sim_frame_tstate( void );
+
+void     sim_z80_write( uint32_t frame_tstate, uint16_t address, uint8_t data );
+void     sim_z80_out( uint32_t frame_tstate, uint16_t port, uint8_t data );
+
+/* An IN, now, from this device's port (see bus_port.h) or nothing */
+uint8_t  sim_z80_in( uint16_t port );
+
+/* The pending bus_hal_alarm_at_us() alarm, in ticks, or UINT64_MAX */
+uint64_t sim_next_alarm( void );
+
+/* When the running transfer's DMA IRQ comes in, in ticks, or UINT64_MAX */
+uint64_t sim_dma_end( void );
+void     sim_run_alarms( void );
+
+/*
+ * Code run between these is on core 1. The HAL calls it makes are charged
+ * to core 1 rather than moving the simulated time on; sim_core1_end()
+ * returns the ticks it took.
+ */
+void     sim_core1_begin( void );
+uint64_t sim_core1_end( void );
+
+#endif
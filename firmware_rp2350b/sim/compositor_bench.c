@@ -0,0 +1,281 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Host benchmark for compositor.c: a tile background with 8, 32 and 64
+ * 16x16 masked sprites bouncing about over it, some of them coloured,
+ * and a few tiles changing each frame.
+ *
+ * ./compositor_bench [frames]
+ *
+ * Every frame is also checked against a pixel at a time model which draws
+ * the whole screen from scratch, and every byte the compositor changes must
+ * be marked in the render map. Exits non-zero if anything is wrong. Host
+ * timings are only a guide to the RP2350's.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zx_display.h"
+#include "screen_dirty.h"
+#include "compositor.h"
+
+#define TILES         16
+#define SPRITE_COLS   2
+#define SPRITE_ROWS   16
+
+static uint8_t screen[ZX_DISPLAY_FILE_SIZE];
+static uint8_t model[ZX_DISPLAY_FILE_SIZE];
+static uint8_t before[ZX_DISPLAY_FILE_SIZE];
+
+static compositor_tile_t    tile_set[TILES];
+static uint8_t              tile_map[ZX_DISPLAY_CHAR_ROWS][ZX_DISPLAY_COLUMNS];
+static uint8_t              ball_data[SPRITE_ROWS*SPRITE_COLS*2];
+static compositor_graphic_t ball = { SPRITE_COLS, SPRITE_ROWS, ball_data };
+
+typedef struct
+{
+  compositor_sprite_t state;
+  int16_t             dx, dy;
+} mover_t;
+
+static mover_t  movers[COMPOSITOR_MAX_SPRITES];
+static uint32_t sprite_count;
+static uint32_t failures;
+
+static double now_us( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (ts.tv_sec*1e6) + (ts.tv_nsec/1e3);
+}
+
+/* A ball with a one pixel clear edge round it, the mask a pixel bigger than the ball */
+static void make_graphics( void )
+{
+  for( int32_t y = 0; y < SPRITE_ROWS; y++ )
+  {
+    for( int32_t x = 0; x < SPRITE_COLS*8; x++ )
+    {
+      int32_t  d2  = (2*x-15)*(2*x-15) + (2*y-15)*(2*y-15);
+      uint8_t *m   = &ball_data[(y*SPRITE_COLS + x/8)*2];
+      uint8_t  bit = 0x80 >> (x%8);
+
+      if( d2 > 15*15 )
+	m[0] |= bit;
+      if( (d2 <= 13*13) && ((x+y) & 1) )
+	m[1] |= bit;
+    }
+  }
+
+  for( uint32_t t = 0; t < TILES; t++ )
+  {
+    for( uint32_t i = 0; i < 8; i++ )
+      tile_set[t].pixels[i] = rand();
+    tile_set[t].attr = rand() & 0x7F;
+  }
+}
+
+/* Moves the sprites and changes a few tiles, as a game on the Z80 might */
+static void frame( uint32_t number )
+{
+  for( uint32_t i = 0; i < sprite_count; i++ )
+  {
+    mover_t *m = &movers[i];
+
+    m->state.x += m->dx;
+    m->state.y += m->dy;
+    if( (m->state.x < -8) || (m->state.x > 248) )
+      m->dx = -m->dx;
+    if( (m->state.y < -8) || (m->state.y > 184) )
+      m->dy = -m->dy;
+
+    compositor_set_sprite( i, &m->state );
+  }
+
+  for( uint32_t i = 0; i < 4; i++ )
+  {
+    uint32_t col = rand() % ZX_DISPLAY_COLUMNS, row = rand() % ZX_DISPLAY_CHAR_ROWS;
+
+    tile_map[row][col] = rand() % TILES;
+    compositor_set_tile( col, row, tile_map[row][col] );
+  }
+}
+
+/*
+ * Pixel model
+ */
+
+static void set_pixel( uint8_t *s, int32_t x, int32_t y, int v )
+{
+  uint8_t *p = &s[ZX_DISPLAY_ROW_OFFSET( y ) + (x/8)];
+  *p = (*p & ~(0x80 >> (x%8))) | (v ? (0x80 >> (x%8)) : 0);
+}
+
+static int get_pixel( const uint8_t *s, int32_t x, int32_t y )
+{
+  return (s[ZX_DISPLAY_ROW_OFFSET( y ) + (x/8)] >> (7-(x%8))) & 1;
+}
+
+static void draw_model( void )
+{
+  for( uint32_t row = 0; row < ZX_DISPLAY_CHAR_ROWS; row++ )
+  {
+    for( uint32_t col = 0; col < ZX_DISPLAY_COLUMNS; col++ )
+    {
+      const compositor_tile_t *t = &tile_set[tile_map[row][col]];
+
+      for( uint32_t line = 0; line < 8; line++ )
+	model[ZX_DISPLAY_ROW_OFFSET( row*8+line ) + col] = t->pixels[line];
+      model[ZX_DISPLAY_ATTR_ROW_OFFSET( row ) + col] = t->attr;
+    }
+  }
+
+  for( uint32_t i = 0; i < sprite_count; i++ )
+  {
+    const compositor_sprite_t  *s = &movers[i].state;
+    const compositor_graphic_t *g = s->graphic;
+
+    for( int32_t y = 0; y < g->rows; y++ )
+    {
+      for( int32_t x = 0; x < g->cols*8; x++ )
+      {
+	int32_t sx = s->x+x, sy = s->y+y;
+	if( (sx < 0) || (sx >= 256) || (sy < 0) || (sy >= 192) )
+	  continue;
+
+	const uint8_t *p    = &g->data[(y*g->cols + x/8)*2];
+	int            mask = (p[0] >> (7-(x%8))) & 1;
+	int            pix  = (p[1] >> (7-(x%8))) & 1;
+
+	set_pixel( model, sx, sy, (mask && get_pixel( model, sx, sy )) || pix );
+      }
+    }
+
+    /* The colour goes on every cell the sprite's box is in */
+    if( !s->coloured )
+      continue;
+
+    for( int32_t row = s->y >> 3; row <= (s->y + g->rows - 1) >> 3; row++ )
+    {
+      for( int32_t col = s->x >> 3; col <= (s->x + g->cols*8 - 1) >> 3; col++ )
+      {
+	if( (row >= 0) && (row < ZX_DISPLAY_CHAR_ROWS) && (col >= 0) && (col < ZX_DISPLAY_COLUMNS) )
+	  model[ZX_DISPLAY_ATTR_ROW_OFFSET( row ) + col] = s->attr;
+      }
+    }
+  }
+}
+
+static void check( uint32_t number )
+{
+  draw_model();
+
+  for( uint32_t i = 0; i < ZX_DISPLAY_FILE_SIZE; i++ )
+  {
+    if( screen[i] != model[i] )
+    {
+      printf( "FAIL %u sprites, frame %u: byte %u is %02X, should be %02X\n",
+	      sprite_count, number, i, screen[i], model[i] );
+      failures++;
+      return;
+    }
+
+    if( (screen[i] != before[i]) && !(screen_render_map[i >> 5] & (1u << (i & 31))) )
+    {
+      printf( "FAIL %u sprites, frame %u: byte %u changed but isn't marked\n", sprite_count, number, i );
+      failures++;
+      return;
+    }
+  }
+}
+
+static void run( uint32_t sprites, uint32_t frames )
+{
+  sprite_count = sprites;
+
+  memset( tile_map, 0, sizeof(tile_map) );
+  memset( screen,   0, sizeof(screen) );
+  compositor_init( tile_set, frame );
+
+  for( uint32_t i = 0; i < sprites; i++ )
+  {
+    mover_t *m = &movers[i];
+
+    m->state.x        = rand() % 240;
+    m->state.y        = rand() % 176;
+    m->state.graphic  = &ball;
+    m->state.coloured = (i % 4) == 0;
+    m->state.attr     = 0x40 | (i & 7);
+    m->dx             = (rand() % 5) - 2;
+    m->dy             = (rand() % 3) + 1;
+  }
+
+  /* The first frame draws everything */
+  compositor_render( screen );
+  double full_us = 0.0, total_us = 0.0, max_us = 0.0;
+  uint64_t bytes = 0;
+
+  compositor_redraw();
+  for( uint32_t i = 0; i <= frames; i++ )
+  {
+    memcpy( before, screen, sizeof(screen) );
+    memset( screen_render_map, 0, sizeof(screen_render_map) );
+
+    double start = now_us();
+    compositor_render( screen );
+    double took = now_us() - start;
+
+    check( i );
+
+    if( i == 0 )
+    {
+      full_us = took;
+      continue;
+    }
+
+    total_us += took;
+    bytes    += compositor_stats.last_bytes;
+    if( took > max_us )
+      max_us = took;
+  }
+
+  printf( "  %2u sprites  %8.2fus per frame, max %8.2fus, %6.1f cells and %6.1f bytes per frame, all cells %8.2fus\n",
+	  sprites, total_us/frames, max_us, (double)(compositor_stats.cells-2*ZX_DISPLAY_COLUMNS*ZX_DISPLAY_CHAR_ROWS)/frames,
+	  (double)bytes/frames, full_us );
+}
+
+int main( int argc, char *argv[] )
+{
+  uint32_t frames = (argc > 1) ? atoi( argv[1] ) : 1000;
+
+  srand( 1 );
+  make_graphics();
+
+  printf( "compositor, %u frames, 16x16 sprites, 4 tiles changed per frame\n", frames );
+  run( 8,  frames );
+  run( 32, frames );
+  run( 64, frames );
+
+  printf( "%u failures\n", failures );
+  return failures ? 1 : 0;
+}
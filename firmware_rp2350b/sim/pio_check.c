@@ -0,0 +1,1223 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Checks the bus master's PIO programs on the host.
+ *
+ * ./pio_check [directory with the .pio files]
+ *
+ * zx_bus_write.pio and zx_bus_read.pio are assembled here, into the same
+ * instruction words pioasm makes, and run a cycle at a time on a model of
+ * a state machine. The pins it drives are watched against a Spectrum's
+ * bus: the address and data have to be out before /MREQ falls and stay
+ * put until /MREQ and /WR (or /RD) go back high, and every byte has to be
+ * the right one at the right address. What it's timed at is checked
+ * against bus_master.h, which is where the sim and the scheduler get
+ * their timings from.
+ *
+ * The rewrites bus_master.c makes to the write program are made here the
+ * same way: every strobe bus_master_set_strobe_cycles() can set, the I/O
+ * write bus_master_out_blocking() does and CLK gated mode, that against a
+ * Z80 clock.
+ *
+ * Only what the two programs use is modelled: no side set, IRQs or EXEC.
+ * Exits non-zero if anything's wrong.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "gpios.h"
+#include "bus_master.h"
+
+#ifndef PIO_SOURCE_DIR
+#define PIO_SOURCE_DIR ".."
+#endif
+
+#define PIO_MAX_INSTRUCTIONS 32
+#define PIO_MAX_SYMBOLS      32
+#define PIO_NAME_LENGTH      32
+
+/* Longer than anything here should take, a stuck program stops at this */
+#define PIO_CHECK_MAX_CYCLES 100000
+
+/* A Z80 CLK for gated mode, 3.5MHz is about 43 PIO cycles */
+#define PIO_CHECK_CLK_HIGH   21
+#define PIO_CHECK_CLK_LOW    22
+
+static uint32_t failures;
+
+/* The pins are on the whole GPIO bank, they're all below 32 */
+#define PIN(gpio)            (1u << (gpio))
+#define LOW(pins, gpio)      (((pins) & PIN( gpio )) == 0)
+
+/*
+ * Assembler
+ */
+
+typedef struct
+{
+  char     name[PIO_NAME_LENGTH];
+  uint32_t value;
+} pio_symbol_t;
+
+typedef struct
+{
+  uint16_t     instructions[PIO_MAX_INSTRUCTIONS];
+  uint32_t     length;
+  uint32_t     wrap_target;
+  uint32_t     wrap;
+  pio_symbol_t labels[PIO_MAX_SYMBOLS];
+  uint32_t     num_labels;
+  pio_symbol_t defines[PIO_MAX_SYMBOLS];
+  uint32_t     num_defines;
+} pio_program_t;
+
+/* The instruction words, as the RP2350 datasheet has them */
+enum { PIO_JMP, PIO_WAIT, PIO_IN, PIO_OUT, PIO_PUSH_PULL, PIO_MOV, PIO_IRQ, PIO_SET };
+
+#define PIO_SRC_DEST_PINS    0
+#define PIO_SRC_DEST_X       1
+#define PIO_SRC_DEST_Y       2
+#define PIO_SRC_DEST_NULL    3
+#define PIO_SRC_DEST_PINDIRS 4
+#define PIO_SRC_DEST_ISR     6
+#define PIO_SRC_DEST_OSR     7
+
+/* MOV numbers them differently */
+#define PIO_MOV_PINS         0
+#define PIO_MOV_X            1
+#define PIO_MOV_Y            2
+#define PIO_MOV_NULL         3
+#define PIO_MOV_ISR          6
+#define PIO_MOV_OSR          7
+
+static uint16_t encode( uint32_t op, uint32_t arg1, uint32_t arg2 )
+{
+  return (uint16_t)((op << 13) | (arg1 << 5) | arg2);
+}
+
+/* The SDK's pio_encode_*() for what bus_master.c writes into the instruction memory */
+static uint16_t pio_encode_set( uint32_t value )      { return encode( PIO_SET, PIO_SRC_DEST_PINS, value ); }
+static uint16_t pio_encode_nop( void )                { return encode( PIO_MOV, PIO_MOV_Y, PIO_MOV_Y ); }
+static uint16_t pio_encode_delay( uint32_t cycles )   { return (uint16_t)(cycles << 8); }
+static uint16_t pio_encode_wait_gpio( bool polarity, uint32_t gpio )
+{
+  return encode( PIO_WAIT, polarity ? 4 : 0, gpio );
+}
+
+static bool find_symbol( const pio_symbol_t *symbols, uint32_t count, const char *name, uint32_t *value )
+{
+  for( uint32_t i = 0; i < count; i++ )
+  {
+    if( strcmp( symbols[i].name, name ) == 0 )
+    {
+      *value = symbols[i].value;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static uint32_t symbol( const pio_program_t *program, const char *name )
+{
+  uint32_t value;
+
+  if( find_symbol( program->labels, program->num_labels, name, &value ) ||
+      find_symbol( program->defines, program->num_defines, name, &value ) )
+    return value;
+
+  fprintf( stderr, "no symbol %s\n", name );
+  exit( 2 );
+}
+
+static bool add_symbol( pio_symbol_t *symbols, uint32_t *count, const char *name, uint32_t value )
+{
+  if( (*count == PIO_MAX_SYMBOLS) || (strlen( name ) >= PIO_NAME_LENGTH) )
+    return false;
+
+  strcpy( symbols[*count].name, name );
+  symbols[*count].value = value;
+  (*count)++;
+
+  return true;
+}
+
+static bool parse_value( const pio_program_t *program, const char *token, uint32_t *value )
+{
+  char *end;
+
+  if( (token[0] == '0') && (token[1] == 'b') )
+    *value = strtoul( token+2, &end, 2 );
+  else if( isdigit( (unsigned char)token[0] ) )
+    *value = strtoul( token, &end, 0 );
+  else
+    return find_symbol( program->defines, program->num_defines, token, value );
+
+  return *end == '\0';
+}
+
+/* Splits on white space and commas. Returns the number of tokens */
+static uint32_t tokenise( char *line, char *tokens[], uint32_t max )
+{
+  uint32_t count = 0;
+
+  for( char *token = strtok( line, " \t\r\n," ); token && (count < max); token = strtok( NULL, " \t\r\n," ) )
+    tokens[count++] = token;
+
+  return count;
+}
+
+static int src_dest( const char *name )
+{
+  static const char *names[] = { "pins", "x", "y", "null", "pindirs", "pc", "isr", "osr" };
+
+  for( int i = 0; i < 8; i++ )
+    if( strcmp( name, names[i] ) == 0 )
+      return i;
+
+  return -1;
+}
+
+static int mov_src_dest( const char *name )
+{
+  static const char *names[] = { "pins", "x", "y", "null", "", "status", "isr", "osr" };
+
+  for( int i = 0; i < 8; i++ )
+    if( names[i][0] && (strcmp( name, names[i] ) == 0) )
+      return i;
+
+  return -1;
+}
+
+/* One instruction, its delay already taken off. Returns -1 if it isn't understood */
+static int32_t assemble( const pio_program_t *program, char *tokens[], uint32_t count )
+{
+  const char *op = tokens[0];
+  uint32_t    value;
+
+  if( strcmp( op, "nop" ) == 0 )
+    return (count == 1) ? pio_encode_nop() : -1;
+
+  if( (strcmp( op, "pull" ) == 0) || (strcmp( op, "push" ) == 0) )
+  {
+    uint32_t pull     = (op[2] == 'l') ? 1 : 0;
+    uint32_t block    = 1;
+    uint32_t if_flag  = 0;
+
+    for( uint32_t i = 1; i < count; i++ )
+    {
+      if( strcmp( tokens[i], "noblock" ) == 0 )
+	block = 0;
+      else if( (strcmp( tokens[i], "iffull" ) == 0) || (strcmp( tokens[i], "ifempty" ) == 0) )
+	if_flag = 1;
+      else if( strcmp( tokens[i], "block" ) != 0 )
+	return -1;
+    }
+
+    return encode( PIO_PUSH_PULL, (pull << 2) | (if_flag << 1) | block, 0 );
+  }
+
+  if( strcmp( op, "jmp" ) == 0 )
+  {
+    static const char *conditions[] = { "", "!x", "x--", "!y", "y--", "x!=y", "pin", "!osre" };
+    uint32_t condition = 0;
+
+    if( count == 3 )
+    {
+      for( condition = 1; condition < 8; condition++ )
+	if( strcmp( tokens[1], conditions[condition] ) == 0 )
+	  break;
+      if( condition == 8 )
+	return -1;
+    }
+    else if( count != 2 )
+    {
+      return -1;
+    }
+
+    if( !find_symbol( program->labels, program->num_labels, tokens[count-1], &value ) &&
+	!parse_value( program, tokens[count-1], &value ) )
+      return -1;
+
+    return encode( PIO_JMP, condition, value );
+  }
+
+  if( strcmp( op, "wait" ) == 0 )
+  {
+    uint32_t polarity;
+
+    if( (count != 4) || !parse_value( program, tokens[1], &polarity ) || !parse_value( program, tokens[3], &value ) )
+      return -1;
+    if( strcmp( tokens[2], "gpio" ) != 0 )
+      return -1;
+
+    return pio_encode_wait_gpio( polarity != 0, value );
+  }
+
+  if( (strcmp( op, "in" ) == 0) || (strcmp( op, "out" ) == 0) )
+  {
+    int where = (count == 3) ? src_dest( tokens[1] ) : -1;
+
+    if( (where < 0) || !parse_value( program, tokens[2], &value ) || (value == 0) || (value > 32) )
+      return -1;
+
+    return encode( (op[0] == 'i') ? PIO_IN : PIO_OUT, where, value & 31 );
+  }
+
+  if( strcmp( op, "set" ) == 0 )
+  {
+    int where = (count == 3) ? src_dest( tokens[1] ) : -1;
+
+    if( (where < 0) || !parse_value( program, tokens[2], &value ) || (value > 31) )
+      return -1;
+
+    return encode( PIO_SET, where, value );
+  }
+
+  if( strcmp( op, "mov" ) == 0 )
+  {
+    if( count != 3 )
+      return -1;
+
+    const char *source    = tokens[2];
+    uint32_t    operation = 0;
+
+    if( (source[0] == '~') || (source[0] == '!') )
+    {
+      operation = 1;
+      source++;
+    }
+    else if( strncmp( source, "::", 2 ) == 0 )
+    {
+      operation = 2;
+      source += 2;
+    }
+
+    int dest = mov_src_dest( tokens[1] );
+    int src  = mov_src_dest( source );
+    if( (dest < 0) || (src < 0) || (dest == PIO_MOV_NULL) )
+      return -1;
+
+    return encode( PIO_MOV, dest, (operation << 3) | src );
+  }
+
+  return -1;
+}
+
+/*
+ * Assembles the program in a .pio file. The c-sdk block is passed over,
+ * as are directives which don't change the instructions.
+ */
+static bool load_program( const char *path, pio_program_t *program )
+{
+  FILE *f = fopen( path, "r" );
+  if( !f )
+  {
+    fprintf( stderr, "%s: can't open\n", path );
+    return false;
+  }
+
+  memset( program, 0, sizeof(*program) );
+
+  static char lines[128][160];
+  static char work[160];
+  uint32_t    addresses[128];
+  uint32_t    num_lines = 0;
+  bool        in_sdk    = false;
+  bool        wrapped   = false;
+  bool        ok        = true;
+
+  /* First pass, the labels, defines and where each instruction goes */
+  while( fgets( work, sizeof(work), f ) && ok )
+  {
+    char *comment = strchr( work, ';' );
+    if( comment )
+      *comment = '\0';
+
+    char *tokens[8];
+    char  line[160];
+    strcpy( line, work );
+    uint32_t count = tokenise( line, tokens, 8 );
+
+    if( count == 0 )
+      continue;
+
+    if( in_sdk )
+    {
+      in_sdk = (strcmp( tokens[0], "%}" ) != 0);
+      continue;
+    }
+
+    if( tokens[0][0] == '%' )
+    {
+      in_sdk = true;
+      continue;
+    }
+
+    uint32_t first = 0;
+    if( strcmp( tokens[0], "public" ) == 0 )
+      first = 1;
+
+    size_t length = (first < count) ? strlen( tokens[first] ) : 0;
+    if( (length > 1) && (tokens[first][length-1] == ':') )
+    {
+      tokens[first][length-1] = '\0';
+      ok = add_symbol( program->labels, &program->num_labels, tokens[first], program->length );
+      continue;
+    }
+
+    if( strcmp( tokens[0], ".define" ) == 0 )
+    {
+      uint32_t name = ((count == 4) && (strcmp( tokens[1], "PUBLIC" ) == 0)) ? 2 : 1;
+      uint32_t value;
+
+      ok = (name+2 == count) && parse_value( program, tokens[name+1], &value ) &&
+	   add_symbol( program->defines, &program->num_defines, tokens[name], value );
+      continue;
+    }
+
+    if( strcmp( tokens[0], ".wrap_target" ) == 0 )
+    {
+      program->wrap_target = program->length;
+      continue;
+    }
+
+    if( strcmp( tokens[0], ".wrap" ) == 0 )
+    {
+      program->wrap = program->length-1;
+      wrapped = true;
+      continue;
+    }
+
+    if( strcmp( tokens[0], ".program" ) == 0 )
+      continue;
+
+    if( tokens[0][0] == '.' )
+    {
+      fprintf( stderr, "%s: %s isn't modelled\n", path, tokens[0] );
+      ok = false;
+      continue;
+    }
+
+    if( (num_lines == 128) || (program->length == PIO_MAX_INSTRUCTIONS) )
+    {
+      ok = false;
+      continue;
+    }
+
+    strcpy( lines[num_lines], work );
+    addresses[num_lines++] = program->length++;
+  }
+
+  fclose( f );
+
+  if( !wrapped )
+    program->wrap = program->length-1;
+
+  /* Second pass, now the labels are known */
+  for( uint32_t i = 0; (i < num_lines) && ok; i++ )
+  {
+    char    *tokens[8];
+    uint32_t count = tokenise( lines[i], tokens, 8 );
+    uint32_t delay = 0;
+
+    /* The delay, which might or might not have a space before it */
+    char *bracket = strchr( tokens[count-1], '[' );
+    if( bracket )
+    {
+      delay = strtoul( bracket+1, NULL, 0 );
+      if( bracket == tokens[count-1] )
+	count--;
+      else
+	*bracket = '\0';
+    }
+
+    int32_t instruction = assemble( program, tokens, count );
+    if( (instruction < 0) || (delay > 31) )
+    {
+      fprintf( stderr, "%s: can't assemble \"%s\"\n", path, tokens[0] );
+      ok = false;
+      continue;
+    }
+
+    program->instructions[addresses[i]] = (uint16_t)instruction | pio_encode_delay( delay );
+  }
+
+  return ok;
+}
+
+/*
+ * State machine
+ */
+
+#define PIO_FIFO_LENGTH 256
+
+typedef struct
+{
+  uint16_t  instructions[PIO_MAX_INSTRUCTIONS];
+  uint32_t  wrap_target, wrap;
+
+  uint32_t  out_base, out_count;
+  uint32_t  set_base, set_count;
+  uint32_t  in_base;
+  bool      out_right, autopull;
+  bool      in_right, autopush;
+  uint32_t  pull_threshold, push_threshold;
+
+  uint32_t  pc, delay;
+  uint32_t  x, y, isr, osr;
+  uint32_t  isr_count, osr_count;
+  uint32_t  pins;
+  bool      stalled;
+
+  /* The FIFOs are longer than the hardware's, the DMA is never behind here */
+  uint32_t  tx[PIO_FIFO_LENGTH];
+  uint32_t  tx_head, tx_tail;
+  uint32_t  rx[PIO_FIFO_LENGTH];
+  uint32_t  rx_count;
+  uint32_t  rx_cycles[PIO_FIFO_LENGTH];
+} pio_sm_t;
+
+static void sm_init( pio_sm_t *sm, const pio_program_t *program, uint32_t start )
+{
+  memset( sm, 0, sizeof(*sm) );
+
+  memcpy( sm->instructions, program->instructions, sizeof(sm->instructions) );
+  sm->wrap_target = program->wrap_target;
+  sm->wrap        = program->wrap;
+  sm->pc          = start;
+
+  /* The OSR starts empty, the ISR with nothing shifted in */
+  sm->osr_count = 32;
+}
+
+static void sm_put( pio_sm_t *sm, uint32_t word )
+{
+  sm->tx[sm->tx_tail++ % PIO_FIFO_LENGTH] = word;
+}
+
+static bool sm_tx_empty( const pio_sm_t *sm )
+{
+  return sm->tx_head == sm->tx_tail;
+}
+
+static uint32_t pins_value( const pio_sm_t *sm, uint32_t gpios, uint32_t base, uint32_t count )
+{
+  uint32_t mask = (count == 32) ? 0xFFFFFFFF : ((1u << count)-1);
+
+  return (gpios >> base) & mask;
+}
+
+static void write_pins( pio_sm_t *sm, uint32_t value, uint32_t base, uint32_t count )
+{
+  uint32_t mask = ((count == 32) ? 0xFFFFFFFF : ((1u << count)-1)) << base;
+
+  sm->pins = (sm->pins & ~mask) | ((value << base) & mask);
+}
+
+static uint32_t shift_out( pio_sm_t *sm, uint32_t bits )
+{
+  uint32_t mask = (bits == 32) ? 0xFFFFFFFF : ((1u << bits)-1);
+  uint32_t data;
+
+  if( sm->out_right )
+  {
+    data    = sm->osr & mask;
+    sm->osr = (bits == 32) ? 0 : (sm->osr >> bits);
+  }
+  else
+  {
+    data    = (sm->osr >> (32-bits)) & mask;
+    sm->osr = (bits == 32) ? 0 : (sm->osr << bits);
+  }
+
+  sm->osr_count += bits;
+  if( sm->osr_count > 32 )
+    sm->osr_count = 32;
+
+  return data;
+}
+
+static void shift_in( pio_sm_t *sm, uint32_t data, uint32_t bits )
+{
+  uint32_t mask = (bits == 32) ? 0xFFFFFFFF : ((1u << bits)-1);
+
+  data &= mask;
+
+  if( sm->in_right )
+    sm->isr = ((bits == 32) ? 0 : (sm->isr >> bits)) | (data << (32-bits));
+  else
+    sm->isr = ((bits == 32) ? 0 : (sm->isr << bits)) | data;
+
+  sm->isr_count += bits;
+  if( sm->isr_count > 32 )
+    sm->isr_count = 32;
+}
+
+static uint32_t mov_source( const pio_sm_t *sm, uint32_t source, uint32_t gpios )
+{
+  switch( source )
+  {
+  case PIO_MOV_PINS: return pins_value( sm, gpios, sm->in_base, 32-sm->in_base );
+  case PIO_MOV_X:    return sm->x;
+  case PIO_MOV_Y:    return sm->y;
+  case PIO_MOV_NULL: return 0;
+  case PIO_MOV_ISR:  return sm->isr;
+  case PIO_MOV_OSR:  return sm->osr;
+  }
+
+  fprintf( stderr, "mov source %u isn't modelled\n", source );
+  exit( 2 );
+}
+
+/*
+ * One cycle. gpios is the level on every pin, as the state machine would
+ * sample it this cycle. An instruction which can't go ahead stalls, and
+ * its delay doesn't start until it does.
+ */
+static void sm_step( pio_sm_t *sm, uint32_t gpios, uint32_t cycle )
+{
+  if( sm->delay )
+  {
+    sm->delay--;
+    return;
+  }
+
+  uint16_t instruction = sm->instructions[sm->pc];
+  uint32_t op          = instruction >> 13;
+  uint32_t arg1        = (instruction >> 5) & 7;
+  uint32_t arg2        = instruction & 31;
+  uint32_t next        = (sm->pc == sm->wrap) ? sm->wrap_target : sm->pc+1;
+
+  sm->stalled = false;
+
+  switch( op )
+  {
+  case PIO_JMP:
+  {
+    bool taken = false;
+
+    switch( arg1 )
+    {
+    case 0: taken = true;                        break;
+    case 1: taken = (sm->x == 0);                break;
+    case 2: taken = (sm->x != 0); sm->x--;       break;
+    case 3: taken = (sm->y == 0);                break;
+    case 4: taken = (sm->y != 0); sm->y--;       break;
+    case 5: taken = (sm->x != sm->y);            break;
+    case 7: taken = (sm->osr_count < sm->pull_threshold); break;
+    default:
+      fprintf( stderr, "jmp pin isn't modelled\n" );
+      exit( 2 );
+    }
+
+    if( taken )
+      next = arg2;
+    break;
+  }
+
+  case PIO_WAIT:
+  {
+    uint32_t polarity = (instruction >> 7) & 1;
+    uint32_t source   = (instruction >> 5) & 3;
+
+    if( source != 0 )
+    {
+      fprintf( stderr, "only wait gpio is modelled\n" );
+      exit( 2 );
+    }
+
+    if( ((gpios >> arg2) & 1) != polarity )
+    {
+      sm->stalled = true;
+      return;
+    }
+    break;
+  }
+
+  case PIO_IN:
+  {
+    uint32_t bits = arg2 ? arg2 : 32;
+
+    if( sm->autopush && (sm->isr_count >= sm->push_threshold) && (sm->rx_count == PIO_FIFO_LENGTH) )
+    {
+      sm->stalled = true;
+      return;
+    }
+
+    uint32_t data;
+    switch( arg1 )
+    {
+    case PIO_SRC_DEST_PINS: data = pins_value( sm, gpios, sm->in_base, bits ); break;
+    case PIO_SRC_DEST_X:    data = sm->x;                                     break;
+    case PIO_SRC_DEST_Y:    data = sm->y;                                     break;
+    case PIO_SRC_DEST_NULL: data = 0;                                         break;
+    case PIO_SRC_DEST_ISR:  data = sm->isr;                                   break;
+    case PIO_SRC_DEST_OSR:  data = sm->osr;                                   break;
+    default:
+      fprintf( stderr, "in source %u isn't modelled\n", arg1 );
+      exit( 2 );
+    }
+
+    shift_in( sm, data, bits );
+
+    if( sm->autopush && (sm->isr_count >= sm->push_threshold) )
+    {
+      sm->rx_cycles[sm->rx_count] = cycle;
+      sm->rx[sm->rx_count++]      = sm->isr;
+      sm->isr       = 0;
+      sm->isr_count = 0;
+    }
+    break;
+  }
+
+  case PIO_OUT:
+  {
+    uint32_t bits = arg2 ? arg2 : 32;
+
+    if( sm->autopull && (sm->osr_count >= sm->pull_threshold) )
+    {
+      if( sm_tx_empty( sm ) )
+      {
+	sm->stalled = true;
+	return;
+      }
+
+      sm->osr       = sm->tx[sm->tx_head++ % PIO_FIFO_LENGTH];
+      sm->osr_count = 0;
+    }
+
+    uint32_t data = shift_out( sm, bits );
+
+    switch( arg1 )
+    {
+    case PIO_SRC_DEST_PINS: write_pins( sm, data, sm->out_base, sm->out_count ); break;
+    case PIO_SRC_DEST_X:    sm->x = data;                                       break;
+    case PIO_SRC_DEST_Y:    sm->y = data;                                       break;
+    case PIO_SRC_DEST_NULL:                                                     break;
+    default:
+      fprintf( stderr, "out destination %u isn't modelled\n", arg1 );
+      exit( 2 );
+    }
+    break;
+  }
+
+  case PIO_PUSH_PULL:
+  {
+    bool pull  = (instruction >> 7) & 1;
+    bool block = (instruction >> 5) & 1;
+
+    if( !pull || ((instruction >> 6) & 1) )
+    {
+      fprintf( stderr, "only pull is modelled\n" );
+      exit( 2 );
+    }
+
+    if( sm_tx_empty( sm ) )
+    {
+      if( block )
+      {
+	sm->stalled = true;
+	return;
+      }
+      sm->osr = sm->x;
+    }
+    else
+    {
+      sm->osr = sm->tx[sm->tx_head++ % PIO_FIFO_LENGTH];
+    }
+    sm->osr_count = 0;
+    break;
+  }
+
+  case PIO_MOV:
+  {
+    uint32_t operation = (arg2 >> 3) & 3;
+    uint32_t data      = mov_source( sm, arg2 & 7, gpios );
+
+    if( operation == 1 )
+      data = ~data;
+    else if( operation == 2 )
+    {
+      uint32_t reversed = 0;
+      for( uint32_t i = 0; i < 32; i++ )
+	reversed |= ((data >> i) & 1) << (31-i);
+      data = reversed;
+    }
+
+    switch( arg1 )
+    {
+    case PIO_MOV_PINS: write_pins( sm, data, sm->out_base, sm->out_count ); break;
+    case PIO_MOV_X:    sm->x = data;                                       break;
+    case PIO_MOV_Y:    sm->y = data;                                       break;
+    case PIO_MOV_ISR:  sm->isr = data; sm->isr_count = 0;                  break;
+    case PIO_MOV_OSR:  sm->osr = data; sm->osr_count = 0;                  break;
+    default:
+      fprintf( stderr, "mov destination %u isn't modelled\n", arg1 );
+      exit( 2 );
+    }
+    break;
+  }
+
+  case PIO_SET:
+    switch( arg1 )
+    {
+    case PIO_SRC_DEST_PINS: write_pins( sm, arg2, sm->set_base, sm->set_count ); break;
+    case PIO_SRC_DEST_X:    sm->x = arg2;                                       break;
+    case PIO_SRC_DEST_Y:    sm->y = arg2;                                       break;
+    default:
+      fprintf( stderr, "set destination %u isn't modelled\n", arg1 );
+      exit( 2 );
+    }
+    break;
+
+  default:
+    fprintf( stderr, "instruction 0x%04X isn't modelled\n", instruction );
+    exit( 2 );
+  }
+
+  sm->delay = (instruction >> 8) & 31;
+  sm->pc    = next;
+}
+
+/*
+ * The Spectrum's side
+ */
+
+typedef struct
+{
+  uint16_t address;
+  uint8_t  data;
+  uint32_t mreq_at;    /* /MREQ or /IORQ fell */
+  uint32_t strobe_at;  /* /WR or /RD fell */
+  uint32_t strobe;     /* ...and was low for */
+} pio_access_t;
+
+#define PIO_MAX_ACCESSES 64
+
+typedef struct
+{
+  pio_access_t accesses[PIO_MAX_ACCESSES];
+  uint32_t     num_accesses;
+  uint32_t     cycles;        /* From the first instruction to stalling at idle */
+  uint32_t     wrong;         /* Bus rules broken */
+} pio_bus_t;
+
+static uint8_t ram[0x10000];
+
+static void bus_wrong( pio_bus_t *bus, const char *name, uint32_t cycle, const char *what )
+{
+  if( bus->wrong++ == 0 )
+    printf( "  %s: %s at cycle %u\n", name, what, cycle );
+}
+
+static bool clk_high( uint32_t cycle )
+{
+  return (cycle % (PIO_CHECK_CLK_HIGH+PIO_CHECK_CLK_LOW)) < PIO_CHECK_CLK_HIGH;
+}
+
+/*
+ * Runs a state machine until it's back at idle with nothing left to do,
+ * watching its pins. driven is the pins it has, the rest are the
+ * Spectrum's: the CLK, and the data bus which the RAM drives on a read.
+ * strobe is /WR or /RD, select is /MREQ or /IORQ.
+ */
+static void run( const char *name, pio_sm_t *sm, uint32_t idle, uint32_t driven,
+		 uint32_t strobe, uint32_t select, uint32_t other, pio_bus_t *bus )
+{
+  uint32_t     previous = sm->pins | ~driven;
+  uint32_t     started  = UINT32_MAX;
+  pio_access_t current  = { 0 };
+  uint32_t     bus_mask = GPIO_ABUS_BITMASK | ((strobe == GPIO_Z80_WR) ? GPIO_DBUS_BITMASK : 0);
+
+  memset( bus, 0, sizeof(*bus) );
+
+  for( uint32_t cycle = 0; cycle < PIO_CHECK_MAX_CYCLES; cycle++ )
+  {
+    uint32_t level = (sm->pins & driven) | (~driven & ~(GPIO_DBUS_BITMASK | PIN( GPIO_Z80_CLK )));
+
+    if( clk_high( cycle ) )
+      level |= PIN( GPIO_Z80_CLK );
+
+    /* The RAM answers a read */
+    if( LOW( level, GPIO_Z80_RD ) && LOW( level, GPIO_Z80_MREQ ) )
+      level |= ram[(level & GPIO_ABUS_BITMASK) >> GPIO_ABUS_A0];
+
+    sm_step( sm, level, cycle );
+
+    if( (started == UINT32_MAX) && !sm->stalled )
+      started = cycle;
+
+    if( (started != UINT32_MAX) && sm->stalled && (sm->pc == idle) && sm_tx_empty( sm ) )
+    {
+      bus->cycles = cycle-started;
+      break;
+    }
+
+    /* The pins as they are after this cycle */
+    uint32_t now     = sm->pins | ~driven;
+    uint32_t changed = now ^ previous;
+
+    if( changed & PIN( other ) )
+      bus_wrong( bus, name, cycle, "the other strobe moved" );
+
+    if( (changed & bus_mask) && (LOW( previous, select ) || LOW( previous, strobe )) )
+      bus_wrong( bus, name, cycle, "the buses moved while they were being read" );
+
+    if( (changed & PIN( select )) && LOW( now, select ) )
+    {
+      current.mreq_at = cycle;
+      current.address = (now & GPIO_ABUS_BITMASK) >> GPIO_ABUS_A0;
+      current.data    = now & GPIO_DBUS_BITMASK;
+    }
+
+    if( (changed & PIN( strobe )) && LOW( now, strobe ) )
+    {
+      if( !LOW( now, select ) )
+	bus_wrong( bus, name, cycle, "strobe without a select" );
+      current.strobe_at = cycle;
+    }
+
+    if( (changed & PIN( strobe )) && !LOW( now, strobe ) )
+    {
+      if( !(changed & PIN( select )) || LOW( now, select ) )
+	bus_wrong( bus, name, cycle, "strobe and select didn't go back together" );
+
+      current.strobe = cycle-current.strobe_at;
+
+      if( strobe == GPIO_Z80_WR )
+	ram[current.address] = current.data;
+
+      if( bus->num_accesses < PIO_MAX_ACCESSES )
+	bus->accesses[bus->num_accesses++] = current;
+    }
+    else if( (changed & PIN( select )) && !LOW( now, select ) )
+    {
+      bus_wrong( bus, name, cycle, "select went without a strobe" );
+    }
+
+    previous = now;
+  }
+
+  if( bus->cycles == 0 )
+    bus_wrong( bus, name, PIO_CHECK_MAX_CYCLES, "never went back to idle" );
+}
+
+#define CHECK(name, what, got, expected)					\
+  do {									\
+    if( (uint32_t)(got) != (uint32_t)(expected) )			\
+    {									\
+      printf( "  %s: %s is %u, should be %u\n", name, what, (unsigned)(got), (unsigned)(expected) ); \
+      wrong++;								\
+    }									\
+  } while( 0 )
+
+/*
+ * Write engine
+ */
+
+static pio_program_t write_program;
+
+/* How bus_master.c has it, with the ROMCS bit of the SET pins not the PIO's */
+static const uint32_t WRITE_PINS = GPIO_ABUS_BITMASK | GPIO_DBUS_BITMASK | PIN( GPIO_Z80_WR ) | PIN( GPIO_Z80_MREQ );
+
+static void write_sm_init( pio_sm_t *sm )
+{
+  sm_init( sm, &write_program, symbol( &write_program, "idle" ) );
+
+  sm->out_base  = GPIO_DBUS_D0;
+  sm->out_count = 24;
+  sm->set_base  = GPIO_Z80_WR;
+  sm->set_count = 4;
+  sm->out_right = true;
+  sm->pull_threshold = 32;
+  sm->push_threshold = 32;
+
+  /* drive_bus_pins() sets the control lines high before it drives them */
+  sm->pins = PIN( GPIO_Z80_WR ) | PIN( GPIO_Z80_MREQ ) | PIN( GPIO_Z80_IORQ );
+}
+
+/* bus_master_set_strobe_cycles() */
+static void set_strobe( pio_sm_t *sm, uint32_t cycles, bool io )
+{
+  uint32_t delay  = cycles-2;
+  uint32_t first  = (delay > 31) ? 31 : delay;
+  uint32_t strobe = symbol( &write_program, "strobe" );
+
+  sm->instructions[strobe]   = pio_encode_set( symbol( &write_program, io ? "WR_IORQ_ACTIVE" : "WR_MREQ_ACTIVE" ) ) |
+                               pio_encode_delay( first );
+  sm->instructions[strobe+1] = pio_encode_nop() | pio_encode_delay( delay-first );
+}
+
+/* bus_master_set_clk_gated() */
+static void set_clk_gated( pio_sm_t *sm, bool gated, bool io )
+{
+  uint32_t gate = symbol( &write_program, "gate" );
+
+  if( gated )
+  {
+    sm->instructions[gate]   = pio_encode_wait_gpio( true,  GPIO_Z80_CLK );
+    sm->instructions[gate+1] = pio_encode_wait_gpio( false, GPIO_Z80_CLK );
+  }
+  else
+  {
+    sm->instructions[gate]   = pio_encode_set( symbol( &write_program, io ? "IORQ_ACTIVE" : "MREQ_ACTIVE" ) );
+    sm->instructions[gate+1] = pio_encode_nop();
+  }
+}
+
+static void put_write_run( pio_sm_t *sm, uint16_t address, const uint8_t *data, uint32_t length )
+{
+  sm_put( sm, address >> 8 );
+  sm_put( sm, address & 0xFF );
+  sm_put( sm, (length-1) >> 8 );
+  sm_put( sm, (length-1) & 0xFF );
+
+  for( uint32_t i = 0; i < length; i++ )
+    sm_put( sm, data[i] );
+}
+
+/*
+ * A run of writes. The bytes have to land at the addresses, with the
+ * strobe and the time per byte bus_master.h says, or in gated mode each
+ * byte's /MREQ and /WR on the cycle after a CLK falling edge. A strobe of
+ * 0 leaves the program's own, which should be BUS_MASTER_STROBE_CYCLES.
+ */
+static uint32_t check_write( const char *name, uint16_t address, uint32_t length,
+			     uint32_t strobe_cycles, bool io, bool gated, bool print )
+{
+  pio_sm_t  sm;
+  pio_bus_t bus;
+  uint8_t   data[PIO_MAX_ACCESSES];
+  uint32_t  wrong = 0;
+
+  write_sm_init( &sm );
+  if( strobe_cycles )
+    set_strobe( &sm, strobe_cycles, io );
+  else
+    strobe_cycles = BUS_MASTER_STROBE_CYCLES;
+  if( gated || io )
+    set_clk_gated( &sm, gated, io );
+
+  for( uint32_t i = 0; i < length; i++ )
+    data[i] = (uint8_t)((i*37) ^ 0xA5 ^ strobe_cycles);
+
+  put_write_run( &sm, address, data, length );
+
+  uint32_t select = io ? GPIO_Z80_IORQ : GPIO_Z80_MREQ;
+  run( name, &sm, symbol( &write_program, "idle" ), WRITE_PINS | (io ? PIN( GPIO_Z80_IORQ ) : 0),
+       GPIO_Z80_WR, select, io ? GPIO_Z80_MREQ : GPIO_Z80_IORQ, &bus );
+
+  wrong += bus.wrong;
+
+  uint32_t per_byte = BUS_MASTER_CYCLES_PER_BYTE - BUS_MASTER_STROBE_CYCLES + strobe_cycles;
+
+  CHECK( name, "bytes written", bus.num_accesses, length );
+
+  for( uint32_t i = 0; i < bus.num_accesses; i++ )
+  {
+    const pio_access_t *access = &bus.accesses[i];
+
+    CHECK( name, "address", access->address, (uint16_t)(address+i) );
+    CHECK( name, "data", access->data, data[i] );
+    CHECK( name, "strobe", access->strobe, strobe_cycles );
+
+    if( gated )
+    {
+      /* /WR on the cycle after the edge, the wait's own cycle */
+      CHECK( name, "/MREQ to /WR", access->strobe_at-access->mreq_at, 0 );
+      CHECK( name, "CLK fall to /WR", !clk_high( access->strobe_at-1 ) && clk_high( access->strobe_at-2 ), 1 );
+    }
+    else
+    {
+      /* /MREQ a cycle ahead, the nop after it */
+      CHECK( name, "/MREQ to /WR", access->strobe_at-access->mreq_at, 2 );
+      if( i > 0 )
+	CHECK( name, "cycles per byte", access->strobe_at-bus.accesses[i-1].strobe_at, per_byte );
+    }
+  }
+
+  if( !gated )
+    CHECK( name, "cycles", bus.cycles, BUS_MASTER_HEADER_CYCLES + length*per_byte );
+
+  if( print )
+    printf( "%-24s %2u bytes at 0x%04X, strobe %u, %u cycles%s\n", name, bus.num_accesses, address,
+	    bus.num_accesses ? bus.accesses[0].strobe : 0, bus.cycles, wrong ? ", WRONG" : "" );
+
+  return wrong;
+}
+
+static void check_write_engine( void )
+{
+  uint32_t wrong = 0;
+
+  failures += check_write( "write", 0x4000, 8, 0, false, false, true );
+  failures += check_write( "write over 0xFFFF", 0xFFFD, 6, 0, false, false, true );
+
+  /* Every strobe the calibration can set */
+  for( uint32_t cycles = BUS_MASTER_MIN_STROBE_CYCLES; cycles <= BUS_MASTER_MAX_STROBE_CYCLES; cycles++ )
+    wrong += check_write( "strobe", 0x5B00, 3, cycles, false, false, false );
+
+  printf( "%-24s %u to %u cycles%s\n", "strobes", BUS_MASTER_MIN_STROBE_CYCLES, BUS_MASTER_MAX_STROBE_CYCLES,
+	  wrong ? ", WRONG" : "" );
+  failures += wrong;
+
+  /* bus_master_out_blocking(), one byte to the port with the longest strobe, BUS_MASTER_OUT_CYCLES */
+  failures += check_write( "out", 0x00FE, 1, BUS_MASTER_MAX_STROBE_CYCLES, true, false, true );
+
+  failures += check_write( "CLK gated", 0x4000, 8, 0, false, true, true );
+}
+
+/*
+ * Read engine
+ */
+
+static pio_program_t read_program;
+
+static const uint32_t READ_PINS = GPIO_ABUS_BITMASK | PIN( GPIO_Z80_RD ) | PIN( GPIO_Z80_WR ) | PIN( GPIO_Z80_MREQ );
+
+static uint32_t check_read( const char *name, uint16_t address, uint32_t length )
+{
+  pio_sm_t  sm;
+  pio_bus_t bus;
+  uint32_t  wrong = 0;
+
+  sm_init( &sm, &read_program, symbol( &read_program, "idle" ) );
+
+  sm.out_base       = GPIO_ABUS_A0;
+  sm.out_count      = 16;
+  sm.set_base       = GPIO_Z80_RD;
+  sm.set_count      = 4;
+  sm.in_base        = GPIO_DBUS_D0;
+  sm.out_right      = true;
+  sm.autopull       = true;
+  sm.pull_threshold = 32;
+  sm.autopush       = true;
+  sm.push_threshold = 8;
+  sm.pins           = PIN( GPIO_Z80_RD ) | PIN( GPIO_Z80_WR ) | PIN( GPIO_Z80_MREQ );
+
+  sm_put( &sm, ~(uint32_t)address );
+  sm_put( &sm, length-1 );
+
+  for( uint32_t i = 0; i < length; i++ )
+    ram[(uint16_t)(address+i)] = (uint8_t)((i*53) ^ 0x3C);
+
+  run( name, &sm, symbol( &read_program, "idle" ), READ_PINS, GPIO_Z80_RD, GPIO_Z80_MREQ, GPIO_Z80_WR, &bus );
+
+  wrong += bus.wrong;
+
+  CHECK( name, "bytes read", sm.rx_count, length );
+  CHECK( name, "bus cycles", bus.num_accesses, length );
+
+  for( uint32_t i = 0; (i < sm.rx_count) && (i < bus.num_accesses); i++ )
+  {
+    const pio_access_t *access = &bus.accesses[i];
+
+    CHECK( name, "address", access->address, (uint16_t)(address+i) );
+    CHECK( name, "data", sm.rx[i] & 0xFF, (uint8_t)((i*53) ^ 0x3C) );
+    CHECK( name, "/MREQ to /RD", access->strobe_at-access->mreq_at, 0 );
+    CHECK( name, "access", sm.rx_cycles[i]-access->strobe_at, BUS_MASTER_READ_ACCESS_CYCLES );
+    if( i > 0 )
+      CHECK( name, "cycles per byte", access->strobe_at-bus.accesses[i-1].strobe_at, BUS_MASTER_READ_CYCLES_PER_BYTE );
+  }
+
+  CHECK( name, "cycles", bus.cycles, BUS_MASTER_READ_HEADER_CYCLES + length*BUS_MASTER_READ_CYCLES_PER_BYTE );
+
+  printf( "%-24s %2u bytes at 0x%04X, access %u, %u cycles%s\n", name, sm.rx_count, address,
+	  (bus.num_accesses && sm.rx_count) ? sm.rx_cycles[0]-bus.accesses[0].strobe_at : 0, bus.cycles,
+	  wrong ? ", WRONG" : "" );
+
+  return wrong;
+}
+
+/*
+ * What the assembler makes of some instructions, against pioasm's output
+ */
+static void check_assembler( void )
+{
+  static const struct { const char *source; uint16_t expected; } cases[] =
+  {
+    { "pull block",      0x80A0 },
+    { "nop",             0xA042 },
+    { "mov isr null",    0xA0C3 },
+    { "in osr 8",        0x40E8 },
+    { "mov y ~isr",      0xA04E },
+    { "mov pins ~y",     0xA00A },
+    { "out x 32",        0x6020 },
+    { "in pins 8",       0x4008 },
+    { "set pins 9",      0xE009 },
+    { "wait 1 gpio 24",  0x2098 },
+  };
+  uint32_t wrong = 0;
+
+  for( uint32_t i = 0; i < sizeof(cases)/sizeof(cases[0]); i++ )
+  {
+    char     line[64];
+    char    *tokens[8];
+
+    strcpy( line, cases[i].source );
+    uint32_t count       = tokenise( line, tokens, 8 );
+    int32_t  instruction = assemble( &write_program, tokens, count );
+
+    CHECK( "assembler", cases[i].source, instruction, cases[i].expected );
+  }
+
+  printf( "%-24s %u instructions, %u in zx_bus_read%s\n", "zx_bus_write", write_program.length,
+	  read_program.length, wrong ? ", assembler WRONG" : "" );
+  failures += wrong;
+
+  /* They share pio0's instruction memory */
+  uint32_t total = write_program.length + read_program.length;
+  if( total > PIO_MAX_INSTRUCTIONS )
+  {
+    printf( "  %u instructions between them, pio0 has %u\n", total, PIO_MAX_INSTRUCTIONS );
+    failures++;
+  }
+}
+
+int main( int argc, char *argv[] )
+{
+  const char *directory = (argc > 1) ? argv[1] : PIO_SOURCE_DIR;
+  char        path[512];
+
+  snprintf( path, sizeof(path), "%s/zx_bus_write.pio", directory );
+  if( !load_program( path, &write_program ) )
+    return 2;
+
+  snprintf( path, sizeof(path), "%s/zx_bus_read.pio", directory );
+  if( !load_program( path, &read_program ) )
+    return 2;
+
+  check_assembler();
+  check_write_engine();
+
+  failures += check_read( "read", 0x5B00, 8 );
+  failures += check_read( "read over 0xFFFF", 0xFFFE, 4 );
+
+  if( failures )
+    printf( "%u wrong\n", failures );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,335 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Host benchmark for screen_blit.c, against the byte at a time scroll loop
+ * the demo used to run in the /INT handler.
+ *
+ * ./screen_bench [iterations]
+ *
+ * Each kernel is also checked against a pixel at a time model, and every
+ * byte it changes must be marked in the render map. Exits non-zero if
+ * anything is wrong. Host timings are only a guide to the RP2350's.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zx_display.h"
+#include "screen_dirty.h"
+#include "screen_blit.h"
+
+static uint8_t screen[ZX_DISPLAY_FILE_SIZE] __attribute__((aligned(8)));
+static uint8_t model[ZX_DISPLAY_FILE_SIZE];
+static uint8_t before[ZX_DISPLAY_FILE_SIZE];
+
+/* The demo's original scroll loop, linear rows, a bit per byte */
+static void legacy_scroll_left( uint8_t *mirror )
+{
+  for( uint32_t scan_line = 0; scan_line < 192; scan_line++ )
+  {
+    uint8_t *scan_data = (mirror + (scan_line*32));
+    uint8_t left_pixel = ((*scan_data & 0x80) == 0x80);
+    uint8_t right_pixel = left_pixel;
+
+    for( int32_t char_count = 31; char_count >= 0; char_count-- )
+    {
+      uint8_t pixel_byte = *(scan_data+char_count);
+      left_pixel = ((pixel_byte & 0x80) == 0x80);
+
+      pixel_byte = pixel_byte << 1;
+      pixel_byte &= 0xFE;
+      pixel_byte |= right_pixel;
+      right_pixel = left_pixel;
+
+      if( *(scan_data+char_count) != pixel_byte )
+      {
+        *(scan_data+char_count) = pixel_byte;
+        screen_render_mark( (scan_data+char_count) - mirror );
+      }
+    }
+  }
+}
+
+static void fill_random( uint8_t *buffer )
+{
+  for( uint32_t i = 0; i < ZX_DISPLAY_FILE_SIZE; i++ )
+    buffer[i] = rand();
+}
+
+static double now_us( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (ts.tv_sec*1e6) + (ts.tv_nsec/1e3);
+}
+
+/*
+ * Pixel model
+ */
+
+static int get_pixel( const uint8_t *s, uint32_t x, uint32_t y )
+{
+  return (s[ZX_DISPLAY_ROW_OFFSET( y ) + (x/8)] >> (7-(x%8))) & 1;
+}
+
+static void set_pixel( uint8_t *s, uint32_t x, uint32_t y, int v )
+{
+  uint8_t *p = &s[ZX_DISPLAY_ROW_OFFSET( y ) + (x/8)];
+  *p = (*p & ~(0x80 >> (x%8))) | (v ? (0x80 >> (x%8)) : 0);
+}
+
+typedef enum { LEFT, RIGHT, UP, DOWN } direction_t;
+
+static void model_scroll( const screen_rect_t *r, uint32_t n, bool wrap, direction_t dir )
+{
+  uint32_t x0 = r->col*8, w = r->cols*8, y0 = r->row, h = r->rows;
+
+  memcpy( model, before, sizeof(model) );
+
+  for( uint32_t y = 0; y < h; y++ )
+  {
+    for( uint32_t x = 0; x < w; x++ )
+    {
+      int64_t sx = x, sy = y;
+      switch( dir )
+      {
+      case LEFT:  sx = (int64_t)x+n; break;
+      case RIGHT: sx = (int64_t)x-n; break;
+      case UP:    sy = (int64_t)y+n; break;
+      case DOWN:  sy = (int64_t)y-n; break;
+      }
+
+      int v;
+      if( wrap )
+	v = get_pixel( before, x0 + ((sx % w) + w) % w, y0 + ((sy % h) + h) % h );
+      else if( (sx < 0) || (sx >= w) || (sy < 0) || (sy >= h) )
+	v = 0;
+      else
+	v = get_pixel( before, x0+sx, y0+sy );
+
+      set_pixel( model, x0+x, y0+y, v );
+    }
+  }
+}
+
+static uint32_t failures = 0;
+
+static void check( const char *what )
+{
+  for( uint32_t i = 0; i < ZX_DISPLAY_FILE_SIZE; i++ )
+  {
+    if( screen[i] != model[i] )
+    {
+      printf( "FAIL %s: byte %u is %02X, should be %02X\n", what, i, screen[i], model[i] );
+      failures++;
+      return;
+    }
+
+    if( (screen[i] != before[i]) && !(screen_render_map[i >> 5] & (1u << (i & 31))) )
+    {
+      printf( "FAIL %s: byte %u changed but isn't marked\n", what, i );
+      failures++;
+      return;
+    }
+  }
+}
+
+static void check_scrolls( void )
+{
+  static const screen_rect_t rects[] =
+  {
+    { 0, 32, 0, 192 },
+    { 0, 32, 5, 50 },
+    { 3, 7, 10, 100 },
+    { 31, 1, 0, 192 },
+    { 8, 16, 64, 64 },
+  };
+  static const uint32_t amounts[] = { 1, 3, 7, 8, 9, 31, 32, 33, 63, 64, 65, 100, 255, 300 };
+
+  for( uint32_t r = 0; r < sizeof(rects)/sizeof(rects[0]); r++ )
+  {
+    for( uint32_t a = 0; a < sizeof(amounts)/sizeof(amounts[0]); a++ )
+    {
+      for( int wrap = 0; wrap < 2; wrap++ )
+      {
+	for( direction_t dir = LEFT; dir <= DOWN; dir++ )
+	{
+	  char what[80];
+	  snprintf( what, sizeof(what), "scroll %d by %u wrap %d rect %u", dir, amounts[a], wrap, r );
+
+	  fill_random( before );
+	  memcpy( screen, before, sizeof(screen) );
+	  memset( screen_render_map, 0, sizeof(screen_render_map) );
+
+	  switch( dir )
+	  {
+	  case LEFT:  screen_scroll_left( screen, &rects[r], amounts[a], wrap );  break;
+	  case RIGHT: screen_scroll_right( screen, &rects[r], amounts[a], wrap ); break;
+	  case UP:    screen_scroll_up( screen, &rects[r], amounts[a], wrap );    break;
+	  case DOWN:  screen_scroll_down( screen, &rects[r], amounts[a], wrap );  break;
+	  }
+
+	  model_scroll( &rects[r], amounts[a], wrap, dir );
+	  check( what );
+	}
+      }
+    }
+  }
+}
+
+static void check_attrs( void )
+{
+  static const screen_rect_t r = { 2, 20, 3, 15 };
+
+  for( uint32_t n = 1; n < 25; n += 5 )
+  {
+    for( int wrap = 0; wrap < 2; wrap++ )
+    {
+      fill_random( before );
+      memcpy( screen, before, sizeof(screen) );
+      memcpy( model, before, sizeof(model) );
+      memset( screen_render_map, 0, sizeof(screen_render_map) );
+
+      screen_attr_scroll_left( screen, &r, n, wrap, 0x47 );
+
+      for( uint32_t y = r.row; y < r.row+r.rows; y++ )
+      {
+	for( uint32_t x = 0; x < r.cols; x++ )
+	{
+	  uint32_t from = x+n;
+	  uint8_t  v    = wrap ? before[ZX_DISPLAY_ATTR_ROW_OFFSET( y )+r.col+(from % r.cols)] :
+	                  (from < r.cols) ? before[ZX_DISPLAY_ATTR_ROW_OFFSET( y )+r.col+from] : 0x47;
+	  model[ZX_DISPLAY_ATTR_ROW_OFFSET( y )+r.col+x] = v;
+	}
+      }
+      check( "attr scroll left" );
+
+      memcpy( before, screen, sizeof(before) );
+      memset( screen_render_map, 0, sizeof(screen_render_map) );
+      screen_attr_scroll_up( screen, &r, n, wrap, 0x47 );
+
+      memcpy( model, before, sizeof(model) );
+      for( uint32_t y = 0; y < r.rows; y++ )
+      {
+	uint32_t from = y+n;
+	for( uint32_t x = 0; x < r.cols; x++ )
+	{
+	  uint8_t v = wrap ? before[ZX_DISPLAY_ATTR_ROW_OFFSET( r.row+(from % r.rows) )+r.col+x] :
+	              (from < r.rows) ? before[ZX_DISPLAY_ATTR_ROW_OFFSET( r.row+from )+r.col+x] : 0x47;
+	  model[ZX_DISPLAY_ATTR_ROW_OFFSET( r.row+y )+r.col+x] = v;
+	}
+      }
+      check( "attr scroll up" );
+    }
+  }
+}
+
+static void check_copy( void )
+{
+  static const screen_rect_t r = { 1, 10, 20, 30 };
+
+  fill_random( before );
+  memcpy( screen, before, sizeof(screen) );
+  memcpy( model, before, sizeof(model) );
+  memset( screen_render_map, 0, sizeof(screen_render_map) );
+
+  /* Overlapping, down and to the right */
+  screen_copy( screen, 4, 35, screen, &r );
+
+  for( uint32_t y = 0; y < r.rows; y++ )
+    memcpy( model+ZX_DISPLAY_ROW_OFFSET( 35+y )+4, before+ZX_DISPLAY_ROW_OFFSET( r.row+y )+r.col, r.cols );
+
+  check( "copy" );
+}
+
+typedef void (*kernel_t)( void );
+
+static void run_legacy( void )    { legacy_scroll_left( screen ); }
+static void run_left1( void )     { screen_scroll_left( screen, &screen_whole, 1, true ); }
+static void run_right1( void )    { screen_scroll_right( screen, &screen_whole, 1, true ); }
+static void run_left12( void )    { screen_scroll_left( screen, &screen_whole, 12, true ); }
+static void run_up1( void )       { screen_scroll_up( screen, &screen_whole, 1, true ); }
+static void run_down8( void )     { screen_scroll_down( screen, &screen_whole, 8, true ); }
+static void run_narrow( void )
+{
+  static const screen_rect_t r = { 4, 24, 16, 160 };
+  screen_scroll_left( screen, &r, 1, true );
+}
+static void run_attr_up( void )   { screen_attr_scroll_up( screen, &screen_whole_attrs, 1, true, 0 ); }
+static void run_fill( void )      { screen_fill( screen, &screen_whole, rand() ); }
+
+static double bench( const char *name, kernel_t kernel, uint32_t iterations, double reference )
+{
+  fill_random( screen );
+
+  double start = now_us();
+  for( uint32_t i = 0; i < iterations; i++ )
+    kernel();
+  double each = (now_us()-start) / iterations;
+
+  if( reference > 0.0 )
+    printf( "  %-32s %8.2fus  %5.1fx\n", name, each, reference/each );
+  else
+    printf( "  %-32s %8.2fus\n", name, each );
+
+  return each;
+}
+
+int main( int argc, char *argv[] )
+{
+  uint32_t iterations = (argc > 1) ? atoi( argv[1] ) : 2000;
+
+  srand( 1 );
+
+  /* The kernel and the old loop must agree, the rows are the same set */
+  fill_random( before );
+  memcpy( screen, before, sizeof(screen) );
+  memcpy( model, before, sizeof(model) );
+  for( uint32_t i = 0; i < 50; i++ )
+  {
+    legacy_scroll_left( model );
+    screen_scroll_left( screen, &screen_whole, 1, true );
+  }
+  if( memcmp( screen, model, ZX_DISPLAY_FILE_PIXEL_SIZE ) != 0 )
+  {
+    printf( "FAIL kernel and old loop disagree\n" );
+    failures++;
+  }
+
+  check_scrolls();
+  check_attrs();
+  check_copy();
+
+  printf( "screen_blit, %u iterations, %u bit words\n", iterations, (unsigned)(sizeof(void *)*8) );
+  double reference = bench( "old loop, left 1 wrap", run_legacy, iterations, 0.0 );
+  bench( "left 1 wrap",               run_left1,   iterations, reference );
+  bench( "right 1 wrap",              run_right1,  iterations, reference );
+  bench( "left 12 wrap",              run_left12,  iterations, reference );
+  bench( "up 1 wrap",                 run_up1,     iterations, reference );
+  bench( "down 8 wrap",               run_down8,   iterations, reference );
+  bench( "left 1 wrap, 24x160 window", run_narrow, iterations, reference );
+  bench( "attributes up 1 wrap",      run_attr_up, iterations, reference );
+  bench( "fill",                      run_fill,    iterations, reference );
+
+  printf( "%u failures\n", failures );
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,477 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Checks snapshot_file.c on the host.
+ *
+ * ./snapshot_check                       The built in cases
+ * ./snapshot_check game.z80              Decode a file and print its registers
+ * ./snapshot_check game.z80 game.ram     ...and check it against 48K from
+ *                                        0x4000 saved by an emulator
+ *
+ * The built in cases are snapshots made here, from a known 48K and set of
+ * registers, in each of the formats: .sna, .z80 version 1 compressed and
+ * not, version 2 compressed and version 3 not, with a ROM page to pass
+ * over, and some which should be turned down. Each is decoded and checked
+ * byte for byte. The stub snapshot_stub() makes for them is run on a
+ * small Z80, which only knows its instructions, to see that it ends up
+ * at PC with every register right.
+ *
+ * Exits non-zero if anything's wrong.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot_file.h"
+
+static uint8_t         reference_ram[SNAPSHOT_RAM_SIZE];
+static snapshot_regs_t reference_regs;
+
+static uint8_t         file[SNAPSHOT_MAX_SIZE+1024];
+static uint8_t         ram[SNAPSHOT_RAM_SIZE];
+static uint32_t        failures;
+
+/*
+ * A screen's worth of runs, some ED bytes on their own, in pairs and in
+ * runs, and an ED just before a run, which the format doesn't let start
+ * a block; then noise
+ */
+static void make_reference( void )
+{
+  uint32_t seed = 12345;
+
+  for( uint32_t i = 0; i < SNAPSHOT_RAM_SIZE; i++ )
+  {
+    seed = seed*1103515245 + 12345;
+
+    if( i < 0x1B00 )
+      reference_ram[i] = (i & 0x100) ? 0x00 : (i >> 4);
+    else if( (i % 97) == 0 )
+      reference_ram[i] = 0xED;
+    else if( (i % 101) < 2 )
+      reference_ram[i] = 0xED;
+    else if( ((i % 211) >= 10) && ((i % 211) < 30) )
+      reference_ram[i] = ((i % 211) == 10) ? 0xED : 0x55;
+    else
+      reference_ram[i] = seed >> 24;
+  }
+
+  snapshot_regs_t *r = &reference_regs;
+  r->af = 0x1234; r->bc = 0x5678; r->de = 0x9ABC; r->hl = 0xDEF0;
+  r->af_alt = 0x1357; r->bc_alt = 0x2468; r->de_alt = 0x369C; r->hl_alt = 0x48AD;
+  r->ix = 0x5C3A; r->iy = 0x5C3B; r->sp = 0xFF40; r->pc = 0x8123;
+  r->i = 0x3F; r->r = 0x85; r->iff1 = 1; r->iff2 = 1; r->im = 1; r->border = 5;
+}
+
+static uint32_t put16( uint8_t *p, uint16_t w )
+{
+  p[0] = w & 0xFF;
+  p[1] = w >> 8;
+  return 2;
+}
+
+/* The .z80 compression, with its rule about the byte after a lone ED */
+static uint32_t compress( uint8_t *out, const uint8_t *in, uint32_t length )
+{
+  uint32_t o = 0;
+
+  for( uint32_t i = 0; i < length; )
+  {
+    uint32_t run = 1;
+    while( (i+run < length) && (in[i+run] == in[i]) && (run < 255) )
+      run++;
+
+    if( (run >= 5) || ((in[i] == 0xED) && (run >= 2)) )
+    {
+      out[o++] = 0xED; out[o++] = 0xED; out[o++] = run; out[o++] = in[i];
+      i += run;
+    }
+    else if( (in[i] == 0xED) && (i+1 < length) )
+    {
+      out[o++] = in[i++];
+      out[o++] = in[i++];
+    }
+    else
+    {
+      out[o++] = in[i++];
+    }
+  }
+
+  return o;
+}
+
+static uint32_t make_sna( void )
+{
+  const snapshot_regs_t *r = &reference_regs;
+  uint16_t sp = r->sp-2;
+
+  file[0] = r->i;
+  put16( &file[1],  r->hl_alt );
+  put16( &file[3],  r->de_alt );
+  put16( &file[5],  r->bc_alt );
+  put16( &file[7],  r->af_alt );
+  put16( &file[9],  r->hl );
+  put16( &file[11], r->de );
+  put16( &file[13], r->bc );
+  put16( &file[15], r->iy );
+  put16( &file[17], r->ix );
+  file[19] = r->iff2 << 2;
+  file[20] = r->r;
+  put16( &file[21], r->af );
+  put16( &file[23], sp );
+  file[25] = r->im;
+  file[26] = r->border;
+
+  /* The PC's on the stack, where it stays once it's been popped */
+  put16( &reference_ram[sp-0x4000], r->pc );
+  memcpy( &file[27], reference_ram, SNAPSHOT_RAM_SIZE );
+
+  return SNAPSHOT_SNA_SIZE;
+}
+
+static uint32_t z80_header( uint16_t pc, bool compressed )
+{
+  const snapshot_regs_t *r = &reference_regs;
+
+  file[0] = r->af >> 8;
+  file[1] = r->af & 0xFF;
+  put16( &file[2], r->bc );
+  put16( &file[4], r->hl );
+  put16( &file[6], pc );
+  put16( &file[8], r->sp );
+  file[10] = r->i;
+  file[11] = r->r & 0x7F;
+  file[12] = (r->r >> 7) | (r->border << 1) | (compressed ? 0x20 : 0);
+  put16( &file[13], r->de );
+  put16( &file[15], r->bc_alt );
+  put16( &file[17], r->de_alt );
+  put16( &file[19], r->hl_alt );
+  file[21] = r->af_alt >> 8;
+  file[22] = r->af_alt & 0xFF;
+  put16( &file[23], r->iy );
+  put16( &file[25], r->ix );
+  file[27] = r->iff1;
+  file[28] = r->iff2;
+  file[29] = r->im;
+
+  return 30;
+}
+
+static uint32_t make_z80_v1( bool compressed )
+{
+  uint32_t n = z80_header( reference_regs.pc, compressed );
+
+  if( !compressed )
+  {
+    memcpy( &file[n], reference_ram, SNAPSHOT_RAM_SIZE );
+    return n + SNAPSHOT_RAM_SIZE;
+  }
+
+  n += compress( &file[n], reference_ram, SNAPSHOT_RAM_SIZE );
+  memcpy( &file[n], "\x00\xED\xED\x00", 4 );
+  return n+4;
+}
+
+static uint32_t z80_page( uint32_t n, uint8_t page, const uint8_t *data, bool compressed )
+{
+  if( compressed )
+  {
+    uint32_t length = compress( &file[n+3], data, 0x4000 );
+    put16( &file[n], length );
+    file[n+2] = page;
+    return n+3+length;
+  }
+
+  put16( &file[n], 0xFFFF );
+  file[n+2] = page;
+  memcpy( &file[n+3], data, 0x4000 );
+  return n+3+0x4000;
+}
+
+/* Version 2 has 23 more bytes of header, version 3 54 or 55 */
+static uint32_t make_z80_v23( uint32_t extra, uint8_t machine, bool compressed, bool rom_page )
+{
+  static uint8_t rom[0x4000];
+
+  uint32_t n = z80_header( 0, false );
+
+  memset( &file[n], 0, 2+extra );
+  put16( &file[n], extra );
+  put16( &file[n+2], reference_regs.pc );
+  file[n+4] = machine;
+  n += 2+extra;
+
+  /* In an odd order, as some emulators write them */
+  n = z80_page( n, 5, &reference_ram[0x8000], compressed );
+  if( rom_page )
+    n = z80_page( n, 0, rom, compressed );
+  n = z80_page( n, 8, &reference_ram[0x0000], compressed );
+  n = z80_page( n, 4, &reference_ram[0x4000], compressed );
+
+  return n;
+}
+
+/*
+ * Enough of a Z80 for the stub. R counts instruction fetches, the prefixed
+ * ones count twice.
+ */
+typedef struct
+{
+  uint8_t  mem[0x10000];
+  uint16_t af, bc, de, hl, af_alt, bc_alt, de_alt, hl_alt, ix, iy, sp, pc;
+  uint8_t  i, r, iff1, im, border;
+  uint32_t steps;
+} z80_t;
+
+static z80_t z80;
+
+static uint8_t  fetch( void )    { return z80.mem[z80.pc++]; }
+static uint16_t fetch16( void )  { uint16_t w = fetch(); return w | (fetch() << 8); }
+static void     refresh( void )  { z80.r = (z80.r & 0x80) | ((z80.r+1) & 0x7F); }
+
+/* Runs to the JP, true if it got there on instructions it knows */
+static bool run_stub( uint16_t at )
+{
+  uint16_t swap;
+
+  z80.pc = at;
+  for( z80.steps = 0; z80.steps < 100; z80.steps++ )
+  {
+    uint8_t op = fetch();
+    refresh();
+
+    switch( op )
+    {
+    case 0x00: break;
+    case 0x01: z80.bc = fetch16(); break;
+    case 0x08: swap = z80.af; z80.af = z80.af_alt; z80.af_alt = swap; break;
+    case 0x11: z80.de = fetch16(); break;
+    case 0x21: z80.hl = fetch16(); break;
+    case 0x31: z80.sp = fetch16(); break;
+    case 0x3E: z80.af = (z80.af & 0xFF) | (fetch() << 8); break;
+    case 0xC3: z80.pc = fetch16(); return true;
+    case 0xD3: if( fetch() == 0xFE ) z80.border = (z80.af >> 8) & 7; break;
+    case 0xD9:
+      swap = z80.bc; z80.bc = z80.bc_alt; z80.bc_alt = swap;
+      swap = z80.de; z80.de = z80.de_alt; z80.de_alt = swap;
+      swap = z80.hl; z80.hl = z80.hl_alt; z80.hl_alt = swap;
+      break;
+    case 0xF1: z80.af = z80.mem[z80.sp] | (z80.mem[(uint16_t)(z80.sp+1)] << 8); z80.sp += 2; break;
+    case 0xF3: z80.iff1 = 0; break;
+    case 0xFB: z80.iff1 = 1; break;
+
+    case 0xDD:
+    case 0xFD:
+      refresh();
+      if( fetch() != 0x21 )
+	return false;
+      if( op == 0xDD )
+	z80.ix = fetch16();
+      else
+	z80.iy = fetch16();
+      break;
+
+    case 0xED:
+      refresh();
+      switch( fetch() )
+      {
+      case 0x46: z80.im = 0; break;
+      case 0x56: z80.im = 1; break;
+      case 0x5E: z80.im = 2; break;
+      case 0x47: z80.i = z80.af >> 8; break;
+      case 0x4F: z80.r = z80.af >> 8; break;
+      default:   return false;
+      }
+      break;
+
+    default:
+      return false;
+    }
+  }
+
+  return false;
+}
+
+#define CHECK(what, got, expected)					\
+  do {									\
+    if( (got) != (expected) )						\
+    {									\
+      printf( "  %s is 0x%04X, should be 0x%04X\n", what, (unsigned)(got), (unsigned)(expected) ); \
+      wrong++;								\
+    }									\
+  } while( 0 )
+
+static uint32_t compare_regs( const snapshot_regs_t *got, const snapshot_regs_t *r )
+{
+  uint32_t wrong = 0;
+
+  CHECK( "AF", got->af, r->af );         CHECK( "BC", got->bc, r->bc );
+  CHECK( "DE", got->de, r->de );         CHECK( "HL", got->hl, r->hl );
+  CHECK( "AF'", got->af_alt, r->af_alt ); CHECK( "BC'", got->bc_alt, r->bc_alt );
+  CHECK( "DE'", got->de_alt, r->de_alt ); CHECK( "HL'", got->hl_alt, r->hl_alt );
+  CHECK( "IX", got->ix, r->ix );         CHECK( "IY", got->iy, r->iy );
+  CHECK( "SP", got->sp, r->sp );         CHECK( "PC", got->pc, r->pc );
+  CHECK( "I", got->i, r->i );            CHECK( "R", got->r, r->r );
+  CHECK( "IFF1", got->iff1, r->iff1 );   CHECK( "IM", got->im, r->im );
+  CHECK( "border", got->border, r->border );
+
+  return wrong;
+}
+
+/* The stub goes where zx_snapshot.c puts it, in a ROM otherwise all 0xFF */
+#define STUB_AT 0x3A90
+
+static uint32_t check_stub( const snapshot_regs_t *regs )
+{
+  memset( &z80, 0, sizeof(z80) );
+  memset( z80.mem, 0xFF, sizeof(z80.mem) );
+  snapshot_stub( &z80.mem[STUB_AT], STUB_AT, regs );
+
+  if( !run_stub( STUB_AT ) )
+  {
+    printf( "  stub didn't run, stopped at 0x%04X\n", z80.pc );
+    return 1;
+  }
+
+  snapshot_regs_t got =
+  {
+    .af = z80.af, .bc = z80.bc, .de = z80.de, .hl = z80.hl,
+    .af_alt = z80.af_alt, .bc_alt = z80.bc_alt, .de_alt = z80.de_alt, .hl_alt = z80.hl_alt,
+    .ix = z80.ix, .iy = z80.iy, .sp = z80.sp, .pc = z80.pc,
+    .i = z80.i, .r = z80.r, .iff1 = z80.iff1, .im = z80.im, .border = z80.border,
+  };
+
+  return compare_regs( &got, regs );
+}
+
+static void check( const char *name, uint32_t length, snapshot_result_t expected )
+{
+  snapshot_regs_t   regs;
+  snapshot_result_t result = snapshot_decode( file, length, ram, &regs );
+  uint32_t          wrong  = 0;
+
+  if( result != expected )
+  {
+    printf( "%-24s %6u bytes, result %d, should be %d\n", name, length, result, expected );
+    failures++;
+    return;
+  }
+
+  if( result == SNAPSHOT_OK )
+  {
+    for( uint32_t i = 0; i < SNAPSHOT_RAM_SIZE; i++ )
+      wrong += (ram[i] != reference_ram[i]);
+
+    uint32_t regs_wrong = compare_regs( &regs, &reference_regs );
+    uint32_t stub_wrong = check_stub( &regs );
+
+    printf( "%-24s %6u bytes, %u bytes wrong, %u registers wrong, %u wrong after the stub (%u instructions)\n",
+	    name, length, wrong, regs_wrong, stub_wrong, z80.steps+1 );
+    wrong += regs_wrong + stub_wrong;
+  }
+  else
+  {
+    printf( "%-24s %6u bytes, turned down as it should be\n", name, length );
+  }
+
+  failures += (wrong != 0);
+}
+
+static void built_in( void )
+{
+  make_reference();
+
+  check( ".sna",                  make_sna(),                          SNAPSHOT_OK );
+  check( ".z80 v1",               make_z80_v1( false ),                SNAPSHOT_OK );
+  check( ".z80 v1 compressed",    make_z80_v1( true ),                 SNAPSHOT_OK );
+  check( ".z80 v2 compressed",    make_z80_v23( 23, 0, true, false ),  SNAPSHOT_OK );
+  check( ".z80 v3",               make_z80_v23( 54, 0, false, false ), SNAPSHOT_OK );
+  check( ".z80 v3 with ROM page", make_z80_v23( 55, 3, true, true ),   SNAPSHOT_OK );
+
+  check( ".z80 v3 128K",          make_z80_v23( 54, 4, true, false ),  SNAPSHOT_NOT_48K );
+  check( ".z80 v2 128K",          make_z80_v23( 23, 3, true, false ),  SNAPSHOT_NOT_48K );
+  check( ".z80 v1 cut short",     make_z80_v1( true )-1000,            SNAPSHOT_TRUNCATED );
+  check( ".z80 v3 page missing",  make_z80_v23( 54, 0, false, false )-0x4003, SNAPSHOT_TRUNCATED );
+
+  /* Other interrupt modes, and the R's top bit */
+  reference_regs.im = 2; reference_regs.iff1 = 0; reference_regs.iff2 = 0; reference_regs.r = 0x02;
+  check( ".z80 v1 IM 2, DI",      make_z80_v1( true ),                 SNAPSHOT_OK );
+}
+
+static uint32_t read_file( const char *path, uint8_t *buffer, uint32_t size )
+{
+  FILE *f = fopen( path, "rb" );
+  if( f == NULL )
+  {
+    perror( path );
+    exit( 1 );
+  }
+
+  uint32_t length = fread( buffer, 1, size, f );
+  fclose( f );
+
+  return length;
+}
+
+int main( int argc, char *argv[] )
+{
+  if( argc == 1 )
+  {
+    built_in();
+    return failures ? 1 : 0;
+  }
+
+  snapshot_regs_t   regs;
+  uint32_t          length = read_file( argv[1], file, sizeof(file) );
+  snapshot_result_t result = snapshot_decode( file, length, ram, &regs );
+
+  if( result != SNAPSHOT_OK )
+  {
+    fprintf( stderr, "%s: not decoded, result %d\n", argv[1], result );
+    return 1;
+  }
+
+  printf( "AF %04X BC %04X DE %04X HL %04X  AF' %04X BC' %04X DE' %04X HL' %04X\n",
+	  regs.af, regs.bc, regs.de, regs.hl, regs.af_alt, regs.bc_alt, regs.de_alt, regs.hl_alt );
+  printf( "IX %04X IY %04X SP %04X PC %04X  I %02X R %02X IFF1 %u IFF2 %u IM %u border %u\n",
+	  regs.ix, regs.iy, regs.sp, regs.pc, regs.i, regs.r, regs.iff1, regs.iff2, regs.im, regs.border );
+
+  failures += (check_stub( &regs ) != 0);
+
+  if( argc > 2 )
+  {
+    static uint8_t expected[SNAPSHOT_RAM_SIZE];
+    if( read_file( argv[2], expected, sizeof(expected) ) != SNAPSHOT_RAM_SIZE )
+    {
+      fprintf( stderr, "%s: should be 48K\n", argv[2] );
+      return 1;
+    }
+
+    uint32_t wrong = 0;
+    for( uint32_t i = 0; i < SNAPSHOT_RAM_SIZE; i++ )
+      wrong += (ram[i] != expected[i]);
+
+    printf( "%u bytes differ from %s\n", wrong, argv[2] );
+    failures += (wrong != 0);
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Prints percentiles and histograms of a frame trace, see frame_trace.h.
+ *
+ * ./trace_decode /dev/ttyACM0     Ask the board for its trace
+ * ./trace_decode trace.bin        Or read one saved earlier, or by zx_dma_sim
+ *
+ * The /INT handler's latency isn't measured on the board, there's nothing
+ * to timestamp the edge. The ULA's frames are evenly spaced, so a line is
+ * fitted through the handler's start times and the latency given is how
+ * far each is behind the line, over the best of them.
+ *
+ * Exits non-zero if the trace couldn't be read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "frame_trace.h"
+
+static int read_all( int fd, void *buffer, size_t length )
+{
+  uint8_t *p = buffer;
+
+  while( length )
+  {
+    ssize_t got = read( fd, p, length );
+    if( got <= 0 )
+      return -1;
+
+    p      += got;
+    length -= got;
+  }
+
+  return 0;
+}
+
+/* A serial port is put in raw mode and asked for the trace */
+static int open_trace( const char *path )
+{
+  int fd = open( path, O_RDWR | O_NOCTTY );
+  if( fd < 0 )
+    fd = open( path, O_RDONLY );
+  if( fd < 0 )
+    return -1;
+
+  if( isatty( fd ) )
+  {
+    struct termios tio;
+
+    tcgetattr( fd, &tio );
+    cfmakeraw( &tio );
+    tio.c_cc[VMIN]  = 0;
+    tio.c_cc[VTIME] = 20;
+    tcsetattr( fd, TCSANOW, &tio );
+    tcflush( fd, TCIOFLUSH );
+
+    char request = FRAME_TRACE_REQUEST;
+    if( write( fd, &request, 1 ) != 1 )
+      return -1;
+  }
+
+  return fd;
+}
+
+static int compare( const void *a, const void *b )
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+#define HISTOGRAM_BUCKETS 10
+#define HISTOGRAM_WIDTH   50
+
+/* Sorts the values */
+static void report( const char *name, const char *unit, double *values, uint32_t count )
+{
+  static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+  printf( "%s, %s, %u frames\n", name, unit, count );
+  if( count == 0 )
+  {
+    printf( "\n" );
+    return;
+  }
+
+  qsort( values, count, sizeof(double), compare );
+
+  printf( "  min %.2f", values[0] );
+  for( uint32_t i = 0; i < sizeof(percentiles)/sizeof(percentiles[0]); i++ )
+    printf( "  p%g %.2f", percentiles[i], values[(uint32_t)((count-1)*percentiles[i]/100.0)] );
+  printf( "  max %.2f\n", values[count-1] );
+
+  double   low   = values[0];
+  double   width = (values[count-1]-low) / HISTOGRAM_BUCKETS;
+  uint32_t buckets[HISTOGRAM_BUCKETS] = { 0 };
+  uint32_t most  = 0;
+
+  for( uint32_t i = 0; i < count; i++ )
+  {
+    uint32_t b = (width > 0) ? (uint32_t)((values[i]-low)/width) : 0;
+    if( b >= HISTOGRAM_BUCKETS )
+      b = HISTOGRAM_BUCKETS-1;
+
+    buckets[b]++;
+    if( buckets[b] > most )
+      most = buckets[b];
+  }
+
+  for( uint32_t b = 0; b < HISTOGRAM_BUCKETS; b++ )
+  {
+    if( (width == 0) && (b > 0) )
+      break;
+
+    printf( "  %10.2f %6u ", low + b*width, buckets[b] );
+    for( uint32_t i = 0; i < (buckets[b]*HISTOGRAM_WIDTH + most-1)/most; i++ )
+      putchar( '#' );
+    putchar( '\n' );
+  }
+  printf( "\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+  if( argc != 2 )
+  {
+    fprintf( stderr, "Usage: %s <serial port or trace file>\n", argv[0] );
+    return 1;
+  }
+
+  int fd = open_trace( argv[1] );
+  if( fd < 0 )
+  {
+    perror( argv[1] );
+    return 1;
+  }
+
+  frame_trace_header_t header;
+  if( (read_all( fd, &header, sizeof(header) ) != 0) || (header.magic != FRAME_TRACE_MAGIC) )
+  {
+    fprintf( stderr, "%s: no frame trace\n", argv[1] );
+    return 1;
+  }
+
+  if( (header.version != FRAME_TRACE_VERSION) || (header.record_size != sizeof(frame_trace_t)) ||
+      (header.cycles_hz == 0) )
+  {
+    fprintf( stderr, "%s: frame trace version %u, record size %u, not understood\n",
+	     argv[1], header.version, header.record_size );
+    return 1;
+  }
+
+  uint32_t       count   = header.records;
+  frame_trace_t *records = malloc( count*sizeof(frame_trace_t) + 1 );
+  if( read_all( fd, records, count*sizeof(frame_trace_t) ) != 0 )
+  {
+    fprintf( stderr, "%s: frame trace cut short\n", argv[1] );
+    return 1;
+  }
+  close( fd );
+
+  double   us_per_cycle = 1000000.0 / header.cycles_hz;
+  double  *latency   = calloc( count+1, sizeof(double) );
+  double  *busreq    = calloc( count+1, sizeof(double) );
+  double  *busack    = calloc( count+1, sizeof(double) );
+  double  *transfer  = calloc( count+1, sizeof(double) );
+  double  *bytes     = calloc( count+1, sizeof(double) );
+  double  *frame_at  = calloc( count+1, sizeof(double) );
+  double  *frame_num = calloc( count+1, sizeof(double) );
+  uint32_t requested = 0, transferred = 0, missing = 0, busy = 0, calibrated = 0, overruns = 0;
+  uint32_t timeouts = 0, resetting = 0;
+
+  /* Both the frame number and the cycle count wrap */
+  double at = 0, num = 0;
+  for( uint32_t i = 0; i < count; i++ )
+  {
+    const frame_trace_t *t = &records[i];
+
+    if( i > 0 )
+    {
+      uint16_t frames = t->frame - records[i-1].frame;
+
+      at      += (uint32_t)(t->int_cycles - records[i-1].int_cycles) * us_per_cycle;
+      num     += frames;
+      missing += frames-1;
+    }
+    frame_at[i]  = at;
+    frame_num[i] = num;
+
+    if( t->busreq_cycles != 0xFFFF )
+    {
+      busreq[requested] = t->busreq_cycles * us_per_cycle;
+      busack[requested] = t->busack_cycles * us_per_cycle;
+      requested++;
+    }
+
+    if( t->windows )
+    {
+      transfer[transferred] = t->transfer_cycles * us_per_cycle;
+      bytes[transferred]    = t->bytes;
+      transferred++;
+    }
+
+    busy       += (t->flags & FRAME_TRACE_BUSY) != 0;
+    calibrated += (t->flags & FRAME_TRACE_CALIBRATED) != 0;
+    overruns   += (t->flags & FRAME_TRACE_OVERRUN) != 0;
+    timeouts   += (t->flags & FRAME_TRACE_TIMEOUT) != 0;
+    resetting  += (t->flags & FRAME_TRACE_RESET) != 0;
+  }
+
+  /* Least squares line through the handler's start times */
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for( uint32_t i = 0; i < count; i++ )
+  {
+    sx  += frame_num[i];
+    sy  += frame_at[i];
+    sxx += frame_num[i]*frame_num[i];
+    sxy += frame_num[i]*frame_at[i];
+  }
+
+  double period = 0, origin = count ? sy/count : 0;
+  if( (count > 1) && ((count*sxx - sx*sx) != 0) )
+  {
+    period = (count*sxy - sx*sy) / (count*sxx - sx*sx);
+    origin = (sy - period*sx) / count;
+  }
+
+  double best = 0;
+  for( uint32_t i = 0; i < count; i++ )
+  {
+    latency[i] = frame_at[i] - (origin + period*frame_num[i]);
+    if( (i == 0) || (latency[i] < best) )
+      best = latency[i];
+  }
+  for( uint32_t i = 0; i < count; i++ )
+    latency[i] -= best;
+
+  printf( "%u frames at %u Hz, frame period %.3fus, %u frames not traced\n",
+	  count, header.cycles_hz, period, missing );
+  printf( "%u busy at /INT, %u calibrations, %u window overruns\n", busy, calibrated, overruns );
+  printf( "%u with BUSACK timeouts, %u in or just after a reset\n\n", timeouts, resetting );
+
+  report( "/INT handler latency, over the best", "us", latency,  count );
+  report( "/INT handler to BUSREQ",             "us", busreq,   requested );
+  report( "BUSREQ to BUSACK, longest",          "us", busack,   requested );
+  report( "Transfer time",                      "us", transfer, transferred );
+  report( "Bytes moved",                        "bytes", bytes, transferred );
+
+  return 0;
+}
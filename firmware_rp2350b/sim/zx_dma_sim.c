@@ -0,0 +1,1535 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Runs the firmware's /INT handler and snoop drain against the simulated
+ * Spectrum in bus_hal_sim.c, on a Linux box.
+ *
+ * mkdir build && cd build
+ * cmake ..
+ * make
+ * ./zx_dma_sim [static|statusbar|scroll|typing|flood|mixed|bulk|bulkclk|capture|upper|jobs|warm|reset|shadow|tape|snapshot|sprites|mailbox|ports|copper|clock|burst] [frames] [trace file]
+ *
+ * The trace file is the frame trace, as the board would send it. Read it
+ * with trace_decode.
+ *
+ * Exits non-zero if any write was corrupted or the mirror and the
+ * simulated Spectrum RAM don't agree at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpios.h"
+#include "bus_hal.h"
+#include "zx_display.h"
+#include "zx_dma.h"
+#include "bus_master.h"
+#include "screen_dirty.h"
+#include "bus_snoop.h"
+#include "frame_sched.h"
+#include "strobe_cal.h"
+#include "frame_trace.h"
+#include "job_queue.h"
+#include "zx_shadow.h"
+#include "zx_tape.h"
+#include "zx_snapshot.h"
+#include "compositor.h"
+#include "zx_mailbox.h"
+#include "bus_port.h"
+#include "zx_port.h"
+#include "bus_rom.h"
+#include "copper.h"
+#include "frame_clock.h"
+
+/* Offset into the display file of pixel byte x (0-31) on pixel row y (0-191) */
+static uint32_t pixel_offset( uint32_t x, uint32_t y )
+{
+  return ((y & 0xC0) << 5) | ((y & 0x07) << 8) | ((y & 0x38) << 2) | x;
+}
+
+/* Number of frames core 1 has been asked to draw */
+static uint32_t render_count;
+
+static void screen_poke( uint8_t *screen, uint32_t offset, uint8_t value )
+{
+  if( screen[offset] != value )
+  {
+    screen[offset] = value;
+    screen_render_mark( offset );
+  }
+}
+
+/* The RP2350 updates an 8 character counter in the bottom right corner */
+static void render_statusbar( uint8_t *screen )
+{
+  for( uint32_t y = 184; y < 192; y++ )
+  {
+    for( uint32_t x = 24; x < 32; x++ )
+      screen_poke( screen, pixel_offset( x, y ), (render_count >> ((31-x)*2)) & 0x03 ? 0x7E : 0x42 );
+  }
+}
+
+/* A picture is drawn, then the scroll demo takes over */
+static void render_scroll( uint8_t *screen )
+{
+  for( uint32_t i = 0; i < ZX_DISPLAY_FILE_PIXEL_SIZE; i++ )
+    screen_poke( screen, i, (i & 0x04) ? 0xF0 : 0x0F );
+
+  for( uint32_t i = 0; i < ZX_DISPLAY_FILE_ATTRIBUTE_SIZE; i++ )
+    screen_poke( screen, ZX_DISPLAY_FILE_PIXEL_SIZE+i, 0x38 );
+
+  zx_dma_start_demo();
+}
+
+/* The Z80 prints a character a frame, the snoop has to catch it */
+static void workload_typing( uint32_t frame )
+{
+  uint32_t column = frame % 32;
+  uint32_t row    = (frame / 32) % 24;
+
+  for( uint32_t y = 0; y < 8; y++ )
+  {
+    uint32_t offset = pixel_offset( column, row*8 + y );
+    sim_z80_write( 20000 + y*100, ZX_DISPLAY_FILE_ADDRESS+offset, 0x3C ^ (frame+y) );
+  }
+}
+
+/*
+ * The Z80 writes as fast as it can (PUSH, 2 bytes per 11T), mostly above
+ * the screen. This is the snoop ring's worst case. It stops short of the
+ * end of the frame to leave room for the Z80 being held off the bus, as a
+ * program which HALTs each frame would.
+ */
+static void workload_flood( uint32_t frame )
+{
+  for( uint32_t t = 0; t+11 < SIM_TSTATES_PER_FRAME-SIM_TOP_BORDER_TSTATES; t += 11 )
+  {
+    uint16_t address = 0x8000 + ((t/11)*2 & 0x3FFF);
+    uint8_t  data    = frame+t;
+
+    /* Every 64th PUSH lands on the screen */
+    if( ((t/11) & 0x3F) == 0 )
+      address = ZX_DISPLAY_FILE_ADDRESS + ((t/11) % (ZX_DISPLAY_FILE_SIZE-1));
+
+    sim_z80_write( t,   address+1, data );
+    sim_z80_write( t+5, address,   data^0xFF );
+  }
+}
+
+/*
+ * The machine warms up: the strobe the RAM needs goes from 150ns to 200ns
+ * over 1500 frames. The strobe calibrated cold wouldn't last that long.
+ */
+static void workload_warm( uint32_t frame )
+{
+  sim_config.min_strobe_ns = 150 + (frame/30);
+}
+
+/*
+ * The RP2350 sends a block of data to the RAM above the display file,
+ * 0x5B00 to 0xBFFF, on top of the scroll demo's full screen. That's more
+ * than the borders of one frame hold, so it spills from window to window.
+ * The block changes each time the last one has gone.
+ */
+#define BULK_ADDRESS (ZX_DISPLAY_FILE_ADDRESS+ZX_DISPLAY_FILE_SIZE)
+#define BULK_SIZE    (0xC000-BULK_ADDRESS)
+
+static uint8_t  bulk_block[BULK_SIZE];
+static bool     bulk_queued;
+static uint32_t bulk_blocks;
+
+static void bulk_done( void *context )
+{
+  bulk_queued = false;
+  bulk_blocks++;
+}
+
+static void workload_bulk( uint32_t frame )
+{
+  if( bulk_queued )
+    return;
+
+  for( uint32_t i = 0; i < BULK_SIZE; i++ )
+    bulk_block[i] = frame + (i*7);
+
+  bulk_queued = frame_sched_add( BULK_ADDRESS, bulk_block, BULK_SIZE, bulk_done, NULL );
+}
+
+/*
+ * The same again in burst mode. The Z80 shouldn't be stopped for longer
+ * than the longest hold, allowing for the transfer's setup and
+ * finishing, the strobe calibrations included.
+ */
+#define BURST_HOLD_US       400
+#define BURST_GAP_TSTATES   350
+#define BURST_STALL_SLACK_US 10
+
+static void workload_burst( uint32_t frame )
+{
+  if( frame == 0 )
+  {
+    zx_dma_set_burst( BURST_HOLD_US, BURST_GAP_TSTATES );
+    sim_config.stall_limit_us = BURST_HOLD_US + BURST_STALL_SLACK_US;
+  }
+
+  workload_bulk( frame );
+}
+
+/*
+ * The Z80 is held in WAIT for a few frames, so BUSACK never comes, then
+ * the Spectrum is reset. Nothing should hang, and once the hold off after
+ * the reset is over the mirror goes out in full.
+ */
+static void workload_reset( uint32_t frame )
+{
+  sim_config.z80_stalled = (frame >= 60) && (frame < 64);
+  sim_config.z80_reset   = (frame >= 100) && (frame < 103);
+
+  if( !sim_config.z80_stalled && !sim_config.z80_reset )
+    workload_typing( frame );
+}
+
+/*
+ * The RP2350 sends 32K to the upper RAM, 0x8000 to 0xFFFF, on top of the
+ * scroll demo. None of it is contended, so it goes during the display
+ * lines as well as in what the screen leaves of the borders.
+ *
+ * Each time the strobe's due to be calibrated the Z80 is held in WAIT
+ * through the top border, so the calibration has to wait for the lower
+ * border rather than going in with the upper RAM during the display lines.
+ */
+#define UPPER_WAIT_TSTATES (SIM_TOP_BORDER_TSTATES-2000)
+#define UPPER_ADDRESS ZX_CONTENDED_RAM_END
+#define UPPER_SIZE    (0x10000-UPPER_ADDRESS)
+
+static uint8_t  upper_block[UPPER_SIZE];
+static bool     upper_queued;
+static uint32_t upper_blocks;
+
+static void upper_done( void *context )
+{
+  upper_queued = false;
+  upper_blocks++;
+}
+
+static void workload_upper( uint32_t frame )
+{
+  sim_config.z80_wait_tstates = ((frame % STROBE_CAL_INTERVAL_FRAMES) == 0) ? UPPER_WAIT_TSTATES : 0;
+
+  if( upper_queued )
+    return;
+
+  for( uint32_t i = 0; i < UPPER_SIZE; i++ )
+    upper_block[i] = frame ^ (i*13);
+
+  upper_queued = frame_sched_add( UPPER_ADDRESS, upper_block, UPPER_SIZE, upper_done, NULL );
+}
+
+/*
+ * Lots of small jobs through a job queue, as core 1 might send them, on
+ * top of the scroll demo. Each scatters to three places, in the contended
+ * RAM and in the upper RAM, so its parts go at different times. A job is
+ * sent again with new data once it's done.
+ */
+#define JOBS        24
+#define JOB_PARTS   3
+
+static const uint16_t job_part_base[JOB_PARTS]   = { 0x5B00, 0x9000, 0xE000 };
+static const uint32_t job_part_length[JOB_PARTS] = { 8, 16, 4 };
+
+typedef struct
+{
+  job_desc_t desc[JOB_PARTS];
+  uint8_t    data[JOB_PARTS][16];
+  bool       busy;
+} sim_job_t;
+
+static sim_job_t   jobs[JOBS];
+static job_queue_t job_queue;
+static uint32_t    jobs_done;
+
+static void job_done( void *context )
+{
+  ((sim_job_t *)context)->busy = false;
+  jobs_done++;
+}
+
+static void workload_jobs( uint32_t frame )
+{
+  if( frame == 0 )
+    job_queue_register( &job_queue );
+
+  for( uint32_t j = 0; j < JOBS; j++ )
+  {
+    sim_job_t *job = &jobs[j];
+    if( job->busy )
+      continue;
+
+    for( uint32_t p = 0; p < JOB_PARTS; p++ )
+    {
+      for( uint32_t i = 0; i < job_part_length[p]; i++ )
+	job->data[p][i] = frame + (j*7) + (p*3) + i;
+
+      job->desc[p].zx_address = job_part_base[p] + (j*16);
+      job->desc[p].src        = job->data[p];
+      job->desc[p].length     = job_part_length[p];
+      job->desc[p].next       = (p < JOB_PARTS-1) ? &job->desc[p+1] : NULL;
+    }
+    job->desc[0].done    = job_done;
+    job->desc[0].context = job;
+
+    job->busy = true;
+    if( !job_queue_submit( &job_queue, &job->desc[0] ) )
+      job->busy = false;
+  }
+}
+
+/*
+ * The RP2350 captures the Spectrum's RAM, 0x4000 to 0xFFFF, on top of the
+ * scroll demo. The reads go in whatever of the windows the screen doesn't
+ * use, up to the scheduler's read budget each frame. Another capture starts
+ * when the last one is done. Above the display file the RAM doesn't change,
+ * so it's checked against the last capture at the end.
+ */
+#define CAPTURE_ADDRESS 0x4000
+#define CAPTURE_SIZE    0xC000
+
+static uint8_t  capture_buffer[CAPTURE_SIZE];
+static bool     capture_queued;
+static uint32_t capture_started;
+static uint32_t captures;
+static uint32_t capture_frames_max;
+
+static void capture_done( void *context )
+{
+  uint32_t took = frame_sched_stats.frames - capture_started;
+  if( took > capture_frames_max )
+    capture_frames_max = took;
+
+  capture_queued = false;
+  captures++;
+}
+
+static void workload_capture( uint32_t frame )
+{
+  if( frame == 0 )
+  {
+    for( uint32_t i = BULK_ADDRESS; i < 0x10000; i++ )
+      sim_ram[i] = i ^ (i >> 8);
+  }
+
+  if( capture_queued )
+    return;
+
+  capture_started = frame_sched_stats.frames;
+  capture_queued  = frame_sched_add_read( CAPTURE_ADDRESS, capture_buffer, CAPTURE_SIZE, capture_done, NULL );
+}
+
+/*
+ * The shadow of the Spectrum's memory is seeded, then kept up to date
+ * while the Z80 types on the screen and moves a game's 64 sprites about,
+ * four bytes each in a table in the upper RAM, and the RP2350 draws the
+ * status bar. The RAM is filled before the first frame, so the seed has
+ * something to find.
+ */
+#define SPRITE_TABLE 0xC000
+
+static void workload_shadow_z80( uint32_t frame )
+{
+  if( frame == 0 )
+  {
+    for( uint32_t i = BULK_ADDRESS; i < 0x10000; i++ )
+      sim_ram[i] = (i*3) ^ (i >> 8);
+  }
+
+  workload_typing( frame );
+
+  for( uint32_t i = 0; i < 64*4; i++ )
+    sim_z80_write( 30000 + i*50, SPRITE_TABLE+i, frame*(i+1) );
+}
+
+/*
+ * A game on the Z80 moves 16 sprites by writing their positions to a
+ * sprite table each frame. The compositor on core 1 takes the table from
+ * the shadow and draws them over a tile background.
+ */
+#define SPRITES 16
+
+static const compositor_tile_t sprite_tiles[2] =
+{
+  { { 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55 }, 0x38 },
+  { { 0xFF, 0x81, 0x81, 0x81, 0x81, 0x81, 0x81, 0xFF }, 0x30 },
+};
+
+/* 8x8, a solid block with a clear border */
+static const uint8_t sprite_block_data[] =
+{
+  0x81, 0x00,  0x00, 0x7E,  0x00, 0x7E,  0x00, 0x7E,
+  0x00, 0x7E,  0x00, 0x7E,  0x00, 0x7E,  0x81, 0x00,
+};
+static const compositor_graphic_t sprite_block = { 1, 8, sprite_block_data };
+static const compositor_graphic_t *const sprite_graphics[] = { &sprite_block };
+
+static void workload_sprites_z80( uint32_t frame )
+{
+  for( uint32_t i = 0; i < SPRITES; i++ )
+  {
+    uint8_t entry[COMPOSITOR_TABLE_ENTRY] =
+    {
+      COMPOSITOR_TABLE_OFFSET + ((frame*((i%3)+1) + i*15) % 248),
+      COMPOSITOR_TABLE_OFFSET + ((frame*2 + i*11) % 184),
+      0,
+      (i & 1) ? 0x47 : 0,
+    };
+
+    for( uint32_t j = 0; j < COMPOSITOR_TABLE_ENTRY; j++ )
+      sim_z80_write( 30000 + (i*COMPOSITOR_TABLE_ENTRY+j)*40, SPRITE_TABLE + i*COMPOSITOR_TABLE_ENTRY + j, entry[j] );
+  }
+}
+
+/* Runs on core 1, the table's as far as the shadow has got */
+static void sprites_frame( uint32_t frame )
+{
+  uint8_t table[SPRITES*COMPOSITOR_TABLE_ENTRY];
+
+  if( zx_shadow_copy( SPRITE_TABLE, table, sizeof(table) ) )
+    compositor_load_table( table, SPRITES, sprite_graphics, 1 );
+}
+
+static void render_sprites( uint8_t *screen )
+{
+  static bool started = false;
+
+  if( !started )
+  {
+    compositor_init( sprite_tiles, sprites_frame );
+    for( uint32_t row = 0; row < ZX_DISPLAY_CHAR_ROWS; row += 4 )
+    {
+      for( uint32_t col = 0; col < ZX_DISPLAY_COLUMNS; col++ )
+	compositor_set_tile( col, row, 1 );
+    }
+    started = true;
+  }
+
+  compositor_render( screen );
+}
+
+/*
+ * The Z80 sends mailbox commands, one after another, waiting for DONE each
+ * time and checking what it gets back. Their data is put in the RAM before
+ * the shadow's seeded, the compressed block by a simple greedy ZX0
+ * compressor, which is enough for the decompressor's check.
+ */
+#define MAILBOX_COPY_SOURCE    0x9000
+#define MAILBOX_COPY_DEST      0xA000
+#define MAILBOX_COPY_LENGTH    256
+#define MAILBOX_BITMAP         0x9800
+#define MAILBOX_SPRITE         0x9900
+#define MAILBOX_PACKED         0xB000
+#define MAILBOX_UNPACKED       0xC000
+#define MAILBOX_PLAIN_LENGTH   3000
+
+typedef struct
+{
+  uint8_t command;
+  uint8_t params[12];
+  uint8_t expect;
+} mailbox_step_t;
+
+#define LE(w) ((w) & 0xFF), ((w) >> 8)
+
+static const mailbox_step_t mailbox_steps[] =
+{
+  { ZX_MAILBOX_FILL,        { 0, 8, 0, 8, 0xFF, ZX_MAILBOX_FILL_PIXELS }, ZX_MAILBOX_OK },
+  { ZX_MAILBOX_SCROLL,      { 0, 8, 0, 8, ZX_MAILBOX_RIGHT, 4, 0 },      ZX_MAILBOX_OK },
+  { ZX_MAILBOX_FILL,        { 0, 8, 0, 1, 0x47, ZX_MAILBOX_FILL_ATTRS },  ZX_MAILBOX_OK },
+  { ZX_MAILBOX_COPY,        { LE(MAILBOX_COPY_SOURCE), LE(MAILBOX_COPY_DEST), LE(MAILBOX_COPY_LENGTH) }, ZX_MAILBOX_OK },
+  { ZX_MAILBOX_DECOMPRESS,  { LE(MAILBOX_PACKED), LE(MAILBOX_UNPACKED), LE(0x1000) }, ZX_MAILBOX_OK },
+  { ZX_MAILBOX_BLIT,        { LE(MAILBOX_BITMAP), 2, 8, 10, 64 },        ZX_MAILBOX_OK },
+  { ZX_MAILBOX_LOAD_SPRITE, { 3, LE(MAILBOX_SPRITE), 1, 8 },             ZX_MAILBOX_OK },
+  { ZX_MAILBOX_FILL,        { 30, 8, 0, 8, 0xFF, ZX_MAILBOX_FILL_PIXELS }, ZX_MAILBOX_BAD_PARAMS },
+  { ZX_MAILBOX_DECOMPRESS,  { LE(MAILBOX_PACKED), LE(MAILBOX_UNPACKED), LE(100) }, ZX_MAILBOX_BAD_DATA },
+  { 99,                     { 0 },                                        ZX_MAILBOX_BAD_COMMAND },
+};
+
+#define MAILBOX_STEPS (sizeof(mailbox_steps)/sizeof(mailbox_steps[0]))
+
+static uint8_t  mailbox_plain[MAILBOX_PLAIN_LENGTH];
+static uint32_t mailbox_next;
+static bool     mailbox_waiting;
+static uint8_t  mailbox_sequence;
+static uint32_t mailbox_wrong;
+static uint32_t mailbox_retries;
+static uint32_t mailbox_frames_max;
+static uint32_t mailbox_sent_frame;
+
+/* The compressor's output, its bits in bytes among the data bytes */
+static uint8_t *zx0_out;
+static uint32_t zx0_length, zx0_bit_index;
+static uint8_t  zx0_bit_mask;
+static bool     zx0_backtrack;
+
+static void zx0_byte( uint8_t value )
+{
+  zx0_out[zx0_length++] = value;
+}
+
+static void zx0_bit( uint32_t value )
+{
+  if( zx0_backtrack )
+  {
+    if( value )
+      zx0_out[zx0_length-1] |= 1;
+    zx0_backtrack = false;
+    return;
+  }
+
+  if( zx0_bit_mask == 0 )
+  {
+    zx0_bit_mask  = 0x80;
+    zx0_bit_index = zx0_length;
+    zx0_byte( 0 );
+  }
+
+  if( value )
+    zx0_out[zx0_bit_index] |= zx0_bit_mask;
+  zx0_bit_mask >>= 1;
+}
+
+static void zx0_gamma( uint32_t value, uint32_t inverted )
+{
+  uint32_t i;
+
+  for( i = 2; i <= value; i <<= 1 )
+    ;
+  i >>= 1;
+
+  while( i >>= 1 )
+  {
+    zx0_bit( 0 );
+    zx0_bit( ((value & i) != 0) ^ inverted );
+  }
+  zx0_bit( 1 );
+}
+
+/* The longest match within 1K of what's gone before */
+static uint32_t zx0_match( const uint8_t *in, uint32_t length, uint32_t position, uint32_t *best_offset )
+{
+  uint32_t best_length = 0;
+
+  for( uint32_t offset = 1; (offset <= position) && (offset <= 1024); offset++ )
+  {
+    uint32_t n = 0;
+    while( (position+n < length) && (in[position+n] == in[position+n-offset]) )
+      n++;
+    if( n > best_length )
+    {
+      best_length  = n;
+      *best_offset = offset;
+    }
+  }
+
+  return best_length;
+}
+
+/* Greedy: the longest match, literals up to the next one otherwise */
+static uint32_t zx0_compress( const uint8_t *in, uint32_t length, uint8_t *out )
+{
+  uint32_t last_offset = 1, position = 0, offset;
+  bool     after_literals = false;
+
+  zx0_out = out; zx0_length = 0; zx0_bit_mask = 0; zx0_backtrack = false;
+
+  while( position < length )
+  {
+    uint32_t best_offset = 0;
+    uint32_t best_length = zx0_match( in, length, position, &best_offset );
+
+    if( best_length < 2 )
+    {
+      /* A literal block can't follow another, so it runs to the next match */
+      uint32_t run = 1;
+      while( (position+run < length) && (zx0_match( in, length, position+run, &offset ) < 2) )
+	run++;
+
+      /* The first needs no bit to say what it is */
+      if( position > 0 )
+	zx0_bit( 0 );
+      zx0_gamma( run, 0 );
+      for( uint32_t i = 0; i < run; i++ )
+	zx0_byte( in[position+i] );
+
+      position      += run;
+      after_literals = true;
+      continue;
+    }
+
+    if( after_literals && (best_offset == last_offset) )
+    {
+      zx0_bit( 0 );
+      zx0_gamma( best_length, 0 );
+    }
+    else
+    {
+      zx0_bit( 1 );
+      zx0_gamma( ((best_offset-1) / 128) + 1, 1 );
+      zx0_byte( (127 - ((best_offset-1) % 128)) << 1 );
+      zx0_backtrack = true;
+      zx0_gamma( best_length-1, 0 );
+    }
+
+    last_offset    = best_offset;
+    position      += best_length;
+    after_literals = false;
+  }
+
+  zx0_bit( 1 );
+  zx0_gamma( 256, 1 );
+
+  return zx0_length;
+}
+
+static void mailbox_check( const mailbox_step_t *step )
+{
+  switch( step->command )
+  {
+  case ZX_MAILBOX_SCROLL:
+    for( uint32_t y = 0; y < 8; y++ )
+    {
+      for( uint32_t x = 0; x < 8; x++ )
+	mailbox_wrong += sim_ram[ZX_DISPLAY_FILE_ADDRESS + ZX_DISPLAY_ROW_OFFSET( y ) + x] != ((x == 0) ? 0x0F : 0xFF);
+    }
+    break;
+
+  case ZX_MAILBOX_FILL:
+    if( step->params[5] == ZX_MAILBOX_FILL_ATTRS )
+    {
+      for( uint32_t x = 0; x < 8; x++ )
+	mailbox_wrong += sim_ram[ZX_DISPLAY_FILE_ADDRESS + ZX_DISPLAY_ATTR_ROW_OFFSET( 0 ) + x] != 0x47;
+    }
+    break;
+
+  case ZX_MAILBOX_COPY:
+    mailbox_wrong += memcmp( &sim_ram[MAILBOX_COPY_DEST], &sim_ram[MAILBOX_COPY_SOURCE], MAILBOX_COPY_LENGTH ) != 0;
+    break;
+
+  case ZX_MAILBOX_DECOMPRESS:
+    if( step->expect == ZX_MAILBOX_OK )
+      mailbox_wrong += memcmp( &sim_ram[MAILBOX_UNPACKED], mailbox_plain, MAILBOX_PLAIN_LENGTH ) != 0;
+    break;
+
+  case ZX_MAILBOX_BLIT:
+    for( uint32_t y = 0; y < 8; y++ )
+    {
+      for( uint32_t x = 0; x < 2; x++ )
+	mailbox_wrong += sim_ram[ZX_DISPLAY_FILE_ADDRESS + ZX_DISPLAY_ROW_OFFSET( 64+y ) + 10+x] != sim_ram[MAILBOX_BITMAP + y*2 + x];
+    }
+    break;
+
+  case ZX_MAILBOX_LOAD_SPRITE:
+    mailbox_wrong += (zx_mailbox_graphics[3] == NULL) ||
+                     (memcmp( zx_mailbox_graphics[3]->data, &sim_ram[MAILBOX_SPRITE], 16 ) != 0);
+    break;
+  }
+}
+
+static void workload_mailbox( uint32_t frame )
+{
+  if( frame == 0 )
+  {
+    for( uint32_t i = 0; i < MAILBOX_PLAIN_LENGTH; i++ )
+      mailbox_plain[i] = ((i % 300) < 200) ? "the quick brown fox "[i % 20] : (i*7) ^ (i >> 3);
+    zx0_compress( mailbox_plain, MAILBOX_PLAIN_LENGTH, &sim_ram[MAILBOX_PACKED] );
+
+    for( uint32_t i = 0; i < MAILBOX_COPY_LENGTH; i++ )
+      sim_ram[MAILBOX_COPY_SOURCE+i] = i ^ 0xA5;
+    for( uint32_t i = 0; i < 16; i++ )
+    {
+      sim_ram[MAILBOX_BITMAP+i] = 0x11*i;
+      sim_ram[MAILBOX_SPRITE+i] = (i & 1) ? 0x3C : 0xC3;
+    }
+    return;
+  }
+
+  if( mailbox_waiting )
+  {
+    if( sim_ram[ZX_MAILBOX_DONE] != mailbox_sequence )
+      return;
+
+    uint8_t got = sim_ram[ZX_MAILBOX_RESULT];
+    mailbox_waiting = false;
+
+    if( frame - mailbox_sent_frame > mailbox_frames_max )
+      mailbox_frames_max = frame - mailbox_sent_frame;
+
+    /* The shadow hasn't been seeded yet, ask again */
+    if( got == ZX_MAILBOX_NOT_READY )
+    {
+      mailbox_retries++;
+      return;
+    }
+
+    if( got != mailbox_steps[mailbox_next].expect )
+      mailbox_wrong++;
+    else
+      mailbox_check( &mailbox_steps[mailbox_next] );
+
+    mailbox_next++;
+  }
+
+  if( mailbox_next == MAILBOX_STEPS )
+    return;
+
+  const mailbox_step_t *step = &mailbox_steps[mailbox_next];
+  sim_z80_write( 20000, ZX_MAILBOX_COMMAND, step->command );
+  for( uint32_t i = 0; i < sizeof(step->params); i++ )
+    sim_z80_write( 20010 + i*10, ZX_MAILBOX_PARAMS+i, step->params[i] );
+
+  sim_z80_write( 20200, ZX_MAILBOX_DOORBELL, ++mailbox_sequence );
+  mailbox_waiting    = true;
+  mailbox_sent_frame = frame;
+}
+
+/*
+ * The Z80 uses the I/O port every frame, while a bulk transfer keeps the
+ * scheduler busy. It OUTs the operands, and next frame reads back what
+ * was worked out from them, and checks the rest of the registers.
+ */
+#define PORT( reg ) ((uint16_t)(((reg) << 8) | ZX_PORT_ADDRESS))
+
+static uint32_t ports_x, ports_y;
+static uint32_t ports_frame;
+static uint32_t ports_checks;
+static uint32_t ports_wrong;
+static uint32_t ports_repeats;
+static uint32_t ports_busy_seen;
+
+static void workload_ports( uint32_t frame )
+{
+  if( frame == 0 )
+  {
+    zx_port_init();
+    ports_frame = sim_z80_in( PORT( ZX_PORT_FRAME ) );
+  }
+  else
+  {
+    uint32_t product   = sim_z80_in( PORT( ZX_PORT_PRODUCT ) ) |
+                         (sim_z80_in( PORT( ZX_PORT_PRODUCT+1 ) ) << 8) |
+                         (sim_z80_in( PORT( ZX_PORT_PRODUCT+2 ) ) << 16);
+    uint32_t quotient  = sim_z80_in( PORT( ZX_PORT_QUOTIENT ) ) |
+                         (sim_z80_in( PORT( ZX_PORT_QUOTIENT+1 ) ) << 8);
+    uint32_t remainder = sim_z80_in( PORT( ZX_PORT_REMAINDER ) );
+
+    ports_wrong += (product != ports_x*ports_y);
+    ports_wrong += (quotient != (ports_y ? ports_x/ports_y : 0xFFFF));
+    ports_wrong += (remainder != (ports_y ? ports_x%ports_y : (ports_x & 0xFF)));
+
+    /* One /INT since last time */
+    uint8_t counted = sim_z80_in( PORT( ZX_PORT_FRAME ) );
+    ports_wrong += ((uint8_t)(counted-ports_frame) != 1);
+    ports_frame  = counted;
+
+    /* The read before brings the status up to date */
+    uint8_t random = sim_z80_in( PORT( ZX_PORT_RANDOM ) );
+    uint8_t status = sim_z80_in( PORT( ZX_PORT_STATUS ) );
+    ports_repeats   += (random == sim_z80_in( PORT( ZX_PORT_RANDOM ) ));
+    ports_wrong     += (((status & ZX_PORT_STATUS_TRANSFERS) != 0) != frame_sched_pending());
+    ports_busy_seen += ((status & ZX_PORT_STATUS_TRANSFERS) != 0);
+
+    /* Other ports aren't answered, and an OUT to one is left alone */
+    ports_wrong += (sim_z80_in( 0x00FE ) != 0xFF);
+    ports_wrong += (bus_port_out[ZX_PORT_Y] != ports_y);
+
+    ports_checks++;
+  }
+
+  /* Y is 0 every so often */
+  ports_x = (frame*2531) & 0xFFFF;
+  ports_y = (frame % 16) ? (frame*37) & 0xFF : 0;
+
+  sim_z80_out( 1000, PORT( ZX_PORT_X ),   ports_x & 0xFF );
+  sim_z80_out( 1012, PORT( ZX_PORT_X+1 ), ports_x >> 8 );
+  sim_z80_out( 1024, PORT( ZX_PORT_Y ),   ports_y );
+  sim_z80_out( 1036, 0x02FE, 0x55 );
+}
+
+/*
+ * A display list: raster bars down the top and lower borders, two groups
+ * held across a WAIT, and attribute row 0 rewritten before each of its
+ * pixel lines, all while a bulk transfer keeps the windows busy. Lists
+ * which break the rules are tried first, and should be turned down.
+ * Each frame's OUTs are checked against the list. It runs long enough
+ * for the strobe to be calibrated again, which has to fit around the list.
+ */
+#define COPPER_MAX_ACTIONS 128
+#define COPPER_FRAMES      (STROBE_CAL_INTERVAL_FRAMES+100)
+
+static copper_action_t copper_list[COPPER_MAX_ACTIONS];
+static uint32_t        copper_count;
+static uint8_t         copper_attributes[8][ZX_DISPLAY_COLUMNS];
+static uint32_t        copper_frames;
+static uint32_t        copper_outs;
+static uint32_t        copper_wrong;
+static int32_t         copper_early_max;
+static int32_t         copper_late_max;
+static uint32_t        copper_held_from;
+static uint32_t        copper_held_to;
+static uint32_t        copper_first_row;
+
+static void copper_add( uint32_t tstate, uint8_t op, uint8_t value, uint16_t zx_address, uint16_t length, const uint8_t *src )
+{
+  copper_list[copper_count++] = (copper_action_t){ tstate, op, value, zx_address, length, src };
+}
+
+static void copper_build( void )
+{
+  copper_count = 0;
+
+  /* Every 4th line of the top border */
+  for( uint32_t line = 4; line < 60; line += 4 )
+    copper_add( line*ZX_TSTATES_PER_LINE + 40, COPPER_BORDER, line & 7, 0, 0, NULL );
+
+  /* A WAIT well after the OUT before, the bus is held through it to the OUT after */
+  copper_held_from = copper_count;
+  copper_add( 57*ZX_TSTATES_PER_LINE + 100, COPPER_BORDER, 1, 0, 0, NULL );
+  copper_add( 57*ZX_TSTATES_PER_LINE + 400, COPPER_WAIT,   0, 0, 0, NULL );
+  copper_held_to = copper_count;
+  copper_add( 57*ZX_TSTATES_PER_LINE + 440, COPPER_BORDER, 6, 0, 0, NULL );
+
+  /* Two OUTs 110T apart, the bus held between */
+  copper_add( 61*ZX_TSTATES_PER_LINE,       COPPER_BORDER, 2, 0, 0, NULL );
+  copper_add( 61*ZX_TSTATES_PER_LINE + 60,  COPPER_WAIT,   0, 0, 0, NULL );
+  copper_add( 61*ZX_TSTATES_PER_LINE + 110, COPPER_BORDER, 5, 0, 0, NULL );
+
+  /* Attribute row 0, new colours for each pixel line, 84T before the line starts */
+  copper_first_row = copper_count;
+  for( uint32_t y = 0; y < 8; y++ )
+  {
+    for( uint32_t x = 0; x < ZX_DISPLAY_COLUMNS; x++ )
+      copper_attributes[y][x] = ((y+x) & 7) | (((7-y) & 7) << 3);
+
+    copper_add( (ZX_TOP_BORDER_LINES+y)*ZX_TSTATES_PER_LINE - 84, COPPER_WRITE, 0,
+		ZX_DISPLAY_FILE_ADDRESS + ZX_DISPLAY_ATTR_ROW_OFFSET( 0 ), ZX_DISPLAY_COLUMNS, copper_attributes[y] );
+  }
+
+  /* Every other line of the lower border */
+  for( uint32_t line = 258; line < 310; line += 2 )
+    copper_add( line*ZX_TSTATES_PER_LINE + 20, COPPER_BORDER, line & 7, 0, 0, NULL );
+}
+
+static void copper_reject( copper_result_t expect )
+{
+  uint32_t rejected = copper_stats.rejected;
+
+  copper_wrong += (copper_set_list( copper_list, copper_count ) != expect);
+  copper_wrong += (copper_stats.rejected != rejected+1);
+}
+
+static void workload_copper( uint32_t frame )
+{
+  if( frame == 0 )
+  {
+    copper_build();
+
+    /* Into the display lines while the ULA fetches */
+    copper_list[copper_first_row].tstate += 100;
+    copper_reject( COPPER_CONTENDED );
+
+    /* Overlapping the action before */
+    copper_build();
+    copper_list[5].tstate = copper_list[4].tstate + 5;
+    copper_reject( COPPER_UNSORTED );
+
+    /* Before the /INT handler's done */
+    copper_build();
+    copper_list[0].tstate = 100;
+    copper_reject( COPPER_OUT_OF_FRAME );
+
+    /* Into the ROM */
+    copper_build();
+    copper_list[copper_first_row].zx_address = 0x1000;
+    copper_reject( COPPER_BAD_ACTION );
+
+    copper_build();
+    sim_out_count = 0;
+    return;
+  }
+
+  /* Picked up at the next /INT, the frame after the mirror's first full send */
+  if( frame == 2 )
+    copper_wrong += (copper_set_list( copper_list, copper_count ) != COPPER_OK);
+
+  /* Last frame's OUTs, in the list's order */
+  if( frame > 2 )
+  {
+    uint32_t out = 0;
+    uint32_t held_from = 0, held_to = 1;
+
+    for( uint32_t i = 0; i < copper_count; i++ )
+    {
+      if( copper_list[i].op != COPPER_BORDER )
+	continue;
+
+      if( (out >= sim_out_count) || (sim_outs[out].port != COPPER_ULA_PORT) || (sim_outs[out].data != copper_list[i].value) )
+      {
+	copper_wrong++;
+	break;
+      }
+
+      int32_t off = (int32_t)sim_outs[out].tstate - (int32_t)copper_list[i].tstate;
+      if( -off > copper_early_max )
+	copper_early_max = -off;
+      if( off > copper_late_max )
+	copper_late_max = off;
+      copper_wrong += (off < -COPPER_SLACK_TSTATES) || (off > COPPER_SLACK_TSTATES);
+
+      if( i == copper_held_from )
+	held_from = sim_outs[out].hold;
+      if( i == copper_held_to )
+	held_to = sim_outs[out].hold;
+
+      out++;
+    }
+
+    copper_wrong += (out != sim_out_count);
+    copper_wrong += (held_from != held_to);
+    copper_outs += out;
+    copper_frames++;
+
+    /* The last colours written are the ones left */
+    copper_wrong += memcmp( &sim_ram[ZX_DISPLAY_FILE_ADDRESS + ZX_DISPLAY_ATTR_ROW_OFFSET( 0 )],
+			    copper_attributes[7], ZX_DISPLAY_COLUMNS ) != 0;
+  }
+
+  sim_out_count = 0;
+}
+
+/*
+ * The display list again, with the /INT handler held off by up to
+ * CLOCK_HOLDOFF_US once the frame clock has locked. The list goes by the
+ * clock, not the handler, so its timing should be as good as without.
+ */
+#define CLOCK_HOLDOFF_US 10
+
+static void workload_clock( uint32_t frame )
+{
+  sim_config.int_holdoff_us = frame_clock_locked() ? CLOCK_HOLDOFF_US : 0;
+
+  workload_bulk( frame );
+}
+
+/*
+ * The ROM is taken over and a tape loaded through the LD-BYTES trap: a
+ * header, a screen and 16K of code, then one more LOAD runs off the end
+ * of the tape. There's no Z80 to run the trap's routine, so this plays
+ * its part: the parameters and GO are written to the ROM as the routine
+ * would, and the ROM image is watched for the answer.
+ */
+typedef struct
+{
+  uint16_t ix;
+  uint16_t de;
+  uint8_t  flag;
+  bool     expect_ok;
+} tape_load_t;
+
+static const tape_load_t tape_loads[] =
+{
+  { 0xFF00, 17,                   0x00, true  },
+  { 0x4000, ZX_DISPLAY_FILE_SIZE, 0xFF, true  },
+  { 0x8000, 0x4000,               0xFF, true  },
+  { 0x8000, 0x4000,               0xFF, false },
+};
+
+#define TAPE_LOADS (sizeof(tape_loads)/sizeof(tape_loads[0]))
+#define TAPE_SIZE  (3*4 + 17 + ZX_DISPLAY_FILE_SIZE + 0x4000)
+
+static uint8_t  tape_rom[ZX_ROM_SIZE];
+static uint8_t  tape_image[TAPE_SIZE];
+static uint32_t tape_next;
+static bool     tape_waiting;
+static uint8_t  tape_done_count;
+static uint32_t tape_wrong;
+
+/* A .tap block, the flag and checksum around the data */
+static uint32_t tape_block( uint32_t at, uint8_t flag, uint32_t length, uint8_t seed )
+{
+  uint8_t *block  = &tape_image[at];
+  uint8_t  parity = flag;
+
+  block[0] = (length+2) & 0xFF;
+  block[1] = (length+2) >> 8;
+  block[2] = flag;
+  for( uint32_t i = 0; i < length; i++ )
+  {
+    block[3+i] = seed + (i*5) + (i >> 7);
+    parity ^= block[3+i];
+  }
+  block[3+length] = parity;
+
+  return at + length + 4;
+}
+
+static void workload_tape( uint32_t frame )
+{
+  if( frame == 0 )
+  {
+    /* Near enough a 48K ROM for the trap: LD-BYTES and the empty space */
+    for( uint32_t i = 0; i < ZX_ROM_SIZE; i++ )
+      tape_rom[i] = ((i >= 0x386E) && (i < 0x3D00)) ? 0xFF : (i*7);
+    memcpy( &tape_rom[ZX_TAPE_LD_BYTES], (const uint8_t[]){ 0x14, 0x08, 0x15, 0xF3 }, 4 );
+
+    bus_rom_init( tape_rom );
+    if( !zx_tape_install( bus_rom_image() ) )
+      tape_wrong++;
+
+    uint32_t at = tape_block( 0, 0x00, 17, 1 );
+    at = tape_block( at, 0xFF, ZX_DISPLAY_FILE_SIZE, 2 );
+    tape_block( at, 0xFF, 0x4000, 3 );
+    zx_tape_insert( tape_image, TAPE_SIZE );
+  }
+
+  const uint8_t *rom = bus_rom_image();
+
+  if( tape_waiting )
+  {
+    if( rom[ZX_TAPE_DONE_COUNT] == tape_done_count )
+      return;
+
+    if( rom[ZX_TAPE_RESULT] != tape_loads[tape_next].expect_ok )
+      tape_wrong++;
+
+    tape_waiting = false;
+    tape_next++;
+  }
+
+  if( tape_next == TAPE_LOADS )
+    return;
+
+  /* Carry set for LOAD */
+  const tape_load_t *l = &tape_loads[tape_next];
+  sim_z80_write( 20000, ZX_TAPE_PARAM_IX,   l->ix & 0xFF );
+  sim_z80_write( 20010, ZX_TAPE_PARAM_IX+1, l->ix >> 8 );
+  sim_z80_write( 20020, ZX_TAPE_PARAM_DE,   l->de & 0xFF );
+  sim_z80_write( 20030, ZX_TAPE_PARAM_DE+1, l->de >> 8 );
+  sim_z80_write( 20040, ZX_TAPE_PARAM_F,    0x01 );
+  sim_z80_write( 20050, ZX_TAPE_PARAM_A,    l->flag );
+
+  tape_done_count = rom[ZX_TAPE_DONE_COUNT];
+  sim_z80_write( 20060, ZX_TAPE_GO, tape_done_count );
+  tape_waiting = true;
+}
+
+/*
+ * A .sna is loaded over BASIC, typing away. There's no Z80 to run the
+ * parking loop or the stub, so this plays its part: once 0x0038 has been
+ * patched the next interrupt pushes the PC and writes PARKED, nothing
+ * more is written until GO is set, and then the stub should be there,
+ * ending with a jump to the snapshot's PC, with 0x0038 put back.
+ */
+#define SNAPSHOT_LOAD_FRAME 5
+#define SNAPSHOT_SP         0xFE00
+#define SNAPSHOT_PC         0x8000
+
+typedef enum { SNAPSHOT_BASIC, SNAPSHOT_PARKED, SNAPSHOT_RUNNING } sim_snapshot_state_t;
+
+static uint8_t              snapshot_rom[ZX_ROM_SIZE];
+static uint8_t              snapshot_sna[SNAPSHOT_SNA_SIZE];
+static sim_snapshot_state_t snapshot_state;
+static uint32_t             snapshot_frames;
+static uint32_t             snapshot_wrong;
+
+static void workload_snapshot( uint32_t frame )
+{
+  uint8_t *rom = bus_rom_image();
+
+  if( frame == 0 )
+  {
+    for( uint32_t i = 0; i < ZX_ROM_SIZE; i++ )
+      snapshot_rom[i] = ((i >= 0x386E) && (i < 0x3D00)) ? 0xFF : (i*7);
+
+    bus_rom_init( snapshot_rom );
+    if( !zx_snapshot_install( bus_rom_image() ) )
+      snapshot_wrong++;
+
+    /* Registers mostly zero, SP and the PC on the stack, and 48K of pattern */
+    snapshot_sna[23] = SNAPSHOT_SP & 0xFF;
+    snapshot_sna[24] = SNAPSHOT_SP >> 8;
+    snapshot_sna[25] = 1;
+    for( uint32_t i = 0; i < SNAPSHOT_RAM_SIZE; i++ )
+      snapshot_sna[27+i] = (i*13) ^ (i >> 9);
+    snapshot_sna[27+SNAPSHOT_SP-0x4000]   = SNAPSHOT_PC & 0xFF;
+    snapshot_sna[27+SNAPSHOT_SP-0x4000+1] = SNAPSHOT_PC >> 8;
+    return;
+  }
+
+  if( (frame == SNAPSHOT_LOAD_FRAME) && !zx_snapshot_load( snapshot_sna, sizeof(snapshot_sna) ) )
+    snapshot_wrong++;
+
+  switch( snapshot_state )
+  {
+  case SNAPSHOT_BASIC:
+    if( (rom[ZX_SNAPSHOT_IM1] == 0xC3) && (rom[ZX_SNAPSHOT_IM1+1] == (ZX_SNAPSHOT_PARK_CODE & 0xFF)) &&
+	(rom[ZX_SNAPSHOT_IM1+2] == (ZX_SNAPSHOT_PARK_CODE >> 8)) )
+    {
+      sim_z80_write( 30, 0xFF4F, 0x12 );
+      sim_z80_write( 40, 0xFF4E, 0x34 );
+      sim_z80_write( 60, ZX_SNAPSHOT_PARKED, 0x00 );
+      snapshot_state = SNAPSHOT_PARKED;
+      break;
+    }
+
+    workload_typing( frame );
+    break;
+
+  case SNAPSHOT_PARKED:
+    snapshot_frames++;
+    if( rom[ZX_SNAPSHOT_GO] == 0 )
+      break;
+
+    /* The jump's the last instruction, before AF' and AF */
+    uint32_t jp = ZX_SNAPSHOT_STUB + SNAPSHOT_STUB_SIZE - 4 - 3;
+    while( (jp > ZX_SNAPSHOT_STUB) && (rom[jp] != 0xC3) )
+      jp--;
+    if( (rom[jp+1] | (rom[jp+2] << 8)) != SNAPSHOT_PC )
+      snapshot_wrong++;
+    if( rom[ZX_SNAPSHOT_IM1] != snapshot_rom[ZX_SNAPSHOT_IM1] )
+      snapshot_wrong++;
+
+    snapshot_state = SNAPSHOT_RUNNING;
+    break;
+
+  default:
+    break;
+  }
+}
+
+/*
+ * Each workload is some Z80 writes (or other goings on in the Spectrum)
+ * per frame, some writes queued by the RP2350, and/or a renderer which
+ * runs on the simulated core 1. Some also send during the display lines,
+ * CLK gated.
+ */
+typedef struct
+{
+  const char         *name;
+  void              (*z80)( uint32_t frame );
+  void              (*rp2350)( uint32_t frame );
+  zx_dma_renderer_t   renderer;
+  bool                display_window;
+  bool                shadow;
+  uint32_t            frames;        /* Run for, if not 250 */
+} workload_t;
+
+static const workload_t workloads[] =
+{
+  { "static",    NULL,            NULL,          NULL             },
+  { "statusbar", NULL,            NULL,          render_statusbar },
+  { "scroll",    NULL,            NULL,          render_scroll    },
+  { "typing",    workload_typing, NULL,          NULL             },
+  { "flood",     workload_flood,  NULL,          NULL             },
+  { "mixed",     workload_typing, NULL,          render_statusbar },
+  { "bulk",      NULL,            workload_bulk, render_scroll    },
+  { "bulkclk",   NULL,            workload_bulk, render_scroll,    true },
+  { "capture",   NULL,            workload_capture, render_scroll },
+  { "upper",     NULL,            workload_upper, render_scroll    },
+  { "jobs",      NULL,            workload_jobs,  render_scroll    },
+  { "warm",      workload_warm,   NULL,          render_scroll    },
+  { "reset",     workload_reset,  NULL,          render_statusbar },
+  { "shadow",    workload_shadow_z80, NULL,      render_statusbar, false, true },
+  { "tape",      workload_tape,   NULL,          NULL,             false, true },
+  { "snapshot",  workload_snapshot, NULL,        NULL,             false, true },
+  { "sprites",   workload_sprites_z80, NULL,     render_sprites,   false, true },
+  { "mailbox",   workload_mailbox, NULL,         NULL,             false, true },
+  { "ports",     workload_ports,  workload_bulk, render_scroll    },
+  { "copper",    workload_copper, workload_bulk, render_scroll,    false, false, COPPER_FRAMES },
+  { "clock",     workload_copper, workload_clock, render_scroll,   false, false, COPPER_FRAMES },
+  { "burst",     NULL,            workload_burst, render_scroll    },
+};
+
+/*
+ * Core 1 has its own clock. A frame is drawn the moment it's asked for,
+ * but it isn't handed over until the time it took has passed.
+ */
+static bool     core1_busy;
+static uint64_t core1_done_at;
+
+/* The memcpy of the front buffer at the start of each frame */
+#define SIM_RENDER_COPY_CYCLES 3500
+
+static void run_core1( void )
+{
+  if( core1_busy && (sim_now() >= core1_done_at) )
+  {
+    zx_dma_render_done();
+    core1_busy = false;
+  }
+
+  if( !core1_busy && zx_dma_render_wanted() )
+  {
+    sim_core1_begin();
+    zx_dma_render_frame();
+    render_count++;
+
+    core1_done_at = sim_now() + sim_core1_end() + SIM_RENDER_COPY_CYCLES*SIM_TICKS_PER_RP_CYCLE;
+    core1_busy    = true;
+  }
+}
+
+static FILE *trace_file;
+
+static void trace_put( const void *data, uint32_t length )
+{
+  fwrite( data, 1, length, trace_file );
+}
+
+int main( int argc, char *argv[] )
+{
+  const workload_t *workload = &workloads[0];
+  uint32_t          frames   = 250;
+
+  if( argc > 1 )
+  {
+    workload = NULL;
+    for( uint32_t i = 0; i < sizeof(workloads)/sizeof(workloads[0]); i++ )
+    {
+      if( strcmp( argv[1], workloads[i].name ) == 0 )
+        workload = &workloads[i];
+    }
+
+    if( workload == NULL )
+    {
+      fprintf( stderr, "Usage: %s [static|statusbar|scroll|typing|flood|mixed|bulk|bulkclk|capture|upper|jobs|warm|reset|shadow|tape|snapshot|sprites|mailbox|ports|copper|clock|burst] [frames] [trace file]\n", argv[0] );
+      return 1;
+    }
+  }
+
+  if( workload->frames )
+    frames = workload->frames;
+  if( argc > 2 )
+    frames = atoi( argv[2] );
+
+  sim_reset();
+  frame_trace_init( BUS_MASTER_REFERENCE_HZ );
+  bus_master_init();
+  zx_dma_init();
+  bus_snoop_init();
+  zx_dma_set_renderer( workload->renderer );
+  zx_dma_use_display_window( workload->display_window );
+  zx_dma_start_running();
+  if( workload->shadow )
+    zx_shadow_start();
+
+  /*
+   * Once the frames have run, carry on until whatever was queued has gone.
+   * A transfer in the last frame can finish after it.
+   */
+  uint32_t frame;
+  for( frame = 0; (frame < frames) || frame_sched_pending(); frame++ )
+  {
+    sim_begin_frame( frame );
+
+    if( frame < frames )
+    {
+      if( workload->z80 )
+	workload->z80( frame );
+      if( workload->rp2350 )
+	workload->rp2350( frame );
+    }
+
+    zx_dma_int_handler();
+    run_core1();
+
+    /* The board's repeating timer and alarm, and core 1 finishing a frame */
+    uint64_t next_drain = sim_now() + (uint64_t)ZX_DMA_SNOOP_DRAIN_US*SIM_TICKS_PER_US;
+    while( sim_now() < sim_frame_end() )
+    {
+      uint64_t next = next_drain;
+      if( core1_busy && (core1_done_at < next) )
+	next = core1_done_at;
+      if( sim_next_alarm() < next )
+	next = sim_next_alarm();
+
+      /* The DMA IRQ might set the alarm sooner */
+      if( sim_dma_end() < next )
+	next = sim_dma_end();
+      if( next > sim_frame_end() )
+	next = sim_frame_end();
+
+      if( next > sim_now() )
+	sim_advance( next-sim_now() );
+      run_core1();
+      sim_run_alarms();
+
+      if( sim_now() >= next_drain )
+      {
+	zx_dma_tick();
+	next_drain += (uint64_t)ZX_DMA_SNOOP_DRAIN_US*SIM_TICKS_PER_US;
+      }
+    }
+  }
+
+  /* Let the last transfer finish */
+  while( bus_master_busy() )
+    sim_advance( SIM_TICKS_PER_US );
+  zx_dma_snoop_drain();
+
+  uint32_t mismatches = 0;
+  for( uint32_t i = 0; i < ZX_DISPLAY_FILE_SIZE; i++ )
+  {
+    if( sim_ram[ZX_DISPLAY_FILE_ADDRESS+i] != zx_screen_mirror[i] )
+      mismatches++;
+  }
+
+  /*
+   * The shadow's valid pages should match the whole of the RAM. A ROM
+   * that's been taken over is only in the image.
+   */
+  uint32_t shadow_mismatches = 0, shadow_valid = 0;
+  if( workload->shadow )
+  {
+    for( uint32_t i = 0; i < 0x10000; i += ZX_SHADOW_PAGE_SIZE )
+    {
+      if( !zx_shadow_valid( i, ZX_SHADOW_PAGE_SIZE ) )
+	continue;
+
+      shadow_valid++;
+      if( (i < ZX_ROM_SIZE) && bus_rom_image() )
+	continue;
+
+      for( uint32_t j = i; j < i+ZX_SHADOW_PAGE_SIZE; j++ )
+      {
+	if( sim_ram[j] != zx_shadow[j] )
+	  shadow_mismatches++;
+      }
+    }
+  }
+
+  /* What was loaded should be in the RAM, where it was asked for */
+  if( workload->z80 == workload_tape )
+  {
+    for( uint32_t i = 0, at = 0; i < TAPE_LOADS-1; i++ )
+    {
+      uint32_t length = tape_image[at] | (tape_image[at+1] << 8);
+
+      if( memcmp( &sim_ram[tape_loads[i].ix], &tape_image[at+3], length-2 ) != 0 )
+	tape_wrong++;
+      at += 2 + length;
+    }
+  }
+
+  /* The snapshot's RAM, the PC still on the stack below SP */
+  if( workload->z80 == workload_snapshot )
+  {
+    if( memcmp( &sim_ram[0x4000], &snapshot_sna[27], SNAPSHOT_RAM_SIZE ) != 0 )
+      snapshot_wrong++;
+  }
+
+  if( argc > 3 )
+  {
+    trace_file = fopen( argv[3], "wb" );
+    if( trace_file == NULL )
+    {
+      perror( argv[3] );
+      return 1;
+    }
+
+    frame_trace_send( trace_put );
+    fclose( trace_file );
+  }
+
+  const sim_stats_t          *s = &sim_stats;
+  const screen_dirty_stats_t *d = &screen_dirty_stats;
+  const bus_snoop_stats_t    *n = &bus_snoop_stats;
+  const frame_sched_stats_t  *f = &frame_sched_stats;
+
+  /* The last block sent should be what's in the RAM */
+  uint32_t bulk_mismatches = 0;
+  if( bulk_blocks )
+  {
+    for( uint32_t i = 0; i < BULK_SIZE; i++ )
+    {
+      if( sim_ram[BULK_ADDRESS+i] != bulk_block[i] )
+	bulk_mismatches++;
+    }
+  }
+
+  uint32_t capture_mismatches = 0;
+  if( captures )
+  {
+    for( uint32_t i = BULK_ADDRESS; i < 0x10000; i++ )
+    {
+      if( sim_ram[i] != capture_buffer[i-CAPTURE_ADDRESS] )
+	capture_mismatches++;
+    }
+  }
+
+  uint32_t upper_mismatches = 0;
+  if( upper_blocks )
+  {
+    for( uint32_t i = 0; i < UPPER_SIZE; i++ )
+    {
+      if( sim_ram[UPPER_ADDRESS+i] != upper_block[i] )
+	upper_mismatches++;
+    }
+  }
+
+  /* The jobs which are done should be in the RAM */
+  uint32_t job_mismatches = 0;
+  for( uint32_t j = 0; j < JOBS; j++ )
+  {
+    for( uint32_t p = 0; (p < JOB_PARTS) && !jobs[j].busy && jobs_done; p++ )
+    {
+      for( uint32_t i = 0; i < job_part_length[p]; i++ )
+      {
+	if( sim_ram[job_part_base[p] + (j*16) + i] != jobs[j].data[p][i] )
+	  job_mismatches++;
+      }
+    }
+  }
+
+  printf( "workload %s, %u frames\n", workload->name, s->frames );
+  printf( "  transfers          %u\n", s->transfers );
+  printf( "  bytes written      %llu (%.1f per frame)\n",
+	  (unsigned long long)s->bytes_written, (double)s->bytes_written/s->frames );
+  if( f->bytes_uncontended )
+    printf( "  uncontended        %llu bytes (%.1f per frame)\n",
+	    (unsigned long long)f->bytes_uncontended, (double)f->bytes_uncontended/s->frames );
+  if( s->bytes_read )
+    printf( "  bytes read         %llu (%.1f per frame)\n",
+	    (unsigned long long)s->bytes_read, (double)s->bytes_read/s->frames );
+  printf( "  bus master cycles  %llu\n", (unsigned long long)s->bus_master_cycles );
+  printf( "  dirty sent/skipped %llu/%llu in %llu runs\n",
+	  (unsigned long long)d->total_bytes_sent, (unsigned long long)d->total_bytes_skipped,
+	  (unsigned long long)d->total_runs );
+  printf( "  /INT to BUSREQ     avg %.2fus max %.2fus\n",
+	  s->busreqs ? (double)s->busreq_latency_ticks/s->busreqs/SIM_TICKS_PER_US : 0.0,
+	  (double)s->busreq_latency_max_ticks/SIM_TICKS_PER_US );
+  printf( "  frames drawn       %u\n", render_count );
+  printf( "  BUSACK wait        avg %.1fT max %uT\n",
+	  s->busack_waits ? (double)s->busack_wait_tstates/s->busack_waits : 0.0, s->busack_wait_max_tstates );
+  printf( "  Z80 stalls         %u, avg %.1fus, longest %.1fus, %u over the limit\n", s->stalls,
+	  s->stalls ? (double)s->stall_ticks/s->stalls/SIM_TICKS_PER_US : 0.0,
+	  (double)s->stall_max_ticks/SIM_TICKS_PER_US, s->long_stalls );
+  printf( "  bus holds          %u, avg %.2fus from BUSREQ to the first byte\n", zx_dma_stats.holds,
+	  zx_dma_stats.holds ? (double)zx_dma_stats.setup_total_cycles*1000000/BUS_MASTER_REFERENCE_HZ/zx_dma_stats.holds : 0.0 );
+  if( workload->rp2350 == workload_burst )
+    printf( "  bursts             hold %uus, gap %uT at the end\n", zx_dma_stats.burst_hold_us, zx_dma_stats.burst_gap_tstates );
+  printf( "  windows            %u top, %u display, %u lower, %u split\n",
+	  f->top_windows, f->display_windows, f->lower_windows, f->split );
+  if( s->clk_gated_bytes )
+    printf( "  CLK gated          %llu bytes, %.2fT per byte\n", (unsigned long long)s->clk_gated_bytes,
+	    (double)(s->clk_gated_bytes*BUS_MASTER_CYCLES_PER_BYTE + s->clk_wait_cycles) *
+	    SIM_TICKS_PER_RP_CYCLE / SIM_TICKS_PER_TSTATE / s->clk_gated_bytes );
+  printf( "  early BUSREQ       %u windows, avg %.2fus max %.2fus ahead\n", zx_dma_stats.early_busreqs,
+	  zx_dma_stats.early_busreqs ? (double)zx_dma_stats.early_total_cycles*1000000/BUS_MASTER_REFERENCE_HZ/zx_dma_stats.early_busreqs : 0.0,
+	  (double)zx_dma_stats.early_max_cycles*1000000/BUS_MASTER_REFERENCE_HZ );
+  printf( "  frame clock        %s, %u locks, %u unlocks, %u resyncs, error %.2fus to %.2fus, period %+dns\n",
+	  frame_clock_locked() ? "locked" : "unlocked", frame_clock_stats.locks, frame_clock_stats.unlocks,
+	  frame_clock_stats.resyncs, frame_clock_stats.error_min_ns/1000.0, frame_clock_stats.error_max_ns/1000.0,
+	  frame_clock_stats.period_ns );
+  printf( "  BUSACK timeouts    %u, %u resets, %u transfers cancelled\n",
+	  zx_dma_stats.busack_timeouts, zx_dma_stats.resets, zx_dma_stats.cancelled );
+  printf( "  longest handler    /INT %.1fus, window %.1fus\n",
+	  (double)zx_dma_stats.int_handler_max_cycles*1000000/BUS_MASTER_REFERENCE_HZ,
+	  (double)zx_dma_stats.window_max_cycles*1000000/BUS_MASTER_REFERENCE_HZ );
+  printf( "  frame overruns     %u\n", s->frame_overruns );
+  printf( "  missed /INTs       %u\n", s->missed_ints );
+  printf( "  contended writes   %llu\n", (unsigned long long)s->contended_writes );
+  if( s->bytes_read )
+    printf( "  contended reads    %llu\n", (unsigned long long)s->contended_reads );
+  printf( "  short /WR writes   %llu\n", (unsigned long long)s->short_strobe_writes );
+  printf( "  strobe             %u cycles, shortest %u, %u calibrations of %u probes in %u parts, %u failed\n",
+	  bus_master_strobe_cycles(), strobe_cal_stats.shortest, strobe_cal_stats.runs,
+	  strobe_cal_stats.probes, strobe_cal_stats.parts, strobe_cal_stats.failures );
+  printf( "  Z80 writes         %llu, snooped %llu, missed %llu\n",
+	  (unsigned long long)s->z80_writes, (unsigned long long)s->snoop_hits,
+	  (unsigned long long)s->snoop_misses );
+  printf( "  snoop ring         %llu events, high water %u/%u, %u overflows, %llu lost\n",
+	  (unsigned long long)n->events, n->high_water, (unsigned)BUS_SNOOP_RING_EVENTS,
+	  n->overflows, (unsigned long long)n->lost );
+  printf( "  mirror mismatches  %u\n", mismatches );
+  if( workload->rp2350 == workload_bulk )
+    printf( "  bulk blocks        %u sent, %u bytes mismatched\n", bulk_blocks, bulk_mismatches );
+  if( workload->rp2350 == workload_upper )
+    printf( "  upper blocks       %u sent, %u bytes mismatched\n", upper_blocks, upper_mismatches );
+  if( workload->rp2350 == workload_jobs )
+    printf( "  jobs               %u done, %.1f per transfer, %u ring full, %u bytes mismatched\n",
+	    jobs_done, s->transfers ? (double)jobs_done/s->transfers : 0.0, job_queue.full, job_mismatches );
+  if( workload->rp2350 == workload_capture )
+    printf( "  captures           %u, %u frames at most (%u expected), %u bytes mismatched\n",
+	    captures, capture_frames_max, frame_sched_read_frames( CAPTURE_SIZE ), capture_mismatches );
+
+  if( workload->shadow )
+  {
+    const zx_shadow_stats_t *h = &zx_shadow_stats;
+
+    printf( "  shadow             %u/%u pages valid, seeded in %u frames with %u reads, %u dropped\n",
+	    shadow_valid, (unsigned)ZX_SHADOW_PAGES, h->seed_frames, h->seeds, h->invalidations );
+    printf( "  shadow checks      %u, %u pages wrong (%u bytes), coherent for %u frames, %u bytes mismatched at the end\n",
+	    h->verifies, h->verify_mismatches, h->mismatched_bytes, h->coherent_frames_max, shadow_mismatches );
+  }
+
+  if( workload->z80 == workload_tape )
+    printf( "  tape               %u of %u loads, %llu bytes, %u failed, last took %u frames, %u wrong\n",
+	    zx_tape_stats.loads, (unsigned)TAPE_LOADS, (unsigned long long)zx_tape_stats.bytes,
+	    zx_tape_stats.failures, zx_tape_stats.last_load_frames, tape_wrong );
+
+  if( workload->renderer == render_sprites )
+    printf( "  compositor         %u frames, %.1f cells drawn and %.1f bytes sent per frame\n",
+	    compositor_stats.frames, compositor_stats.frames ? (double)compositor_stats.cells/compositor_stats.frames : 0.0,
+	    (double)d->total_bytes_sent/s->frames );
+
+  if( workload->z80 == workload_ports )
+    printf( "  ports              %u checks, %u INs, %u OUTs, busy in %u, %u random repeats, %u wrong\n",
+	    ports_checks, zx_port_stats.ins, zx_port_stats.outs, ports_busy_seen, ports_repeats, ports_wrong );
+
+  if( workload->z80 == workload_mailbox )
+    printf( "  mailbox            %u of %u commands, %u retried, %u ignored, %u frames at most, %u wrong\n",
+	    mailbox_next, (unsigned)MAILBOX_STEPS, mailbox_retries, zx_mailbox_stats.ignored, mailbox_frames_max, mailbox_wrong );
+
+  if( workload->z80 == workload_copper )
+    printf( "  copper             %u frames checked, %u groups, %u actions, %u OUTs, %d T early to %d T late, %u late, %u missed, %u lists rejected, %u wrong\n",
+	    copper_frames, copper_stats.groups, copper_stats.actions, copper_outs, copper_early_max, copper_late_max,
+	    copper_stats.late, copper_stats.missed, copper_stats.rejected, copper_wrong );
+
+  if( workload->z80 == workload_snapshot )
+    printf( "  snapshot           %u loaded, parked for %u frames, %u frames from the request, %u wrong\n",
+	    zx_snapshot_stats.loads, snapshot_frames, zx_snapshot_stats.last_load_frames, snapshot_wrong );
+
+  bool failed = s->contended_writes || s->contended_reads || s->short_strobe_writes || s->missed_ints ||
+                s->frame_overruns || s->snoop_misses || mismatches || bulk_mismatches || capture_mismatches || upper_mismatches || job_mismatches ||
+                ((workload->rp2350 == workload_jobs) && (jobs_done == 0)) ||
+                (workload->shadow && ((shadow_valid != ZX_SHADOW_PAGES) || shadow_mismatches ||
+				      zx_shadow_stats.verify_mismatches || (zx_shadow_stats.verifies == 0))) ||
+                ((workload->z80 == workload_tape) && (tape_wrong || (tape_next != TAPE_LOADS))) ||
+                ((workload->z80 == workload_ports) && (ports_wrong || (ports_checks == 0) || (ports_repeats*16 > ports_checks))) ||
+                ((workload->z80 == workload_mailbox) && (mailbox_wrong || (mailbox_next != MAILBOX_STEPS))) ||
+                ((workload->z80 == workload_copper) && (copper_wrong || (copper_frames == 0) ||
+					                copper_stats.late || copper_stats.missed)) ||
+                ((workload->rp2350 == workload_burst) && s->long_stalls) ||
+                ((workload->rp2350 == workload_clock) && (!frame_clock_locked() || frame_clock_stats.unlocks ||
+					                  frame_clock_stats.resyncs)) ||
+                ((workload->z80 == workload_snapshot) && (snapshot_wrong || (snapshot_state != SNAPSHOT_RUNNING) ||
+					                  (zx_snapshot_stats.last_load_frames > ZX_SNAPSHOT_PARK_FRAMES))) ||
+                (captures && (capture_frames_max > frame_sched_read_frames( CAPTURE_SIZE )));
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Snapshot decoding. Formats as documented at
+ * https://worldofspectrum.org/faq/reference/formats.htm and
+ * https://worldofspectrum.org/faq/reference/z80format.htm
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "snapshot_file.h"
+
+#define WORD(p) ((uint16_t)((p)[0] | ((p)[1] << 8)))
+
+/* The 16K pages of a 48K machine in a version 2 or 3 .z80, and where they go */
+#define Z80_PAGE_8000   4
+#define Z80_PAGE_C000   5
+#define Z80_PAGE_4000   8
+
+/*
+ * .sna. The PC is on the stack, as if there'd been an NMI, and the
+ * interrupt state is IFF2's.
+ */
+static snapshot_result_t decode_sna( const uint8_t *file, uint8_t *ram, snapshot_regs_t *regs )
+{
+  memcpy( ram, &file[27], SNAPSHOT_RAM_SIZE );
+
+  regs->i      = file[0];
+  regs->hl_alt = WORD( &file[1] );
+  regs->de_alt = WORD( &file[3] );
+  regs->bc_alt = WORD( &file[5] );
+  regs->af_alt = WORD( &file[7] );
+  regs->hl     = WORD( &file[9] );
+  regs->de     = WORD( &file[11] );
+  regs->bc     = WORD( &file[13] );
+  regs->iy     = WORD( &file[15] );
+  regs->ix     = WORD( &file[17] );
+  regs->iff2   = (file[19] >> 2) & 1;
+  regs->iff1   = regs->iff2;
+  regs->r      = file[20];
+  regs->af     = WORD( &file[21] );
+  regs->sp     = WORD( &file[23] );
+  regs->im     = file[25] & 3;
+  regs->border = file[26] & 7;
+
+  if( regs->sp < 0x4000 )
+    return SNAPSHOT_BAD_FORMAT;
+
+  uint32_t sp = regs->sp - 0x4000;
+  regs->pc  = ram[sp] | (ram[(sp+1) % SNAPSHOT_RAM_SIZE] << 8);
+  regs->sp += 2;
+
+  return SNAPSHOT_OK;
+}
+
+/*
+ * A .z80 block, ED ED nn bb being nn copies of bb. Version 1's 48K ends
+ * with 00 ED ED 00, the later versions' blocks have their lengths given.
+ * Returns the number of bytes of the file used, or 0 if the output's the
+ * wrong size.
+ */
+static uint32_t expand( const uint8_t *in, uint32_t in_length, uint8_t *out, uint32_t out_length, bool marker )
+{
+  uint32_t i = 0, o = 0;
+
+  while( i < in_length )
+  {
+    if( marker && (i+4 <= in_length) && (memcmp( &in[i], "\x00\xED\xED\x00", 4 ) == 0) )
+    {
+      i += 4;
+      break;
+    }
+
+    if( (i+4 <= in_length) && (in[i] == 0xED) && (in[i+1] == 0xED) )
+    {
+      uint32_t count = in[i+2];
+
+      if( o+count > out_length )
+	return 0;
+
+      memset( &out[o], in[i+3], count );
+      o += count;
+      i += 4;
+    }
+    else
+    {
+      if( o == out_length )
+	return 0;
+
+      out[o++] = in[i++];
+    }
+  }
+
+  return (o == out_length) ? i : 0;
+}
+
+static snapshot_result_t decode_z80( const uint8_t *file, uint32_t length, uint8_t *ram, snapshot_regs_t *regs )
+{
+  if( length < 30 )
+    return SNAPSHOT_TRUNCATED;
+
+  uint8_t flags = (file[12] == 0xFF) ? 1 : file[12];
+
+  regs->af     = (file[0] << 8) | file[1];
+  regs->bc     = WORD( &file[2] );
+  regs->hl     = WORD( &file[4] );
+  regs->pc     = WORD( &file[6] );
+  regs->sp     = WORD( &file[8] );
+  regs->i      = file[10];
+  regs->r      = (file[11] & 0x7F) | ((flags & 1) << 7);
+  regs->border = (flags >> 1) & 7;
+  regs->de     = WORD( &file[13] );
+  regs->bc_alt = WORD( &file[15] );
+  regs->de_alt = WORD( &file[17] );
+  regs->hl_alt = WORD( &file[19] );
+  regs->af_alt = (file[21] << 8) | file[22];
+  regs->iy     = WORD( &file[23] );
+  regs->ix     = WORD( &file[25] );
+  regs->iff1   = file[27] ? 1 : 0;
+  regs->iff2   = file[28] ? 1 : 0;
+  regs->im     = file[29] & 3;
+
+  /* Version 1, the 48K follows the header */
+  if( regs->pc != 0 )
+  {
+    if( !(flags & 0x20) )
+    {
+      if( length < 30+SNAPSHOT_RAM_SIZE )
+	return SNAPSHOT_TRUNCATED;
+
+      memcpy( ram, &file[30], SNAPSHOT_RAM_SIZE );
+      return SNAPSHOT_OK;
+    }
+
+    return expand( &file[30], length-30, ram, SNAPSHOT_RAM_SIZE, true ) ? SNAPSHOT_OK : SNAPSHOT_TRUNCATED;
+  }
+
+  /* Versions 2 and 3, with an extra header and a block per 16K page */
+  if( length < 32 )
+    return SNAPSHOT_TRUNCATED;
+
+  uint32_t extra = WORD( &file[30] );
+  uint32_t pos   = 32+extra;
+  if( (extra < 23) || (length < pos) )
+    return (length < pos) ? SNAPSHOT_TRUNCATED : SNAPSHOT_BAD_FORMAT;
+
+  /* The machine's numbers for the 48K and its add ons differ between the versions */
+  uint8_t machine = file[34];
+  bool    v2      = (extra == 23);
+  if( (v2 && (machine > 2)) || (!v2 && (machine > 3)) || (file[37] & 0x80) )
+    return SNAPSHOT_NOT_48K;
+
+  regs->pc = WORD( &file[32] );
+
+  uint32_t pages = 0;
+  while( pos+3 <= length )
+  {
+    uint32_t block_length = WORD( &file[pos] );
+    uint8_t  page         = file[pos+2];
+    bool     compressed   = (block_length != 0xFFFF);
+
+    pos += 3;
+    if( !compressed )
+      block_length = 0x4000;
+    if( pos+block_length > length )
+      return SNAPSHOT_TRUNCATED;
+
+    uint8_t *dst = NULL;
+    if( page == Z80_PAGE_4000 )
+      dst = &ram[0x0000];
+    else if( page == Z80_PAGE_8000 )
+      dst = &ram[0x4000];
+    else if( page == Z80_PAGE_C000 )
+      dst = &ram[0x8000];
+
+    /* Anything else is a ROM or an add on's, not needed */
+    if( dst )
+    {
+      if( !compressed )
+	memcpy( dst, &file[pos], 0x4000 );
+      else if( expand( &file[pos], block_length, dst, 0x4000, false ) != block_length )
+	return SNAPSHOT_BAD_FORMAT;
+
+      pages++;
+    }
+
+    pos += block_length;
+  }
+
+  return (pages == 3) ? SNAPSHOT_OK : SNAPSHOT_TRUNCATED;
+}
+
+snapshot_result_t snapshot_decode( const uint8_t *file, uint32_t length, uint8_t *ram, snapshot_regs_t *regs )
+{
+  memset( regs, 0, sizeof(*regs) );
+
+  if( length == SNAPSHOT_SNA_SIZE )
+    return decode_sna( file, ram, regs );
+
+  return decode_z80( file, length, ram, regs );
+}
+
+/*
+ * The stub. The main registers can't be loaded until the alternate set
+ * has been, and AF only comes off a stack, so it's popped from data after
+ * the code. R counts on with each instruction fetched, it's set to come
+ * out right at the jump.
+ *
+ *   LD A,border; OUT ($FE),A; LD A,i; LD I,A; IM n
+ *   LD BC,bc'; LD DE,de'; LD HL,hl'; EXX
+ *   LD SP,af'; POP AF; EX AF,AF'
+ *   LD BC,bc; LD DE,de; LD HL,hl; LD IX,ix; LD IY,iy
+ *   LD A,r; LD R,A; LD SP,af; POP AF; LD SP,sp; EI or NOP; JP pc
+ *
+ * IFF2 can't be set apart from IFF1 without a RETN, it ends up the same.
+ */
+#define EMIT(b)     (code[n++] = (b))
+#define EMIT16(w)   (EMIT( (w) & 0xFF ), EMIT( (w) >> 8 ))
+
+/* Instructions fetched after LD R,A up to the game's first */
+#define STUB_FETCHES_AFTER_R 5
+
+uint32_t snapshot_stub( uint8_t *code, uint16_t at, const snapshot_regs_t *regs )
+{
+  static const uint8_t im_opcodes[] = { 0x46, 0x56, 0x5E, 0x5E };
+
+  uint32_t n = 0;
+  uint16_t data = at + SNAPSHOT_STUB_SIZE - 4;
+
+  EMIT( 0x3E ); EMIT( regs->border );                      /* LD A,border */
+  EMIT( 0xD3 ); EMIT( 0xFE );                              /* OUT ($FE),A */
+  EMIT( 0x3E ); EMIT( regs->i );                           /* LD A,i */
+  EMIT( 0xED ); EMIT( 0x47 );                              /* LD I,A */
+  EMIT( 0xED ); EMIT( im_opcodes[regs->im & 3] );          /* IM n */
+
+  EMIT( 0x01 ); EMIT16( regs->bc_alt );                    /* LD BC,bc' */
+  EMIT( 0x11 ); EMIT16( regs->de_alt );                    /* LD DE,de' */
+  EMIT( 0x21 ); EMIT16( regs->hl_alt );                    /* LD HL,hl' */
+  EMIT( 0xD9 );                                            /* EXX */
+  EMIT( 0x31 ); EMIT16( data );                            /* LD SP,af' */
+  EMIT( 0xF1 );                                            /* POP AF */
+  EMIT( 0x08 );                                            /* EX AF,AF' */
+
+  EMIT( 0x01 ); EMIT16( regs->bc );                        /* LD BC,bc */
+  EMIT( 0x11 ); EMIT16( regs->de );                        /* LD DE,de */
+  EMIT( 0x21 ); EMIT16( regs->hl );                        /* LD HL,hl */
+  EMIT( 0xDD ); EMIT( 0x21 ); EMIT16( regs->ix );          /* LD IX,ix */
+  EMIT( 0xFD ); EMIT( 0x21 ); EMIT16( regs->iy );          /* LD IY,iy */
+
+  uint8_t r = (regs->r & 0x80) | ((regs->r - STUB_FETCHES_AFTER_R) & 0x7F);
+  EMIT( 0x3E ); EMIT( r );                                 /* LD A,r */
+  EMIT( 0xED ); EMIT( 0x4F );                              /* LD R,A */
+  EMIT( 0x31 ); EMIT16( data+2 );                          /* LD SP,af */
+  EMIT( 0xF1 );                                            /* POP AF */
+  EMIT( 0x31 ); EMIT16( regs->sp );                        /* LD SP,sp */
+  EMIT( regs->iff1 ? 0xFB : 0x00 );                        /* EI or NOP */
+  EMIT( 0xC3 ); EMIT16( regs->pc );                        /* JP pc */
+
+  while( n < SNAPSHOT_STUB_SIZE-4 )
+    EMIT( 0x00 );
+
+  EMIT16( regs->af_alt );
+  EMIT16( regs->af );
+
+  return n;
+}
@@ -0,0 +1,74 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __SNAPSHOT_FILE_H
+#define __SNAPSHOT_FILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * 48K snapshot files, .sna and .z80 (versions 1, 2 and 3, compressed or
+ * not). Decoding gives the RAM from 0x4000 and the Z80's registers; the
+ * registers are put back by a few bytes of Z80 code made here, see
+ * zx_snapshot.c for how it's run. None of this touches the bus, it's
+ * checked on the host by sim/snapshot_check.c.
+ */
+#define SNAPSHOT_RAM_SIZE   0xC000
+#define SNAPSHOT_SNA_SIZE   (27+SNAPSHOT_RAM_SIZE)
+
+/* The biggest a 48K one can be, a version 3 .z80 with its pages uncompressed */
+#define SNAPSHOT_MAX_SIZE   (32+55+3*(3+0x4000))
+
+/* The longest snapshot_stub() makes, code and data */
+#define SNAPSHOT_STUB_SIZE  64
+
+typedef struct
+{
+  uint16_t af, bc, de, hl;
+  uint16_t af_alt, bc_alt, de_alt, hl_alt;
+  uint16_t ix, iy, sp, pc;
+  uint8_t  i, r;
+  uint8_t  iff1, iff2;
+  uint8_t  im;
+  uint8_t  border;
+} snapshot_regs_t;
+
+typedef enum
+{
+  SNAPSHOT_OK,
+  SNAPSHOT_TRUNCATED,      /* Ran out of file */
+  SNAPSHOT_NOT_48K,        /* A 128K or other machine's snapshot */
+  SNAPSHOT_BAD_FORMAT,     /* Not a .sna or .z80 this understands */
+} snapshot_result_t;
+
+/*
+ * Decode a .sna (recognised by its length) or a .z80 into ram, which is
+ * SNAPSHOT_RAM_SIZE bytes for 0x4000 to 0xFFFF, and regs
+ */
+snapshot_result_t snapshot_decode( const uint8_t *file, uint32_t length, uint8_t *ram, snapshot_regs_t *regs );
+
+/*
+ * Make the code which puts the registers back and jumps to PC, to run at
+ * address "at", which has to be in the ROM (it reads its data from
+ * there). It's entered with interrupts off. Returns its length.
+ */
+uint32_t snapshot_stub( uint8_t *code, uint16_t at, const snapshot_regs_t *regs );
+
+#endif
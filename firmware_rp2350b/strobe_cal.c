@@ -0,0 +1,150 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Strobe calibration. A binary search over the strobe length, each probe
+ * writing two complementary patterns and reading each back, so a write
+ * which didn't take shows up whatever was there before. The search can
+ * be done a few probes at a time.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bus_master.h"
+#include "strobe_cal.h"
+
+/* Starting each blocking transfer and waiting for the state machine to finish, about 2us */
+#define TRANSFER_OVERHEAD_CYCLES 300
+
+strobe_cal_stats_t strobe_cal_stats;
+
+static uint8_t saved[STROBE_CAL_LENGTH];
+static uint8_t pattern[STROBE_CAL_LENGTH];
+static uint8_t readback[STROBE_CAL_LENGTH];
+
+/* The search so far */
+static bool     running;
+static bool     longest_tried;
+static uint32_t low, high;
+static uint32_t previous;
+
+/* Both patterns have each bit of each byte high and low at least once */
+static bool probe( uint32_t cycles )
+{
+  bus_master_set_strobe_cycles( cycles );
+  strobe_cal_stats.probes++;
+
+  for( uint32_t pass = 0; pass < 2; pass++ )
+  {
+    for( uint32_t i = 0; i < STROBE_CAL_LENGTH; i++ )
+      pattern[i] = ((i & 1) ? 0x55 : 0xAA) ^ (pass ? 0xFF : 0x00) ^ (uint8_t)(i << 3);
+
+    bus_master_write_blocking( STROBE_CAL_ADDRESS, pattern, STROBE_CAL_LENGTH );
+    bus_master_read( STROBE_CAL_ADDRESS, readback, STROBE_CAL_LENGTH );
+
+    if( memcmp( pattern, readback, STROBE_CAL_LENGTH ) != 0 )
+      return false;
+  }
+
+  return true;
+}
+
+/* Writing and reading the scratch area, with the longest strobe for the writes */
+static uint32_t write_cycles( void )
+{
+  return TRANSFER_OVERHEAD_CYCLES + BUS_MASTER_HEADER_CYCLES +
+         STROBE_CAL_LENGTH*(BUS_MASTER_CYCLES_PER_BYTE - BUS_MASTER_STROBE_CYCLES + BUS_MASTER_MAX_STROBE_CYCLES);
+}
+
+static uint32_t read_cycles( void )
+{
+  return TRANSFER_OVERHEAD_CYCLES + BUS_MASTER_READ_HEADER_CYCLES + STROBE_CAL_LENGTH*BUS_MASTER_READ_CYCLES_PER_BYTE;
+}
+
+bool strobe_cal_run( uint32_t max_cycles )
+{
+  uint32_t save_cycles  = read_cycles() + write_cycles();
+  uint32_t probe_cycles = 2*(write_cycles() + read_cycles());
+
+  if( max_cycles < save_cycles+probe_cycles )
+    return false;
+
+  uint32_t probes = (max_cycles-save_cycles) / probe_cycles;
+
+  if( !running )
+  {
+    running       = true;
+    longest_tried = false;
+    previous      = bus_master_strobe_cycles();
+    low           = BUS_MASTER_MIN_STROBE_CYCLES;
+    high          = BUS_MASTER_MAX_STROBE_CYCLES;
+    strobe_cal_stats.runs++;
+  }
+
+  strobe_cal_stats.parts++;
+
+  bus_master_read( STROBE_CAL_ADDRESS, saved, STROBE_CAL_LENGTH );
+
+  bool     finished = false;
+  uint32_t result   = previous;
+
+  if( !longest_tried )
+  {
+    longest_tried = true;
+    probes--;
+
+    if( !probe( high ) )
+    {
+      /* Nothing works, not the strobe's fault. Leave it be */
+      strobe_cal_stats.failures++;
+      finished = true;
+    }
+  }
+
+  while( !finished && (low < high) && probes )
+  {
+    uint32_t mid = (low+high)/2;
+
+    if( probe( mid ) )
+      high = mid;
+    else
+      low = mid+1;
+
+    probes--;
+  }
+
+  if( !finished && (low == high) )
+  {
+    strobe_cal_stats.shortest = low;
+    result   = low + ((low*STROBE_CAL_MARGIN_PERCENT)+99)/100;
+    finished = true;
+  }
+
+  /* Put the scratch area back with a strobe which is sure to work */
+  bus_master_set_strobe_cycles( BUS_MASTER_MAX_STROBE_CYCLES );
+  bus_master_write_blocking( STROBE_CAL_ADDRESS, saved, STROBE_CAL_LENGTH );
+
+  bus_master_set_strobe_cycles( result );
+  strobe_cal_stats.strobe_cycles = bus_master_strobe_cycles();
+
+  running = !finished;
+  return finished;
+}
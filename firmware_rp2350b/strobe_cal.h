@@ -0,0 +1,78 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __STROBE_CAL_H
+#define __STROBE_CAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Finds the shortest /WR strobe this machine's RAM reliably takes, by
+ * writing test patterns into a scratch area and reading them back, and
+ * sets the bus master to use it plus a margin.
+ *
+ * The scratch area is the 48K's printer buffer, in the lower RAM where the
+ * strobe matters. Its contents are saved first and put back afterwards.
+ */
+#define STROBE_CAL_ADDRESS        0x5B00
+#define STROBE_CAL_LENGTH         64
+
+/*
+ * The margin on top of the shortest strobe which worked. The safe value
+ * drifts as the machine warms up and cools down, 29 cycles working on a
+ * warm machine which needed 35 cold, so it's generous.
+ */
+#define STROBE_CAL_MARGIN_PERCENT 25
+
+/* How often to recalibrate, about every 10 seconds */
+#define STROBE_CAL_INTERVAL_FRAMES 500
+
+/*
+ * "shortest" is the shortest strobe which worked last time, "failures"
+ * counts calibrations where even the longest strobe didn't, which leaves
+ * the strobe as it was. "parts" is how many goes the calibrations took.
+ * Look at these in the debugger.
+ */
+typedef struct
+{
+  uint32_t runs;
+  uint32_t parts;
+  uint32_t probes;
+  uint32_t shortest;
+  uint32_t strobe_cycles;
+  uint32_t failures;
+} strobe_cal_stats_t;
+
+extern strobe_cal_stats_t strobe_cal_stats;
+
+/*
+ * Start a calibration, or carry on with one, doing as many probes as fit
+ * in max_cycles of the bus master's time at BUS_MASTER_REFERENCE_HZ. The
+ * caller must have the Z80's bus, with the snoop paused. All of it takes
+ * about a millisecond, less with the bus for longer at a time.
+ *
+ * The scratch area is put back after each part and the strobe is the one
+ * which was in use until the search is over, so the Z80 can have the bus
+ * in between. Returns true once it's over, false if there's more to do
+ * or max_cycles wasn't enough for a probe.
+ */
+bool strobe_cal_run( uint32_t max_cycles );
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * ZX0 decompression, following the reference decompressor. The stream is
+ * bytes with bits in among them: a byte of bits is read, most significant
+ * first, whenever the last is used up. Numbers are interlaced Elias gamma
+ * codes. Blocks are literals, a copy from the last offset, or a copy from
+ * a new offset, whose low 7 bits share a byte with the first bit of the
+ * length after it.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "zx0.h"
+
+#define ZX0_END_OFFSET 256
+
+typedef struct
+{
+  zx0_read_t read;
+  void      *context;
+  uint8_t    bits;
+  uint8_t    mask;
+  bool       backtrack;
+  uint8_t    last_byte;
+  bool       failed;
+} stream_t;
+
+static uint8_t read_byte( stream_t *s )
+{
+  int c = s->read( s->context );
+  if( c < 0 )
+  {
+    s->failed = true;
+    c = 0;
+  }
+
+  s->last_byte = c;
+  return c;
+}
+
+static uint32_t read_bit( stream_t *s )
+{
+  if( s->backtrack )
+  {
+    s->backtrack = false;
+    return s->last_byte & 1;
+  }
+
+  s->mask >>= 1;
+  if( s->mask == 0 )
+  {
+    s->mask = 0x80;
+    s->bits = read_byte( s );
+  }
+
+  return (s->bits & s->mask) ? 1 : 0;
+}
+
+/* Anything over 16 bits is bad data */
+static uint32_t read_gamma( stream_t *s, uint32_t inverted )
+{
+  uint32_t value = 1;
+
+  while( !s->failed && !read_bit( s ) )
+  {
+    value = (value << 1) | (read_bit( s ) ^ inverted);
+    if( value > 0xFFFF )
+      s->failed = true;
+  }
+
+  return value;
+}
+
+uint32_t zx0_decompress( zx0_read_t read, void *context, uint8_t *dst, uint32_t max )
+{
+  stream_t s           = { read, context, 0, 0, false, 0, false };
+  uint32_t out         = 0;
+  uint32_t last_offset = 1;
+  uint32_t length;
+  bool     new_offset;
+
+  /* Literals first, every time */
+  for( ;; )
+  {
+    length = read_gamma( &s, 0 );
+    if( s.failed || (out+length > max) )
+      return 0;
+
+    for( uint32_t i = 0; i < length; i++ )
+      dst[out++] = read_byte( &s );
+
+    new_offset = read_bit( &s );
+
+    if( !new_offset )
+    {
+      length = read_gamma( &s, 0 );
+      if( s.failed || (out+length > max) || (last_offset > out) )
+	return 0;
+
+      for( uint32_t i = 0; i < length; i++, out++ )
+	dst[out] = dst[out-last_offset];
+
+      if( !read_bit( &s ) )
+	continue;
+    }
+
+    /* New offsets, as many as follow each other */
+    for( ;; )
+    {
+      uint32_t msb = read_gamma( &s, 1 );
+      if( s.failed )
+	return 0;
+      if( msb == ZX0_END_OFFSET )
+	return out;
+
+      last_offset = (msb*128) - (read_byte( &s ) >> 1);
+      s.backtrack = true;
+
+      length = read_gamma( &s, 0 ) + 1;
+      if( s.failed || (out+length > max) || (last_offset == 0) || (last_offset > out) )
+	return 0;
+
+      for( uint32_t i = 0; i < length; i++, out++ )
+	dst[out] = dst[out-last_offset];
+
+      if( !read_bit( &s ) )
+	break;
+    }
+  }
+}
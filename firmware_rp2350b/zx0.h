@@ -0,0 +1,38 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __ZX0_H
+#define __ZX0_H
+
+#include <stdint.h>
+
+/*
+ * Decompression of Einar Saukas' ZX0 format, the current one (version 2,
+ * not "classic"), forwards. It's what most Spectrum software compresses
+ * with now. The compressed data comes a byte at a time from read, which
+ * returns -1 if there's no more.
+ *
+ * Returns the decompressed length, or 0 if the data's bad, ran out, or
+ * would make more than max bytes.
+ */
+typedef int (*zx0_read_t)( void *context );
+
+uint32_t zx0_decompress( zx0_read_t read, void *context, uint8_t *dst, uint32_t max );
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __ZX_DISPLAY_H
+#define __ZX_DISPLAY_H
+
+/*
+ * The ZX display file. Pixel data is 256x192 pixels, at 8 pixels per
+ * byte. Colour attributes are 32x24 bytes
+ */
+#define ZX_DISPLAY_FILE_ADDRESS        0x4000
+#define ZX_DISPLAY_FILE_PIXEL_SIZE     ((256*192)/8)
+#define ZX_DISPLAY_FILE_ATTRIBUTE_SIZE (32*24)
+#define ZX_DISPLAY_FILE_SIZE           (ZX_DISPLAY_FILE_PIXEL_SIZE + ZX_DISPLAY_FILE_ATTRIBUTE_SIZE)
+
+#define ZX_DISPLAY_COLUMNS             32
+#define ZX_DISPLAY_PIXEL_ROWS          192
+#define ZX_DISPLAY_CHAR_ROWS           24
+
+/*
+ * Offset into the display file of the start of pixel row y (0-191). The
+ * bits of y are third (7-6), pixel row in the character (2-0) and
+ * character row in the third (5-3), in that order of significance.
+ * Each row is 32 bytes, and always starts on a 32 byte boundary.
+ */
+#define ZX_DISPLAY_ROW_OFFSET(y)       ((((y) & 0xC0) << 5) | (((y) & 0x07) << 8) | (((y) & 0x38) << 2))
+
+/* Offset of the attribute row for character row r (0-23) */
+#define ZX_DISPLAY_ATTR_ROW_OFFSET(r)  (ZX_DISPLAY_FILE_PIXEL_SIZE + ((r)*ZX_DISPLAY_COLUMNS))
+
+/*
+ * 48K frame timing, from the fall of /INT. 64 lines of top border, 192
+ * display lines, 56 lines of lower border, 224T per line at 3.5MHz. The
+ * ULA only contends 0x4000-0x7FFF during the display lines.
+ */
+#define ZX_TSTATES_PER_LINE            224
+#define ZX_TSTATES_PER_FRAME           69888
+#define ZX_TOP_BORDER_LINES            64
+#define ZX_LOWER_BORDER_START_TSTATES  ((ZX_TOP_BORDER_LINES+ZX_DISPLAY_PIXEL_ROWS)*ZX_TSTATES_PER_LINE)
+#define ZX_TOP_BORDER_TSTATES          (ZX_TOP_BORDER_LINES*ZX_TSTATES_PER_LINE)
+
+/* The ULA fetches for the first 128T of each display line, the rest is border */
+#define ZX_ULA_FETCH_TSTATES           128
+
+#define ZX_TSTATES_TO_US(t)            (((t)*2)/7)
+
+/* The ROM, which is at the bottom of the memory map */
+#define ZX_ROM_SIZE                    0x4000
+
+/* The RAM the ULA shares, the lower 16K. The upper 32K is the Z80's alone */
+#define ZX_CONTENDED_RAM_START         0x4000
+#define ZX_CONTENDED_RAM_END           0x8000
+
+#endif
@@ -0,0 +1,1159 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The DMA experiment itself: the screen mirror, the /INT time transfer and
+ * the snoop on the Z80's writes. Everything here goes through bus_hal.h and
+ * bus_master.h so it builds for the board and for the host simulator in sim/.
+ *
+ * The mirror is double buffered. The front buffer is what the Spectrum's
+ * display file should hold: it's what gets sent, and the snooped Z80 writes
+ * go into it. It belongs to core 0. The back buffer is where core 1 draws the
+ * next frame, at its own pace. When core 1 has finished a frame the /INT
+ * handler swaps the two over and sends the difference, so the time taken to
+ * draw a frame never delays BUSREQ.
+ *
+ * The handshake is a single atomic: RENDER_WANTED gives the back buffer to
+ * core 1, RENDER_READY or RENDER_CHANGED gives it back to core 0, the
+ * latter if anything in it differs from the front. Nothing ever waits for
+ * it.
+ *
+ * The writes themselves go through frame_sched.c, which fits them into the
+ * top border after /INT and the lower border before the next one. The
+ * screen's runs are just one user of it, so anything else queued there
+ * shares the same windows.
+ *
+ * The display list in copper.c has the bus at set times in the frame. The
+ * windows stop short of each of its groups and carry on after.
+ *
+ * The frame's times are from frame_clock.c, which predicts when /INT fell
+ * rather than going by when the handler happened to run. BUSREQ goes out
+ * ahead of the lower border by the Z80's longest BUSACK wait, so the bus
+ * is held when the border starts. The top border's can't go out before
+ * /INT, the Z80 wouldn't see it, so it goes out first thing in the
+ * handler instead.
+ *
+ * In burst mode a window is split up into holds of a limited length with
+ * gaps between, see zx_dma_set_burst(). The window's picked up again from
+ * the one alarm after each gap.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "gpios.h"
+#include "bus_hal.h"
+#include "zx_display.h"
+#include "zx_dma.h"
+#include "bus_master.h"
+#include "screen_dirty.h"
+#include "bus_snoop.h"
+#include "screen_blit.h"
+#include "frame_sched.h"
+#include "frame_trace.h"
+#include "job_queue.h"
+#include "zx_shadow.h"
+#include "zx_tape.h"
+#include "zx_snapshot.h"
+#include "zx_mailbox.h"
+#include "zx_port.h"
+#include "bus_rom.h"
+#include "strobe_cal.h"
+#include "copper.h"
+#include "frame_clock.h"
+
+/*
+ * Time from the fall of /INT to the handler reading the clock. The window
+ * edges are measured from /INT, so it's taken off.
+ */
+#define ZX_DMA_INT_LATENCY_US 2
+
+zx_dma_stats_t zx_dma_stats;
+
+static uint32_t busack_timeout_us = ZX_DMA_BUSACK_TIMEOUT_US;
+
+/* Frames left before the Spectrum's RAM is touched again after a reset */
+static uint32_t reset_holdoff = 0;
+
+/*
+ * Front and back copies of the ZX display file, word aligned for the
+ * kernels in screen_blit.c. Changes to the front are tracked in the dirty
+ * map so only the bytes which differ go over the bus each frame.
+ */
+static uint8_t screen_buffers[2][ZX_DISPLAY_FILE_SIZE] __attribute__((aligned(8)));
+
+uint8_t *zx_screen_mirror = screen_buffers[0];
+uint8_t *zx_screen_back   = screen_buffers[1];
+
+/*
+ * Display file bytes the Z80 has written since the last swap. Core 1 is
+ * drawing over a copy of the front taken before some of them happened.
+ */
+static uint32_t snooped_map[SCREEN_DIRTY_MAP_WORDS];
+
+enum
+{
+  RENDER_WANTED,  /* Core 1 owns the back buffer */
+  RENDER_READY,   /* Core 1 has finished, core 0 owns the back buffer */
+  RENDER_CHANGED, /* As RENDER_READY, and there's something to send */
+};
+
+static atomic_uint render_state = RENDER_WANTED;
+
+static zx_dma_renderer_t renderer = NULL;
+
+/* When the current frame's /INT fell */
+static uint64_t frame_start_us = 0;
+
+/*
+ * Frames until the strobe is next calibrated. The first is done in the
+ * first frame, it's 0 at boot.
+ */
+static uint32_t frames_to_calibration = 0;
+static bool     calibrate_now = false;
+
+/*
+ * Screen runs queued with the scheduler and not yet written. They point
+ * into the front buffer, so it can't be swapped until they're all out.
+ */
+static uint32_t screen_runs_outstanding = 0;
+
+/* The window the bus is held for */
+static uint64_t             window_end_us = 0;
+static frame_sched_window_t window_kind   = FRAME_SCHED_TOP;
+
+static bool send_window( void );
+static void own_writes( uint16_t zx_address, const uint8_t *src, uint32_t length );
+
+/*
+ * There's one alarm. The frame's own events, display_lines() then
+ * lower_border(), share it with the display list's groups and the end
+ * of a burst's gap, whichever is sooner is set.
+ */
+static uint64_t        frame_alarm_us    = UINT64_MAX;
+static bus_hal_alarm_t frame_alarm_event = NULL;
+
+static void arm_alarm( void );
+
+/*
+ * Burst mode, see zx_dma.h. After each hold the Z80 has the bus until
+ * burst_gap_end_us, and the window is picked up again at burst_resume_us.
+ */
+static uint32_t burst_max_hold_us = 0;
+static uint32_t burst_min_gap_tstates;
+static uint64_t burst_gap_end_us  = 0;
+static uint64_t burst_resume_us   = UINT64_MAX;
+
+/* When BUSREQ went out for the bus being held now, and whether anything's moved yet */
+static uint32_t hold_start;
+static bool     hold_moved;
+
+static void request_bus( void )
+{
+  bus_hal_busreq( true );
+  frame_trace_busreq();
+
+  hold_start = bus_hal_cycles();
+  hold_moved = false;
+}
+
+/* Set while BUSREQ is out ahead of the window it's for */
+static bool     busreq_ahead = false;
+static uint32_t busreq_ahead_at;
+
+static void request_bus_ahead( void )
+{
+  request_bus();
+
+  busreq_ahead    = true;
+  busreq_ahead_at = bus_hal_cycles();
+}
+
+/* How far ahead of the lower border BUSREQ goes out */
+static uint64_t busreq_lead_us( void )
+{
+  const uint32_t cycles_per_us = BUS_MASTER_REFERENCE_HZ/1000000;
+  uint32_t       lead_us = ((zx_dma_stats.busack_max_cycles + cycles_per_us - 1) / cycles_per_us) + 1;
+
+  if( lead_us < ZX_DMA_BUSREQ_LEAD_MIN_US )
+    return ZX_DMA_BUSREQ_LEAD_MIN_US;
+  if( lead_us > ZX_DMA_BUSREQ_LEAD_MAX_US )
+    return ZX_DMA_BUSREQ_LEAD_MAX_US;
+  return lead_us;
+}
+
+static void release_bus( void )
+{
+  bus_hal_drive_rd_iorq( false );
+
+  /* Watch for the Z80's writes again, and serve its ROM, before it gets the bus back */
+  bus_snoop_resume();
+  bus_rom_resume();
+
+  /* Release bus request */
+  bus_hal_busreq( false );
+
+  uint32_t held = bus_hal_cycles() - hold_start;
+
+  zx_dma_stats.holds++;
+  zx_dma_stats.hold_total_cycles += held;
+  if( held > zx_dma_stats.hold_max_cycles )
+    zx_dma_stats.hold_max_cycles = held;
+
+  /* T-states to microseconds, rounded up, the Z80 gets at least the gap */
+  if( burst_max_hold_us )
+    burst_gap_end_us = bus_hal_time_us() + ((zx_dma_stats.burst_gap_tstates*2 + 6) / 7);
+}
+
+/*
+ * True if the Z80 is still having its gap between bursts. If it is, the
+ * window is picked up again when it's over, or at not_before_us if
+ * that's later.
+ */
+static bool in_burst_gap( uint64_t not_before_us )
+{
+  if( bus_hal_time_us() >= burst_gap_end_us )
+    return false;
+
+  uint64_t resume_us = (not_before_us > burst_gap_end_us) ? not_before_us : burst_gap_end_us;
+  if( resume_us < burst_resume_us )
+  {
+    burst_resume_us = resume_us;
+    arm_alarm();
+  }
+
+  return true;
+}
+
+/*
+ * Called from the DMA IRQ when the bus master has finished the last byte and
+ * put the address, data and control lines back to hi-Z
+ */
+static void dma_complete( void )
+{
+  frame_trace_transfer_end( bus_hal_time_us() > window_end_us );
+
+  /* See to whoever queued the transfer, they might queue more */
+  frame_sched_retire();
+
+  /*
+   * Reads wait behind the writes. If they can have the rest of the window
+   * they go now, the Z80 doesn't need the bus back in between.
+   */
+  if( frame_sched_has_work( window_kind ) && send_window() )
+    return;
+
+  release_bus();
+
+  /* Indicate DMA process complete */
+  bus_hal_signal( GPIO_BLIPPER1, 0 );
+
+  /* The burst's over but the window isn't, the rest goes after the gap */
+  if( burst_max_hold_us && frame_sched_has_work( window_kind ) )
+    in_burst_gap( 0 );
+}
+
+static void screen_run_done( void *context )
+{
+  screen_runs_outstanding--;
+}
+
+static void note_time( uint32_t start, uint32_t *max )
+{
+  uint32_t took = bus_hal_cycles() - start;
+
+  if( took > *max )
+    *max = took;
+}
+
+/*
+ * Spin waiting for Z80 to acknowledge. BUSACK goes active (low) on the
+ * rising edge of the clock - see fig8 in the Z80 manual. If it doesn't
+ * come, or the Spectrum is reset, BUSREQ is let go and false returned.
+ */
+static bool wait_busack( void )
+{
+  uint32_t start   = bus_hal_cycles();
+  uint64_t give_up = bus_hal_time_us() + busack_timeout_us;
+
+  while( !bus_hal_busack() )
+  {
+    if( (bus_hal_time_us() > give_up) || bus_hal_z80_reset() )
+    {
+      bus_hal_busreq( false );
+
+      zx_dma_stats.busack_timeouts++;
+      frame_trace_flag( FRAME_TRACE_TIMEOUT );
+      return false;
+    }
+  }
+
+  uint32_t wait = bus_hal_cycles() - start;
+
+  zx_dma_stats.busack_waits++;
+  zx_dma_stats.busack_total_cycles += wait;
+  if( wait > zx_dma_stats.busack_max_cycles )
+    zx_dma_stats.busack_max_cycles = wait;
+  frame_trace_busack();
+
+  return true;
+}
+
+/* When the display list's next group is due, UINT64_MAX if there isn't one */
+static uint64_t copper_start_us( void )
+{
+  uint32_t tstate = copper_next_tstate();
+
+  return (tstate == UINT32_MAX) ? UINT64_MAX : frame_start_us + ZX_TSTATES_TO_US( tstate );
+}
+
+/*
+ * A window ends before the display list's next group asks for the bus,
+ * with a lead's time to spare for the transfer overrunning its estimate.
+ */
+static uint64_t copper_window_end( uint64_t end_us )
+{
+  uint64_t copper_us = copper_start_us();
+
+  if( copper_us == UINT64_MAX )
+    return end_us;
+
+  copper_us -= 2*COPPER_LEAD_US;
+  return (copper_us < end_us) ? copper_us : end_us;
+}
+
+/*
+ * Only in the borders: the calibration's scratch area is contended and
+ * the calibration isn't CLK gated.
+ */
+static bool calibration_window( frame_sched_window_t window )
+{
+  return calibrate_now && ((window == FRAME_SCHED_TOP) || (window == FRAME_SCHED_LOWER));
+}
+
+/* Worth having the bus for */
+static bool window_wanted( frame_sched_window_t window )
+{
+  return frame_sched_has_work( window ) || calibration_window( window );
+}
+
+/*
+ * BUSREQ has been asserted. Wait for the bus, then send as much of the
+ * scheduler's queue as can be done before end_us.
+ */
+static void use_window( uint64_t end_us, frame_sched_window_t window )
+{
+  if( busreq_ahead )
+  {
+    uint32_t ahead = bus_hal_cycles() - busreq_ahead_at;
+
+    busreq_ahead = false;
+    zx_dma_stats.early_busreqs++;
+    zx_dma_stats.early_total_cycles += ahead;
+    if( ahead > zx_dma_stats.early_max_cycles )
+      zx_dma_stats.early_max_cycles = ahead;
+  }
+
+  if( !wait_busack() )
+    return;
+
+  /* OK, we have the Z80's bus */
+  uint64_t hold_us = bus_hal_time_us();
+
+  /* RD and IORQ are held inactive. The read engine takes RD over while it runs */
+  bus_hal_drive_rd_iorq( true );
+
+  /* The writes which follow are this device's own, don't snoop them */
+  bus_snoop_pause();
+  bus_rom_pause();
+
+  /*
+   * Bring the mirror up to date with the Z80's writes since last time.
+   * The screen runs point into the mirror, so they go out with the Z80's
+   * values rather than overwriting them with older ones.
+   */
+  zx_dma_snoop_drain();
+
+  window_end_us = copper_window_end( end_us );
+  window_kind   = window;
+
+  /*
+   * A burst ends when it's had the bus for long enough. A calibration part
+   * can have the longest hold, it might not fit in a shorter one.
+   */
+  uint64_t calibration_end_us = window_end_us;
+
+  if( burst_max_hold_us )
+  {
+    uint64_t burst_end_us   = hold_us + zx_dma_stats.burst_hold_us;
+    uint64_t longest_end_us = hold_us + burst_max_hold_us;
+
+    if( burst_end_us < window_end_us )
+      window_end_us = burst_end_us;
+    if( longest_end_us < calibration_end_us )
+      calibration_end_us = longest_end_us;
+  }
+
+  /*
+   * Now and again the strobe is recalibrated, it drifts with temperature.
+   * That takes a millisecond or so. It does what fits before the display
+   * list wants the bus, or the burst's over, and carries on in the next
+   * window.
+   */
+  if( calibration_window( window ) )
+  {
+    uint64_t now_us = bus_hal_time_us();
+    uint32_t budget = 0;
+    if( now_us < calibration_end_us )
+      budget = (uint32_t)(calibration_end_us-now_us) * (BUS_MASTER_REFERENCE_HZ/1000000);
+
+    if( strobe_cal_run( budget ) )
+    {
+      calibrate_now = false;
+      frame_trace_flag( FRAME_TRACE_CALIBRATED );
+    }
+  }
+
+  /* Blipper goes high while DMA process is active */
+  bus_hal_signal( GPIO_BLIPPER1, 1 );
+
+  if( !send_window() )
+  {
+    /* Nothing to send, or too late to fit anything in. Give the bus straight back */
+    release_bus();
+    bus_hal_signal( GPIO_BLIPPER1, 0 );
+  }
+}
+
+static void run_window( uint64_t end_us, frame_sched_window_t window )
+{
+  uint32_t start = bus_hal_cycles();
+
+  use_window( end_us, window );
+
+  note_time( start, &zx_dma_stats.window_max_cycles );
+}
+
+/*
+ * Fill a transfer from the scheduler's queue with as much as can be done
+ * before the end of the window, and hand it to the PIO/DMA engine. A full
+ * screen (6,912 byte) transfer takes about 2.03ms at 44 PIO cycles per byte,
+ * which is well inside the 4.096ms top border. This returns straight away,
+ * dma_complete() is called when the DMA IRQ fires.
+ */
+static bool send_window( void )
+{
+  /* The bus master's cycles are counted at its reference clock */
+  uint64_t now_us = bus_hal_time_us();
+  uint32_t budget = 0;
+  if( now_us < window_end_us )
+    budget = (uint32_t)(window_end_us-now_us) * (BUS_MASTER_REFERENCE_HZ/1000000);
+
+  uint32_t bytes = frame_sched_fill( budget, window_kind );
+  if( bytes == 0 )
+    return false;
+
+  if( !hold_moved )
+  {
+    hold_moved = true;
+    zx_dma_stats.setup_total_cycles += bus_hal_cycles() - hold_start;
+  }
+
+  frame_trace_transfer_start( bytes );
+  bus_master_start( dma_complete );
+  return true;
+}
+
+/*
+ * Called from the timer IRQ just before the ULA has finished the display
+ * lines. Whatever didn't fit in the top border goes in the lower border,
+ * with the bus already held when it starts.
+ */
+static void lower_border( void )
+{
+  if( reset_holdoff )
+    return;
+
+  job_queue_drain();
+
+  if( bus_master_busy() || !window_wanted( FRAME_SCHED_LOWER ) )
+    return;
+
+  if( in_burst_gap( frame_start_us + FRAME_SCHED_LOWER_START_US ) )
+    return;
+
+  request_bus_ahead();
+
+  /* The Z80 stops here, while the ULA's still fetching, but nothing's written until the border */
+  uint64_t start_us = frame_start_us + FRAME_SCHED_LOWER_START_US;
+  uint64_t now_us   = bus_hal_time_us();
+  if( now_us < start_us )
+    bus_hal_busy_wait_us( start_us-now_us );
+
+  run_window( frame_start_us + FRAME_SCHED_LOWER_END_US, FRAME_SCHED_LOWER );
+}
+
+/*
+ * The display lines take transfers to the uncontended RAM, and the
+ * contended writes if CLK gated mode is on
+ */
+static void display_window( void )
+{
+  if( reset_holdoff || bus_master_busy() || !frame_sched_has_work( FRAME_SCHED_DISPLAY ) )
+    return;
+
+  if( in_burst_gap( 0 ) )
+    return;
+
+  request_bus();
+
+  run_window( frame_start_us + FRAME_SCHED_DISPLAY_END_US, FRAME_SCHED_DISPLAY );
+}
+
+/*
+ * Called from the timer IRQ at the end of the top border. The lower border
+ * is next. The Z80 took its interrupt long ago, so the ROM's handler can be
+ * patched for the snapshot loader now.
+ */
+static void display_lines( void )
+{
+  frame_alarm_us    = frame_start_us + FRAME_SCHED_LOWER_START_US - busreq_lead_us();
+  frame_alarm_event = lower_border;
+
+  if( !reset_holdoff )
+    zx_snapshot_frame();
+
+  display_window();
+}
+
+/*
+ * The window the time is in, picked up again after the display list has
+ * had the bus
+ */
+static void resume_window( void )
+{
+  if( reset_holdoff || bus_master_busy() )
+    return;
+
+  uint64_t             now_us = bus_hal_time_us() - frame_start_us;
+  uint64_t             end_us;
+  frame_sched_window_t window;
+
+  if( now_us < FRAME_SCHED_TOP_END_US )
+  {
+    end_us = FRAME_SCHED_TOP_END_US;
+    window = FRAME_SCHED_TOP;
+  }
+  else if( (now_us >= FRAME_SCHED_DISPLAY_START_US) && (now_us < FRAME_SCHED_DISPLAY_END_US) )
+  {
+    end_us = FRAME_SCHED_DISPLAY_END_US;
+    window = FRAME_SCHED_DISPLAY;
+  }
+  else if( (now_us >= FRAME_SCHED_LOWER_START_US) && (now_us < FRAME_SCHED_LOWER_END_US) )
+  {
+    end_us = FRAME_SCHED_LOWER_END_US;
+    window = FRAME_SCHED_LOWER;
+  }
+  else
+  {
+    return;
+  }
+
+  if( !window_wanted( window ) || in_burst_gap( 0 ) )
+    return;
+
+  request_bus();
+
+  run_window( frame_start_us + end_us, window );
+}
+
+/*
+ * Run the display list's next group of actions, each at its time. The
+ * bus is taken COPPER_LEAD_US before the first and held to the end of the
+ * last. If something else has the bus, or the Spectrum's being reset, the
+ * group is dropped; there's no later time it would still be right for.
+ */
+static void run_copper_group( void )
+{
+  const copper_action_t *group;
+  uint32_t               count = copper_next_group( &group );
+
+  if( count == 0 )
+    return;
+
+  if( reset_holdoff || bus_master_busy() )
+  {
+    copper_stats.missed += count;
+    return;
+  }
+
+  request_bus();
+
+  if( !wait_busack() )
+  {
+    copper_stats.missed += count;
+    return;
+  }
+
+  bus_hal_drive_rd_iorq( true );
+  bus_snoop_pause();
+  bus_rom_pause();
+
+  /* The writes go in the mirror after the Z80's */
+  zx_dma_snoop_drain();
+
+  bus_hal_signal( GPIO_BLIPPER1, 1 );
+
+  bus_master_set_clk_gated( false );
+
+  for( uint32_t i = 0; i < count; i++ )
+  {
+    const copper_action_t *action = &group[i];
+
+    uint64_t at_us  = frame_start_us + ZX_TSTATES_TO_US( action->tstate );
+    uint64_t now_us = bus_hal_time_us();
+
+    if( now_us < at_us )
+      bus_hal_busy_wait_us( at_us-now_us );
+    else if( now_us > at_us )
+      copper_stats.late++;
+
+    switch( action->op )
+    {
+    case COPPER_WRITE:
+      bus_master_write_blocking( action->zx_address, action->src, action->length );
+      own_writes( action->zx_address, action->src, action->length );
+      break;
+
+    case COPPER_BORDER:
+      bus_master_out_blocking( COPPER_ULA_PORT, action->value );
+      break;
+    }
+
+    copper_stats.actions++;
+  }
+
+  copper_stats.groups++;
+
+  release_bus();
+  bus_hal_signal( GPIO_BLIPPER1, 0 );
+}
+
+/* The bus is given back between groups, the window's work goes on in the gaps */
+static void copper_alarm( void )
+{
+  run_copper_group();
+
+  arm_alarm();
+  resume_window();
+}
+
+static void frame_alarm( void )
+{
+  bus_hal_alarm_t event = frame_alarm_event;
+
+  frame_alarm_us    = UINT64_MAX;
+  frame_alarm_event = NULL;
+  event();
+
+  arm_alarm();
+}
+
+/* A burst's gap is over, carry on with the window */
+static void burst_alarm( void )
+{
+  burst_resume_us = UINT64_MAX;
+  resume_window();
+
+  arm_alarm();
+}
+
+static void arm_alarm( void )
+{
+  uint64_t        at_us     = frame_alarm_us;
+  bus_hal_alarm_t callback  = frame_alarm_event ? frame_alarm : NULL;
+  uint64_t        copper_us = copper_start_us();
+
+  if( copper_us != UINT64_MAX )
+    copper_us -= COPPER_LEAD_US;
+
+  if( copper_us < at_us )
+  {
+    at_us    = copper_us;
+    callback = copper_alarm;
+  }
+
+  if( burst_resume_us < at_us )
+  {
+    at_us    = burst_resume_us;
+    callback = burst_alarm;
+  }
+
+  if( callback )
+    bus_hal_alarm_at_us( at_us, callback );
+}
+
+/*
+ * Scroll left, just to show something happening. The old byte at a time
+ * loop took about 465us on an un-overclocked RP2350b, see sim/screen_bench.c
+ * for how the word wide kernel compares.
+ */
+static void scroll_demo( uint8_t *screen )
+{
+  bus_hal_signal( GPIO_BLIPPER2, 1 );
+
+  screen_scroll_left( screen, &screen_whole, 1, true );
+
+  bus_hal_signal( GPIO_BLIPPER2, 0 );
+}
+
+/*
+ * If core 1 has a frame ready, make it the front buffer. The Z80 might have
+ * written to the front since core 1 took its copy; where core 1 hasn't
+ * changed the byte the Z80's value is carried across, where it has core 1's
+ * value wins and is sent. Core 1 is then set going on the next frame.
+ */
+static void swap_buffers( void )
+{
+  if( atomic_load_explicit( &render_state, memory_order_acquire ) == RENDER_WANTED )
+    return;
+
+  for( uint32_t i = 0; i < SCREEN_DIRTY_MAP_WORDS; i++ )
+  {
+    uint32_t carry = snooped_map[i] & ~screen_render_map[i];
+    snooped_map[i] = 0;
+
+    while( carry )
+    {
+      uint32_t offset = (i*32) + __builtin_ctz( carry );
+      zx_screen_back[offset] = zx_screen_mirror[offset];
+      carry &= carry-1;
+    }
+  }
+
+  screen_dirty_merge_render();
+
+  uint8_t *front   = zx_screen_back;
+  zx_screen_back   = zx_screen_mirror;
+  zx_screen_mirror = front;
+
+  /* Before core 1 can start on a mailbox command in the next frame */
+  zx_mailbox_swapped();
+
+  atomic_store_explicit( &render_state, RENDER_WANTED, memory_order_release );
+}
+
+/*
+ * Longer bursts, closer together, if last frame didn't get through its
+ * work. Shorter ones further apart if it did.
+ */
+static void tune_bursts( void )
+{
+  if( burst_max_hold_us == 0 )
+    return;
+
+  uint32_t hold     = zx_dma_stats.burst_hold_us;
+  uint32_t gap      = zx_dma_stats.burst_gap_tstates;
+  uint32_t min_hold = (burst_max_hold_us < ZX_DMA_BURST_MIN_HOLD_US) ? burst_max_hold_us : ZX_DMA_BURST_MIN_HOLD_US;
+  uint32_t max_gap  = burst_min_gap_tstates*ZX_DMA_BURST_GAP_RANGE;
+
+  if( frame_sched_pending() )
+  {
+    hold = (hold*2 < burst_max_hold_us) ? hold*2 : burst_max_hold_us;
+    gap  = (gap/2 > burst_min_gap_tstates) ? gap/2 : burst_min_gap_tstates;
+  }
+  else
+  {
+    hold = (hold/2 > min_hold) ? hold/2 : min_hold;
+    gap  = (gap*2 < max_gap) ? gap*2 : max_gap;
+  }
+
+  zx_dma_stats.burst_hold_us     = hold;
+  zx_dma_stats.burst_gap_tstates = gap;
+}
+
+/* From how things were left last frame, will the top border be wanted? */
+static bool top_border_wanted( void )
+{
+  return (frames_to_calibration == 0) || frame_sched_has_work( FRAME_SCHED_TOP ) ||
+         ((screen_runs_outstanding == 0) &&
+	  ((atomic_load_explicit( &render_state, memory_order_acquire ) == RENDER_CHANGED) ||
+	   screen_dirty_any( screen_dirty_map )));
+}
+
+/*
+ * While the Spectrum's /RESET is held, and for a while after, its RAM is
+ * left alone. What was queued is dropped, the ROM is about to clear the
+ * RAM anyway, and the whole mirror is sent when the hold off is over.
+ */
+static bool spectrum_resetting( void )
+{
+  if( bus_hal_z80_reset() )
+  {
+    if( reset_holdoff == 0 )
+    {
+      zx_dma_stats.resets++;
+      zx_shadow_invalidate();
+      zx_snapshot_reset();
+    }
+
+    reset_holdoff = ZX_DMA_RESET_HOLDOFF_FRAMES;
+  }
+
+  if( reset_holdoff == 0 )
+    return false;
+
+  frame_trace_flag( FRAME_TRACE_RESET );
+
+  /* Not while the DMA is still reading the entries */
+  if( !bus_master_busy() && frame_sched_pending() )
+    zx_dma_stats.cancelled += frame_sched_cancel();
+
+  if( !bus_hal_z80_reset() && (--reset_holdoff == 0) )
+  {
+    screen_dirty_mark_all();
+    frames_to_calibration = 0;
+  }
+
+  return true;
+}
+
+/*
+ * This handler is called when the ULA pings the /INT line.
+ *
+ * Spectrum top border time is 64 line times, which is 14336 T states. That's
+ * 0.004096 of a second, or a smidge over 4ms. DMA in top border time needs to
+ * run in that time, otherwise contention comes into play, not to mention the Z80
+ * potentially writing to screen memory.
+ *
+ * The top border is 64 lines, each line being 224Ts.
+ *
+ * Nothing is computed here, the frame was drawn on core 1 beforehand, so
+ * BUSREQ goes out almost as soon as /INT is seen. If it looks like there'll
+ * be something to send it goes out first, and the Z80 hands the bus over
+ * while the rest of the handler's done. What doesn't fit in the top border
+ * is sent later in the frame, see display_lines() and lower_border().
+ */
+static void int_handler( void )
+{
+  /*
+   * Crude hack to let the ROM interrupt routine run, makes testing easier
+   * because the Spectrum's keyboard scanning routine is in the interrupt
+   * routine which runs at the same time as this DMA code.
+   * If BASIC isn't running this isn't necessary. Even if BASIC is running
+   * the Spectrum still works even without this. So I'm not quite sure how
+   * necessary it is.
+   */
+#define TESTING_FROM_BASIC 0
+#if TESTING_FROM_BASIC  
+  bus_hal_busy_wait_us( 1000 );
+#endif
+
+  frame_start_us = frame_clock_int( bus_hal_time_us() - ZX_DMA_INT_LATENCY_US );
+
+  /* Before anything's queued for this frame */
+  tune_bursts();
+
+  /* The last burst of the frame before might not have left the Z80 its gap yet */
+  bool gap = in_burst_gap( 0 );
+
+  if( !gap && !reset_holdoff && !bus_master_busy() && top_border_wanted() )
+    request_bus_ahead();
+
+  /* Reads get a fresh allowance each frame */
+  frame_sched_new_frame();
+
+  /* The display list starts again, perhaps a new one */
+  copper_frame();
+
+  frame_alarm_us    = frame_start_us + FRAME_SCHED_DISPLAY_START_US;
+  frame_alarm_event = display_lines;
+  arm_alarm();
+
+  if( spectrum_resetting() )
+  {
+    if( busreq_ahead )
+      bus_hal_busreq( false );
+    busreq_ahead = false;
+    return;
+  }
+
+  /*
+   * Previous transfer still running, leave it be. The buffers can't be
+   * swapped either, the DMA is still reading the front one.
+   */
+  if( bus_master_busy() )
+  {
+    frame_trace_flag( FRAME_TRACE_BUSY );
+    return;
+  }
+
+  /*
+   * If there's going to be something to send, ask for the bus straight away.
+   * The Z80 takes a machine cycle or so to let go of it, which is plenty of
+   * time to swap the buffers and queue the runs. If nothing has changed
+   * there's no need to stop the Z80 at all.
+   *
+   * The last frame's screen runs might not all have gone yet. If not, the
+   * rest go first and the swap waits for the next frame.
+   */
+  if( frames_to_calibration == 0 )
+  {
+    calibrate_now         = true;
+    frames_to_calibration = STROBE_CAL_INTERVAL_FRAMES;
+  }
+  frames_to_calibration--;
+
+  zx_shadow_frame();
+  zx_tape_frame();
+  job_queue_drain();
+
+  bool screen_free = (screen_runs_outstanding == 0);
+  bool send = calibrate_now || frame_sched_has_work( FRAME_SCHED_TOP ) ||
+              (screen_free &&
+	       ((atomic_load_explicit( &render_state, memory_order_acquire ) == RENDER_CHANGED) ||
+		screen_dirty_any( screen_dirty_map )));
+
+  if( send && !busreq_ahead && !gap )
+    request_bus();
+
+  if( screen_free )
+  {
+    swap_buffers();
+
+    /* Queue just the parts of the mirror which have changed */
+    if( screen_dirty_queue_runs( zx_screen_mirror, screen_run_done ) )
+      screen_runs_outstanding = screen_dirty_stats.last_runs;
+  }
+
+  /* A mailbox reply goes after the screen runs it answers for */
+  zx_mailbox_frame();
+  zx_port_frame();
+
+  if( gap || (!calibrate_now && !frame_sched_has_work( FRAME_SCHED_TOP )) )
+  {
+    if( (send && !gap) || busreq_ahead )
+      bus_hal_busreq( false );
+    busreq_ahead = false;
+
+    zx_dma_snoop_drain();
+    return;
+  }
+
+  /* Core 1 finished between the check and the swap */
+  if( !send && !busreq_ahead )
+    request_bus();
+
+  run_window( frame_start_us + FRAME_SCHED_TOP_END_US, FRAME_SCHED_TOP );
+}
+
+/*
+ * The handler's time is bounded, it only waits for BUSACK as long as the
+ * timeout. The transfer itself runs on after it's returned.
+ */
+void zx_dma_int_handler( void )
+{
+  uint32_t start = bus_hal_cycles();
+
+  /* First, so the trace sees when the handler was entered */
+  frame_trace_frame_start();
+
+  int_handler();
+
+  note_time( start, &zx_dma_stats.int_handler_max_cycles );
+}
+
+/* Set the scroll demo running on core 1 */
+void zx_dma_start_demo( void )
+{
+  renderer = scroll_demo;
+}
+
+void zx_dma_set_renderer( zx_dma_renderer_t new_renderer )
+{
+  renderer = new_renderer;
+}
+
+/*
+ * Let the contended writes use the display lines, CLK gated, for whatever
+ * the borders can't take. The Z80 is held off the bus while it's happening.
+ */
+void zx_dma_use_display_window( bool use )
+{
+  frame_sched_set_clk_gated( use );
+}
+
+void zx_dma_set_busack_timeout_us( uint32_t us )
+{
+  busack_timeout_us = us;
+}
+
+/* Tuning starts from the longest hold and the shortest gap */
+void zx_dma_set_burst( uint32_t max_hold_us, uint32_t gap_tstates )
+{
+  burst_max_hold_us     = max_hold_us;
+  burst_min_gap_tstates = gap_tstates;
+
+  zx_dma_stats.burst_hold_us     = max_hold_us;
+  zx_dma_stats.burst_gap_tstates = gap_tstates;
+}
+
+/*
+ * This device's own writes aren't snooped. What they put in the display
+ * file goes in the mirror, as the Z80's writes do, unless they came from
+ * it in the first place, and all of them go in the shadow.
+ */
+static void own_writes( uint16_t zx_address, const uint8_t *src, uint32_t length )
+{
+  zx_shadow_written( zx_address, src, length );
+
+  if( (src >= screen_buffers[0]) && (src < screen_buffers[0]+sizeof(screen_buffers)) )
+    return;
+
+  for( uint32_t i = 0; i < length; i++ )
+  {
+    uint32_t offset = (uint16_t)(zx_address+i) - ZX_DISPLAY_FILE_ADDRESS;
+
+    if( offset < ZX_DISPLAY_FILE_SIZE )
+    {
+      zx_screen_mirror[offset] = src[i];
+      snooped_map[offset >> 5] |= (1u << (offset & 31));
+    }
+  }
+}
+
+void zx_dma_init( void )
+{
+  /* Zero mirror memory */
+  memset( screen_buffers, 0, sizeof(screen_buffers) );
+
+  frame_sched_set_written( own_writes );
+
+  /* The mailbox's job queue, before core 1 starts */
+  zx_mailbox_init();
+}
+
+/*
+ * Called when the /INT handler is about to be enabled. The mirror is the
+ * master copy, so the first frame sends all of it.
+ */
+void zx_dma_start_running( void )
+{
+  screen_dirty_mark_all();
+}
+
+/*
+ * Core 1's side. It waits for zx_dma_render_wanted(), then calls
+ * zx_dma_render_frame() to draw the next frame into the back buffer and
+ * zx_dma_render_done() to hand it over. The back buffer starts as a copy
+ * of the front, so the renderer only changes what moves, marking each byte
+ * it changes with screen_render_mark().
+ */
+bool zx_dma_render_wanted( void )
+{
+  return atomic_load_explicit( &render_state, memory_order_acquire ) == RENDER_WANTED;
+}
+
+void zx_dma_render_frame( void )
+{
+  memcpy( zx_screen_back, zx_screen_mirror, ZX_DISPLAY_FILE_SIZE );
+
+  zx_dma_renderer_t render = renderer;
+  if( render )
+    render( zx_screen_back );
+
+  zx_mailbox_run( zx_screen_back );
+}
+
+void zx_dma_render_done( void )
+{
+  atomic_store_explicit( &render_state,
+			 screen_dirty_any( screen_render_map ) ? RENDER_CHANGED : RENDER_READY,
+			 memory_order_release );
+}
+
+/*
+ * Apply a batch of snooped Z80 writes to the mirror, and the shadow of the
+ * whole memory if it's running.
+ *
+ * The Z80's write has put the same value in the Spectrum's RAM, so the
+ * byte isn't marked dirty. If it was already dirty it stays dirty and the
+ * new value goes out with the next frame. It is noted in the snooped map
+ * so it can be copied into the back buffer at the next swap.
+ */
+static void apply_snooped_writes( const uint32_t *events, uint32_t count )
+{
+  zx_shadow_apply( events, count );
+
+  for( uint32_t i = 0; i < count; i++ )
+  {
+    uint16_t address = BUS_SNOOP_EVENT_ADDRESS( events[i] );
+    uint32_t offset  = address - ZX_DISPLAY_FILE_ADDRESS;
+
+    if( offset < ZX_DISPLAY_FILE_SIZE )
+    {
+      zx_screen_mirror[offset] = BUS_SNOOP_EVENT_DATA( events[i] );
+      snooped_map[offset >> 5] |= (1u << (offset & 31));
+    }
+    else if( address < ZX_ROM_SIZE )
+    {
+      /* Nothing's written to the ROM, but the tape trap and snapshot loader talk this way */
+      zx_tape_snooped( address, BUS_SNOOP_EVENT_DATA( events[i] ) );
+      zx_snapshot_snooped( address, BUS_SNOOP_EVENT_DATA( events[i] ) );
+    }
+    else
+    {
+      zx_mailbox_snooped( address, BUS_SNOOP_EVENT_DATA( events[i] ) );
+    }
+  }
+}
+
+/*
+ * Apply whatever the snoop has caught since last time. The PIO and DMA
+ * catch every write so this doesn't need to be quick, it just needs calling
+ * often enough that the ring doesn't fill: every ZX_DMA_SNOOP_DRAIN_US, and
+ * at the start of the /INT handler.
+ */
+void zx_dma_snoop_drain( void )
+{
+  bus_snoop_drain( apply_snooped_writes );
+}
+
+/*
+ * Called every ZX_DMA_SNOOP_DRAIN_US from the timer IRQ. As well as the
+ * drain, this takes the jobs from the job queues and starts uncontended
+ * transfers queued during the display lines, which don't need to wait for
+ * the lower border.
+ */
+void zx_dma_tick( void )
+{
+  zx_dma_snoop_drain();
+
+  if( reset_holdoff )
+    return;
+
+  job_queue_drain();
+
+  uint64_t now_us = bus_hal_time_us();
+  if( (now_us >= frame_start_us + FRAME_SCHED_DISPLAY_START_US) &&
+      (now_us <  frame_start_us + FRAME_SCHED_DISPLAY_END_US) )
+    display_window();
+}
@@ -0,0 +1,146 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __ZX_DMA_H
+#define __ZX_DMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "zx_display.h"
+
+/*
+ * How often the snooped writes need applying to the mirror. The ring holds
+ * 4096 events, a Z80 doing nothing but PUSHes manages one every 5.5
+ * T-states, about 640 a millisecond, so a millisecond is plenty.
+ */
+#define ZX_DMA_SNOOP_DRAIN_US 1000
+
+/*
+ * How long to wait for BUSACK before giving the window up. The Z80 lets
+ * go at the end of the machine cycle it's in, a few T-states, unless it's
+ * held in WAIT or reset; a stuck Z80 mustn't hang the IRQ handlers. What
+ * was going to be sent goes in the next window.
+ */
+#define ZX_DMA_BUSACK_TIMEOUT_US 20
+
+/*
+ * Frames to leave the Spectrum alone after a reset, while the ROM checks
+ * and clears the RAM. The mirror is sent in full afterwards.
+ */
+#define ZX_DMA_RESET_HOLDOFF_FRAMES 150
+
+/*
+ * BUSREQ goes out this long before the lower border, so the bus is held
+ * when it starts. It's the longest BUSACK wait seen so far plus a
+ * microsecond for the alarm, within these.
+ */
+#define ZX_DMA_BUSREQ_LEAD_MIN_US 2
+#define ZX_DMA_BUSREQ_LEAD_MAX_US 8
+
+/*
+ * Burst mode, off unless zx_dma_set_burst() turns it on. The Z80 is held
+ * off the bus for at most a set time at once, and has it back for at
+ * least a set number of T-states in between, so code which counts its
+ * T-states, BEEP for one, is stopped in short pieces rather than for the
+ * whole of a window. Every frame the hold is doubled and the gap halved
+ * if there was work left over from the frame before, and the other way
+ * about if there wasn't. The hold stays between ZX_DMA_BURST_MIN_HOLD_US
+ * and what was set, the gap between what was set and
+ * ZX_DMA_BURST_GAP_RANGE times that.
+ *
+ * The strobe calibration goes a part at a time, each part in a hold of up
+ * to what was set. A part is about 160us, so a shorter hold than that
+ * leaves the strobe as it was.
+ */
+#define ZX_DMA_BURST_MIN_HOLD_US  100
+#define ZX_DMA_BURST_GAP_RANGE    4
+
+/*
+ * Times are in bus_hal_cycles(). The handler times are the longest any
+ * one call took, the BUSACK wait included. Look at these in the debugger.
+ */
+typedef struct
+{
+  uint32_t busack_waits;
+  uint32_t busack_timeouts;
+  uint64_t busack_total_cycles;
+  uint32_t busack_max_cycles;
+  uint32_t resets;
+  uint32_t cancelled;            /* Queued transfers dropped by resets */
+  uint32_t int_handler_max_cycles;
+  uint32_t window_max_cycles;    /* run_window(), from wherever it was called */
+
+  /*
+   * BUSREQs which went out ahead of their window, and how far ahead. The
+   * Z80 hands the bus over in that time, rather than the window's.
+   */
+  uint32_t early_busreqs;
+  uint64_t early_total_cycles;
+  uint32_t early_max_cycles;
+
+  /*
+   * Each time the bus was held, from BUSREQ to giving it back, and the
+   * part of that before the first byte moved. Splitting a window into
+   * bursts costs a setup for each.
+   */
+  uint32_t holds;
+  uint64_t hold_total_cycles;
+  uint32_t hold_max_cycles;
+  uint64_t setup_total_cycles;
+
+  /* Burst mode's hold and gap this frame */
+  uint32_t burst_hold_us;
+  uint32_t burst_gap_tstates;
+} zx_dma_stats_t;
+
+extern zx_dma_stats_t zx_dma_stats;
+
+/* The front buffer, what the Spectrum's display file should hold */
+extern uint8_t *zx_screen_mirror;
+
+/* The back buffer, core 1's while it's drawing a frame */
+extern uint8_t *zx_screen_back;
+
+/*
+ * Draws the next frame into the back buffer, on core 1. It must mark the
+ * bytes it changes with screen_render_mark().
+ */
+typedef void (*zx_dma_renderer_t)( uint8_t *screen );
+
+void zx_dma_init( void );
+void zx_dma_start_running( void );
+void zx_dma_start_demo( void );
+void zx_dma_set_renderer( zx_dma_renderer_t renderer );
+void zx_dma_use_display_window( bool use );
+void zx_dma_set_busack_timeout_us( uint32_t us );
+
+/* Hold the bus for at most max_hold_us at once, with gap_tstates between. 0 turns it off */
+void zx_dma_set_burst( uint32_t max_hold_us, uint32_t gap_tstates );
+
+/* Core 1 */
+bool zx_dma_render_wanted( void );
+void zx_dma_render_frame( void );
+void zx_dma_render_done( void );
+
+void zx_dma_int_handler( void );
+void zx_dma_snoop_drain( void );
+void zx_dma_tick( void );
+
+#endif
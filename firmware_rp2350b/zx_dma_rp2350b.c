@@ -29,6 +29,22 @@
  *  load
  *  monitor reset init
  *  continue
+ *
+ * The frame trace is sent over the USB serial port when it's asked for,
+ * sim/trace_decode reads it:
+ *
+ * ./trace_decode /dev/ttyACM0
+ *
+ * With a ROM image given to cmake the Spectrum's ROM is replaced, and a
+ * tape given with it loads through the LD-BYTES trap, see zx_tape.h:
+ *
+ * cmake -DZX_ROM_FILE=48.rom -DZX_TAP_FILE=game.tap ..
+ *
+ * A snapshot can be built in the same way, it's loaded in place of the
+ * demo, see zx_snapshot.h. Or one can be sent over the USB serial port:
+ *
+ * cmake -DZX_ROM_FILE=48.rom -DZX_SNA_FILE=game.z80 ..
+ * python3 -c 'import sys,struct; d=open(sys.argv[1],"rb").read(); sys.stdout.buffer.write(b"S"+struct.pack("<I",len(d))+d)' game.z80 > /dev/ttyACM0
  */
 
 #include "pico.h"
@@ -38,255 +54,92 @@
 #include "hardware/timer.h"
 #include "hardware/clocks.h"
 #include "pico/multicore.h"
+#include "hardware/structs/m33.h"
 
 #include "gpios.h"
+#include "bus_master.h"
+#include "bus_snoop.h"
+#include "zx_dma.h"
+#include "frame_trace.h"
+#include "zx_shadow.h"
+#include "bus_rom.h"
+#include "zx_tape.h"
+#include "zx_snapshot.h"
+#include "zx_port.h"
 
 //#define OVERCLOCK 270000
 
-static void test_blipper( void )
+/* Built in from ZX_ROM_FILE and ZX_TAP_FILE by CMakeLists.txt */
+#if ZX_DMA_ROM_TAKEOVER
+extern const uint8_t  zx_rom_file[];
+#endif
+#if ZX_DMA_TAPE
+extern const uint8_t  zx_tap_file[];
+extern const uint32_t zx_tap_file_size;
+#endif
+#if ZX_DMA_SNAPSHOT
+extern const uint8_t  zx_sna_file[];
+extern const uint32_t zx_sna_file_size;
+#endif
+
+/* A snapshot sent over the USB serial port is gathered here */
+static uint8_t snapshot_stream[SNAPSHOT_MAX_SIZE];
+
+/* Set when start_dma_running() has run */
+static volatile bool dma_running = false;
+
+/* The trace is binary, it goes out without the CR/LF translation */
+static void trace_put( const void *data, uint32_t length )
 {
-  gpio_put( GPIO_BLIPPER1, 1 );
-  __asm volatile ("nop");
-  __asm volatile ("nop");
-  __asm volatile ("nop");
-  __asm volatile ("nop");
-  gpio_put( GPIO_BLIPPER1, 0 );
-}
+  const uint8_t *bytes = data;
 
-/*
- * Local copy of the ZX display file. Pixel data is 256x192 pixels,
- * at 8 pixels per byte. Colour attributes are 32x24 bytes
- */
-#define ZX_DISPLAY_FILE_PIXEL_SIZE     ((256*192)/8)
-#define ZX_DISPLAY_FILE_ATTRIBUTE_SIZE (32*24)
-#define ZX_DISPLAY_FILE_SIZE           (ZX_DISPLAY_FILE_PIXEL_SIZE + ZX_DISPLAY_FILE_ATTRIBUTE_SIZE)
-static uint8_t zx_screen_mirror[ZX_DISPLAY_FILE_SIZE];
+  while( length-- )
+    putchar_raw( *bytes++ );
+}
 
 /*
  * This handler is called when the ULA pings the /INT line.
- *
- * Spectrum top border time is 64 line times, which is 14336 T states. That's
- * 0.004096 of a second, or a smidge over 4ms. DMA in top border time needs to
- * run in that time, otherwise contention comes into play, not to mention the Z80
- * potentially writing to screen memory.
- *
- * The top border is 64 lines, each line being 224Ts.
  */
-static uint32_t activate_demo = 0;
 void int_handler( uint gpio, uint32_t events ) 
 {
-  /*
-   * Crude hack to let the ROM interrupt routine run, makes testing easier
-   * because the Spectrum's keyboard scanning routine is in the interrupt
-   * routine which runs at the same time as this DMA code.
-   * If BASIC isn't running this isn't necessary. Even if BASIC is running
-   * the Spectrum still works even without this. So I'm not quite sure how
-   * necessary it is.
-   */
-#define TESTING_FROM_BASIC 0
-#if TESTING_FROM_BASIC  
-  busy_wait_ms(1);
-#endif
+  zx_dma_int_handler();
 
-  /*
-   * Scroll left, just to show something happening. This takes about
-   * 465us on an un-overclocked RP2350b
-   */
-  if( activate_demo > 0 )
-  {
-    gpio_put( GPIO_BLIPPER2, 1 );
-
-     /* Work down the screen lines */
-    for( uint32_t scan_line = 0; scan_line < 192; scan_line++ )
-    {
-      uint8_t *scan_data = (zx_screen_mirror + (scan_line*32));
-
-      /* Pick up the 0/1 value of the pixel at extreme left */
-      uint8_t left_pixel = ((*scan_data & 0x80) == 0x80);
-
-      /* Copy it ready for inserting at extreme right */
-      uint8_t right_pixel = left_pixel;
-
-      /* Work across the 32 bytes of the line, right to left */
-      for( int32_t char_count = 31; char_count >= 0; char_count-- )
-      {
-        /*
-         * Pick up the byte value, note and store the leftmost pixel 0/1 value
-         * (which is about to be scrolled out of this byte)
-         */
-        uint8_t pixel_byte = *(scan_data+char_count);
-        left_pixel = ((pixel_byte & 0x80) == 0x80);
-
-        /*
-         * Rotate the value and put the leftmost pixel from the previous byte
-         * (the one to this byte's right) into the right side
-         */
-        pixel_byte = pixel_byte << 1;
-        pixel_byte &= 0xFE;
-        pixel_byte |= right_pixel;
-        
-        /*
-         * Store that leftmost pixel ready for putting it into the right
-         * side of the next byte
-         */
-        right_pixel = left_pixel;
-
-        /* Load the rotated byte back into the mirror */
-        *(scan_data+char_count) = pixel_byte;
-      }
-    }
-
-    gpio_put( GPIO_BLIPPER2, 0 );
-  }
-
-  /* Assert bus request */
-  gpio_put( GPIO_Z80_BUSREQ, 0 );
-
-  /*
-   * Spin waiting for Z80 to acknowledge. BUSACK goes active (low) on the 
-   * rising edge of the clock - see fig8 in the Z80 manual
-   */
-  while( gpio_get( GPIO_Z80_BUSACK ) == 1 );
-
-  /* OK, we have the Z80's bus */
-
-  /* RD and IORQ lines are unused by this DMA process and stay inactive */
-  gpio_set_dir( GPIO_Z80_RD,   GPIO_OUT ); gpio_put( GPIO_Z80_RD,   1 );
-  gpio_set_dir( GPIO_Z80_IORQ, GPIO_OUT ); gpio_put( GPIO_Z80_IORQ, 1 );
-
-  /* Reset Z80 address and data bus GPIOs as outputs */
-  gpio_set_dir_out_masked( GPIO_ABUS_BITMASK );
-  gpio_set_dir_out_masked( GPIO_DBUS_BITMASK );
-
-  /* Set directions of control signals to outputs */
-  gpio_set_dir( GPIO_Z80_MREQ, GPIO_OUT ); gpio_put( GPIO_Z80_MREQ, 1 );
-  gpio_set_dir( GPIO_Z80_WR,   GPIO_OUT ); gpio_put( GPIO_Z80_WR,   1 );
-
-  /* Blipper goes high while DMA process is active */
-  gpio_put( GPIO_BLIPPER1, 1 );
-
-  const uint32_t write_address = 0x4000;
+  /* Wake core 1 in case the buffers were swapped */
+  __sev();
+}
 
-  uint32_t byte_counter;
-  for( byte_counter=0; byte_counter < ZX_DISPLAY_FILE_SIZE; byte_counter++ )
+/*
+ * Core 1 draws the next frame into the back buffer, then sleeps until the
+ * /INT handler has swapped it to the front and wants another
+ */
+void core1_main( void )
+{
+  while( 1 )
   {
-    /*
-     * A full screen (6,912 byte) DMA transfer (with the static RAM timings
-     * below) takes 2.37ms.
-     * Top border time is 4.096ms, so DMAing a full screen is easily done
-     * inside the time it takes the ULA to draw the top border.
-     */
-
-    /* Set address of ZX byte to write to */
-    gpio_put_masked( GPIO_ABUS_BITMASK, (write_address+byte_counter)<<GPIO_ABUS_A0 );
-
-    /* Assert memory request */
-    gpio_put( GPIO_Z80_MREQ, 0 );
-
-    /* Put value on the data bus */
-    gpio_put_masked( GPIO_DBUS_BITMASK, zx_screen_mirror[byte_counter]);
-
-    /*
-     * Assert the write line to write it, the ULA responds to this and does
-     * the write into the Spectrum's memory. i.e. the RAS/CAS stuff.
-     */
-    gpio_put( GPIO_Z80_WR, 0 );
-
-    /*
-     * Spectrum RAM is rated 150ns which is 1.5e-07. RP2350 clock speed is
-     * 150,000,000Hz, so one clock cycle is 6.66666666667e-09. So that's 22.5
-     * RP2350 clock cycles in one DRAM transaction time. NOP is T1, so it
-     * takes one clock cycle, so 23 NOPs should guarantee a pause long
-     * enough for the 4116s to respond.
-     */
-#define USING_STATIC_RAM_MODULE 1
-#if USING_STATIC_RAM_MODULE
-  /*
-   * This was developed on a Spectrum containing a static RAM-based lower memory
-   * module. I thought it would be faster than the 4116s, so should work with
-   * fewer than 23 NOPs. Turns out it doesn't. Empirical testing shows it needs 29,
-   * which is 1.93e-07 seconds, or about 1.93 microseconds. It don't know why.
-   * 
-   * Update: it turns out that sometimes 29 is too few and the DMA doesn't work.
-   * This appears to be related to the Spectrum's temperature. The cooler the
-   * machine is the longer this delay needs to be - but again, this is with a
-   * static RAM module.
-   * 
-   * I've currently got this at 35/150,000,000ths of a second. This seems
-   * reliable. A transfer of 6,912 bytes at this speed takes 2.37ms.
-   */
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-    __asm volatile ("nop");
-#else
-    /* Timings with 4116s go here */
-#endif
+    while( !zx_dma_render_wanted() )
+      __wfe();
 
-    /* Remove write and memory request */
-    gpio_put( GPIO_Z80_WR,   1 );
-    gpio_put( GPIO_Z80_MREQ, 1 ); 
+    zx_dma_render_frame();
+    zx_dma_render_done();
   }
+}
 
-  /* DMA complete - put the address, data and control buses back to hi-Z */
-  gpio_set_dir_in_masked( GPIO_ABUS_BITMASK );
-  gpio_set_dir_in_masked( GPIO_DBUS_BITMASK );
-
-  gpio_set_dir( GPIO_Z80_MREQ, GPIO_IN );
-  gpio_set_dir( GPIO_Z80_WR,   GPIO_IN );
-  gpio_set_dir( GPIO_Z80_IORQ, GPIO_IN );
-  gpio_set_dir( GPIO_Z80_RD,   GPIO_IN );
-
-  /* Release bus request */
-  gpio_put( GPIO_Z80_BUSREQ, 1 );
-
-  /* Indicate DMA process complete */
-  gpio_put( GPIO_BLIPPER1, 0 );
-
-  return;
+/*
+ * Timer handler, applies the snooped Z80 writes to the mirror and starts
+ * any uncontended transfers which can go now. It's the same IRQ priority
+ * as the /INT and DMA handlers so none of them can cut in on another.
+ */
+static repeating_timer_t snoop_drain_timer;
+bool snoop_drain( repeating_timer_t *timer )
+{
+  zx_dma_tick();
+  return true;
 }
 
 int64_t scroll_display( alarm_id_t id, void *user_data )
 {
-  /* Set the demo code in the /INT handler running */
-  activate_demo = 1;
+  /* Set the demo code on core 1 running */
+  zx_dma_start_demo();
   return 0;
 }
 
@@ -302,14 +155,45 @@ int64_t start_dma_running( alarm_id_t id, void *user_data )
    * When the ULA pulls /INT low at the start of the frame, dump my
    * mirror of the display file into the Spectrum's live display
    */
+  zx_dma_start_running();
   gpio_set_irq_enabled_with_callback( GPIO_Z80_INT, GPIO_IRQ_EDGE_FALL, true, &int_handler );
 
+  /* Keep a copy of all the Spectrum's memory, it's seeded over the next few frames */
+  zx_shadow_start();
+
+#if !ZX_DMA_SNAPSHOT
   /* Demo it's working */
   add_alarm_in_ms( 10000, scroll_display, NULL, 0 );
+#endif
 
+  dma_running = true;
   return 0;
 }
 
+/*
+ * ZX_SNAPSHOT_REQUEST has been seen, the length and the file follow. A
+ * second with nothing is taken as the sender having given up.
+ */
+static void receive_snapshot( void )
+{
+  uint32_t length = 0;
+
+  for( uint32_t i = 0; i < 4+length; i++ )
+  {
+    int c = getchar_timeout_us( 1000000 );
+    if( c < 0 )
+      return;
+
+    if( i < 4 )
+      length |= (uint32_t)c << (8*i);
+    else if( length <= sizeof(snapshot_stream) )
+      snapshot_stream[i-4] = c;
+  }
+
+  if( length <= sizeof(snapshot_stream) )
+    zx_snapshot_load( snapshot_stream, length );
+}
+
 void main( void )
 {
   bi_decl(bi_program_description("ZX Spectrum DMA RP2350 Stamp XL Board Binary."));
@@ -318,6 +202,14 @@ void main( void )
   set_sys_clock_khz( OVERCLOCK, 1 );
 #endif
 
+  /* USB serial, for the frame trace. The UART's pins are the Z80's data bus */
+  stdio_init_all();
+
+  /* Start the cycle counter, the frame trace's timings are in CPU cycles */
+  m33_hw->demcr    |= M33_DEMCR_TRCENA_BITS;
+  m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+  frame_trace_init( clock_get_hz( clk_sys ) );
+
   /* All interrupts off except the timers */
 //  irq_set_mask_enabled( 0xFFFFFFFF, 0 );
 //  irq_set_mask_enabled( 0x0000000F, 1 );
@@ -342,7 +234,7 @@ void main( void )
   gpio_init( GPIO_BLIPPER1 ); gpio_set_dir( GPIO_BLIPPER1, GPIO_OUT ); gpio_put( GPIO_BLIPPER1, 0 );
   gpio_init( GPIO_BLIPPER2 ); gpio_set_dir( GPIO_BLIPPER2, GPIO_OUT ); gpio_put( GPIO_BLIPPER2, 0 );
  
-  /* Not taking over the ZX ROM for the time being */
+  /* The ZX ROM stays in unless bus_rom_init() takes over, below */
   gpio_init( GPIO_ROMCS );    gpio_set_dir( GPIO_ROMCS, GPIO_IN );
 
   /* Set up Z80 control bus */  
@@ -363,9 +255,31 @@ void main( void )
   /* Initialise Z80 address bus GPIOs as inputs */
   gpio_init_mask( GPIO_ABUS_BITMASK );  gpio_set_dir_in_masked( GPIO_ABUS_BITMASK );
 
+  /* Hand the buses, /MREQ and /WR to the PIO write engine. They stay inputs until a transfer */
+  bus_master_init();
+
   /* Zero mirror memory */
-  for( uint32_t i=0; i < ZX_DISPLAY_FILE_SIZE; i++)
-    zx_screen_mirror[i]=0;
+  zx_dma_init();
+
+  /* Frame drawing runs on core 1 */
+  multicore_launch_core1( core1_main );
+
+  /* Start watching the Z80's writes, draining them into the mirror every millisecond */
+  bus_snoop_init();
+  add_repeating_timer_us( -ZX_DMA_SNOOP_DRAIN_US, snoop_drain, NULL, &snoop_drain_timer );
+
+#if ZX_DMA_ROM_TAKEOVER
+  /* Serve the ROM from here, with the tape trap patched in, before the Z80 starts */
+  bus_rom_init( zx_rom_file );
+  zx_tape_install( bus_rom_image() );
+#if ZX_DMA_TAPE
+  zx_tape_insert( zx_tap_file, zx_tap_file_size );
+#endif
+  zx_snapshot_install( bus_rom_image() );
+#endif
+
+  /* Answer the Z80's IN and OUT on this device's port */
+  zx_port_init();
 
   /* Let the Spectrum run and do its RAM check before we start interferring */
   gpio_put( GPIO_RESET_Z80, 0 );
@@ -374,37 +288,32 @@ void main( void )
   add_alarm_in_ms( 3000, start_dma_running, NULL, 0 );
 
   /*
-   * The IRQ handler stuff is nowhere near fast enough to handle this. The Z80's
-   * write is finished long before the RP2350 even gets to call the handler function.
-   * So, tight loop in the main core for now.
+   * The Z80's writes are caught by the PIO and DMA, and everything else
+   * happens in IRQ handlers, so all that's left for this core to do is
+   * send the trace when it's asked for, and decode snapshots
    */
+#if ZX_DMA_SNAPSHOT
+  bool snapshot_loaded = false;
+#endif
   while( 1 )
   {
-    register uint64_t gpios = gpio_get_all64();
-
-    /* A memory write is when mem-request and write are both low */
-    const uint64_t WR_MREQ_MASK = (0x01 << GPIO_Z80_MREQ) | (0x01 << GPIO_Z80_WR);
+    int c = getchar_timeout_us( 0 );
 
-    if( (gpios & WR_MREQ_MASK) == 0 )
+    if( c == FRAME_TRACE_REQUEST )
     {
-      /* It's a write to memory, find the address being written to */
-      uint64_t address = (gpios & GPIO_ABUS_BITMASK) >> GPIO_ABUS_A0;
-
-      /* For this example I'm only interested in writes to the display file */
-      const uint64_t display_first_byte = 0x4000;
-      const uint64_t display_last_byte  = 0x5AFF;
-
-      if( (address >= display_first_byte) && (address <= display_last_byte) )
-      {
-        /* Pick the value being written from the data bus and mirror it */
-        uint8_t data = (gpios & GPIO_DBUS_BITMASK) & 0xFF;
-        zx_screen_mirror[address-display_first_byte] = data;
-      }
-
-      /* Wait for the Z80 write to finish */
-      while( (gpio_get_all64() & WR_MREQ_MASK) == 0 );
+      frame_trace_send( trace_put );
+      stdio_flush();
+    }
+    else if( (c == ZX_SNAPSHOT_REQUEST) && dma_running )
+    {
+      receive_snapshot();
     }
 
-  }
+#if ZX_DMA_SNAPSHOT
+    if( dma_running && !snapshot_loaded )
+      snapshot_loaded = zx_snapshot_load( zx_sna_file, zx_sna_file_size );
+#endif
 
+    __wfi();
+  }
 }
@@ -0,0 +1,358 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The mailbox. A command goes through these states, each move made by the
+ * core named:
+ *
+ *   FREE -0-> PENDING        The doorbell's been snooped
+ *   PENDING -1-> AT_SWAP     Done in the frame core 1 has drawn, or failed
+ *   AT_SWAP -0-> SWAPPED     That frame's gone to the front
+ *   PENDING -1-> WRITING     The results are in the job queue
+ *   SWAPPED, WRITING -0-> REPLYING, once the screen runs or the results
+ *                            have been queued, and the reply with them
+ *   REPLYING -0-> FREE       DONE's been written
+ *
+ * The reply goes in the same queue as what it's answering, or the one
+ * after it, so the Z80 never sees DONE before the results.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "zx_display.h"
+#include "frame_sched.h"
+#include "job_queue.h"
+#include "screen_blit.h"
+#include "zx_shadow.h"
+#include "zx0.h"
+#include "zx_mailbox.h"
+
+typedef enum
+{
+  MAILBOX_FREE,
+  MAILBOX_PENDING,
+  MAILBOX_AT_SWAP,
+  MAILBOX_SWAPPED,
+  MAILBOX_WRITING,
+  MAILBOX_WRITTEN,
+  MAILBOX_REPLYING,
+} mailbox_state_t;
+
+zx_mailbox_stats_t zx_mailbox_stats;
+
+const compositor_graphic_t *zx_mailbox_graphics[ZX_MAILBOX_SPRITES];
+
+static atomic_uint          state = MAILBOX_FREE;
+
+/* Core 0's, what the snoop has seen, and the reply */
+static uint8_t              mailbox[ZX_MAILBOX_DOORBELL-ZX_MAILBOX_ADDRESS];
+static uint8_t              reply[2];
+static uint32_t             doorbell_frame;
+
+/* Copied for core 1 when the doorbell's rung */
+static uint8_t              command[sizeof(mailbox)];
+static uint8_t              result;
+
+/* Core 1's */
+static job_queue_t          queue;
+static job_desc_t           job;
+static bool                 job_ready;
+static uint8_t              buffer[ZX_MAILBOX_BUFFER_SIZE];
+static compositor_graphic_t graphics[ZX_MAILBOX_SPRITES];
+static uint8_t              graphics_data[ZX_MAILBOX_SPRITES][ZX_MAILBOX_SPRITE_BYTES];
+
+#define PARAM(n)    (command[1+(n)])
+#define PARAM16(n)  ((uint16_t)(command[1+(n)] | (command[2+(n)] << 8)))
+
+void zx_mailbox_init( void )
+{
+  job_queue_register( &queue );
+}
+
+/*
+ * Core 0
+ */
+
+static void reply_written( void *context )
+{
+  atomic_store_explicit( &state, MAILBOX_FREE, memory_order_release );
+}
+
+static void send_reply( void )
+{
+  reply[0] = result;
+  reply[1] = command[sizeof(command)-1];
+
+  if( frame_sched_add( ZX_MAILBOX_RESULT, reply, sizeof(reply), reply_written, NULL ) )
+  {
+    zx_mailbox_stats.last_frames = frame_sched_stats.frames - doorbell_frame;
+    atomic_store_explicit( &state, MAILBOX_REPLYING, memory_order_relaxed );
+  }
+}
+
+static void results_written( void *context )
+{
+  atomic_store_explicit( &state, MAILBOX_WRITTEN, memory_order_relaxed );
+  send_reply();
+}
+
+void zx_mailbox_snooped( uint16_t address, uint8_t data )
+{
+  if( (address < ZX_MAILBOX_ADDRESS) || (address > ZX_MAILBOX_DOORBELL) )
+    return;
+
+  if( address < ZX_MAILBOX_DOORBELL )
+  {
+    mailbox[address-ZX_MAILBOX_ADDRESS] = data;
+    return;
+  }
+
+  if( atomic_load_explicit( &state, memory_order_acquire ) != MAILBOX_FREE )
+  {
+    zx_mailbox_stats.ignored++;
+    return;
+  }
+
+  /* The sequence number goes on the end, for the reply */
+  memcpy( command, mailbox, sizeof(mailbox)-1 );
+  command[sizeof(command)-1] = data;
+  doorbell_frame = frame_sched_stats.frames;
+  zx_mailbox_stats.commands++;
+
+  atomic_store_explicit( &state, MAILBOX_PENDING, memory_order_release );
+}
+
+void zx_mailbox_swapped( void )
+{
+  if( atomic_load_explicit( &state, memory_order_acquire ) == MAILBOX_AT_SWAP )
+    atomic_store_explicit( &state, MAILBOX_SWAPPED, memory_order_relaxed );
+}
+
+void zx_mailbox_frame( void )
+{
+  uint32_t now = atomic_load_explicit( &state, memory_order_acquire );
+
+  /* Or the scheduler was full when the results were written */
+  if( (now == MAILBOX_SWAPPED) || (now == MAILBOX_WRITTEN) )
+    send_reply();
+}
+
+/*
+ * Core 1
+ */
+
+typedef struct
+{
+  uint32_t address;
+  bool     not_ready;
+} source_t;
+
+static int read_source( void *context )
+{
+  source_t *s = context;
+  uint8_t   byte;
+
+  if( s->address > 0xFFFF )
+    return -1;
+
+  if( !zx_shadow_copy( s->address, &byte, 1 ) )
+  {
+    s->not_ready = true;
+    return -1;
+  }
+
+  s->address++;
+  return byte;
+}
+
+static bool fits( uint32_t address, uint32_t length )
+{
+  return (length > 0) && (address+length <= 0x10000);
+}
+
+static bool rect_ok( const screen_rect_t *r, uint32_t rows )
+{
+  return (r->cols > 0) && (r->rows > 0) &&
+         (r->col+r->cols <= ZX_DISPLAY_COLUMNS) && (r->row+r->rows <= rows);
+}
+
+static zx_mailbox_result_t scroll( uint8_t *screen )
+{
+  screen_rect_t rect   = { PARAM(0), PARAM(1), PARAM(2), PARAM(3) };
+  uint32_t      pixels = PARAM(5);
+  bool          wrap   = PARAM(6);
+
+  if( !rect_ok( &rect, ZX_DISPLAY_PIXEL_ROWS ) )
+    return ZX_MAILBOX_BAD_PARAMS;
+
+  switch( PARAM(4) )
+  {
+  case ZX_MAILBOX_LEFT:  screen_scroll_left( screen, &rect, pixels, wrap );  break;
+  case ZX_MAILBOX_RIGHT: screen_scroll_right( screen, &rect, pixels, wrap ); break;
+  case ZX_MAILBOX_UP:    screen_scroll_up( screen, &rect, pixels, wrap );    break;
+  case ZX_MAILBOX_DOWN:  screen_scroll_down( screen, &rect, pixels, wrap );  break;
+  default:               return ZX_MAILBOX_BAD_PARAMS;
+  }
+
+  return ZX_MAILBOX_OK;
+}
+
+static zx_mailbox_result_t fill( uint8_t *screen )
+{
+  screen_rect_t rect  = { PARAM(0), PARAM(1), PARAM(2), PARAM(3) };
+  bool          attrs = (PARAM(5) == ZX_MAILBOX_FILL_ATTRS);
+
+  if( !rect_ok( &rect, attrs ? ZX_DISPLAY_CHAR_ROWS : ZX_DISPLAY_PIXEL_ROWS ) )
+    return ZX_MAILBOX_BAD_PARAMS;
+
+  if( attrs )
+    screen_attr_fill( screen, &rect, PARAM(4) );
+  else
+    screen_fill( screen, &rect, PARAM(4) );
+
+  return ZX_MAILBOX_OK;
+}
+
+static zx_mailbox_result_t blit( uint8_t *screen )
+{
+  uint16_t source = PARAM16(0);
+  uint32_t cols   = PARAM(2), rows = PARAM(3), col = PARAM(4), row = PARAM(5);
+
+  if( (cols == 0) || (rows == 0) || (col+cols > ZX_DISPLAY_COLUMNS) || (row+rows > ZX_DISPLAY_PIXEL_ROWS) ||
+      !fits( source, cols*rows ) )
+    return ZX_MAILBOX_BAD_PARAMS;
+
+  if( !zx_shadow_copy( source, buffer, cols*rows ) )
+    return ZX_MAILBOX_NOT_READY;
+
+  screen_blit( screen, col, row, buffer, cols, rows );
+  return ZX_MAILBOX_OK;
+}
+
+static zx_mailbox_result_t load_sprite( void )
+{
+  uint32_t number = PARAM(0);
+  uint16_t source = PARAM16(1);
+  uint32_t cols   = PARAM(3), rows = PARAM(4);
+  uint32_t length = cols*rows*2;
+
+  if( (number >= ZX_MAILBOX_SPRITES) || (length == 0) || (length > ZX_MAILBOX_SPRITE_BYTES) || !fits( source, length ) )
+    return ZX_MAILBOX_BAD_PARAMS;
+
+  if( !zx_shadow_copy( source, graphics_data[number], length ) )
+    return ZX_MAILBOX_NOT_READY;
+
+  graphics[number].cols = cols;
+  graphics[number].rows = rows;
+  graphics[number].data = graphics_data[number];
+  zx_mailbox_graphics[number] = &graphics[number];
+
+  return ZX_MAILBOX_OK;
+}
+
+/* COPY and DECOMPRESS, the results into the buffer and the job made ready */
+static zx_mailbox_result_t prepare_job( uint8_t code )
+{
+  uint16_t source      = PARAM16(0);
+  uint16_t destination = PARAM16(2);
+  uint32_t length      = PARAM16(4);
+
+  if( (length > ZX_MAILBOX_BUFFER_SIZE) || (destination < ZX_ROM_SIZE) || !fits( destination, length ) )
+    return ZX_MAILBOX_BAD_PARAMS;
+
+  if( code == ZX_MAILBOX_COPY )
+  {
+    if( !fits( source, length ) )
+      return ZX_MAILBOX_BAD_PARAMS;
+    if( !zx_shadow_copy( source, buffer, length ) )
+      return ZX_MAILBOX_NOT_READY;
+  }
+  else
+  {
+    source_t s = { source, false };
+
+    length = zx0_decompress( read_source, &s, buffer, length );
+    if( length == 0 )
+      return s.not_ready ? ZX_MAILBOX_NOT_READY : ZX_MAILBOX_BAD_DATA;
+  }
+
+  job.zx_address = destination;
+  job.src        = buffer;
+  job.length     = length;
+  job.next       = NULL;
+  job.done       = results_written;
+  job.context    = NULL;
+  job_ready      = true;
+
+  return ZX_MAILBOX_OK;
+}
+
+void zx_mailbox_run( uint8_t *screen )
+{
+  if( atomic_load_explicit( &state, memory_order_acquire ) != MAILBOX_PENDING )
+    return;
+
+  /* A job the queue had no room for last time */
+  if( !job_ready )
+  {
+    uint8_t code = command[0];
+
+    switch( code )
+    {
+    case ZX_MAILBOX_SCROLL:      result = scroll( screen ); break;
+    case ZX_MAILBOX_FILL:        result = fill( screen );   break;
+    case ZX_MAILBOX_BLIT:        result = blit( screen );   break;
+    case ZX_MAILBOX_LOAD_SPRITE: result = load_sprite();    break;
+
+    case ZX_MAILBOX_COPY:
+    case ZX_MAILBOX_DECOMPRESS:
+      result = prepare_job( code );
+      break;
+
+    default:
+      result = ZX_MAILBOX_BAD_COMMAND;
+      break;
+    }
+
+    if( result != ZX_MAILBOX_OK )
+      zx_mailbox_stats.failed++;
+
+    if( !job_ready )
+    {
+      atomic_store_explicit( &state, MAILBOX_AT_SWAP, memory_order_release );
+      return;
+    }
+  }
+
+  /* Core 0 can have written the results before the submit returns */
+  atomic_store_explicit( &state, MAILBOX_WRITING, memory_order_release );
+  if( job_queue_submit( &queue, &job ) )
+    job_ready = false;
+  else
+    atomic_store_explicit( &state, MAILBOX_PENDING, memory_order_relaxed );
+}
+
+bool zx_mailbox_busy( void )
+{
+  return atomic_load_explicit( &state, memory_order_relaxed ) != MAILBOX_FREE;
+}
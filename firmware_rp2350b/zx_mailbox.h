@@ -0,0 +1,125 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __ZX_MAILBOX_H
+#define __ZX_MAILBOX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "compositor.h"
+
+/*
+ * Commands from the Spectrum. The Z80 writes a command and its parameters
+ * to the mailbox, then a new sequence number to the doorbell, and waits
+ * for this device to write the same number to DONE, with the result
+ * written just before it. Nothing is read from the Spectrum: the snoop
+ * sees the mailbox being written, and the doorbell last. Any data the
+ * command works on comes out of the shadow, see zx_shadow.h.
+ *
+ * The work is done on core 1, as part of drawing the next frame. The
+ * screen commands work on the frame being drawn, so their results go out
+ * with it and DONE is written after them; the others write their results
+ * through a job queue, with DONE after. Either way the Z80 waits a frame
+ * or two, and spends only a few bus cycles itself.
+ *
+ * One command at a time: the doorbell is ignored until the last one's
+ * DONE has been written.
+ *
+ * Parameters, 16 bit ones little endian:
+ *
+ *   SCROLL       col, cols, row, rows, direction (LEFT...), pixels, wrap
+ *   FILL         col, cols, row, rows, value, what (FILL_PIXELS or FILL_ATTRS)
+ *                  Pixel rows for pixels, character rows for attributes
+ *   COPY         source, destination, length         Anywhere in the RAM
+ *   BLIT         source, cols, rows, col, row        A linear bitmap onto the screen
+ *   DECOMPRESS   source, destination, max length     ZX0, see zx0.h
+ *   LOAD_SPRITE  number, source, cols, rows          A masked graphic for the compositor
+ */
+#define ZX_MAILBOX_ADDRESS      0x5B00   /* The printer buffer */
+#define ZX_MAILBOX_COMMAND      (ZX_MAILBOX_ADDRESS+0x00)
+#define ZX_MAILBOX_PARAMS       (ZX_MAILBOX_ADDRESS+0x01)
+#define ZX_MAILBOX_DOORBELL     (ZX_MAILBOX_ADDRESS+0x1E)
+#define ZX_MAILBOX_RESULT       (ZX_MAILBOX_ADDRESS+0x1F)   /* Written by this device */
+#define ZX_MAILBOX_DONE         (ZX_MAILBOX_ADDRESS+0x20)
+#define ZX_MAILBOX_SIZE         0x21
+
+typedef enum
+{
+  ZX_MAILBOX_SCROLL = 1,
+  ZX_MAILBOX_FILL,
+  ZX_MAILBOX_COPY,
+  ZX_MAILBOX_BLIT,
+  ZX_MAILBOX_DECOMPRESS,
+  ZX_MAILBOX_LOAD_SPRITE,
+} zx_mailbox_command_t;
+
+typedef enum
+{
+  ZX_MAILBOX_OK = 0,
+  ZX_MAILBOX_BAD_COMMAND,
+  ZX_MAILBOX_BAD_PARAMS,
+  ZX_MAILBOX_NOT_READY,     /* The shadow doesn't have the source yet, try again */
+  ZX_MAILBOX_BAD_DATA,      /* Decompression failed */
+} zx_mailbox_result_t;
+
+enum { ZX_MAILBOX_LEFT, ZX_MAILBOX_RIGHT, ZX_MAILBOX_UP, ZX_MAILBOX_DOWN };
+enum { ZX_MAILBOX_FILL_PIXELS, ZX_MAILBOX_FILL_ATTRS };
+
+/* The most COPY and DECOMPRESS write, and the sprite graphics LOAD_SPRITE keeps */
+#define ZX_MAILBOX_BUFFER_SIZE  0x4000
+#define ZX_MAILBOX_SPRITES      16
+#define ZX_MAILBOX_SPRITE_BYTES 256
+
+/* Look at these in the debugger */
+typedef struct
+{
+  uint32_t commands;
+  uint32_t failed;          /* Any result but OK */
+  uint32_t ignored;         /* Doorbells rung before the last was DONE */
+  uint32_t last_frames;     /* From the doorbell to DONE being queued */
+} zx_mailbox_stats_t;
+
+extern zx_mailbox_stats_t zx_mailbox_stats;
+
+/*
+ * The graphics LOAD_SPRITE has loaded, for compositor_load_table(). Unloaded
+ * ones are NULL.
+ */
+extern const compositor_graphic_t *zx_mailbox_graphics[ZX_MAILBOX_SPRITES];
+
+/* Core 0, before core 1 starts */
+void zx_mailbox_init( void );
+
+/* Core 1, after the frame's been drawn, see zx_dma_render_frame() */
+void zx_mailbox_run( uint8_t *screen );
+
+/* Core 0's side, see zx_dma.c. Writes to the mailbox from the snoop */
+void zx_mailbox_snooped( uint16_t address, uint8_t data );
+
+/* The frame core 1 drew is going out, just before core 1 is set going again */
+void zx_mailbox_swapped( void );
+
+/* From the /INT handler, after the frame's screen runs are queued */
+void zx_mailbox_frame( void );
+
+/* A command has been rung in and not yet answered */
+bool zx_mailbox_busy( void );
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The port's registers. Everything here runs in core 0's IRQ handlers:
+ * bus_port.c's after an IN or OUT, and the /INT handler's.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bus_hal.h"
+#include "bus_port.h"
+#include "frame_sched.h"
+#include "zx_mailbox.h"
+#include "zx_snapshot.h"
+#include "zx_port.h"
+
+zx_port_stats_t zx_port_stats;
+
+static uint32_t random_state;
+static uint8_t  frames;
+
+/* xorshift32, never 0 */
+static uint8_t next_random( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state >> 24;
+}
+
+static void update_status( void )
+{
+  uint8_t status = 0;
+
+  if( frame_sched_pending() )
+    status |= ZX_PORT_STATUS_TRANSFERS;
+  if( zx_mailbox_busy() )
+    status |= ZX_PORT_STATUS_MAILBOX;
+  if( zx_snapshot_busy() )
+    status |= ZX_PORT_STATUS_SNAPSHOT;
+
+  bus_port_in[ZX_PORT_STATUS] = status;
+}
+
+static void port_written( uint8_t reg, uint8_t data )
+{
+  zx_port_stats.outs++;
+
+  if( (reg != ZX_PORT_X) && (reg != ZX_PORT_X+1) && (reg != ZX_PORT_Y) )
+    return;
+
+  uint32_t x = bus_port_out[ZX_PORT_X] | (bus_port_out[ZX_PORT_X+1] << 8);
+  uint32_t y = bus_port_out[ZX_PORT_Y];
+
+  uint32_t product   = x*y;
+  uint32_t quotient  = y ? x/y : 0xFFFF;
+  uint32_t remainder = y ? x%y : x & 0xFF;
+
+  bus_port_in[ZX_PORT_PRODUCT]    = product;
+  bus_port_in[ZX_PORT_PRODUCT+1]  = product >> 8;
+  bus_port_in[ZX_PORT_PRODUCT+2]  = product >> 16;
+  bus_port_in[ZX_PORT_QUOTIENT]   = quotient;
+  bus_port_in[ZX_PORT_QUOTIENT+1] = quotient >> 8;
+  bus_port_in[ZX_PORT_REMAINDER]  = remainder;
+}
+
+/* Which register was read isn't known, so whatever changes on a read moves on */
+static void port_read( void )
+{
+  zx_port_stats.ins++;
+
+  bus_port_in[ZX_PORT_RANDOM] = next_random();
+  update_status();
+}
+
+void zx_port_init( void )
+{
+  random_state = (uint32_t)bus_hal_time_us() | 1;
+
+  bus_port_in[ZX_PORT_RANDOM]     = next_random();
+  bus_port_in[ZX_PORT_QUOTIENT]   = 0xFF;
+  bus_port_in[ZX_PORT_QUOTIENT+1] = 0xFF;
+  update_status();
+
+  bus_port_init( ZX_PORT_ADDRESS, port_written, port_read );
+}
+
+void zx_port_frame( void )
+{
+  bus_port_in[ZX_PORT_FRAME] = ++frames;
+  update_status();
+}
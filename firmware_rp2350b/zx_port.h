@@ -0,0 +1,87 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __ZX_PORT_H
+#define __ZX_PORT_H
+
+#include <stdint.h>
+
+/*
+ * The registers on this device's I/O port, see bus_port.h. Where the
+ * mailbox (zx_mailbox.h) takes a frame or two, these answer in the one
+ * instruction:
+ *
+ *   LD BC,ZX_PORT_ADDRESS+(ZX_PORT_STATUS<<8)
+ *   IN A,(C)
+ *
+ * The port is odd so the ULA leaves it alone, and has A5 set so a
+ * Kempston joystick interface does too.
+ *
+ * Written by the Z80 (OUT):
+ *
+ *   X, X+1     16 bit operand, little endian
+ *   Y          8 bit operand
+ *
+ * Read by the Z80 (IN):
+ *
+ *   STATUS     What's going on, the STATUS_ bits
+ *   RANDOM     A new random number every read
+ *   FRAME      Counts /INTs
+ *   PRODUCT    X*Y, 24 bits, little endian
+ *   QUOTIENT   X/Y, 16 bits, little endian. 0xFFFF if Y is 0
+ *   REMAINDER  X%Y. X's low byte if Y is 0
+ *
+ * The results are worked out as soon as the OUT is seen, and the status
+ * after every IN and every /INT, so they're always up to date by the next
+ * instruction.
+ */
+#define ZX_PORT_ADDRESS          0xBF
+
+/* OUT */
+#define ZX_PORT_X                0
+#define ZX_PORT_Y                2
+
+/* IN */
+#define ZX_PORT_STATUS           0
+#define ZX_PORT_RANDOM           1
+#define ZX_PORT_FRAME            2
+#define ZX_PORT_PRODUCT          4
+#define ZX_PORT_QUOTIENT         8
+#define ZX_PORT_REMAINDER        10
+
+#define ZX_PORT_STATUS_TRANSFERS 0x01   /* Writes or reads queued for the Spectrum's RAM */
+#define ZX_PORT_STATUS_MAILBOX   0x02   /* A mailbox command hasn't been answered */
+#define ZX_PORT_STATUS_SNAPSHOT  0x04   /* A snapshot is loading */
+
+/* Look at these in the debugger */
+typedef struct
+{
+  uint32_t ins;
+  uint32_t outs;
+} zx_port_stats_t;
+
+extern zx_port_stats_t zx_port_stats;
+
+/* Start answering on ZX_PORT_ADDRESS */
+void zx_port_init( void );
+
+/* From the /INT handler */
+void zx_port_frame( void );
+
+#endif
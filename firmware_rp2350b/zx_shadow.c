@@ -0,0 +1,279 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Shadow of the Spectrum's memory. The reads and writes which keep it
+ * right all happen with the Z80 off the bus: the snooped writes from
+ * before the bus was taken are applied first, in zx_dma.c's use_window(),
+ * so a page read in lands in a shadow which is otherwise up to date and
+ * the check can compare the two straight away.
+ *
+ * Reads queued before the shadow was last dropped can still finish, or be
+ * cancelled, afterwards. Each carries the generation it was queued in and
+ * is ignored if that's gone.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "zx_display.h"
+#include "bus_snoop.h"
+#include "bus_rom.h"
+#include "frame_sched.h"
+#include "zx_shadow.h"
+
+enum
+{
+  PAGE_INVALID,
+  PAGE_SEEDING,
+  PAGE_VALID,
+};
+
+zx_shadow_stats_t zx_shadow_stats;
+
+uint8_t zx_shadow[0x10000] __attribute__((aligned(8)));
+
+static uint8_t  page_state[ZX_SHADOW_PAGES];
+static bool     running = false;
+static uint32_t generation;
+static uint32_t seeding;
+static uint32_t valid_pages;
+static uint32_t seed_started;
+static uint32_t snoop_overflows;
+
+/* The page being checked, and what was read back */
+static uint8_t  verify_buffer[ZX_SHADOW_PAGE_SIZE];
+static bool     verifying;
+static uint32_t verify_page;
+static uint32_t frames_to_verify;
+
+/* The context passed to the scheduler, the page and the generation */
+#define CONTEXT(page)          ((void *)(uintptr_t)((generation << 8) | (page)))
+#define CONTEXT_PAGE(c)        ((uint32_t)(uintptr_t)(c) & 0xFF)
+#define CONTEXT_CURRENT(c)     (((uint32_t)(uintptr_t)(c) >> 8) == (generation & 0xFFFFFF))
+
+static void seed_done( void *context )
+{
+  uint32_t page = CONTEXT_PAGE( context );
+
+  if( !CONTEXT_CURRENT( context ) )
+    return;
+
+  seeding--;
+  page_state[page] = PAGE_VALID;
+
+  if( ++valid_pages == ZX_SHADOW_PAGES )
+    zx_shadow_stats.seed_frames = frame_sched_stats.frames - seed_started;
+}
+
+static void verify_done( void *context )
+{
+  uint32_t page = CONTEXT_PAGE( context );
+
+  verifying = false;
+  if( !CONTEXT_CURRENT( context ) || (page_state[page] != PAGE_VALID) )
+    return;
+
+  zx_shadow_stats.verifies++;
+
+  uint8_t  *shadow = &zx_shadow[page*ZX_SHADOW_PAGE_SIZE];
+  uint32_t  wrong  = 0;
+  for( uint32_t i = 0; i < ZX_SHADOW_PAGE_SIZE; i++ )
+    wrong += (shadow[i] != verify_buffer[i]);
+
+  if( wrong )
+  {
+    zx_shadow_stats.verify_mismatches++;
+    zx_shadow_stats.mismatched_bytes += wrong;
+    zx_shadow_stats.coherent_frames = 0;
+
+    /* It's as good as seeded, the read has just been made */
+    memcpy( shadow, verify_buffer, ZX_SHADOW_PAGE_SIZE );
+  }
+}
+
+static void drop( void )
+{
+  generation++;
+  seeding     = 0;
+  valid_pages = 0;
+  verifying   = false;
+  memset( page_state, PAGE_INVALID, sizeof(page_state) );
+
+  seed_started = frame_sched_stats.frames;
+  zx_shadow_stats.coherent_frames = 0;
+}
+
+void zx_shadow_invalidate( void )
+{
+  if( !running )
+    return;
+
+  drop();
+  zx_shadow_stats.invalidations++;
+}
+
+/* Our own writes, which aren't snooped. The ROM doesn't take writes */
+void zx_shadow_written( uint16_t zx_address, const uint8_t *src, uint32_t length )
+{
+  if( !running )
+    return;
+
+  for( uint32_t i = 0; i < length; i++ )
+  {
+    uint16_t address = zx_address+i;
+
+    if( address >= ZX_ROM_SIZE )
+      zx_shadow[address] = src[i];
+  }
+}
+
+void zx_shadow_start( void )
+{
+  running = true;
+  snoop_overflows = bus_snoop_stats.overflows;
+  frames_to_verify = ZX_SHADOW_VERIFY_FRAMES;
+
+  drop();
+}
+
+void zx_shadow_apply( const uint32_t *events, uint32_t count )
+{
+  if( !running )
+    return;
+
+  for( uint32_t i = 0; i < count; i++ )
+  {
+    uint16_t address = BUS_SNOOP_EVENT_ADDRESS( events[i] );
+
+    if( address >= ZX_ROM_SIZE )
+      zx_shadow[address] = BUS_SNOOP_EVENT_DATA( events[i] );
+  }
+}
+
+/*
+ * With the ROM taken over, a read of it with the bus held gets nothing,
+ * there's no one to answer. It's copied from the image instead, and not
+ * checked, the tape trap's part of it changes under the shadow.
+ */
+static bool rom_page( uint32_t page )
+{
+  return (page*ZX_SHADOW_PAGE_SIZE < ZX_ROM_SIZE) && (bus_rom_image() != NULL);
+}
+
+/* Check the next valid page, round robin */
+static void queue_verify( void )
+{
+  for( uint32_t i = 0; i < ZX_SHADOW_PAGES; i++ )
+  {
+    verify_page = (verify_page+1) % ZX_SHADOW_PAGES;
+
+    if( (page_state[verify_page] == PAGE_VALID) && !rom_page( verify_page ) )
+    {
+      verifying = frame_sched_add_read( verify_page*ZX_SHADOW_PAGE_SIZE, verify_buffer, ZX_SHADOW_PAGE_SIZE,
+					verify_done, CONTEXT( verify_page ) );
+      return;
+    }
+  }
+}
+
+/*
+ * Called from the /INT handler, before it decides whether to ask for the
+ * bus. Drops the shadow if the snoop has missed anything, queues more of
+ * the seed, and now and again a check.
+ */
+void zx_shadow_frame( void )
+{
+  if( !running )
+    return;
+
+  if( bus_snoop_stats.overflows != snoop_overflows )
+  {
+    snoop_overflows = bus_snoop_stats.overflows;
+    zx_shadow_invalidate();
+  }
+
+  for( uint32_t page = 0; (page < ZX_SHADOW_PAGES) && (seeding < ZX_SHADOW_SEED_QUEUE); page++ )
+  {
+    if( page_state[page] != PAGE_INVALID )
+      continue;
+
+    if( rom_page( page ) )
+    {
+      memcpy( &zx_shadow[page*ZX_SHADOW_PAGE_SIZE], &bus_rom_image()[page*ZX_SHADOW_PAGE_SIZE], ZX_SHADOW_PAGE_SIZE );
+      page_state[page] = PAGE_SEEDING;
+      seeding++;
+      seed_done( CONTEXT( page ) );
+      continue;
+    }
+
+    if( !frame_sched_add_read( page*ZX_SHADOW_PAGE_SIZE, &zx_shadow[page*ZX_SHADOW_PAGE_SIZE], ZX_SHADOW_PAGE_SIZE,
+			       seed_done, CONTEXT( page ) ) )
+      break;
+
+    page_state[page] = PAGE_SEEDING;
+    seeding++;
+    zx_shadow_stats.seeds++;
+  }
+
+  if( valid_pages < ZX_SHADOW_PAGES )
+    return;
+
+  if( ++zx_shadow_stats.coherent_frames > zx_shadow_stats.coherent_frames_max )
+    zx_shadow_stats.coherent_frames_max = zx_shadow_stats.coherent_frames;
+
+  if( ZX_SHADOW_VERIFY_FRAMES && !verifying && (--frames_to_verify == 0) )
+  {
+    frames_to_verify = ZX_SHADOW_VERIFY_FRAMES;
+    queue_verify();
+  }
+}
+
+bool zx_shadow_valid( uint16_t zx_address, uint32_t length )
+{
+  if( length == 0 )
+    return true;
+
+  if( length > 0x10000 )
+    return false;
+
+  uint32_t first = zx_address / ZX_SHADOW_PAGE_SIZE;
+  uint32_t last  = (zx_address+length-1) / ZX_SHADOW_PAGE_SIZE;
+
+  for( uint32_t page = first; page <= last; page++ )
+  {
+    if( page_state[page % ZX_SHADOW_PAGES] != PAGE_VALID )
+      return false;
+  }
+
+  return true;
+}
+
+bool zx_shadow_copy( uint16_t zx_address, uint8_t *dst, uint32_t length )
+{
+  if( !zx_shadow_valid( zx_address, length ) )
+    return false;
+
+  for( uint32_t i = 0; i < length; i++ )
+    dst[i] = zx_shadow[(uint16_t)(zx_address+i)];
+
+  return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __ZX_SHADOW_H
+#define __ZX_SHADOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A copy of all 64K of the Spectrum's memory, kept up to date from the
+ * snooped Z80 writes and this device's own writes, so code here can look
+ * at the Spectrum's variables, sprite tables or game state without going
+ * near the bus.
+ *
+ * The snoop only sees what's written, so each page is seeded once with a
+ * read through frame_sched.c, using its read budget. A page can only be
+ * trusted once it's been seeded. The whole lot is dropped, and seeded
+ * again, if the snoop ring overflows or the Spectrum is reset.
+ *
+ * As a check, a valid page is read back every ZX_SHADOW_VERIFY_FRAMES and
+ * compared. The ROM is in there too, it's read once like everything else,
+ * or copied from the image if bus_rom.c has taken it over.
+ *
+ * The shadow is core 0's, it's written from its IRQ handlers. Core 1 can
+ * read it, a copy taken while the Z80 is writing might be half of one
+ * frame and half of the next.
+ */
+#define ZX_SHADOW_PAGE_SIZE    1024
+#define ZX_SHADOW_PAGES        (0x10000/ZX_SHADOW_PAGE_SIZE)
+
+/* Pages queued for seeding at once */
+#define ZX_SHADOW_SEED_QUEUE   8
+
+/* A page is read back to check every this many frames, 0 for never */
+#define ZX_SHADOW_VERIFY_FRAMES 8
+
+/* Look at these in the debugger */
+typedef struct
+{
+  uint32_t seeds;                /* Page reads to seed the shadow */
+  uint32_t seed_frames;          /* Frames the last full seed took */
+  uint32_t invalidations;        /* Whole shadow dropped, overflow or reset */
+  uint32_t verifies;
+  uint32_t verify_mismatches;    /* Pages the check found wrong, seeded again */
+  uint32_t mismatched_bytes;
+  uint32_t coherent_frames;      /* Frames it's all been valid, and checked out */
+  uint32_t coherent_frames_max;
+} zx_shadow_stats_t;
+
+extern zx_shadow_stats_t zx_shadow_stats;
+
+extern uint8_t zx_shadow[0x10000];
+
+/* Start seeding, and keeping it up to date. Nothing is done before this */
+void zx_shadow_start( void );
+
+/* True if all of the range is seeded. It can wrap round from 0xFFFF */
+bool zx_shadow_valid( uint16_t zx_address, uint32_t length );
+
+/* Copy out of the shadow. False, and nothing copied, if it isn't all valid */
+bool zx_shadow_copy( uint16_t zx_address, uint8_t *dst, uint32_t length );
+
+/* Core 0's side, see zx_dma.c */
+void zx_shadow_frame( void );
+void zx_shadow_invalidate( void );
+void zx_shadow_apply( const uint32_t *events, uint32_t count );
+void zx_shadow_written( uint16_t zx_address, const uint8_t *src, uint32_t length );
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The parking loop, entered from 0x0038 with the return address pushed:
+ *
+ *   DI; LD (PARKED),A
+ *   wait: LD A,(GO); OR A; JR Z,wait
+ *   JP stub
+ *
+ * A load goes IDLE -> ARMING, until the next end of the top border when
+ * 0x0038 is patched -> PARKING, until the Z80 writes PARKED -> WRITING,
+ * until both halves of the RAM are written -> IDLE, with the Z80 sent on
+ * its way.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "zx_display.h"
+#include "frame_sched.h"
+#include "zx_snapshot.h"
+
+#define LO(a) ((a) & 0xFF)
+#define HI(a) ((a) >> 8)
+
+static const uint8_t park_code[] =
+{
+  0xF3,                                                    /* DI */
+  0x32, LO(ZX_SNAPSHOT_PARKED), HI(ZX_SNAPSHOT_PARKED),    /* LD (PARKED),A */
+  0x3A, LO(ZX_SNAPSHOT_GO), HI(ZX_SNAPSHOT_GO),            /* wait: LD A,(GO) */
+  0xB7,                                                    /* OR A */
+  0x28, 0xFA,                                              /* JR Z,wait */
+  0xC3, LO(ZX_SNAPSHOT_STUB), HI(ZX_SNAPSHOT_STUB),        /* JP stub */
+};
+
+typedef enum
+{
+  SNAPSHOT_IDLE,
+  SNAPSHOT_ARMING,
+  SNAPSHOT_PARKING,
+  SNAPSHOT_WRITING,
+} snapshot_state_t;
+
+zx_snapshot_stats_t zx_snapshot_stats;
+
+static uint8_t         *rom = NULL;
+static uint8_t          im1_code[3];
+
+static uint8_t          ram[SNAPSHOT_RAM_SIZE];
+static snapshot_regs_t  regs;
+
+/* Set by the thread, everything after ARMING is core 0's IRQs */
+static volatile snapshot_state_t state = SNAPSHOT_IDLE;
+static uint32_t         park_frames;
+static uint32_t         load_frame;
+
+/* The contended and uncontended halves, each queued when there's room */
+static bool             queued[2];
+static uint32_t         written;
+
+bool zx_snapshot_install( uint8_t *image )
+{
+  for( uint32_t i = ZX_SNAPSHOT_PARK_CODE; i < ZX_SNAPSHOT_END; i++ )
+  {
+    if( image[i] != 0xFF )
+      return false;
+  }
+
+  memcpy( &image[ZX_SNAPSHOT_PARK_CODE], park_code, sizeof(park_code) );
+  image[ZX_SNAPSHOT_GO] = 0;
+
+  rom = image;
+  return true;
+}
+
+bool zx_snapshot_busy( void )
+{
+  return state != SNAPSHOT_IDLE;
+}
+
+bool zx_snapshot_load( const uint8_t *file, uint32_t length )
+{
+  if( (rom == NULL) || (state != SNAPSHOT_IDLE) )
+    return false;
+
+  if( snapshot_decode( file, length, ram, &regs ) != SNAPSHOT_OK )
+  {
+    zx_snapshot_stats.bad_files++;
+    return false;
+  }
+
+  state = SNAPSHOT_ARMING;
+  return true;
+}
+
+static void unpatch( void )
+{
+  memcpy( &rom[ZX_SNAPSHOT_IM1], im1_code, sizeof(im1_code) );
+}
+
+/* The Z80 is spinning on GO, it sees nothing until that's set */
+static void resume( void )
+{
+  unpatch();
+  snapshot_stub( &rom[ZX_SNAPSHOT_STUB], ZX_SNAPSHOT_STUB, &regs );
+
+  /* The ROM server's DMA mustn't see GO before the stub */
+  atomic_thread_fence( memory_order_release );
+  rom[ZX_SNAPSHOT_GO] = 1;
+
+  zx_snapshot_stats.loads++;
+  zx_snapshot_stats.last_load_frames = frame_sched_stats.frames - load_frame;
+  state = SNAPSHOT_IDLE;
+}
+
+static void half_written( void *context )
+{
+  if( (state == SNAPSHOT_WRITING) && (++written == 2) )
+    resume();
+}
+
+/*
+ * 0x4000-0x7FFF only goes in the borders and 0x8000-0xFFFF can go during
+ * the display lines, so they're queued separately
+ */
+static void queue_halves( void )
+{
+  static const uint16_t address[2] = { ZX_CONTENDED_RAM_START, ZX_CONTENDED_RAM_END };
+  static const uint32_t length[2]  = { ZX_CONTENDED_RAM_END-ZX_CONTENDED_RAM_START,
+                                       0x10000-ZX_CONTENDED_RAM_END };
+
+  for( uint32_t i = 0; i < 2; i++ )
+  {
+    if( !queued[i] )
+      queued[i] = frame_sched_add( address[i], &ram[address[i]-0x4000], length[i], half_written, NULL );
+  }
+}
+
+void zx_snapshot_snooped( uint16_t address, uint8_t data )
+{
+  if( (address != ZX_SNAPSHOT_PARKED) || (state != SNAPSHOT_PARKING) )
+    return;
+
+  state     = SNAPSHOT_WRITING;
+  queued[0] = queued[1] = false;
+  written   = 0;
+  queue_halves();
+}
+
+void zx_snapshot_frame( void )
+{
+  switch( state )
+  {
+  case SNAPSHOT_ARMING:
+    rom[ZX_SNAPSHOT_GO] = 0;
+    memcpy( im1_code, &rom[ZX_SNAPSHOT_IM1], sizeof(im1_code) );
+
+    rom[ZX_SNAPSHOT_IM1]   = 0xC3;                         /* JP park */
+    rom[ZX_SNAPSHOT_IM1+1] = LO(ZX_SNAPSHOT_PARK_CODE);
+    rom[ZX_SNAPSHOT_IM1+2] = HI(ZX_SNAPSHOT_PARK_CODE);
+
+    park_frames = ZX_SNAPSHOT_PARK_FRAMES;
+    load_frame  = frame_sched_stats.frames;
+    state       = SNAPSHOT_PARKING;
+    break;
+
+  case SNAPSHOT_PARKING:
+    if( --park_frames == 0 )
+    {
+      /*
+       * The Z80 might get to the loop just as this gives up, so it's sent
+       * on to the ROM's own handler, which ends with EI; RET
+       */
+      unpatch();
+      rom[ZX_SNAPSHOT_STUB]   = 0xC3;                      /* JP 0x0038 */
+      rom[ZX_SNAPSHOT_STUB+1] = LO(ZX_SNAPSHOT_IM1);
+      rom[ZX_SNAPSHOT_STUB+2] = HI(ZX_SNAPSHOT_IM1);
+      atomic_thread_fence( memory_order_release );
+      rom[ZX_SNAPSHOT_GO] = 1;
+
+      zx_snapshot_stats.not_parked++;
+      state = SNAPSHOT_IDLE;
+    }
+    break;
+
+  case SNAPSHOT_WRITING:
+    queue_halves();
+    break;
+
+  default:
+    break;
+  }
+}
+
+void zx_snapshot_reset( void )
+{
+  if( state == SNAPSHOT_IDLE )
+    return;
+
+  /* A reset jumps to 0x0000, not the loop, but the loop's left ready for next time */
+  if( state != SNAPSHOT_ARMING )
+    unpatch();
+
+  zx_snapshot_stats.aborted++;
+  state = SNAPSHOT_IDLE;
+}
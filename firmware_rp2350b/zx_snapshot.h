@@ -0,0 +1,101 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __ZX_SNAPSHOT_H
+#define __ZX_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "snapshot_file.h"
+
+/*
+ * Snapshot loading, for when bus_rom.c is serving the ROM. The Z80 is
+ * parked first: the ROM's IM 1 handler at 0x0038 is patched to jump to a
+ * loop near the top of the ROM, which writes to the ROM to say it's there
+ * and spins reading it, so the Z80 touches no RAM while it's replaced. The
+ * RAM goes through the scheduler, the upper 32K at full rate during the
+ * display lines and the contended 16K in the borders, which takes two or
+ * three frames. Then 0x0038 is put back, the stub from snapshot_stub() is
+ * put in the ROM and the loop is told to jump to it.
+ *
+ * The Z80 has to be taking IM 1 interrupts to be parked, which it always
+ * is in BASIC. A game running in IM 2, or with interrupts off, isn't
+ * caught; the load gives up after ZX_SNAPSHOT_PARK_FRAMES and the Z80 is
+ * left as it was.
+ */
+
+/* The loop, and where it talks to this code. All 0xFF in the 48K ROM, after the tape's */
+#define ZX_SNAPSHOT_IM1         0x0038
+#define ZX_SNAPSHOT_PARK_CODE   0x3A00
+#define ZX_SNAPSHOT_PARKED      0x3A80   /* Written by the Z80 */
+#define ZX_SNAPSHOT_GO          0x3A81   /* Read by the Z80 */
+#define ZX_SNAPSHOT_STUB        0x3A90
+#define ZX_SNAPSHOT_END         (ZX_SNAPSHOT_STUB+SNAPSHOT_STUB_SIZE)
+
+#define ZX_SNAPSHOT_PARK_FRAMES 50
+
+/*
+ * Sent over the USB serial port, followed by the file's length, 4 bytes
+ * little endian, then the file
+ */
+#define ZX_SNAPSHOT_REQUEST     'S'
+
+/* Look at these in the debugger */
+typedef struct
+{
+  uint32_t loads;
+  uint32_t bad_files;        /* snapshot_decode() said no */
+  uint32_t not_parked;       /* The Z80 didn't come to the loop in time */
+  uint32_t aborted;          /* Reset while loading */
+  uint32_t last_load_frames; /* From the request to the jump */
+} zx_snapshot_stats_t;
+
+extern zx_snapshot_stats_t zx_snapshot_stats;
+
+/*
+ * Put the parking loop in a ROM image, the one bus_rom.c is serving. False
+ * if the space isn't free, in which case it's left alone.
+ */
+bool zx_snapshot_install( uint8_t *rom );
+
+/*
+ * Load a .sna or .z80. It's decoded before this returns, the file needn't
+ * stay put, and the rest happens over the next few frames. False if the
+ * file's no good, the loop isn't installed or a load is already going.
+ * Not from an IRQ handler, decoding takes a while.
+ */
+bool zx_snapshot_load( const uint8_t *file, uint32_t length );
+
+/* True while a load is going */
+bool zx_snapshot_busy( void );
+
+/* Core 0's side, see zx_dma.c. Writes to the ROM from the snoop */
+void zx_snapshot_snooped( uint16_t address, uint8_t data );
+
+/*
+ * From the timer IRQ at the end of the top border, well after the Z80 has
+ * taken its interrupt, so 0x0038 can be changed under it
+ */
+void zx_snapshot_frame( void );
+
+/* The Spectrum's been reset, give up */
+void zx_snapshot_reset( void );
+
+#endif
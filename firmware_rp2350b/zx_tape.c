@@ -0,0 +1,246 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The LD-BYTES trap. The routine at ZX_TAPE_TRAP_CODE starts as LD-BYTES
+ * does, with interrupts off and SA/LD-RET as the return address, so the
+ * border and interrupts are put back and BREAK is checked as usual. Then:
+ *
+ *   LD (PARAM_IX),IX; LD (PARAM_DE),DE; PUSH AF; POP HL; LD (PARAM_F),HL
+ *   LD A,(DONE_COUNT); LD B,A; LD (GO),A
+ *   wait: LD A,(DONE_COUNT); CP B; JR Z,wait
+ *   LD A,(RESULT); OR A; RET Z
+ *   LD IX,(RESULT_IX); LD DE,0; SCF; RET
+ *
+ * which returns as LD-BYTES would: carry set and IX past the block if it
+ * loaded, carry clear if not. The write to GO is the last of the Z80's, so
+ * everything else has been snooped by the time it's seen. The answer is
+ * written before DONE_COUNT moves on.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "zx_display.h"
+#include "frame_sched.h"
+#include "zx_shadow.h"
+#include "zx_tape.h"
+
+#define LO(a) ((a) & 0xFF)
+#define HI(a) ((a) >> 8)
+
+static const uint8_t ld_bytes_start[] = { 0x14, 0x08, 0x15, 0xF3 };
+
+static const uint8_t trap_code[] =
+{
+  0xF3,                                                    /* DI */
+  0x21, 0x3F, 0x05,                                        /* LD HL,SA/LD-RET */
+  0xE5,                                                    /* PUSH HL */
+  0xDD, 0x22, LO(ZX_TAPE_PARAM_IX), HI(ZX_TAPE_PARAM_IX),  /* LD (PARAM_IX),IX */
+  0xED, 0x53, LO(ZX_TAPE_PARAM_DE), HI(ZX_TAPE_PARAM_DE),  /* LD (PARAM_DE),DE */
+  0xF5,                                                    /* PUSH AF */
+  0xE1,                                                    /* POP HL */
+  0x22, LO(ZX_TAPE_PARAM_F), HI(ZX_TAPE_PARAM_F),          /* LD (PARAM_F),HL */
+  0x3A, LO(ZX_TAPE_DONE_COUNT), HI(ZX_TAPE_DONE_COUNT),    /* LD A,(DONE_COUNT) */
+  0x47,                                                    /* LD B,A */
+  0x32, LO(ZX_TAPE_GO), HI(ZX_TAPE_GO),                    /* LD (GO),A */
+  0x3A, LO(ZX_TAPE_DONE_COUNT), HI(ZX_TAPE_DONE_COUNT),    /* wait: LD A,(DONE_COUNT) */
+  0xB8,                                                    /* CP B */
+  0x28, 0xFA,                                              /* JR Z,wait */
+  0x3A, LO(ZX_TAPE_RESULT), HI(ZX_TAPE_RESULT),            /* LD A,(RESULT) */
+  0xB7,                                                    /* OR A */
+  0xC8,                                                    /* RET Z */
+  0xDD, 0x2A, LO(ZX_TAPE_RESULT_IX), HI(ZX_TAPE_RESULT_IX),/* LD IX,(RESULT_IX) */
+  0x11, 0x00, 0x00,                                        /* LD DE,0 */
+  0x37,                                                    /* SCF */
+  0xC9,                                                    /* RET */
+};
+
+zx_tape_stats_t zx_tape_stats;
+
+static uint8_t       *rom = NULL;
+static const uint8_t *tape;
+static uint32_t       tape_length;
+static uint32_t       tape_position;
+
+/* What the Z80 has written since its last request */
+static uint8_t        params[ZX_TAPE_GO-ZX_TAPE_PARAM_IX];
+
+/* The block being written, waiting for room in the scheduler if pending */
+static bool           pending = false;
+static uint16_t       load_address;
+static const uint8_t *load_data;
+static uint32_t       load_length;
+static bool           load_ok;
+static uint32_t       load_frame;
+
+bool zx_tape_install( uint8_t *image )
+{
+  if( memcmp( &image[ZX_TAPE_LD_BYTES], ld_bytes_start, sizeof(ld_bytes_start) ) != 0 )
+    return false;
+
+  for( uint32_t i = ZX_TAPE_TRAP_CODE; i < ZX_TAPE_TRAP_END; i++ )
+  {
+    if( image[i] != 0xFF )
+      return false;
+  }
+
+  memcpy( &image[ZX_TAPE_TRAP_CODE], trap_code, sizeof(trap_code) );
+  image[ZX_TAPE_DONE_COUNT] = 0;
+
+  image[ZX_TAPE_LD_BYTES]   = 0xC3;                        /* JP trap */
+  image[ZX_TAPE_LD_BYTES+1] = LO(ZX_TAPE_TRAP_CODE);
+  image[ZX_TAPE_LD_BYTES+2] = HI(ZX_TAPE_TRAP_CODE);
+
+  rom = image;
+  return true;
+}
+
+void zx_tape_insert( const uint8_t *tap, uint32_t length )
+{
+  tape          = tap;
+  tape_length   = length;
+  tape_position = 0;
+}
+
+/* The Z80 is spinning on DONE_COUNT, it sees nothing until that moves */
+static void answer( bool ok, uint16_t ix )
+{
+  rom[ZX_TAPE_RESULT]      = ok;
+  rom[ZX_TAPE_RESULT_IX]   = LO(ix);
+  rom[ZX_TAPE_RESULT_IX+1] = HI(ix);
+
+  /* The ROM server's DMA mustn't see the count before the answer */
+  atomic_thread_fence( memory_order_release );
+  rom[ZX_TAPE_DONE_COUNT]++;
+
+  if( !ok )
+    zx_tape_stats.failures++;
+}
+
+static void block_written( void *context )
+{
+  zx_tape_stats.last_load_frames = frame_sched_stats.frames - load_frame;
+  zx_tape_stats.bytes += load_length;
+
+  answer( load_ok, load_address+load_length );
+}
+
+static void queue_block( void )
+{
+  if( load_length == 0 )
+  {
+    block_written( NULL );
+    return;
+  }
+
+  pending = !frame_sched_add( load_address, load_data, load_length, block_written, NULL );
+}
+
+/*
+ * The next block with the right flag, as the tape plays on. Its flag is
+ * at block[0] and its checksum at block[length-1].
+ */
+static const uint8_t *next_block( uint8_t flag, uint32_t *length )
+{
+  while( tape && (tape_position+2 <= tape_length) )
+  {
+    const uint8_t *block = &tape[tape_position+2];
+
+    *length = tape[tape_position] | (tape[tape_position+1] << 8);
+    tape_position += 2 + *length;
+
+    if( (*length < 2) || (tape_position > tape_length) )
+      break;
+
+    if( block[0] == flag )
+      return block;
+
+    zx_tape_stats.skipped++;
+  }
+
+  return NULL;
+}
+
+static void request( void )
+{
+  uint16_t ix   = params[0] | (params[1] << 8);
+  uint16_t de   = params[2] | (params[3] << 8);
+  bool     load = params[ZX_TAPE_PARAM_F-ZX_TAPE_PARAM_IX] & 0x01;
+  uint8_t  flag = params[ZX_TAPE_PARAM_A-ZX_TAPE_PARAM_IX];
+
+  uint32_t       length;
+  const uint8_t *block = next_block( flag, &length );
+  if( block == NULL )
+  {
+    answer( false, ix );
+    return;
+  }
+
+  uint8_t parity = 0;
+  for( uint32_t i = 0; i < length; i++ )
+    parity ^= block[i];
+
+  /* A short block is loaded as far as it goes, as LD-BYTES would */
+  uint32_t data_length = length-2;
+  uint32_t n           = (de < data_length) ? de : data_length;
+  bool     ok          = (de == data_length) && (parity == 0);
+
+  if( !load )
+  {
+    /* VERIFY compares against the shadow if it can, otherwise the block is taken as read */
+    zx_tape_stats.verifies++;
+
+    uint8_t byte;
+    for( uint32_t i = 0; ok && (i < n) && zx_shadow_copy( ix+i, &byte, 1 ); i++ )
+      ok = (byte == block[1+i]);
+
+    answer( ok, ix+n );
+    return;
+  }
+
+  zx_tape_stats.loads++;
+
+  load_address = ix;
+  load_data    = &block[1];
+  load_length  = n;
+  load_ok      = ok;
+  load_frame   = frame_sched_stats.frames;
+  queue_block();
+}
+
+void zx_tape_snooped( uint16_t address, uint8_t data )
+{
+  if( (rom == NULL) || (address < ZX_TAPE_PARAM_IX) || (address > ZX_TAPE_GO) )
+    return;
+
+  if( address < ZX_TAPE_GO )
+    params[address-ZX_TAPE_PARAM_IX] = data;
+  else if( !pending )
+    request();
+}
+
+void zx_tape_frame( void )
+{
+  if( pending )
+    queue_block();
+}
@@ -0,0 +1,84 @@
+/*
+ * ZX DMA Firmware, a Raspberry Pi RP2350b based Spectrum DMA device
+ * Copyright (C) 2025 Derek Fountain
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __ZX_TAPE_H
+#define __ZX_TAPE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Tape loading through a trap in the ROM, for when bus_rom.c is serving
+ * it. The first instruction of LD-BYTES is patched to jump to a routine
+ * put in the unused space near the top of the 48K ROM, which asks for the
+ * block by writing its parameters to the ROM, where the snoop sees them,
+ * and spins reading the ROM until the answer appears there. The block is
+ * written to the RAM by the bus master, so a load takes a frame or two
+ * rather than minutes.
+ *
+ * The tape is a .tap image, blocks of a 2 byte length then that many
+ * bytes: the flag, the data and the checksum. As with a real tape, blocks
+ * with the wrong flag are passed over, and a block which is the wrong
+ * length, or whose checksum is wrong, is an error.
+ */
+
+/* LD-BYTES, and what's expected there: INC D; EX AF,AF'; DEC D; DI */
+#define ZX_TAPE_LD_BYTES        0x0556
+
+/* The routine, and where it talks to this code. All of it is 0xFF in the 48K ROM */
+#define ZX_TAPE_TRAP_CODE       0x3900
+#define ZX_TAPE_PARAM_IX        0x3980   /* Written by the Z80 */
+#define ZX_TAPE_PARAM_DE        0x3982
+#define ZX_TAPE_PARAM_F         0x3984
+#define ZX_TAPE_PARAM_A         0x3985
+#define ZX_TAPE_GO              0x3986
+#define ZX_TAPE_DONE_COUNT      0x3990   /* Read by the Z80 */
+#define ZX_TAPE_RESULT          0x3991
+#define ZX_TAPE_RESULT_IX       0x3992
+#define ZX_TAPE_TRAP_END        0x39A0
+
+/* Look at these in the debugger */
+typedef struct
+{
+  uint32_t loads;
+  uint32_t verifies;
+  uint32_t failures;         /* Wrong length, bad checksum or the end of the tape */
+  uint32_t skipped;          /* Blocks passed over for their flag */
+  uint64_t bytes;
+  uint32_t last_load_frames; /* From the request to the block being written */
+} zx_tape_stats_t;
+
+extern zx_tape_stats_t zx_tape_stats;
+
+/*
+ * Patch the trap into a ROM image, the one bus_rom.c is serving. False if
+ * it doesn't look like a 48K ROM, in which case it's left alone.
+ */
+bool zx_tape_install( uint8_t *rom );
+
+/* Put a .tap image in the deck, at the start. It has to stay put */
+void zx_tape_insert( const uint8_t *tap, uint32_t length );
+
+/* Core 0's side, see zx_dma.c. Writes to the ROM from the snoop */
+void zx_tape_snooped( uint16_t address, uint8_t data );
+
+/* From the /INT handler, retries a block the scheduler had no room for */
+void zx_tape_frame( void );
+
+#endif